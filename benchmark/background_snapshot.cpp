@@ -0,0 +1,97 @@
+/**
+ * Copyright 2013 Matt Mason
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+
+// Measures the pause seen by a process that snapshots a large instance
+// store, writing it synchronously versus from a forked child while the
+// parent keeps firing triggers.
+
+#include <stateless++/snapshot.hpp>
+#include <stateless++/state_machine.hpp>
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <iostream>
+#include <string>
+
+using namespace stateless;
+
+namespace
+{
+
+enum class state { idle, ringing, connected, hung_up };
+
+enum class trigger { call, answer, hang_up, reset };
+
+typedef state_machine<state, trigger> TStateMachine;
+
+typedef instance_store<state, trigger> TStore;
+
+double seconds_since(const std::chrono::steady_clock::time_point& start)
+{
+  std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+  return elapsed.count();
+}
+
+}
+
+int main(int argc, char* argv[])
+{
+  const std::size_t instances = argc > 1 ? std::strtoul(argv[1], nullptr, 10) : 200000000;
+  const std::string path = argc > 2 ? argv[2] : "background_snapshot_benchmark.bin";
+
+  TStateMachine sm(state::idle);
+  sm.configure(state::idle).permit(trigger::call, state::ringing);
+  sm.configure(state::ringing).permit(trigger::answer, state::connected);
+  sm.configure(state::connected).permit(trigger::hang_up, state::hung_up);
+  sm.configure(state::hung_up).permit(trigger::reset, state::idle);
+  TStore store(sm.freeze(), instances, state::idle);
+
+  auto start = std::chrono::steady_clock::now();
+  save_snapshot(store, path);
+  const double synchronous_pause = seconds_since(start);
+
+  const trigger cycle[] = { trigger::call, trigger::answer, trigger::hang_up, trigger::reset };
+  std::size_t fired = 0;
+  double longest_fire = 0;
+  start = std::chrono::steady_clock::now();
+  background_snapshot snapshot(store, path);
+  const double fork_pause = seconds_since(start);
+  const auto child_start = std::chrono::steady_clock::now();
+  while (!snapshot.poll())
+  {
+    // Touch instances spread over the store, so that pages are copied.
+    for (std::size_t i = 0; i < 1000; ++i, ++fired)
+    {
+      const auto fire_start = std::chrono::steady_clock::now();
+      const std::size_t instance = (fired * 104729) % instances;
+      store.fire(instance, cycle[static_cast<int>(store.state(instance))]);
+      const double elapsed = seconds_since(fire_start);
+      longest_fire = elapsed > longest_fire ? elapsed : longest_fire;
+    }
+  }
+  const double background_seconds = seconds_since(child_start);
+  std::remove(path.c_str());
+
+  std::cout << instances << " instances" << std::endl;
+  std::cout << "synchronous snapshot pause: " << synchronous_pause * 1e3 << " ms" << std::endl;
+  std::cout << "fork pause:                 " << fork_pause * 1e3 << " ms" << std::endl;
+  std::cout << "background write:           " << background_seconds * 1e3 << " ms, "
+            << fired << " triggers fired meanwhile, longest " << longest_fire * 1e6 << " us" << std::endl;
+  return snapshot.succeeded() ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,113 @@
+/**
+ * Copyright 2013 Matt Mason
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+// Measures the time to apply a "halt every motor" trigger to a large
+// instance store, firing each instance in turn versus a single broadcast.
+
+#include <stateless++/instance_store.hpp>
+#include <stateless++/state_machine.hpp>
+
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+
+using namespace stateless;
+
+namespace
+{
+
+enum class state { idle, stopped, started, running };
+
+enum class trigger { start, stop, set_speed, halt };
+
+typedef state_machine<state, trigger> TStateMachine;
+
+typedef instance_store<state, trigger> TStore;
+
+/// Number of motors whose speed was reset on entering the stopped state.
+unsigned long long speed_resets = 0;
+
+TStore::TDefinitionPtr define_motor()
+{
+  TStateMachine sm(state::idle);
+  sm.configure(state::idle)
+    .permit(trigger::start, state::started)
+    .ignore(trigger::halt);
+  sm.configure(state::stopped)
+    .on_entry([](const TStateMachine::TTransition&){ ++speed_resets; })
+    .permit(trigger::halt, state::idle);
+  sm.configure(state::started)
+    .permit(trigger::set_speed, state::running)
+    .permit(trigger::stop, state::stopped)
+    .permit_if(trigger::halt, state::stopped, [](){ return true; });
+  sm.configure(state::running)
+    .permit(trigger::stop, state::stopped)
+    .permit(trigger::halt, state::stopped);
+  return sm.freeze();
+}
+
+void populate(TStore& store)
+{
+  const state mix[] = { state::idle, state::started, state::running, state::stopped, state::running };
+  for (std::size_t i = 0; i < store.size(); ++i)
+  {
+    store.set_state(i, mix[(i * 7919) % 5]);
+  }
+}
+
+double seconds_since(const std::chrono::steady_clock::time_point& start)
+{
+  std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+  return elapsed.count();
+}
+
+}
+
+int main(int argc, char* argv[])
+{
+  const std::size_t instances = argc > 1 ? std::strtoul(argv[1], nullptr, 10) : 10000000;
+  auto definition = define_motor();
+
+  TStore per_instance(definition, instances, state::idle);
+  populate(per_instance);
+  auto start = std::chrono::steady_clock::now();
+  for (std::size_t i = 0; i < per_instance.size(); ++i)
+  {
+    per_instance.fire(i, trigger::halt);
+  }
+  const double per_instance_seconds = seconds_since(start);
+
+  TStore grouped(definition, instances, state::idle);
+  populate(grouped);
+  start = std::chrono::steady_clock::now();
+  grouped.broadcast(trigger::halt);
+  const double broadcast_seconds = seconds_since(start);
+
+  for (std::size_t i = 0; i < instances; ++i)
+  {
+    if (per_instance.state(i) != grouped.state(i))
+    {
+      std::cerr << "Mismatch at instance " << i << std::endl;
+      return EXIT_FAILURE;
+    }
+  }
+
+  std::cout << instances << " instances, " << speed_resets << " entry actions" << std::endl;
+  std::cout << "fire per instance: " << per_instance_seconds << " s" << std::endl;
+  std::cout << "broadcast:         " << broadcast_seconds << " s" << std::endl;
+  return EXIT_SUCCESS;
+}
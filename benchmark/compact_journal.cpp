@@ -0,0 +1,152 @@
+/**
+ * Copyright 2013 Matt Mason
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+
+
+// Compares the size of the fixed-size and compact journals and the time to
+// recover an instance store from each, with and without a checkpoint.
+
+#include <stateless++/compact_journal.hpp>
+#include <stateless++/instance_store.hpp>
+#include <stateless++/journal.hpp>
+#include <stateless++/state_machine.hpp>
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <string>
+
+using namespace stateless;
+
+namespace
+{
+
+enum class state { idle, ringing, connected, hung_up };
+
+enum class trigger { call, answer, hang_up, reset };
+
+typedef state_machine<state, trigger> TStateMachine;
+
+typedef instance_store<state, trigger> TStore;
+
+typedef journal_writer<state, trigger> TWriter;
+
+typedef journal_reader<state, trigger> TReader;
+
+typedef compact_journal_writer<state, trigger> TCompactWriter;
+
+typedef compact_journal_reader<state, trigger> TCompactReader;
+
+double seconds_since(const std::chrono::steady_clock::time_point& start)
+{
+  std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+  return elapsed.count();
+}
+
+std::size_t file_size(const std::string& path)
+{
+  std::ifstream in(path, std::ios::binary | std::ios::ate);
+  return static_cast<std::size_t>(in.tellg());
+}
+
+}
+
+int main(int argc, char* argv[])
+{
+  const std::size_t records = argc > 1 ? std::strtoul(argv[1], nullptr, 10) : 10000000;
+  const std::size_t instances = argc > 2 ? std::strtoul(argv[2], nullptr, 10) : 1000000;
+  const std::string path = argc > 3 ? argv[3] : "compact_journal_benchmark";
+  const std::string fixed_path = path + ".bin";
+  const std::string compact_path = path + ".cjnl";
+  std::remove(fixed_path.c_str());
+  std::remove(compact_path.c_str());
+
+  const TWriter::TTransition transitions[] = {
+    TWriter::TTransition(state::idle, state::ringing, trigger::call),
+    TWriter::TTransition(state::ringing, state::connected, trigger::answer),
+    TWriter::TTransition(state::connected, state::hung_up, trigger::hang_up),
+    TWriter::TTransition(state::hung_up, state::idle, trigger::reset)
+  };
+  TStateMachine sm(state::idle);
+  auto definition = sm.freeze();
+  TStore live(definition, instances, state::idle);
+  {
+    TWriter writer(fixed_path, 1 << 20);
+    TCompactWriter compact_writer(compact_path, 1 << 20);
+    const auto epoch = std::chrono::system_clock::now().time_since_epoch();
+    const auto now = std::chrono::duration_cast<std::chrono::nanoseconds>(epoch).count();
+    for (std::size_t i = 0; i < records; ++i)
+    {
+      const std::size_t instance = (i * 104729) % instances;
+      const auto& transition = transitions[(i / instances) % 4];
+      // Roughly a microsecond apart, as from a busy live system.
+      const std::int64_t timestamp = now + static_cast<std::int64_t>(i * 1000 + i % 7);
+      writer.append_at(timestamp, instance, transition);
+      compact_writer.append_at(timestamp, instance, transition);
+      live.set_state(instance, transition.destination());
+    }
+    writer.commit();
+    compact_writer.commit();
+  }
+  std::cout << records << " records, " << instances << " instances" << std::endl;
+  std::cout << "fixed-size journal: " << file_size(fixed_path) << " bytes" << std::endl;
+  std::cout << "compact journal: " << file_size(compact_path) << " bytes" << std::endl;
+
+  TStore fixed(definition, instances, state::idle);
+  auto start = std::chrono::steady_clock::now();
+  TReader(fixed_path).replay_into(fixed);
+  std::cout << "fixed-size full replay: " << seconds_since(start) << " s" << std::endl;
+
+  TStore compact(definition, instances, state::idle);
+  start = std::chrono::steady_clock::now();
+  TCompactReader(compact_path).recover(compact);
+  std::cout << "compact full replay: " << seconds_since(start) << " s" << std::endl;
+
+  // Checkpoint, then a short tail of further transitions.
+  {
+    TCompactWriter compact_writer(compact_path);
+    compact_writer.checkpoint(live);
+    for (std::size_t i = 0; i < records / 100; ++i)
+    {
+      const std::size_t instance = (i * 104729) % instances;
+      compact_writer.append(instance, TWriter::TTransition(live.state(instance), state::idle, trigger::reset));
+      live.set_state(instance, state::idle);
+    }
+    compact_writer.commit();
+    compact_writer.compact();
+  }
+  std::cout << "compacted journal: " << file_size(compact_path) << " bytes" << std::endl;
+
+  TStore recovered(definition, instances, state::idle);
+  start = std::chrono::steady_clock::now();
+  TCompactReader(compact_path).recover(recovered);
+  std::cout << "checkpoint recovery: " << seconds_since(start) << " s" << std::endl;
+
+  for (std::size_t i = 0; i < instances; ++i)
+  {
+    if (fixed.state(i) != compact.state(i) || recovered.state(i) != live.state(i))
+    {
+      std::cerr << "Mismatch at instance " << i << std::endl;
+      return EXIT_FAILURE;
+    }
+  }
+  std::remove(fixed_path.c_str());
+  std::remove(compact_path.c_str());
+  return EXIT_SUCCESS;
+}
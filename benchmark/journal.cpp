@@ -0,0 +1,97 @@
+/**
+ * Copyright 2013 Matt Mason
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+
+// Measures journal append throughput on one thread, with a group commit
+// every few thousand records, and the rate of replay from the mapped file.
+
+#include <stateless++/journal.hpp>
+
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <iostream>
+#include <string>
+
+using namespace stateless;
+
+namespace
+{
+
+enum class state { idle, ringing, connected, hung_up };
+
+enum class trigger { call, answer, hang_up };
+
+typedef journal_writer<state, trigger> TWriter;
+
+typedef journal_reader<state, trigger> TReader;
+
+double seconds_since(const std::chrono::steady_clock::time_point& start)
+{
+  std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+  return elapsed.count();
+}
+
+}
+
+int main(int argc, char* argv[])
+{
+  const std::size_t records = argc > 1 ? std::strtoul(argv[1], nullptr, 10) : 10000000;
+  const std::size_t commit_interval = argc > 2 ? std::strtoul(argv[2], nullptr, 10) : 4096;
+  const std::string path = argc > 3 ? argv[3] : "journal_benchmark.bin";
+  std::remove(path.c_str());
+
+  const TWriter::TTransition transitions[] = {
+    TWriter::TTransition(state::idle, state::ringing, trigger::call),
+    TWriter::TTransition(state::ringing, state::connected, trigger::answer),
+    TWriter::TTransition(state::connected, state::hung_up, trigger::hang_up)
+  };
+
+  auto start = std::chrono::steady_clock::now();
+  {
+    TWriter writer(path, 1 << 20);
+    for (std::size_t i = 0; i < records; ++i)
+    {
+      writer.append(i % 100000, transitions[i % 3], static_cast<std::uint32_t>(i));
+      if (commit_interval != 0 && i % commit_interval == commit_interval - 1)
+      {
+        writer.commit();
+      }
+    }
+    writer.commit();
+  }
+  const double append_seconds = seconds_since(start);
+
+  start = std::chrono::steady_clock::now();
+  std::uint64_t checksum = 0;
+  const std::size_t replayed = TReader(path).for_each(
+    [&](const TReader::entry& e)
+    {
+      std::uint32_t i;
+      e.read_arguments(i);
+      checksum += e.instance() + i;
+    });
+  const double replay_seconds = seconds_since(start);
+  std::remove(path.c_str());
+
+  std::cout << records << " records, commit every " << commit_interval
+            << ", checksum " << checksum << std::endl;
+  std::cout << "append: " << records / append_seconds / 1e6 << " million records/s" << std::endl;
+  std::cout << "replay: " << replayed / replay_seconds / 1e6 << " million records/s" << std::endl;
+  return replayed == records ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,118 @@
+/**
+ * Copyright 2013 Matt Mason
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+// Reports the bytes per instance of the bug tracker example's state machine
+// at a million instances, with a state machine configured for each bug as in
+// the example, and with the bugs' states in an instance store sharing one
+// frozen definition, plain, indexed and with per instance dwell times.
+
+#include <stateless++/instance_store.hpp>
+#include <stateless++/state_machine.hpp>
+
+#include <cstdlib>
+#include <iostream>
+#include <string>
+
+using namespace stateless;
+
+namespace
+{
+
+enum class state { open, assigned, deferred, resolved, closed };
+
+enum class trigger { assign, defer, resolve, close, open };
+
+typedef state_machine<state, trigger> TStateMachine;
+
+typedef instance_store<state, trigger> TStore;
+
+/// The configuration of bug_tracker_example::bug, with actions that only note the assignee.
+void configure(TStateMachine& sm, std::string& assignee)
+{
+  auto assign_trigger = sm.set_trigger_parameters<std::string>(trigger::assign);
+  sm.set_trigger_parameters<std::string>(trigger::resolve);
+
+  sm.configure(state::open)
+    .permit(trigger::assign, state::assigned);
+
+  sm.configure(state::assigned)
+    .sub_state_of(state::open)
+    .on_entry_from(assign_trigger,
+      [&](const TStateMachine::TTransition&, const std::string& a){ assignee = a; })
+    .permit_reentry(trigger::assign)
+    .permit(trigger::resolve, state::resolved)
+    .permit(trigger::close, state::closed)
+    .permit(trigger::defer, state::deferred)
+    .on_exit([&](const TStateMachine::TTransition&){ assignee.clear(); });
+
+  sm.configure(state::deferred)
+    .on_entry([&](const TStateMachine::TTransition&){ assignee.clear(); })
+    .permit(trigger::assign, state::assigned);
+
+  sm.configure(state::resolved)
+    .on_entry<std::string>(
+      [&](const TStateMachine::TTransition&, const std::string& a){ assignee = a; })
+    .permit(trigger::close, state::closed)
+    .permit(trigger::open, state::open);
+
+  sm.configure(state::closed)
+    .permit(trigger::open, state::open);
+}
+
+void report(const char* name, const memory_usage& usage, std::size_t instances)
+{
+  std::cout << name << ": " << static_cast<double>(usage.total()) / instances << " bytes/instance"
+    << " (representations " << usage.representations
+    << ", behaviours " << usage.behaviours
+    << ", closures " << usage.closures
+    << ", actions " << usage.actions
+    << ", trigger parameters " << usage.trigger_parameters
+    << ", instances " << usage.instances
+    << ", other " << usage.other << " bytes)" << std::endl;
+}
+
+}
+
+int main(int argc, char* argv[])
+{
+  const std::size_t instances = argc > 1 ? std::strtoul(argv[1], nullptr, 10) : 1000000;
+
+  // Every bug's machine is configured alike, so one stands for them all.
+  std::string assignee;
+  TStateMachine sm(state::open);
+  configure(sm, assignee);
+  report("state_machine per bug", sm.memory_usage(), 1);
+
+  auto definition = sm.freeze();
+  report("definition", definition->memory_usage(), 1);
+
+  TStore store(definition, instances, state::open);
+  report("instance_store", store.memory_usage(), instances);
+
+  store.enable_index();
+  report("instance_store indexed", store.memory_usage(), instances);
+
+  store.enable_dwell_times(TStore::dwell_tracking::per_instance);
+  report("instance_store indexed with dwell times", store.memory_usage(), instances);
+
+  if (store.count(state::open) != instances)
+  {
+    std::cerr << "Unexpected count" << std::endl;
+    return EXIT_FAILURE;
+  }
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,111 @@
+/**
+ * Copyright 2013 Matt Mason
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+
+// Measures rebuilding an instance store from a journal sequentially and
+// with parallel partitioned replay on increasing numbers of threads.
+
+#include <stateless++/instance_store.hpp>
+#include <stateless++/journal.hpp>
+#include <stateless++/state_machine.hpp>
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <iostream>
+#include <string>
+#include <thread>
+
+using namespace stateless;
+
+namespace
+{
+
+enum class state { idle, ringing, connected, hung_up };
+
+enum class trigger { call, answer, hang_up, reset };
+
+typedef state_machine<state, trigger> TStateMachine;
+
+typedef instance_store<state, trigger> TStore;
+
+typedef journal_writer<state, trigger> TWriter;
+
+typedef journal_reader<state, trigger> TReader;
+
+double seconds_since(const std::chrono::steady_clock::time_point& start)
+{
+  std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+  return elapsed.count();
+}
+
+}
+
+int main(int argc, char* argv[])
+{
+  const std::size_t records = argc > 1 ? std::strtoul(argv[1], nullptr, 10) : 20000000;
+  const std::size_t instances = argc > 2 ? std::strtoul(argv[2], nullptr, 10) : 1000000;
+  const std::string path = argc > 3 ? argv[3] : "parallel_replay_benchmark.bin";
+  const std::size_t cores = std::max(1u, std::thread::hardware_concurrency());
+  const std::size_t max_threads = argc > 4 ? std::strtoul(argv[4], nullptr, 10) : cores;
+  std::remove(path.c_str());
+
+  const TWriter::TTransition transitions[] = {
+    TWriter::TTransition(state::idle, state::ringing, trigger::call),
+    TWriter::TTransition(state::ringing, state::connected, trigger::answer),
+    TWriter::TTransition(state::connected, state::hung_up, trigger::hang_up),
+    TWriter::TTransition(state::hung_up, state::idle, trigger::reset)
+  };
+  {
+    TWriter writer(path, 1 << 20);
+    for (std::size_t i = 0; i < records; ++i)
+    {
+      writer.append((i * 104729) % instances, transitions[(i / instances) % 4]);
+    }
+    writer.commit();
+  }
+
+  TStateMachine sm(state::idle);
+  auto definition = sm.freeze();
+  TReader reader(path);
+
+  TStore sequential(definition, instances, state::idle);
+  auto start = std::chrono::steady_clock::now();
+  reader.replay_into(sequential);
+  const double sequential_seconds = seconds_since(start);
+  std::cout << records << " records, " << instances << " instances" << std::endl;
+  std::cout << "sequential: " << sequential_seconds << " s" << std::endl;
+
+  for (std::size_t threads = 1; threads <= max_threads; threads *= 2)
+  {
+    TStore parallel(definition, instances, state::idle);
+    start = std::chrono::steady_clock::now();
+    parallel.replay(reader, threads);
+    const double parallel_seconds = seconds_since(start);
+    for (std::size_t i = 0; i < instances; ++i)
+    {
+      if (parallel.state(i) != sequential.state(i))
+      {
+        std::cerr << "Mismatch at instance " << i << std::endl;
+        return EXIT_FAILURE;
+      }
+    }
+    std::cout << threads << " threads: " << parallel_seconds << " s" << std::endl;
+  }
+  std::remove(path.c_str());
+  return EXIT_SUCCESS;
+}
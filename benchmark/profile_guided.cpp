@@ -0,0 +1,106 @@
+/**
+ * Copyright 2013 Matt Mason
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+// Measures firing a trigger with eight guarded candidates whose last is
+// taken most often, with a plain definition and one frozen with a profile.
+
+#include <stateless++/frequency_matrix.hpp>
+#include <stateless++/state_machine.hpp>
+
+#include <chrono>
+#include <cstdint>
+#include <cstdlib>
+#include <iostream>
+
+using namespace stateless;
+
+namespace
+{
+
+enum class state { idle, lane0, lane1, lane2, lane3, lane4, lane5, lane6, lane7 };
+
+enum class trigger { route, reset };
+
+typedef state_machine<state, trigger> TStateMachine;
+
+typedef definition<state, trigger> TDefinition;
+
+const int lanes = 8;
+
+/// The lane the next route takes: lane 7 nine times in ten.
+int lane = 0;
+
+/// Number of guards evaluated.
+unsigned long long guard_calls = 0;
+
+void configure(TStateMachine& sm)
+{
+  for (int i = 0; i < lanes; ++i)
+  {
+    const state destination = static_cast<state>(i + 1);
+    sm.configure(state::idle)
+      .permit_if(trigger::route, destination, [i](){ ++guard_calls; return lane == i; });
+    sm.configure(destination).permit(trigger::reset, state::idle);
+  }
+}
+
+/// Route and reset, returning the seconds taken.
+double run(const TDefinition& d, std::size_t iterations, transition_counters<state, trigger>* counters)
+{
+  std::uint64_t random = 88172645463325252ULL;
+  const auto start = std::chrono::steady_clock::now();
+  state s = state::idle;
+  for (std::size_t i = 0; i < iterations; ++i)
+  {
+    random ^= random << 13;
+    random ^= random >> 7;
+    random ^= random << 17;
+    lane = random % 10 == 0 ? static_cast<int>((random >> 8) % (lanes - 1)) : lanes - 1;
+    d.fire(counters, s, trigger::route);
+    d.fire(counters, s, trigger::reset);
+  }
+  std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+  return elapsed.count();
+}
+
+}
+
+int main(int argc, char* argv[])
+{
+  const std::size_t iterations = argc > 1 ? std::strtoul(argv[1], nullptr, 10) : 2000000;
+  TStateMachine sm(state::idle);
+  configure(sm);
+
+  auto plain = sm.freeze();
+  transition_counters<state, trigger> counters;
+  run(*plain, iterations / 10, &counters);
+  auto arranged = sm.freeze(frequency_matrix<state, trigger>(*plain, counters));
+
+  guard_calls = 0;
+  const double plain_seconds = run(*plain, iterations, nullptr);
+  const unsigned long long plain_guards = guard_calls;
+  guard_calls = 0;
+  const double arranged_seconds = run(*arranged, iterations, nullptr);
+  const unsigned long long arranged_guards = guard_calls;
+
+  std::cout << iterations << " routes" << std::endl;
+  std::cout << "plain:    " << plain_seconds * 1e9 / iterations << " ns, "
+    << static_cast<double>(plain_guards) / iterations << " guards per route" << std::endl;
+  std::cout << "profiled: " << arranged_seconds * 1e9 / iterations << " ns, "
+    << static_cast<double>(arranged_guards) / iterations << " guards per route" << std::endl;
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,140 @@
+/**
+ * Copyright 2013 Matt Mason
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+// Measures fire() throughput of many instances driven from several threads,
+// comparing a registry against a map guarded by a single mutex.
+
+#include <stateless++/registry.hpp>
+
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+#include <mutex>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+using namespace stateless;
+
+namespace
+{
+
+enum class state { idle, started, running, stopped };
+
+enum class trigger { start, run, stop, halt };
+
+typedef state_machine<state, trigger> TStateMachine;
+
+void configure_motor(TStateMachine& sm)
+{
+  sm.configure(state::idle).permit(trigger::start, state::started);
+  sm.configure(state::started).permit(trigger::run, state::running);
+  sm.configure(state::running).permit(trigger::stop, state::stopped);
+  sm.configure(state::stopped).permit(trigger::halt, state::idle);
+}
+
+const trigger cycle[] = { trigger::start, trigger::run, trigger::stop, trigger::halt };
+
+/// The usual arrangement: one map of states behind one mutex.
+class global_mutex_map
+{
+public:
+  global_mutex_map()
+    : current_(nullptr)
+    , machine_([this](){ return *current_; }, [this](const state& s){ *current_ = s; })
+  {
+    configure_motor(machine_);
+  }
+
+  void create(int id)
+  {
+    instances_[id] = state::idle;
+  }
+
+  void fire(int id, trigger t)
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    current_ = &instances_.at(id);
+    machine_.fire(t);
+  }
+
+private:
+  std::mutex mutex_;
+  std::unordered_map<int, state> instances_;
+  state* current_;
+  TStateMachine machine_;
+};
+
+/**
+ * Each thread drives its own slice of the ids through the four state cycle.
+ * Returns millions of fires per second.
+ */
+template<typename TStore>
+double run(TStore& store, int threads, int instances, int rounds)
+{
+  auto start = std::chrono::steady_clock::now();
+  std::vector<std::thread> workers;
+  for (int t = 0; t < threads; ++t)
+  {
+    workers.push_back(std::thread([&, t]()
+      {
+        for (int r = 0; r < rounds; ++r)
+        {
+          for (int id = t; id < instances; id += threads)
+          {
+            store.fire(id, cycle[r % 4]);
+          }
+        }
+      }));
+  }
+  for (auto& w : workers)
+  {
+    w.join();
+  }
+  std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+  return (static_cast<double>(instances) * rounds) / elapsed.count() / 1e6;
+}
+
+}
+
+int main(int argc, char* argv[])
+{
+  const int instances = argc > 1 ? std::atoi(argv[1]) : 100000;
+  const int rounds = argc > 2 ? std::atoi(argv[2]) : 40;
+  const int max_threads =
+    std::max(1, static_cast<int>(std::thread::hardware_concurrency()));
+
+  std::cout << instances << " instances, " << rounds << " fires each" << std::endl;
+  std::cout << "threads\tglobal mutex (M fires/s)\tregistry (M fires/s)" << std::endl;
+
+  for (int threads = 1; threads <= max_threads; threads *= 2)
+  {
+    global_mutex_map baseline;
+    registry<int, state, trigger> sharded(configure_motor);
+    for (int id = 0; id < instances; ++id)
+    {
+      baseline.create(id);
+      sharded.create(id, state::idle);
+    }
+    double baseline_rate = run(baseline, threads, instances, rounds);
+    double sharded_rate = run(sharded, threads, instances, rounds);
+    std::cout << threads << "\t" << baseline_rate << "\t" << sharded_rate << std::endl;
+  }
+
+  return EXIT_SUCCESS;
+}
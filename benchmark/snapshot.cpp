@@ -0,0 +1,98 @@
+/**
+ * Copyright 2013 Matt Mason
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+
+// Measures saving a large instance store to a snapshot, restoring it, and
+// then touching every instance. Restoring reads the mapped codes once to
+// check them, which faults the pages in.
+
+#include <stateless++/snapshot.hpp>
+#include <stateless++/state_machine.hpp>
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <iostream>
+#include <string>
+
+using namespace stateless;
+
+namespace
+{
+
+enum class state { idle, ringing, connected, on_hold, hung_up };
+
+enum class trigger { call, answer, hold, resume, hang_up };
+
+typedef state_machine<state, trigger> TStateMachine;
+
+typedef instance_store<state, trigger> TStore;
+
+double seconds_since(const std::chrono::steady_clock::time_point& start)
+{
+  std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+  return elapsed.count();
+}
+
+}
+
+int main(int argc, char* argv[])
+{
+  const std::size_t instances = argc > 1 ? std::strtoul(argv[1], nullptr, 10) : 100000000;
+  const std::string path = argc > 2 ? argv[2] : "snapshot_benchmark.bin";
+
+  TStateMachine sm(state::idle);
+  sm.configure(state::idle).permit(trigger::call, state::ringing);
+  sm.configure(state::ringing).permit(trigger::answer, state::connected);
+  sm.configure(state::connected)
+    .permit(trigger::hold, state::on_hold)
+    .permit(trigger::hang_up, state::hung_up);
+  sm.configure(state::on_hold).permit(trigger::resume, state::connected);
+  auto definition = sm.freeze();
+
+  TStore store(definition, instances, state::idle);
+  store.apply(trigger::call, 0, instances / 2);
+  store.apply(trigger::answer, 0, instances / 4);
+
+  auto start = std::chrono::steady_clock::now();
+  save_snapshot(store, path);
+  const double save_seconds = seconds_since(start);
+
+  start = std::chrono::steady_clock::now();
+  auto restored = restore_snapshot(definition, path);
+  const double restore_seconds = seconds_since(start);
+
+  start = std::chrono::steady_clock::now();
+  std::size_t connected = 0;
+  for (std::size_t i = 0; i < restored->size(); ++i)
+  {
+    connected += restored->codes()[i] == TStore::encode_state(state::connected) ? 1 : 0;
+  }
+  const double touch_seconds = seconds_since(start);
+
+  start = std::chrono::steady_clock::now();
+  restored->apply(trigger::hold);
+  const double apply_seconds = seconds_since(start);
+  std::remove(path.c_str());
+
+  std::cout << instances << " instances, " << connected << " connected" << std::endl;
+  std::cout << "save:             " << save_seconds << " s" << std::endl;
+  std::cout << "restore:          " << restore_seconds << " s" << std::endl;
+  std::cout << "first full scan:  " << touch_seconds << " s" << std::endl;
+  std::cout << "apply (copy-on-write): " << apply_seconds << " s" << std::endl;
+  return connected == instances / 4 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
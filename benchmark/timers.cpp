@@ -0,0 +1,134 @@
+/**
+ * Copyright 2013 Matt Mason
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+
+// Measures scheduling, cancelling and expiring timers on a timing wheel
+// driven by a virtual clock, and the cost of timed triggers on a population
+// of state machines that ring until answered or timed out.
+
+#include <stateless++/state_machine.hpp>
+#include <stateless++/timing_wheel.hpp>
+
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+#include <memory>
+#include <vector>
+
+using namespace stateless;
+
+namespace
+{
+
+enum class state { idle, ringing, connected, hung_up };
+
+enum class trigger { call, answer, time_out };
+
+typedef state_machine<state, trigger> TStateMachine;
+
+double seconds_since(const std::chrono::steady_clock::time_point& start)
+{
+  std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+  return elapsed.count();
+}
+
+double nanoseconds_each(double seconds, std::size_t count)
+{
+  return count == 0 ? 0 : seconds * 1e9 / count;
+}
+
+}
+
+int main(int argc, char* argv[])
+{
+  const std::size_t timers = argc > 1 ? std::strtoul(argv[1], nullptr, 10) : 1000000;
+  const std::size_t machines = argc > 2 ? std::strtoul(argv[2], nullptr, 10) : 100000;
+
+  std::chrono::milliseconds now(0);
+  timing_wheel wheel(std::chrono::milliseconds(1), [&](){ return now; });
+
+  std::size_t expired = 0;
+  std::vector<timing_wheel::TTimerId> ids;
+  ids.reserve(timers);
+  auto start = std::chrono::steady_clock::now();
+  for (std::size_t i = 0; i < timers; ++i)
+  {
+    // Spread the delays over a few minutes so that every wheel is used.
+    ids.push_back(wheel.schedule(
+      std::chrono::milliseconds((i * 7919) % 300000), [&](){ ++expired; }));
+  }
+  const double schedule_seconds = seconds_since(start);
+
+  start = std::chrono::steady_clock::now();
+  for (std::size_t i = 0; i < ids.size(); i += 2)
+  {
+    wheel.cancel(ids[i]);
+  }
+  const double cancel_seconds = seconds_since(start);
+
+  start = std::chrono::steady_clock::now();
+  for (now = std::chrono::milliseconds(0); wheel.size() != 0; now += std::chrono::milliseconds(10))
+  {
+    wheel.poll();
+  }
+  const double expire_seconds = seconds_since(start);
+
+  std::cout << timers << " timers, " << expired << " expired" << std::endl;
+  std::cout << "schedule: " << nanoseconds_each(schedule_seconds, timers) << " ns each" << std::endl;
+  std::cout << "cancel:   " << nanoseconds_each(cancel_seconds, (timers + 1) / 2) << " ns each" << std::endl;
+  std::cout << "expire:   " << nanoseconds_each(expire_seconds, expired) << " ns each" << std::endl;
+
+  now = std::chrono::milliseconds(0);
+  timing_wheel calls(std::chrono::milliseconds(1), [&](){ return now; });
+  std::vector<std::unique_ptr<TStateMachine>> phones;
+  phones.reserve(machines);
+  for (std::size_t i = 0; i < machines; ++i)
+  {
+    phones.emplace_back(new TStateMachine(state::idle));
+    auto& sm = *phones.back();
+    sm.set_timer_scheduler(calls);
+    sm.configure(state::idle).permit(trigger::call, state::ringing);
+    sm.configure(state::ringing)
+      .permit(trigger::answer, state::connected)
+      .permit_after(std::chrono::seconds(30), trigger::time_out, state::hung_up);
+  }
+
+  start = std::chrono::steady_clock::now();
+  for (std::size_t i = 0; i < machines; ++i)
+  {
+    now = std::chrono::milliseconds(i % 1000);
+    phones[i]->fire(trigger::call);
+    if (i % 3 == 0)
+    {
+      phones[i]->fire(trigger::answer);
+    }
+  }
+  for (; calls.size() != 0; now += std::chrono::milliseconds(1))
+  {
+    calls.poll();
+  }
+  const double phone_seconds = seconds_since(start);
+
+  std::size_t hung_up = 0;
+  for (auto& sm : phones)
+  {
+    hung_up += sm->is_in_state(state::hung_up) ? 1 : 0;
+  }
+  std::cout << machines << " calls, " << hung_up << " timed out" << std::endl;
+  std::cout << "call with timeout: " << nanoseconds_each(phone_seconds, machines) << " ns each" << std::endl;
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,143 @@
+/**
+ * Copyright 2013 Matt Mason
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+
+
+// Measures the cost of counting transitions with transition_counters,
+// against no observer and against counting in an on_transition action
+// with a mutex and a std::map, of timing them with latency_histograms, of
+// keeping them in a flight_recorder and of sampling 1 in 1000 with a
+// fire_sampler.
+
+#include <stateless++/fire_sampler.hpp>
+#include <stateless++/flight_recorder.hpp>
+#include <stateless++/latency_histograms.hpp>
+#include <stateless++/state_machine.hpp>
+#include <stateless++/transition_counters.hpp>
+
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+#include <map>
+#include <mutex>
+#include <tuple>
+
+using namespace stateless;
+
+namespace
+{
+
+enum class state { idle, ringing, connected, hung_up };
+
+enum class trigger { call, answer, hang_up, reset };
+
+typedef state_machine<state, trigger> TStateMachine;
+
+typedef transition_counters<state, trigger> TCounters;
+
+void configure(TStateMachine& sm)
+{
+  sm.configure(state::idle).permit(trigger::call, state::ringing);
+  sm.configure(state::ringing).permit(trigger::answer, state::connected);
+  sm.configure(state::connected).permit(trigger::hang_up, state::hung_up);
+  sm.configure(state::hung_up).permit(trigger::reset, state::idle);
+}
+
+/// The best time per fire over several runs, to discount interruptions.
+double run(TStateMachine& sm, std::size_t cycles)
+{
+  double best = 0;
+  for (int attempt = 0; attempt < 5; ++attempt)
+  {
+    const auto start = std::chrono::steady_clock::now();
+    for (std::size_t i = 0; i < cycles; ++i)
+    {
+      sm.fire(trigger::call);
+      sm.fire(trigger::answer);
+      sm.fire(trigger::hang_up);
+      sm.fire(trigger::reset);
+    }
+    std::chrono::duration<double, std::nano> elapsed = std::chrono::steady_clock::now() - start;
+    const double per_fire = elapsed.count() / (4 * cycles);
+    best = attempt == 0 ? per_fire : std::min(best, per_fire);
+  }
+  return best;
+}
+
+}
+
+int main(int argc, char* argv[])
+{
+  const std::size_t cycles = argc > 1 ? std::strtoul(argv[1], nullptr, 10) : 500000;
+
+  TStateMachine plain(state::idle);
+  configure(plain);
+  std::cout << "no observer: " << run(plain, cycles) << " ns/fire" << std::endl;
+
+  TStateMachine counted(state::idle);
+  configure(counted);
+  TCounters counters;
+  counted.set_observer(&counters);
+  std::cout << "transition_counters: " << run(counted, cycles) << " ns/fire" << std::endl;
+
+  TStateMachine mapped(state::idle);
+  configure(mapped);
+  std::mutex mutex;
+  std::map<std::tuple<state, trigger, state>, std::uint64_t> counts;
+  mapped.on_transition([&](const TStateMachine::TTransition& t)
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      ++counts[std::make_tuple(t.source(), t.trigger(), t.destination())];
+    });
+  std::cout << "on_transition with map and mutex: " << run(mapped, cycles) << " ns/fire" << std::endl;
+
+  TStateMachine timed(state::idle);
+  configure(timed);
+  latency_histograms<state, trigger> histograms;
+  timed.set_observer(&histograms);
+  std::cout << "latency_histograms: " << run(timed, cycles) << " ns/fire" << std::endl;
+  typedef latency_histograms<state, trigger>::phase phase;
+  const auto total = histograms.histogram_for_trigger(phase::total, trigger::call);
+  const double ns_per_tick = 1.0 / cycle_clock::ticks_per_nanosecond();
+  std::cout << "  call p50 " << total.value_at_percentile(50) * ns_per_tick
+    << " ns, p99 " << total.value_at_percentile(99) * ns_per_tick
+    << " ns, max " << total.max() * ns_per_tick << " ns" << std::endl;
+
+  TStateMachine recorded(state::idle);
+  configure(recorded);
+  flight_recorder<state, trigger> recorder(1 << 16);
+  recorded.set_observer(&recorder);
+  std::cout << "flight_recorder: " << run(recorded, cycles) << " ns/fire" << std::endl;
+
+  TStateMachine sampled(state::idle);
+  configure(sampled);
+  std::size_t samples = 0;
+  fire_sampler<state, trigger> sampler(
+    1000, [&](const fire_sampler<state, trigger>::sample&) { ++samples; });
+  sampled.set_observer(&sampler);
+  std::cout << "fire_sampler 1 in 1000: " << run(sampled, cycles) << " ns/fire, "
+    << samples << " samples" << std::endl;
+
+  if (counters.transitions(state::idle, trigger::call, state::ringing) != 5 * cycles ||
+    counts[std::make_tuple(state::idle, trigger::call, state::ringing)] != 5 * cycles)
+  {
+    std::cerr << "Unexpected count" << std::endl;
+    return EXIT_FAILURE;
+  }
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,125 @@
+/**
+ * Copyright 2013 Matt Mason
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#ifndef STATELESS_CLOCKS_HPP
+#define STATELESS_CLOCKS_HPP
+
+#include <chrono>
+#include <cstdint>
+#include <thread>
+
+#if defined(_MSC_VER) && (defined(_M_X64) || defined(_M_IX86))
+#include <intrin.h>
+#define STATELESS_HAS_RDTSC
+#elif defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#include <x86intrin.h>
+#define STATELESS_HAS_RDTSC
+#endif
+
+#if defined(__linux__)
+#include <time.h>
+#endif
+
+namespace stateless
+{
+
+/**
+ * A clock for timing short intervals in as few cycles as possible: the
+ * processor's time stamp counter where available, and otherwise
+ * nanoseconds of std::chrono::steady_clock.
+ *
+ * Ticks are only comparable on one machine, and on some older processors
+ * only on one core; use ticks_per_nanosecond() to convert them.
+ */
+struct cycle_clock
+{
+  /// Type of a time in ticks.
+  typedef std::uint64_t rep;
+
+  /// The current time in ticks.
+  static rep now()
+  {
+#ifdef STATELESS_HAS_RDTSC
+    return __rdtsc();
+#else
+    return static_cast<rep>(std::chrono::duration_cast<std::chrono::nanoseconds>(
+      std::chrono::steady_clock::now().time_since_epoch()).count());
+#endif
+  }
+
+  /**
+   * The tick rate, measured against the steady clock over a few
+   * milliseconds on first use.
+   */
+  static double ticks_per_nanosecond()
+  {
+#ifdef STATELESS_HAS_RDTSC
+    static const double rate = calibrate();
+    return rate;
+#else
+    return 1.0;
+#endif
+  }
+
+private:
+  static double calibrate()
+  {
+    const auto start = std::chrono::steady_clock::now();
+    const rep start_ticks = now();
+    std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    const rep end_ticks = now();
+    const std::chrono::duration<double, std::nano> elapsed = std::chrono::steady_clock::now() - start;
+    return static_cast<double>(end_ticks - start_ticks) / elapsed.count();
+  }
+};
+
+/**
+ * A clock for timing long intervals, such as time spent in a state, at the
+ * lowest cost per reading: CLOCK_MONOTONIC_COARSE where available, which
+ * the kernel updates every tick (typically 1 to 4 ms) and which is read
+ * without a system call, and otherwise std::chrono::steady_clock.
+ *
+ * Ticks are nanoseconds.
+ */
+struct coarse_clock
+{
+  /// Type of a time in ticks.
+  typedef std::uint64_t rep;
+
+  /// The current time in ticks.
+  static rep now()
+  {
+#ifdef CLOCK_MONOTONIC_COARSE
+    timespec ts;
+    clock_gettime(CLOCK_MONOTONIC_COARSE, &ts);
+    return static_cast<rep>(ts.tv_sec) * 1000000000u + static_cast<rep>(ts.tv_nsec);
+#else
+    return static_cast<rep>(std::chrono::duration_cast<std::chrono::nanoseconds>(
+      std::chrono::steady_clock::now().time_since_epoch()).count());
+#endif
+  }
+
+  /// The tick rate.
+  static double ticks_per_nanosecond()
+  {
+    return 1.0;
+  }
+};
+
+}
+
+#endif // STATELESS_CLOCKS_HPP
@@ -0,0 +1,788 @@
+/**
+ * Copyright 2013 Matt Mason
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#ifndef STATELESS_COMPACT_JOURNAL_HPP
+#define STATELESS_COMPACT_JOURNAL_HPP
+
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "detail/posix_file.hpp"
+#include "detail/transition.hpp"
+#include "detail/varint.hpp"
+#include "error.hpp"
+#include "journal.hpp"
+
+namespace stateless
+{
+
+namespace detail
+{
+
+/// Precedes each block of a compact journal.
+struct compact_block_header
+{
+  std::uint32_t kind;
+  std::uint32_t size;
+  std::uint32_t count;
+  std::uint32_t crc;
+};
+
+static_assert(sizeof(compact_block_header) == 16, "Unexpected compact journal block layout.");
+
+/// Block holding transition records.
+const std::uint32_t compact_records_block = 1;
+
+/// Block holding the states of every instance.
+const std::uint32_t compact_checkpoint_block = 2;
+
+/// The states, trigger and argument size of a record, which most records in a block share with others.
+struct compact_record_shape
+{
+  std::uint32_t source;
+  std::uint32_t destination;
+  std::uint32_t trigger;
+  std::uint32_t argument_size;
+};
+
+inline bool operator==(const compact_record_shape& a, const compact_record_shape& b)
+{
+  return a.source == b.source && a.destination == b.destination &&
+    a.trigger == b.trigger && a.argument_size == b.argument_size;
+}
+
+/// The number of shapes a block numbers; any further ones are written out in full.
+const std::size_t compact_shape_limit = 64;
+
+inline journal_file_header compact_journal_header()
+{
+  journal_file_header header = { { 'S', 'T', 'L', 'S', 'C', 'J', 'N', 'L' }, 2, 0 };
+  return header;
+}
+
+inline bool is_compact_journal_header(const unsigned char* data, std::size_t size)
+{
+  const auto expected = compact_journal_header();
+  return size >= sizeof(expected) && std::memcmp(data, &expected, sizeof(expected)) == 0;
+}
+
+inline const compact_block_header& compact_block_at(const unsigned char* data, std::size_t offset)
+{
+  return *reinterpret_cast<const compact_block_header*>(data + offset);
+}
+
+/**
+ * Find the complete blocks of a compact journal, ignoring a block torn by a
+ * crash during a write.
+ *
+ * \param data The journal.
+ * \param size The journal size.
+ * \param verify Whether to check block checksums, stopping at the first mismatch.
+ * \param offsets If not null, receives the offset of each block.
+ *
+ * \return The length of the complete blocks and the file header.
+ */
+inline std::size_t scan_compact_blocks(
+  const unsigned char* data,
+  std::size_t size,
+  bool verify,
+  std::vector<std::size_t>* offsets)
+{
+  std::size_t offset = sizeof(journal_file_header);
+  while (size - offset >= sizeof(compact_block_header))
+  {
+    const auto& header = compact_block_at(data, offset);
+    const std::size_t payload = offset + sizeof(compact_block_header);
+    if (size - payload < header.size ||
+      (verify && crc32(data + payload, header.size) != header.crc))
+    {
+      break;
+    }
+    if (offsets != nullptr)
+    {
+      offsets->push_back(offset);
+    }
+    offset = payload + header.size;
+  }
+  return offset;
+}
+
+}
+
+/**
+ * Appends transitions to a compact journal file.
+ *
+ * Records are encoded with variable length integers, relative to the
+ * previous record in the same block: the instance id as the difference
+ * from the previous one, and the timestamp as the change in the interval
+ * between records. The source and destination states, trigger and
+ * argument size are numbered in order of first use within a block, so a
+ * record that repeats them takes one byte for all four. Records are
+ * grouped into blocks, each with a CRC-32 of its contents, that are
+ * written when full, on flush() and on commit(). Blocks decode
+ * independently.
+ *
+ * checkpoint() writes the states of every instance of a store. Recovery
+ * starts from the latest checkpoint and replays only the records after it,
+ * and compact() discards everything before it.
+ *
+ * States and triggers must be enumerations or integers, and arguments
+ * trivially copyable. Member functions may be called from any thread.
+ *
+ * \tparam TState The type used to represent the states.
+ * \tparam TTrigger The type used to represent the triggers that cause state transitions.
+ */
+template<typename TState, typename TTrigger>
+class compact_journal_writer
+{
+public:
+  /// Parameterized transition type.
+  typedef detail::transition<TState, TTrigger> TTransition;
+
+  /**
+   * Open a compact journal for appending, creating it if necessary.
+   * A block torn by a crash, or with a bad checksum, at the end of an
+   * existing journal is removed, along with anything after it.
+   *
+   * \param path The journal file.
+   * \param block_size The size at which a block of records is written.
+   *
+   * \throw error The file cannot be opened or is not a compact journal.
+   */
+  compact_journal_writer(const std::string& path, std::size_t block_size = 1 << 16)
+    : path_(path)
+    , block_size_(block_size)
+    , mutex_()
+    , file_()
+    , payload_()
+    , count_(0)
+    , previous_instance_(0)
+    , previous_timestamp_(0)
+    , previous_interval_(0)
+    , shapes_()
+    , previous_shape_(0)
+    , block_()
+  {
+    shapes_.reserve(detail::compact_shape_limit);
+    payload_.reserve(block_size_);
+    open();
+  }
+
+  /// Write any buffered records. They are not synced.
+  ~compact_journal_writer()
+  {
+    try
+    {
+      flush();
+    }
+    catch (...)
+    {}
+  }
+
+  /**
+   * Append a transition, timestamped with the system clock.
+   *
+   * \param instance The id of the instance that made the transition.
+   * \param transition The transition.
+   * \param args The arguments passed in the transition.
+   */
+  template<typename... TArgs>
+  void append(std::uint64_t instance, const TTransition& transition, const TArgs&... args)
+  {
+    const auto now = std::chrono::duration_cast<std::chrono::nanoseconds>(
+      std::chrono::system_clock::now().time_since_epoch());
+    append_at(now.count(), instance, transition, args...);
+  }
+
+  /**
+   * Append a transition with the supplied timestamp.
+   *
+   * \param timestamp The time of the transition, in nanoseconds since the epoch.
+   * \param instance The id of the instance that made the transition.
+   * \param transition The transition.
+   * \param args The arguments passed in the transition.
+   */
+  template<typename... TArgs>
+  void append_at(
+    std::int64_t timestamp,
+    std::uint64_t instance,
+    const TTransition& transition,
+    const TArgs&... args)
+  {
+    const detail::compact_record_shape shape = {
+      detail::journal_code(transition.source()),
+      detail::journal_code(transition.destination()),
+      detail::journal_code(transition.trigger()),
+      static_cast<std::uint32_t>(detail::packed_size(args...)) };
+    std::lock_guard<std::mutex> lock(mutex_);
+    detail::put_varint(payload_, detail::zigzag_encode(
+      static_cast<std::int64_t>(instance - previous_instance_)));
+    put_shape(shape);
+    const std::int64_t interval = timestamp - previous_timestamp_;
+    detail::put_varint(payload_, detail::zigzag_encode(interval - previous_interval_));
+    const std::size_t offset = payload_.size();
+    payload_.resize(offset + shape.argument_size);
+    detail::pack(payload_.data() + offset, args...);
+    previous_instance_ = instance;
+    previous_timestamp_ = timestamp;
+    previous_interval_ = interval;
+    ++count_;
+    if (payload_.size() >= block_size_)
+    {
+      write_records();
+    }
+  }
+
+  /**
+   * Write a checkpoint of the states of every instance in a store, after
+   * any buffered records, and make the journal durable.
+   *
+   * \param store A store, such as an instance_store, with size() and state(index).
+   */
+  template<typename TStore>
+  void checkpoint(const TStore& store)
+  {
+    std::vector<unsigned char> payload;
+    const std::size_t size = store.size();
+    detail::put_varint(payload, size);
+    // Runs of instances in the same state.
+    for (std::size_t first = 0; first < size; )
+    {
+      const TState state = store.state(first);
+      std::size_t last = first + 1;
+      while (last < size && store.state(last) == state)
+      {
+        ++last;
+      }
+      detail::put_varint(payload, last - first);
+      detail::put_varint(payload, detail::journal_code(state));
+      first = last;
+    }
+
+    std::lock_guard<std::mutex> lock(mutex_);
+    write_records();
+    write_block(detail::compact_checkpoint_block, 1, payload);
+    file_->sync();
+  }
+
+  /// Write the buffered records to the file, without syncing.
+  void flush()
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    write_records();
+  }
+
+  /// Write the buffered records and make the journal durable.
+  void commit()
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    write_records();
+    file_->sync();
+  }
+
+  /**
+   * Discard everything before the latest checkpoint. The remainder is
+   * copied to a new file which replaces the journal atomically.
+   *
+   * \return The number of bytes removed.
+   */
+  std::size_t compact()
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    write_records();
+    std::size_t checkpoint = 0, size = 0;
+    {
+      detail::mapped_file existing(path_);
+      size = existing.size();
+      std::vector<std::size_t> offsets;
+      detail::scan_compact_blocks(existing.data(), existing.size(), false, &offsets);
+      for (auto offset : offsets)
+      {
+        if (detail::compact_block_at(existing.data(), offset).kind == detail::compact_checkpoint_block)
+        {
+          checkpoint = offset;
+        }
+      }
+      if (checkpoint <= sizeof(detail::journal_file_header))
+      {
+        return 0;
+      }
+      const std::string temporary = path_ + ".tmp";
+      {
+        detail::file_descriptor file(temporary, O_WRONLY | O_CREAT | O_TRUNC);
+        const auto header = detail::compact_journal_header();
+        file.write_all(&header, sizeof(header));
+        file.write_all(existing.data() + checkpoint, size - checkpoint);
+        file.sync();
+      }
+      if (std::rename(temporary.c_str(), path_.c_str()) != 0)
+      {
+        std::remove(temporary.c_str());
+        throw error("Unable to replace the journal file.");
+      }
+    }
+    open();
+    return checkpoint - sizeof(detail::journal_file_header);
+  }
+
+private:
+  compact_journal_writer(const compact_journal_writer&);
+  compact_journal_writer& operator=(const compact_journal_writer&);
+
+  void open()
+  {
+    file_.reset(new detail::file_descriptor(path_, O_RDWR | O_CREAT | O_APPEND));
+    const std::size_t size = file_->size();
+    if (size == 0)
+    {
+      const auto header = detail::compact_journal_header();
+      file_->write_all(&header, sizeof(header));
+      file_->sync();
+      return;
+    }
+    std::size_t valid_size = 0;
+    {
+      detail::mapped_file existing(path_);
+      if (!detail::is_compact_journal_header(existing.data(), existing.size()))
+      {
+        throw error("The file is not a compact journal.");
+      }
+      valid_size = detail::scan_compact_blocks(existing.data(), existing.size(), true, nullptr);
+    }
+    if (valid_size != size && ::ftruncate(file_->get(), static_cast<off_t>(valid_size)) != 0)
+    {
+      throw error("Unable to remove a torn block from the journal.");
+    }
+  }
+
+  /// Write the buffered records as a block. Called with the mutex held.
+  void write_records()
+  {
+    if (count_ == 0)
+    {
+      return;
+    }
+    write_block(detail::compact_records_block, count_, payload_);
+    payload_.clear();
+    count_ = 0;
+    previous_instance_ = 0;
+    previous_timestamp_ = 0;
+    previous_interval_ = 0;
+    shapes_.clear();
+    previous_shape_ = 0;
+  }
+
+  /**
+   * Write the number of a record's shape in the block. A shape not yet
+   * numbered takes the next number and is written out after it.
+   * Called with the mutex held.
+   */
+  void put_shape(const detail::compact_record_shape& shape)
+  {
+    std::size_t number = previous_shape_;
+    if (number >= shapes_.size() || !(shapes_[number] == shape))
+    {
+      number = 0;
+      while (number < shapes_.size() && !(shapes_[number] == shape))
+      {
+        ++number;
+      }
+    }
+    detail::put_varint(payload_, number);
+    if (number == shapes_.size())
+    {
+      detail::put_varint(payload_, shape.source);
+      detail::put_varint(payload_, shape.destination);
+      detail::put_varint(payload_, shape.trigger);
+      detail::put_varint(payload_, shape.argument_size);
+      if (shapes_.size() < detail::compact_shape_limit)
+      {
+        shapes_.push_back(shape);
+      }
+    }
+    previous_shape_ = number;
+  }
+
+  void write_block(std::uint32_t kind, std::uint32_t count, const std::vector<unsigned char>& payload)
+  {
+    detail::compact_block_header header;
+    header.kind = kind;
+    header.size = static_cast<std::uint32_t>(payload.size());
+    header.count = count;
+    header.crc = detail::crc32(payload.data(), payload.size());
+    // One write per block, so that a crash tears at most the last block.
+    block_.resize(sizeof(header) + payload.size());
+    std::memcpy(block_.data(), &header, sizeof(header));
+    if (!payload.empty())
+    {
+      std::memcpy(block_.data() + sizeof(header), payload.data(), payload.size());
+    }
+    file_->write_all(block_.data(), block_.size());
+  }
+
+  const std::string path_;
+  const std::size_t block_size_;
+  std::mutex mutex_;
+  std::unique_ptr<detail::file_descriptor> file_;
+
+  /// The records of the block being built.
+  std::vector<unsigned char> payload_;
+  std::uint32_t count_;
+  std::uint64_t previous_instance_;
+  std::int64_t previous_timestamp_;
+  std::int64_t previous_interval_;
+
+  /// The shapes numbered in the block being built, and the last one used.
+  std::vector<detail::compact_record_shape> shapes_;
+  std::size_t previous_shape_;
+
+  /// Scratch space for assembling a block to write.
+  std::vector<unsigned char> block_;
+};
+
+/**
+ * Reads a journal written by compact_journal_writer, decoding records in
+ * place from a read-only memory mapping of the file.
+ *
+ * \tparam TState The type used to represent the states.
+ * \tparam TTrigger The type used to represent the triggers that cause state transitions.
+ */
+template<typename TState, typename TTrigger>
+class compact_journal_reader
+{
+public:
+  /// A decoded record.
+  class entry
+  {
+  public:
+    /// The id of the instance that made the transition.
+    std::uint64_t instance() const
+    {
+      return instance_;
+    }
+
+    TState source() const
+    {
+      return static_cast<TState>(source_);
+    }
+
+    TState destination() const
+    {
+      return static_cast<TState>(destination_);
+    }
+
+    TTrigger trigger() const
+    {
+      return static_cast<TTrigger>(trigger_);
+    }
+
+    /// The time of the transition, in nanoseconds since the epoch.
+    std::int64_t timestamp() const
+    {
+      return timestamp_;
+    }
+
+    /// The packed arguments.
+    const unsigned char* arguments() const
+    {
+      return arguments_;
+    }
+
+    std::size_t argument_size() const
+    {
+      return argument_size_;
+    }
+
+    /**
+     * Unpack the arguments.
+     *
+     * \throw error The arguments were not packed from the supplied types.
+     */
+    template<typename... TArgs>
+    void read_arguments(TArgs&... args) const
+    {
+      if (detail::packed_size(args...) != argument_size())
+      {
+        throw error("The journaled arguments do not match the supplied types.");
+      }
+      detail::unpack(arguments(), args...);
+    }
+
+  private:
+    friend class compact_journal_reader;
+
+    entry()
+      : instance_(0)
+      , source_(0)
+      , destination_(0)
+      , trigger_(0)
+      , timestamp_(0)
+      , arguments_(nullptr)
+      , argument_size_(0)
+    {}
+
+    std::uint64_t instance_;
+    std::uint64_t source_;
+    std::uint64_t destination_;
+    std::uint64_t trigger_;
+    std::int64_t timestamp_;
+    const unsigned char* arguments_;
+    std::size_t argument_size_;
+  };
+
+  /// The records after the latest checkpoint, for replay.
+  class tail_view
+  {
+  public:
+    typedef typename compact_journal_reader::entry entry;
+
+    template<typename TCallable>
+    std::size_t for_each(TCallable visitor) const
+    {
+      return reader_.for_each_from(reader_.tail_block(), visitor);
+    }
+
+  private:
+    friend class compact_journal_reader;
+
+    explicit tail_view(const compact_journal_reader& reader)
+      : reader_(reader)
+    {}
+
+    const compact_journal_reader& reader_;
+  };
+
+  /**
+   * Map a compact journal. Blocks appended after it is mapped are not read.
+   *
+   * \param path The journal file.
+   *
+   * \throw error The file cannot be mapped or is not a compact journal.
+   */
+  explicit compact_journal_reader(const std::string& path)
+    : file_(path)
+    , offsets_()
+    , checkpoint_(npos)
+  {
+    if (!detail::is_compact_journal_header(file_.data(), file_.size()))
+    {
+      throw error("The file is not a compact journal.");
+    }
+    detail::scan_compact_blocks(file_.data(), file_.size(), false, &offsets_);
+    for (std::size_t i = 0; i < offsets_.size(); ++i)
+    {
+      if (block(i).kind == detail::compact_checkpoint_block)
+      {
+        checkpoint_ = i;
+      }
+    }
+    file_.advise_sequential();
+  }
+
+  /**
+   * Visit every record, in the order in which they were appended.
+   *
+   * \param visitor Function called with each entry.
+   *
+   * \return The number of records visited.
+   *
+   * \throw error A block is corrupt.
+   */
+  template<typename TCallable>
+  std::size_t for_each(TCallable visitor) const
+  {
+    return for_each_from(0, visitor);
+  }
+
+  /// The records after the latest checkpoint, or all of them if there is none.
+  tail_view tail() const
+  {
+    return tail_view(*this);
+  }
+
+  /// Whether the journal holds a checkpoint.
+  bool has_checkpoint() const
+  {
+    return checkpoint_ != npos;
+  }
+
+  /**
+   * Set the state of every instance in a store to that in the latest
+   * checkpoint. Instances beyond the checkpoint are left unchanged.
+   *
+   * \param store A store, such as an instance_store, with size() and set_state(index, state).
+   *
+   * \return False if there is no checkpoint.
+   *
+   * \throw error The checkpoint is corrupt or has more instances than the store.
+   */
+  template<typename TStore>
+  bool apply_checkpoint(TStore& store) const
+  {
+    if (!has_checkpoint())
+    {
+      return false;
+    }
+    const unsigned char* next = verified_payload(checkpoint_);
+    const unsigned char* end = next + block(checkpoint_).size;
+    const std::uint64_t size = detail::get_varint(next, end);
+    if (size > store.size())
+    {
+      throw error("The checkpoint has more instances than the store.");
+    }
+    std::uint64_t instance = 0;
+    while (instance < size)
+    {
+      const std::uint64_t run = detail::get_varint(next, end);
+      const TState state = static_cast<TState>(detail::get_varint(next, end));
+      if (run > size - instance)
+      {
+        throw error("A compact journal checkpoint is corrupt.");
+      }
+      for (const std::uint64_t last = instance + run; instance < last; ++instance)
+      {
+        store.set_state(static_cast<std::size_t>(instance), state);
+      }
+    }
+    return true;
+  }
+
+  /**
+   * Restore a store from the latest checkpoint and the records after it.
+   *
+   * \param store A store, such as an instance_store, with size() and set_state(index, state).
+   *              For parallel replay use apply_checkpoint() and
+   *              instance_store::replay() with tail().
+   *
+   * \return The number of records replayed.
+   */
+  template<typename TStore>
+  std::size_t recover(TStore& store) const
+  {
+    apply_checkpoint(store);
+    return tail().for_each(
+      [&](const entry& e)
+      {
+        store.set_state(static_cast<std::size_t>(e.instance()), e.destination());
+      });
+  }
+
+private:
+  compact_journal_reader(const compact_journal_reader&);
+  compact_journal_reader& operator=(const compact_journal_reader&);
+
+  static const std::size_t npos = static_cast<std::size_t>(-1);
+
+  const detail::compact_block_header& block(std::size_t i) const
+  {
+    return detail::compact_block_at(file_.data(), offsets_[i]);
+  }
+
+  /// The first block to replay for recovery.
+  std::size_t tail_block() const
+  {
+    return has_checkpoint() ? checkpoint_ + 1 : 0;
+  }
+
+  const unsigned char* verified_payload(std::size_t i) const
+  {
+    const unsigned char* payload = file_.data() + offsets_[i] + sizeof(detail::compact_block_header);
+    if (detail::crc32(payload, block(i).size) != block(i).crc)
+    {
+      throw error("A compact journal block is corrupt.");
+    }
+    return payload;
+  }
+
+  template<typename TCallable>
+  std::size_t for_each_from(std::size_t first_block, TCallable visitor) const
+  {
+    std::size_t count = 0;
+    std::vector<detail::compact_record_shape> shapes;
+    shapes.reserve(detail::compact_shape_limit);
+    for (std::size_t i = first_block; i < offsets_.size(); ++i)
+    {
+      if (block(i).kind != detail::compact_records_block)
+      {
+        continue;
+      }
+      const unsigned char* next = verified_payload(i);
+      const unsigned char* end = next + block(i).size;
+      entry e;
+      std::int64_t interval = 0;
+      shapes.clear();
+      for (std::uint32_t record = 0; record < block(i).count; ++record, ++count)
+      {
+        e.instance_ += static_cast<std::uint64_t>(detail::zigzag_decode(detail::get_varint(next, end)));
+        const std::uint64_t number = detail::get_varint(next, end);
+        detail::compact_record_shape shape;
+        if (number < shapes.size())
+        {
+          shape = shapes[static_cast<std::size_t>(number)];
+        }
+        else if (number == shapes.size())
+        {
+          shape.source = static_cast<std::uint32_t>(detail::get_varint(next, end));
+          shape.destination = static_cast<std::uint32_t>(detail::get_varint(next, end));
+          shape.trigger = static_cast<std::uint32_t>(detail::get_varint(next, end));
+          shape.argument_size = static_cast<std::uint32_t>(detail::get_varint(next, end));
+          if (shapes.size() < detail::compact_shape_limit)
+          {
+            shapes.push_back(shape);
+          }
+        }
+        else
+        {
+          throw error("A compact journal block is corrupt.");
+        }
+        e.source_ = shape.source;
+        e.destination_ = shape.destination;
+        e.trigger_ = shape.trigger;
+        e.argument_size_ = shape.argument_size;
+        interval += detail::zigzag_decode(detail::get_varint(next, end));
+        e.timestamp_ += interval;
+        if (static_cast<std::size_t>(end - next) < e.argument_size_)
+        {
+          throw error("A compact journal block is corrupt.");
+        }
+        e.arguments_ = next;
+        next += e.argument_size_;
+        visitor(static_cast<const entry&>(e));
+      }
+    }
+    return count;
+  }
+
+  detail::mapped_file file_;
+
+  /// The offset of each complete block.
+  std::vector<std::size_t> offsets_;
+
+  /// The index of the latest checkpoint block, or npos.
+  std::size_t checkpoint_;
+};
+
+}
+
+#endif // STATELESS_COMPACT_JOURNAL_HPP
@@ -0,0 +1,670 @@
+/**
+ * Copyright 2013 Matt Mason
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#ifndef STATELESS_DEFINITION_HPP
+#define STATELESS_DEFINITION_HPP
+
+#include <algorithm>
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <set>
+#include <utility>
+#include <vector>
+
+#include "detail/fingerprint.hpp"
+#include "detail/state_representation.hpp"
+#include "detail/transition.hpp"
+#include "error.hpp"
+#include "fire_observer.hpp"
+#include "memory_usage.hpp"
+#include "trigger_with_parameters.hpp"
+
+namespace stateless
+{
+
+template<typename TState, typename TTrigger>
+class frequency_matrix;
+
+/**
+ * An immutable state machine configuration that operates on states
+ * stored by the caller.
+ *
+ * A definition is created by state_machine::freeze() and is typically shared
+ * by many instances. Its member functions do not modify it, so they may be
+ * called concurrently from any number of threads, for different instances,
+ * provided that the configured guards and actions are themselves thread safe.
+ *
+ * Asynchronous actions configured with on_entry_async() and on_exit_async()
+ * belong to the state machine they were configured on and should not be
+ * used with a definition. Likewise a definition does not arm the timed
+ * triggers configured with fire_after() and permit_after().
+ *
+ * \tparam TState The type used to represent the states.
+ * \tparam TTrigger The type used to represent the triggers that cause state transitions.
+ */
+template<typename TState, typename TTrigger>
+class definition
+{
+public:
+  /// Parameterized state representation type.
+  typedef detail::state_representation<TState, TTrigger> TStateRepresentation;
+
+  /// Parameterized transition type.
+  typedef typename TStateRepresentation::TTransition TTransition;
+
+  /// Parameterized trigger with parameters type.
+  typedef std::shared_ptr<abstract_trigger_with_parameters<TTrigger>> TTriggerWithParameters;
+
+  /// Mapping from state to representation.
+  typedef std::map<TState, TStateRepresentation> TRepresentations;
+
+  /// Mapping of triggers with arguments to the underlying trigger.
+  typedef std::map<TTrigger, TTriggerWithParameters> TTriggerConfiguration;
+
+  /// Parameterized fire observer type.
+  typedef fire_observer<TState, TTrigger> TFireObserver;
+
+  /**
+   * Construct a definition from a copy of a state machine's configuration.
+   * Not for client use; use state_machine::freeze().
+   */
+  definition(
+    const TRepresentations& state_configuration,
+    const TTriggerConfiguration& trigger_configuration)
+    : state_configuration_(state_configuration)
+    , trigger_configuration_(trigger_configuration)
+    , layout_()
+    , layout_states_()
+    , layout_index_()
+  {
+    for (auto& entry : state_configuration_)
+    {
+      entry.second.relink(
+        [this](const TState& state){ return find_representation(state); });
+      entry.second.detach_timers();
+    }
+  }
+
+  /**
+   * Construct a definition from a copy of a state machine's configuration,
+   * arranged for the frequencies in a profile.
+   * Not for client use; use state_machine::freeze(const frequency_matrix&).
+   */
+  definition(
+    const TRepresentations& state_configuration,
+    const TTriggerConfiguration& trigger_configuration,
+    const frequency_matrix<TState, TTrigger>& profile)
+    : definition(state_configuration, trigger_configuration)
+  {
+    arrange(profile);
+  }
+
+  /**
+   * Transition the supplied state via the supplied trigger.
+   * Actions associated with leaving the current state and entering the new one
+   * will be invoked.
+   *
+   * \param state The current state, which is updated with the new state.
+   * \param trigger The trigger to fire.
+   *
+   * \throw error The current state does not allow the trigger to be fired.
+   */
+  void fire(TState& state, const TTrigger& trigger) const
+  {
+    internal_fire(nullptr, state, trigger);
+  }
+
+  /**
+   * Transition the supplied state via the supplied trigger.
+   * Actions associated with leaving the current state and entering the new one
+   * will be invoked.
+   *
+   * \param state The current state, which is updated with the new state.
+   * \param trigger The trigger to fire.
+   * \param args The arguments to pass in the transition.
+   *
+   * \throw error The current state does not allow the trigger to be fired.
+   */
+  template<typename... TArgs>
+  void fire(
+    TState& state,
+    const std::shared_ptr<trigger_with_parameters<TTrigger, TArgs...>>& trigger,
+    TArgs... args) const
+  {
+    internal_fire(nullptr, state, trigger->trigger(), std::move(args)...);
+  }
+
+  /**
+   * Transition the supplied state via the supplied trigger, reporting
+   * progress to an observer if STATELESS_ENABLE_INSTRUMENTATION is defined.
+   *
+   * \param observer The observer, or nullptr.
+   * \param state The current state, which is updated with the new state.
+   * \param trigger The trigger to fire.
+   *
+   * \throw error The current state does not allow the trigger to be fired.
+   */
+  void fire(TFireObserver* observer, TState& state, const TTrigger& trigger) const
+  {
+    internal_fire(observer, state, trigger);
+  }
+
+  /**
+   * Transition the supplied state via the supplied trigger, reporting
+   * progress to an observer if STATELESS_ENABLE_INSTRUMENTATION is defined.
+   *
+   * \param observer The observer, or nullptr.
+   * \param state The current state, which is updated with the new state.
+   * \param trigger The trigger to fire.
+   * \param args The arguments to pass in the transition.
+   *
+   * \throw error The current state does not allow the trigger to be fired.
+   */
+  template<typename... TArgs>
+  void fire(
+    TFireObserver* observer,
+    TState& state,
+    const std::shared_ptr<trigger_with_parameters<TTrigger, TArgs...>>& trigger,
+    TArgs... args) const
+  {
+    internal_fire(observer, state, trigger->trigger(), std::move(args)...);
+  }
+
+  /**
+   * Transition the supplied state via the supplied trigger if the trigger is
+   * permitted, resolving its handler, and so evaluating its guards, once.
+   *
+   * \param observer The observer, or nullptr.
+   * \param state The current state, which is updated with the new state.
+   * \param trigger The trigger to fire.
+   *
+   * \return False if the trigger is not permitted, in which case the state is unchanged.
+   */
+  bool try_fire(TFireObserver* observer, TState& state, const TTrigger& trigger) const
+  {
+    return try_internal_fire(observer, state, trigger);
+  }
+
+  /**
+   * Determine the state that a trigger would lead to, without executing any
+   * actions or modifying anything. Guards and dynamic destinations are
+   * evaluated, so this is safe to call from parallel algorithms provided
+   * they are pure.
+   *
+   * \param state The current state.
+   * \param trigger The trigger.
+   * \param destination Set to the resulting state if the trigger is permitted.
+   *                    An ignored trigger results in the current state.
+   *
+   * \return True if the trigger is permitted, false otherwise.
+   *
+   * \throw error The trigger is configured with parameters.
+   */
+  bool next(const TState& state, const TTrigger& trigger, TState& destination) const
+  {
+    detail::check_trigger_parameters<TTrigger>(trigger_configuration_, trigger);
+
+    auto handler = find_handler(state, trigger);
+    if (handler == nullptr)
+    {
+      return false;
+    }
+    if (!detail::results_in_transition_from<TState, TTrigger>(handler, state, destination))
+    {
+      destination = state;
+    }
+    return true;
+  }
+
+  /**
+   * Determine whether a trigger can be fired in a state.
+   *
+   * \param state The current state.
+   * \param trigger The trigger to test.
+   *
+   * \return True if the trigger is permitted, false otherwise.
+   */
+  bool can_fire(const TState& state, const TTrigger& trigger) const
+  {
+    return find_handler(state, trigger) != nullptr;
+  }
+
+  /**
+   * Determine whether a state is equal to, or a substate of, another.
+   *
+   * \param state The state to test.
+   * \param super_state The state to test for.
+   */
+  bool is_in_state(const TState& state, const TState& super_state) const
+  {
+    auto representation = find_representation(state);
+    if (representation == nullptr)
+    {
+      return state == super_state;
+    }
+    return representation->is_included_in(super_state);
+  }
+
+  /**
+   * Determine the outcome of a trigger without evaluating guards or executing
+   * actions, where that is possible: the state that handles the trigger has a
+   * single unguarded behaviour for it, whose destination was fixed at
+   * configuration time, and the transition executes no entry or exit actions.
+   *
+   * \param source The current state.
+   * \param trigger The trigger.
+   * \param destination Set to the resulting state, which is the source state
+   *                    if the trigger is ignored.
+   *
+   * \return True if the destination was determined, false if the trigger must
+   *         be fired to find out.
+   */
+  bool try_resolve_statically(
+    const TState& source, const TTrigger& trigger, TState& destination) const
+  {
+    if (trigger_configuration_.find(trigger) != trigger_configuration_.end())
+    {
+      return false;
+    }
+    auto representation = find_representation(source);
+    if (representation == nullptr)
+    {
+      return false;
+    }
+    auto candidates = representation->find_candidates(trigger);
+    if (candidates == nullptr || candidates->size() != 1 || candidates->front()->is_guarded())
+    {
+      return false;
+    }
+
+    typedef detail::ignored_trigger_behaviour<TState, TTrigger> TIgnored;
+    typedef detail::transitioning_trigger_behaviour<TState, TTrigger> TTransitioning;
+    const auto& behaviour = candidates->front();
+    if (std::dynamic_pointer_cast<TIgnored>(behaviour) != nullptr)
+    {
+      destination = source;
+      return true;
+    }
+    auto transitioning = std::dynamic_pointer_cast<TTransitioning>(behaviour);
+    if (transitioning == nullptr)
+    {
+      return false;
+    }
+    TTransition transition(source, transitioning->destination(), trigger);
+    if (representation->has_exit_actions_for(transition))
+    {
+      return false;
+    }
+    auto destination_representation = find_representation(transition.destination());
+    if (destination_representation != nullptr &&
+      destination_representation->has_entry_actions_for(transition))
+    {
+      return false;
+    }
+    destination = transition.destination();
+    return true;
+  }
+
+  /**
+   * The representation of a configured state.
+   *
+   * \return The representation, or nullptr if the state is not configured.
+   */
+  const TStateRepresentation* find_representation(const TState& state) const
+  {
+    if (!layout_.empty())
+    {
+      return find_arranged(state);
+    }
+    auto it = state_configuration_.find(state);
+    return it == state_configuration_.end() ? nullptr : &it->second;
+  }
+
+  /// Whether the definition was arranged for a profile.
+  bool is_arranged() const
+  {
+    return !layout_.empty();
+  }
+
+  /**
+   * The bytes used by the definition, by category, including the behaviours
+   * and actions it shares with the state machine it was frozen from.
+   */
+  stateless::memory_usage memory_usage() const
+  {
+    stateless::memory_usage usage;
+    std::set<const void*> seen;
+    usage.other += sizeof(*this);
+    detail::add_configuration_usage(usage, state_configuration_, trigger_configuration_, seen);
+    usage.representations += detail::capacity_bytes(layout_) - layout_.size() * sizeof(TStateRepresentation) +
+      detail::capacity_bytes(layout_states_) + detail::capacity_bytes(layout_index_);
+    for (auto& representation : layout_)
+    {
+      representation.add_memory_usage(usage, seen);
+    }
+    return usage;
+  }
+
+  /**
+   * A hash of the configured states, hierarchy and transitions that is the
+   * same in every process, for checking that persisted states were produced
+   * by an equivalent configuration. Actions, guard functions and dynamic
+   * destinations cannot be compared, so only their presence is hashed.
+   */
+  std::uint64_t fingerprint() const
+  {
+    typedef detail::transitioning_trigger_behaviour<TState, TTrigger> TTransitioning;
+    typedef detail::ignored_trigger_behaviour<TState, TTrigger> TIgnored;
+    enum { transitioning = 1, ignored = 2, dynamic = 3 };
+
+    detail::fingerprint result;
+    result.add(state_configuration_.size());
+    for (auto& entry : state_configuration_)
+    {
+      const auto& representation = entry.second;
+      result.add_value(entry.first);
+      result.add(representation.has_super_state() ? 1 : 0);
+      if (representation.has_super_state())
+      {
+        result.add_value(representation.super_state().underlying_state());
+      }
+      result.add(representation.trigger_behaviours().size());
+      for (auto& candidates : representation.trigger_behaviours())
+      {
+        result.add_value(candidates.first);
+        result.add(candidates.second.size());
+        for (auto& behaviour : candidates.second)
+        {
+          result.add(behaviour->is_guarded() ? 1 : 0);
+          if (auto t = std::dynamic_pointer_cast<TTransitioning>(behaviour))
+          {
+            result.add(transitioning);
+            result.add_value(t->destination());
+          }
+          else if (std::dynamic_pointer_cast<TIgnored>(behaviour))
+          {
+            result.add(ignored);
+          }
+          else
+          {
+            result.add(dynamic);
+          }
+        }
+      }
+      result.add(representation.timed_triggers().size());
+      for (auto& timed : representation.timed_triggers())
+      {
+        result.add(static_cast<std::uint64_t>(timed.first.count()));
+        result.add_value(timed.second);
+      }
+    }
+    result.add(trigger_configuration_.size());
+    for (auto& entry : trigger_configuration_)
+    {
+      result.add_value(entry.first);
+    }
+    return result.value();
+  }
+
+  /// The triggers configured with parameters.
+  const TTriggerConfiguration& trigger_configuration() const
+  {
+    return trigger_configuration_;
+  }
+
+  /// The configured states and their representations.
+  const TRepresentations& representations() const
+  {
+    return state_configuration_;
+  }
+
+  /**
+   * The behaviour that handles a trigger in a state. Guards are evaluated.
+   *
+   * \return The handler, or nullptr if the trigger is not permitted.
+   */
+  typename TStateRepresentation::TTriggerBehaviour find_handler(
+    const TState& state, const TTrigger& trigger) const
+  {
+    auto representation = find_representation(state);
+    if (representation == nullptr)
+    {
+      return nullptr;
+    }
+    return representation->try_find_handler(trigger);
+  }
+
+private:
+  definition(const definition&);
+  definition& operator=(const definition&);
+
+  /// Implementation of state transition given a trigger.
+  template<typename... TArgs>
+  void internal_fire(
+    TFireObserver* observer, TState& state, const TTrigger& trigger, TArgs&&... args) const
+  {
+    if (!try_internal_fire(observer, state, trigger, std::forward<TArgs>(args)...))
+    {
+      throw error(
+        "No valid leaving transitions are permitted for trigger. "
+        "Consider ignoring the trigger.");
+    }
+  }
+
+  /**
+   * Implementation of state transition given a trigger.
+   *
+   * \return False if the trigger is not permitted.
+   */
+  template<typename... TArgs>
+  bool try_internal_fire(
+    TFireObserver* observer, TState& state, const TTrigger& trigger, TArgs&&... args) const
+  {
+    detail::check_trigger_parameters<TTrigger, TArgs...>(trigger_configuration_, trigger);
+
+    const TState source = state;
+#ifdef STATELESS_ENABLE_INSTRUMENTATION
+    // An observer that declines the trigger is not told the rest of it.
+    if (observer != nullptr && !observer->on_fire(source, trigger))
+    {
+      observer = nullptr;
+    }
+#endif
+    if (sizeof...(TArgs) != 0)
+    {
+      STATELESS_OBSERVE(observer, on_arguments(trigger, detail::make_fire_arguments(args...)));
+    }
+    typename TStateRepresentation::TTriggerBehaviour abstract_handler;
+    auto source_representation = find_representation(source);
+    if (source_representation != nullptr)
+    {
+      abstract_handler = source_representation->try_find_handler(
+        trigger,
+        [&](const detail::abstract_trigger_behaviour& candidate) -> bool
+        {
+#ifdef STATELESS_ENABLE_INSTRUMENTATION
+          if (observer != nullptr && candidate.is_guarded())
+          {
+            observer->on_evaluating_guard(source, trigger);
+            const bool is_met = candidate.is_condition_met();
+            observer->on_guard(source, trigger, is_met);
+            return is_met;
+          }
+#endif
+          return candidate.is_condition_met();
+        });
+    }
+    if (abstract_handler == nullptr)
+    {
+      STATELESS_OBSERVE(observer, on_unhandled(source, trigger));
+      return false;
+    }
+
+    TState destination;
+    if (detail::results_in_transition_from<TState, TTrigger>(
+      abstract_handler, source, destination, std::forward<TArgs>(args)...))
+    {
+      TTransition transition(source, destination, trigger);
+      STATELESS_OBSERVE(observer, on_resolved(transition));
+      source_representation->exit(transition);
+      STATELESS_OBSERVE(observer, on_exited(transition));
+      state = destination;
+      STATELESS_OBSERVE(observer, on_state_changed(transition));
+      auto destination_representation = find_representation(destination);
+      if (destination_representation != nullptr)
+      {
+        destination_representation->enter(transition, std::forward<TArgs>(args)...);
+      }
+      STATELESS_OBSERVE(observer, on_entered(transition));
+      STATELESS_OBSERVE(observer, on_transitioned(transition));
+    }
+    else
+    {
+      STATELESS_OBSERVE(observer, on_ignored(source, trigger));
+    }
+    return true;
+  }
+
+  /// Number of the hottest states found by a linear scan in an arranged definition.
+  enum { hot_states = 4 };
+
+  /**
+   * Copy the representations into a contiguous array, hottest first, and
+   * order each trigger's candidates by how often they were taken. The
+   * heat of a state is the number of triggers fired in it plus the number
+   * of transitions into it, the two reasons to look it up. The configured
+   * order in state_configuration_ is kept, for fingerprint() and for
+   * clients of representations().
+   */
+  void arrange(const frequency_matrix<TState, TTrigger>& profile)
+  {
+    typedef frequency_matrix<TState, TTrigger> TProfile;
+    typedef detail::transitioning_trigger_behaviour<TState, TTrigger> TTransitioning;
+    typedef detail::ignored_trigger_behaviour<TState, TTrigger> TIgnored;
+
+    std::map<TState, std::uint64_t> heat;
+    for (auto& r : profile.rows())
+    {
+      heat[r.source] += r.count;
+      if (r.result == TProfile::outcome::transition)
+      {
+        heat[r.destination] += r.count;
+      }
+    }
+    std::vector<std::pair<std::uint64_t, TState>> order;
+    for (auto& entry : state_configuration_)
+    {
+      auto it = heat.find(entry.first);
+      order.push_back(std::make_pair(it == heat.end() ? 0 : it->second, entry.first));
+    }
+    std::stable_sort(order.begin(), order.end(),
+      [](const std::pair<std::uint64_t, TState>& a, const std::pair<std::uint64_t, TState>& b)
+      {
+        return a.first > b.first;
+      });
+
+    layout_.reserve(order.size());
+    for (auto& entry : order)
+    {
+      layout_index_.push_back(std::make_pair(entry.second, layout_.size()));
+      layout_states_.push_back(entry.second);
+      layout_.push_back(state_configuration_.find(entry.second)->second);
+    }
+    std::sort(layout_index_.begin(), layout_index_.end(),
+      [](const std::pair<TState, std::size_t>& a, const std::pair<TState, std::size_t>& b)
+      {
+        return a.first < b.first;
+      });
+    for (auto& representation : layout_)
+    {
+      representation.relink([this](const TState& state){ return find_arranged(state); });
+    }
+
+    for (auto& representation : layout_)
+    {
+      const TState& handler_state = representation.underlying_state();
+      representation.prioritize(
+        [&](const TTrigger& trigger, const detail::abstract_trigger_behaviour& candidate) -> std::uint64_t
+        {
+          // Candidates of a super state are also taken by its substates.
+          const auto transitioning = dynamic_cast<const TTransitioning*>(&candidate);
+          const bool is_ignored = dynamic_cast<const TIgnored*>(&candidate) != nullptr;
+          std::uint64_t taken = 0;
+          for (auto& r : profile.rows())
+          {
+            if (!(r.trigger == trigger) || !is_in_state(r.source, handler_state))
+            {
+              continue;
+            }
+            if (transitioning != nullptr)
+            {
+              taken += r.result == TProfile::outcome::transition
+                && r.destination == transitioning->destination() ? r.count : 0;
+            }
+            else if (is_ignored)
+            {
+              taken += r.result == TProfile::outcome::ignored ? r.count : 0;
+            }
+            else
+            {
+              // Dynamic destinations are only known from observation.
+              taken += r.result == TProfile::outcome::transition && !r.is_configured ? r.count : 0;
+            }
+          }
+          return taken;
+        });
+    }
+  }
+
+  /// Find a representation in the arranged layout.
+  const TStateRepresentation* find_arranged(const TState& state) const
+  {
+    const std::size_t scanned = std::min<std::size_t>(layout_states_.size(), hot_states);
+    for (std::size_t i = 0; i < scanned; ++i)
+    {
+      if (layout_states_[i] == state)
+      {
+        return &layout_[i];
+      }
+    }
+    auto it = std::lower_bound(layout_index_.begin(), layout_index_.end(), state,
+      [](const std::pair<TState, std::size_t>& entry, const TState& s)
+      {
+        return entry.first < s;
+      });
+    return it != layout_index_.end() && !(state < it->first) ? &layout_[it->second] : nullptr;
+  }
+
+  /// Mapping from state to representation.
+  TRepresentations state_configuration_;
+
+  /// Mapping of triggers with arguments to the underlying trigger.
+  TTriggerConfiguration trigger_configuration_;
+
+  /**
+   * The representations as arranged for a profile, if any: hottest first,
+   * their states in the same order, and their indices sorted by state.
+   */
+  std::vector<TStateRepresentation> layout_;
+  std::vector<TState> layout_states_;
+  std::vector<std::pair<TState, std::size_t>> layout_index_;
+};
+
+}
+
+#endif // STATELESS_DEFINITION_HPP
@@ -0,0 +1,178 @@
+/**
+ * Copyright 2013 Matt Mason
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#ifndef STATELESS_DETAIL_BATCH_KERNEL_HPP
+#define STATELESS_DETAIL_BATCH_KERNEL_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <vector>
+
+#if (defined(__GNUC__) || defined(__clang__)) && (defined(__x86_64__) || defined(__i386__))
+#define STATELESS_HAS_SSSE3_KERNEL
+#include <tmmintrin.h>
+#endif
+
+namespace stateless
+{
+
+namespace detail
+{
+
+/**
+ * Replace each code with its entry in a transition table. Codes that map to
+ * the slow marker are left unchanged and their indices, offset by base, are
+ * appended to slow_indices.
+ */
+template<typename TCode>
+inline void apply_table_scalar(
+  TCode* codes,
+  std::size_t count,
+  const TCode* table,
+  TCode slow,
+  std::vector<std::size_t>& slow_indices,
+  std::size_t base)
+{
+  for (std::size_t i = 0; i < count; ++i)
+  {
+    const TCode next = table[codes[i]];
+    if (next == slow)
+    {
+      slow_indices.push_back(base + i);
+    }
+    else
+    {
+      codes[i] = next;
+    }
+  }
+}
+
+#ifdef STATELESS_HAS_SSSE3_KERNEL
+
+/**
+ * SSSE3 version of apply_table_scalar() for byte codes below 32.
+ * Sixteen codes are looked up at a time with two byte shuffles, one for each
+ * half of the 32 entry table.
+ */
+__attribute__((target("ssse3")))
+inline void apply_table_ssse3(
+  std::uint8_t* codes,
+  std::size_t count,
+  const std::uint8_t (&table)[32],
+  std::uint8_t slow,
+  std::vector<std::size_t>& slow_indices,
+  std::size_t base)
+{
+  const __m128i low_table = _mm_loadu_si128(reinterpret_cast<const __m128i*>(table));
+  const __m128i high_table = _mm_loadu_si128(reinterpret_cast<const __m128i*>(table + 16));
+  const __m128i fifteen = _mm_set1_epi8(15);
+  const __m128i slow_marker = _mm_set1_epi8(static_cast<char>(slow));
+
+  std::size_t i = 0;
+  for (; i + 16 <= count; i += 16)
+  {
+    __m128i* block = reinterpret_cast<__m128i*>(codes + i);
+    const __m128i current = _mm_loadu_si128(block);
+    const __m128i from_low = _mm_shuffle_epi8(low_table, current);
+    const __m128i from_high = _mm_shuffle_epi8(high_table, current);
+    const __m128i is_high = _mm_cmpgt_epi8(current, fifteen);
+    __m128i next = _mm_or_si128(
+      _mm_and_si128(is_high, from_high), _mm_andnot_si128(is_high, from_low));
+
+    const __m128i is_slow = _mm_cmpeq_epi8(next, slow_marker);
+    int mask = _mm_movemask_epi8(is_slow);
+    if (mask != 0)
+    {
+      next = _mm_or_si128(
+        _mm_and_si128(is_slow, current), _mm_andnot_si128(is_slow, next));
+      while (mask != 0)
+      {
+        slow_indices.push_back(base + i + __builtin_ctz(mask));
+        mask &= mask - 1;
+      }
+    }
+    _mm_storeu_si128(block, next);
+  }
+  apply_table_scalar<std::uint8_t>(codes + i, count - i, table, slow, slow_indices, base + i);
+}
+
+inline bool cpu_supports_ssse3()
+{
+#ifdef __SSSE3__
+  return true;
+#else
+  static const bool supported = __builtin_cpu_supports("ssse3") != 0;
+  return supported;
+#endif
+}
+
+#endif // STATELESS_HAS_SSSE3_KERNEL
+
+/**
+ * Apply a transition table to a column of codes, using a vector kernel
+ * where the code type, table size and processor allow.
+ *
+ * \param codes The codes to update.
+ * \param count The number of codes.
+ * \param table The table, which must have an entry for every code present.
+ * \param table_size The number of entries in the table.
+ * \param slow The marker for entries that need individual processing.
+ * \param slow_indices Receives the indices, offset by base, of codes that were left unchanged.
+ * \param base Offset added to reported indices.
+ */
+template<typename TCode>
+inline void apply_table(
+  TCode* codes,
+  std::size_t count,
+  const TCode* table,
+  std::size_t table_size,
+  TCode slow,
+  std::vector<std::size_t>& slow_indices,
+  std::size_t base)
+{
+  apply_table_scalar(codes, count, table, slow, slow_indices, base);
+}
+
+template<>
+inline void apply_table<std::uint8_t>(
+  std::uint8_t* codes,
+  std::size_t count,
+  const std::uint8_t* table,
+  std::size_t table_size,
+  std::uint8_t slow,
+  std::vector<std::size_t>& slow_indices,
+  std::size_t base)
+{
+#ifdef STATELESS_HAS_SSSE3_KERNEL
+  if (table_size <= 32 && cpu_supports_ssse3())
+  {
+    std::uint8_t padded[32];
+    std::memset(padded, slow, sizeof(padded));
+    std::memcpy(padded, table, table_size);
+    apply_table_ssse3(codes, count, padded, slow, slow_indices, base);
+    return;
+  }
+#endif
+  apply_table_scalar(codes, count, table, slow, slow_indices, base);
+}
+
+}
+
+}
+
+#endif // STATELESS_DETAIL_BATCH_KERNEL_HPP
@@ -0,0 +1,120 @@
+/**
+ * Copyright 2013 Matt Mason
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#ifndef STATELESS_DETAIL_CHUNK_QUEUE_HPP
+#define STATELESS_DETAIL_CHUNK_QUEUE_HPP
+
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <mutex>
+#include <vector>
+
+namespace stateless
+{
+
+namespace detail
+{
+
+/**
+ * A bounded queue of chunks of values passed from one producer thread to
+ * one consumer thread. The producer waits while the queue is full, so the
+ * values in flight are bounded however far ahead it reads.
+ */
+template<typename T>
+class chunk_queue
+{
+public:
+  typedef std::vector<T> TChunk;
+
+  /// \param capacity The number of chunks that may wait in the queue.
+  explicit chunk_queue(std::size_t capacity)
+    : capacity_(capacity)
+    , mutex_()
+    , changed_()
+    , chunks_()
+    , is_closed_(false)
+    , is_abandoned_(false)
+  {}
+
+  /// Pass a chunk to the consumer, or drop it if the consumer has abandoned the queue.
+  void push(TChunk& chunk)
+  {
+    std::unique_lock<std::mutex> lock(mutex_);
+    changed_.wait(lock, [this](){ return chunks_.size() < capacity_ || is_abandoned_; });
+    if (!is_abandoned_)
+    {
+      chunks_.push_back(TChunk());
+      chunks_.back().swap(chunk);
+      changed_.notify_all();
+    }
+    chunk.clear();
+  }
+
+  /// Tell the consumer that no more chunks will be pushed.
+  void close()
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    is_closed_ = true;
+    changed_.notify_all();
+  }
+
+  /// Stop accepting chunks, so that the producer never waits on a consumer that has failed.
+  void abandon()
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    is_abandoned_ = true;
+    chunks_.clear();
+    changed_.notify_all();
+  }
+
+  /**
+   * Take the next chunk, waiting for one if necessary.
+   *
+   * \return False once the queue is closed and empty.
+   */
+  bool pop(TChunk& chunk)
+  {
+    std::unique_lock<std::mutex> lock(mutex_);
+    changed_.wait(lock, [this](){ return !chunks_.empty() || is_closed_; });
+    if (chunks_.empty())
+    {
+      return false;
+    }
+    chunk.swap(chunks_.front());
+    chunks_.pop_front();
+    changed_.notify_all();
+    return true;
+  }
+
+private:
+  chunk_queue(const chunk_queue&);
+  chunk_queue& operator=(const chunk_queue&);
+
+  const std::size_t capacity_;
+  std::mutex mutex_;
+  std::condition_variable changed_;
+  std::deque<TChunk> chunks_;
+  bool is_closed_;
+  bool is_abandoned_;
+};
+
+}
+
+}
+
+#endif // STATELESS_DETAIL_CHUNK_QUEUE_HPP
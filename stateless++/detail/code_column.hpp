@@ -0,0 +1,146 @@
+/**
+ * Copyright 2013 Matt Mason
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#ifndef STATELESS_DETAIL_CODE_COLUMN_HPP
+#define STATELESS_DETAIL_CODE_COLUMN_HPP
+
+#include <cstddef>
+#include <memory>
+#include <stdexcept>
+#include <vector>
+
+namespace stateless
+{
+
+namespace detail
+{
+
+/**
+ * A column of state codes, either in its own storage or in memory owned
+ * elsewhere, such as a copy-on-write mapping of a snapshot. Borrowed codes
+ * are copied into the column's own storage before it first grows.
+ */
+template<typename TCode>
+class code_column
+{
+public:
+  code_column()
+    : owned_()
+    , data_(nullptr)
+    , size_(0)
+    , owner_()
+  {}
+
+  /**
+   * Use codes owned elsewhere.
+   *
+   * \param data The codes, which the column may modify.
+   * \param size The number of codes.
+   * \param owner Keeps the codes alive for as long as the column uses them.
+   */
+  code_column(TCode* data, std::size_t size, const std::shared_ptr<void>& owner)
+    : owned_()
+    , data_(data)
+    , size_(size)
+    , owner_(owner)
+  {}
+
+  void assign(std::size_t size, TCode code)
+  {
+    owner_.reset();
+    owned_.assign(size, code);
+    use_owned();
+  }
+
+  void push_back(TCode code)
+  {
+    if (owner_ != nullptr)
+    {
+      owned_.assign(data_, data_ + size_);
+      owner_.reset();
+    }
+    owned_.push_back(code);
+    use_owned();
+  }
+
+  std::size_t size() const
+  {
+    return size_;
+  }
+
+  TCode* data()
+  {
+    return data_;
+  }
+
+  const TCode* data() const
+  {
+    return data_;
+  }
+
+  TCode& operator[](std::size_t i)
+  {
+    return data_[i];
+  }
+
+  const TCode& operator[](std::size_t i) const
+  {
+    return data_[i];
+  }
+
+  const TCode& at(std::size_t i) const
+  {
+    if (i >= size_)
+    {
+      throw std::out_of_range("code_column");
+    }
+    return data_[i];
+  }
+
+  /// Bytes used by the codes, whether owned or borrowed.
+  std::size_t bytes() const
+  {
+    return is_borrowed() ? size_ * sizeof(TCode) : owned_.capacity() * sizeof(TCode);
+  }
+
+  /// Whether the codes are owned elsewhere.
+  bool is_borrowed() const
+  {
+    return owner_ != nullptr;
+  }
+
+private:
+  code_column(const code_column&);
+  code_column& operator=(const code_column&);
+
+  void use_owned()
+  {
+    data_ = owned_.data();
+    size_ = owned_.size();
+  }
+
+  std::vector<TCode> owned_;
+  TCode* data_;
+  std::size_t size_;
+  std::shared_ptr<void> owner_;
+};
+
+}
+
+}
+
+#endif // STATELESS_DETAIL_CODE_COLUMN_HPP
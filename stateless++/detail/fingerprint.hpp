@@ -0,0 +1,88 @@
+/**
+ * Copyright 2013 Matt Mason
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#ifndef STATELESS_DETAIL_FINGERPRINT_HPP
+#define STATELESS_DETAIL_FINGERPRINT_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <type_traits>
+
+namespace stateless
+{
+
+namespace detail
+{
+
+/**
+ * 64-bit FNV-1a hash, fed values in a fixed byte order so that the result
+ * is the same on every platform and in every process.
+ */
+class fingerprint
+{
+public:
+  fingerprint()
+    : hash_(14695981039346656037ULL)
+  {}
+
+  void add_bytes(const void* data, std::size_t size)
+  {
+    const unsigned char* bytes = static_cast<const unsigned char*>(data);
+    for (std::size_t i = 0; i < size; ++i)
+    {
+      hash_ ^= bytes[i];
+      hash_ *= 1099511628211ULL;
+    }
+  }
+
+  void add(std::uint64_t value)
+  {
+    for (int i = 0; i < 8; ++i)
+    {
+      const unsigned char byte = static_cast<unsigned char>(value >> (8 * i));
+      add_bytes(&byte, 1);
+    }
+  }
+
+  template<typename T>
+  typename std::enable_if<std::is_enum<T>::value || std::is_integral<T>::value>::type
+  add_value(const T& value)
+  {
+    add(static_cast<std::uint64_t>(value));
+  }
+
+  void add_value(const std::string& value)
+  {
+    add(value.size());
+    add_bytes(value.data(), value.size());
+  }
+
+  std::uint64_t value() const
+  {
+    return hash_;
+  }
+
+private:
+  std::uint64_t hash_;
+};
+
+}
+
+}
+
+#endif // STATELESS_DETAIL_FINGERPRINT_HPP
@@ -0,0 +1,164 @@
+/**
+ * Copyright 2013 Matt Mason
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#ifndef STATELESS_DETAIL_PER_THREAD_HPP
+#define STATELESS_DETAIL_PER_THREAD_HPP
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+namespace stateless
+{
+
+namespace detail
+{
+
+/// A process wide id for each per_thread object, never reused.
+inline std::uint64_t next_per_thread_id()
+{
+  static std::atomic<std::uint64_t> id(0);
+  return ++id;
+}
+
+/**
+ * A separate value for each thread that uses the object, so that threads
+ * can update their own without contention. The values outlive the threads
+ * and are destroyed with the object. Visitors of the values must
+ * synchronize with their owners as necessary.
+ */
+template<typename T>
+class per_thread
+{
+public:
+  per_thread()
+    : id_(next_per_thread_id())
+    , mutex_()
+    , values_()
+    , owners_()
+  {}
+
+  /// The calling thread's value, default constructed on first use.
+  T& local()
+  {
+    // Each thread remembers its values in the objects it used recently.
+    // Ids are never reused, so entries for destroyed objects never match.
+    // A thread that returns to an object it has since forgotten finds its
+    // value again under the lock. The last one used is checked first, in
+    // variables that need no thread exit handling.
+    static thread_local std::uint64_t last_id = 0;
+    static thread_local T* last_value = nullptr;
+    if (last_id == id_)
+    {
+      return *last_value;
+    }
+    static thread_local std::vector<std::pair<std::uint64_t, T*>> cache;
+    for (auto& entry : cache)
+    {
+      if (entry.first == id_)
+      {
+        last_id = id_;
+        last_value = entry.second;
+        return *entry.second;
+      }
+    }
+    T* found = nullptr;
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      // A thread that reuses the id of one that has exited takes over its value.
+      T*& owned = owners_[std::this_thread::get_id()];
+      if (owned == nullptr)
+      {
+        values_.emplace_back(new T());
+        owned = values_.back().get();
+      }
+      found = owned;
+    }
+    if (cache.size() == 8)
+    {
+      cache.pop_back();
+    }
+    cache.insert(cache.begin(), std::make_pair(id_, found));
+    last_id = id_;
+    last_value = found;
+    return *found;
+  }
+
+  /// Visit every thread's value.
+  template<typename TCallable>
+  void for_each(TCallable visitor) const
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    for (auto& value : values_)
+    {
+      visitor(*value);
+    }
+  }
+
+private:
+  per_thread(const per_thread&);
+  per_thread& operator=(const per_thread&);
+
+  const std::uint64_t id_;
+
+  /// Guards the list of values and the value of each thread.
+  mutable std::mutex mutex_;
+  std::vector<std::unique_ptr<T>> values_;
+  std::unordered_map<std::thread::id, T*> owners_;
+};
+
+/// A count written by one thread and read by any.
+class owned_counter
+{
+public:
+  owned_counter()
+    : value_(0)
+  {}
+
+  /// Not an atomic increment: only the owning thread writes.
+  void add(std::uint64_t n)
+  {
+    value_.store(value_.load(std::memory_order_relaxed) + n, std::memory_order_relaxed);
+  }
+
+  void increment()
+  {
+    add(1);
+  }
+
+  std::uint64_t get() const
+  {
+    return value_.load(std::memory_order_relaxed);
+  }
+
+private:
+  owned_counter(const owned_counter&);
+  owned_counter& operator=(const owned_counter&);
+
+  std::atomic<std::uint64_t> value_;
+};
+
+}
+
+}
+
+#endif // STATELESS_DETAIL_PER_THREAD_HPP
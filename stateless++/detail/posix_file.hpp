@@ -0,0 +1,231 @@
+/**
+ * Copyright 2013 Matt Mason
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#ifndef STATELESS_DETAIL_POSIX_FILE_HPP
+#define STATELESS_DETAIL_POSIX_FILE_HPP
+
+#include <cerrno>
+#include <cstddef>
+#include <string>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "../error.hpp"
+
+namespace stateless
+{
+
+namespace detail
+{
+
+/// Owns a POSIX file descriptor.
+class file_descriptor
+{
+public:
+  file_descriptor(const std::string& path, int flags, mode_t mode = 0644)
+    : fd_(-1)
+  {
+    do
+    {
+      fd_ = ::open(path.c_str(), flags | O_CLOEXEC, mode);
+    } while (fd_ == -1 && errno == EINTR);
+    if (fd_ == -1)
+    {
+      throw error("Unable to open file.");
+    }
+  }
+
+  ~file_descriptor()
+  {
+    ::close(fd_);
+  }
+
+  int get() const
+  {
+    return fd_;
+  }
+
+  /// The current size of the file.
+  std::size_t size() const
+  {
+    struct stat status;
+    if (::fstat(fd_, &status) != 0)
+    {
+      throw error("Unable to determine the size of file.");
+    }
+    return static_cast<std::size_t>(status.st_size);
+  }
+
+  /// Write the whole of a buffer, retrying partial and interrupted writes.
+  void write_all(const void* data, std::size_t size) const
+  {
+    if (!try_write_all(data, size))
+    {
+      throw error("Unable to write to file.");
+    }
+  }
+
+  /**
+   * Write the whole of a buffer, retrying partial and interrupted writes.
+   * Only makes system calls, so it is safe to call in a forked child.
+   *
+   * \return False if a write failed.
+   */
+  bool try_write_all(const void* data, std::size_t size) const
+  {
+    const char* next = static_cast<const char*>(data);
+    while (size != 0)
+    {
+      const ssize_t written = ::write(fd_, next, size);
+      if (written < 0)
+      {
+        if (errno == EINTR)
+        {
+          continue;
+        }
+        return false;
+      }
+      next += written;
+      size -= static_cast<std::size_t>(written);
+    }
+    return true;
+  }
+
+  /// Read exactly the requested number of bytes from an offset.
+  bool read_at(void* data, std::size_t size, std::size_t offset) const
+  {
+    char* next = static_cast<char*>(data);
+    while (size != 0)
+    {
+      const ssize_t count = ::pread(fd_, next, size, static_cast<off_t>(offset));
+      if (count < 0 && errno == EINTR)
+      {
+        continue;
+      }
+      if (count <= 0)
+      {
+        return false;
+      }
+      next += count;
+      size -= static_cast<std::size_t>(count);
+      offset += static_cast<std::size_t>(count);
+    }
+    return true;
+  }
+
+  /// Make written data durable.
+  void sync() const
+  {
+    if (!try_sync())
+    {
+      throw error("Unable to sync file.");
+    }
+  }
+
+  /// Make written data durable, returning false on failure.
+  bool try_sync() const
+  {
+#if defined(__APPLE__)
+    return ::fsync(fd_) == 0;
+#else
+    return ::fdatasync(fd_) == 0;
+#endif
+  }
+
+private:
+  file_descriptor(const file_descriptor&);
+  file_descriptor& operator=(const file_descriptor&);
+
+  int fd_;
+};
+
+/**
+ * A whole file mapped into memory. The mapping is private, so pages that
+ * are written are copied and the file is never modified.
+ */
+class mapped_file
+{
+public:
+  /**
+   * Map a file.
+   *
+   * \param path The file to map.
+   * \param writable Whether the mapping may be written, copying pages on write.
+   */
+  mapped_file(const std::string& path, bool writable = false)
+    : data_(nullptr)
+    , size_(0)
+  {
+    file_descriptor file(path, O_RDONLY);
+    size_ = file.size();
+    if (size_ == 0)
+    {
+      return;
+    }
+    void* data = ::mmap(
+      nullptr, size_, writable ? PROT_READ | PROT_WRITE : PROT_READ,
+      MAP_PRIVATE, file.get(), 0);
+    if (data == MAP_FAILED)
+    {
+      throw error("Unable to map file.");
+    }
+    data_ = static_cast<unsigned char*>(data);
+  }
+
+  ~mapped_file()
+  {
+    if (data_ != nullptr)
+    {
+      ::munmap(data_, size_);
+    }
+  }
+
+  /// Hint that the file will be read from start to end.
+  void advise_sequential() const
+  {
+    if (data_ != nullptr)
+    {
+      ::madvise(data_, size_, MADV_SEQUENTIAL);
+    }
+  }
+
+  unsigned char* data() const
+  {
+    return data_;
+  }
+
+  std::size_t size() const
+  {
+    return size_;
+  }
+
+private:
+  mapped_file(const mapped_file&);
+  mapped_file& operator=(const mapped_file&);
+
+  unsigned char* data_;
+  std::size_t size_;
+};
+
+}
+
+}
+
+#endif // STATELESS_DETAIL_POSIX_FILE_HPP
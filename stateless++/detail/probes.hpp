@@ -0,0 +1,146 @@
+/**
+ * Copyright 2013 Matt Mason
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#ifndef STATELESS_DETAIL_PROBES_HPP
+#define STATELESS_DETAIL_PROBES_HPP
+
+#include <cstdint>
+#include <type_traits>
+
+/**
+ * USDT (statically defined tracing) probes for tools such as bpftrace and
+ * perf, compiled in when STATELESS_ENABLE_PROBES is defined. Each probe is
+ * a single nop plus an ELF note in the provider "stateless", so it costs
+ * next to nothing until a tracer attaches. <sys/sdt.h> is used where it is
+ * available; otherwise the notes are emitted directly on x86-64 and
+ * AArch64 ELF targets with GCC or Clang, and elsewhere probes compile to
+ * nothing. Every argument is passed as a 64-bit integer; see probe_value().
+ */
+
+#if defined(STATELESS_ENABLE_PROBES) && defined(__has_include)
+#if __has_include(<sys/sdt.h>)
+#include <sys/sdt.h>
+#define STATELESS_PROBES_USE_SDT_H
+#endif
+#endif
+
+#if defined(STATELESS_PROBES_USE_SDT_H)
+
+#define STATELESS_PROBE3(name, p1, p2, p3) \
+  DTRACE_PROBE3(stateless, name, \
+    ::stateless::detail::probe_value(p1), \
+    ::stateless::detail::probe_value(p2), \
+    ::stateless::detail::probe_value(p3))
+
+#define STATELESS_PROBE4(name, p1, p2, p3, p4) \
+  DTRACE_PROBE4(stateless, name, \
+    ::stateless::detail::probe_value(p1), \
+    ::stateless::detail::probe_value(p2), \
+    ::stateless::detail::probe_value(p3), \
+    ::stateless::detail::probe_value(p4))
+
+#elif defined(STATELESS_ENABLE_PROBES) && defined(__GNUC__) && defined(__ELF__) \
+  && (defined(__x86_64__) || defined(__aarch64__))
+
+// The note layout is version 3 of the SystemTap SDT format, as written by
+// <sys/sdt.h>: the probe address, the address of _.stapsdt.base (to
+// detect prelinking), a zero semaphore address, then the provider, probe
+// name and argument descriptions. "8@" describes an unsigned 64-bit value.
+#define STATELESS_PROBE_ASM_(name, arguments) \
+  "990: nop\n" \
+  ".pushsection .note.stapsdt,\"?\",\"note\"\n" \
+  ".balign 4\n" \
+  ".4byte 992f-991f, 994f-993f, 3\n" \
+  "991: .asciz \"stapsdt\"\n" \
+  "992: .balign 4\n" \
+  "993: .8byte 990b\n" \
+  ".8byte _.stapsdt.base\n" \
+  ".8byte 0\n" \
+  ".asciz \"stateless\"\n" \
+  ".asciz \"" #name "\"\n" \
+  ".asciz \"" arguments "\"\n" \
+  "994: .balign 4\n" \
+  ".popsection\n" \
+  ".ifndef _.stapsdt.base\n" \
+  ".pushsection .stapsdt.base,\"aG\",\"progbits\",.stapsdt.base,comdat\n" \
+  ".weak _.stapsdt.base\n" \
+  ".hidden _.stapsdt.base\n" \
+  "_.stapsdt.base: .space 1\n" \
+  ".size _.stapsdt.base, 1\n" \
+  ".popsection\n" \
+  ".endif\n"
+
+#define STATELESS_PROBE3(name, p1, p2, p3) \
+  __asm__ __volatile__ ( \
+    STATELESS_PROBE_ASM_(name, "8@%[a1] 8@%[a2] 8@%[a3]") \
+    : \
+    : [a1] "nor" (::stateless::detail::probe_value(p1)), \
+      [a2] "nor" (::stateless::detail::probe_value(p2)), \
+      [a3] "nor" (::stateless::detail::probe_value(p3)))
+
+#define STATELESS_PROBE4(name, p1, p2, p3, p4) \
+  __asm__ __volatile__ ( \
+    STATELESS_PROBE_ASM_(name, "8@%[a1] 8@%[a2] 8@%[a3] 8@%[a4]") \
+    : \
+    : [a1] "nor" (::stateless::detail::probe_value(p1)), \
+      [a2] "nor" (::stateless::detail::probe_value(p2)), \
+      [a3] "nor" (::stateless::detail::probe_value(p3)), \
+      [a4] "nor" (::stateless::detail::probe_value(p4)))
+
+#else
+
+#define STATELESS_PROBE3(name, p1, p2, p3)
+#define STATELESS_PROBE4(name, p1, p2, p3, p4)
+
+#endif
+
+namespace stateless
+{
+
+namespace detail
+{
+
+/// Integers and enums are passed to probes by value.
+template<typename T>
+inline typename std::enable_if<std::is_integral<T>::value || std::is_enum<T>::value, std::uint64_t>::type
+probe_value(const T& value)
+{
+  return static_cast<std::uint64_t>(value);
+}
+
+/// Other states and triggers are passed by address.
+template<typename T>
+inline typename std::enable_if<
+  !std::is_integral<T>::value && !std::is_enum<T>::value && !std::is_pointer<T>::value,
+  std::uint64_t>::type
+probe_value(const T& value)
+{
+  return static_cast<std::uint64_t>(reinterpret_cast<std::uintptr_t>(&value));
+}
+
+/// Pointers, such as the address of an instance, are passed unchanged.
+template<typename T>
+inline std::uint64_t probe_value(T* value)
+{
+  return static_cast<std::uint64_t>(reinterpret_cast<std::uintptr_t>(value));
+}
+
+}
+
+}
+
+#endif // STATELESS_DETAIL_PROBES_HPP
@@ -18,6 +18,7 @@
 #define STATELESS_DETAIL_STATE_REPRESENTATION_HPP
 
 #include <algorithm>
+#include <cstdint>
 #include <map>
 #include <memory>
 #include <set>
@@ -25,6 +26,8 @@
 #include <vector>
 
 #include "../error.hpp"
+#include "../memory_usage.hpp"
+#include "../timer_scheduler.hpp"
 #include "transition.hpp"
 #include "trigger_behaviour.hpp"
 
@@ -37,6 +40,12 @@ namespace detail
 class abstract_entry_action
 {
 public:
+  /// Bytes of the action object, including its closure.
+  virtual std::size_t object_size() const = 0;
+
+  /// Bytes of the closure the action object holds.
+  virtual std::size_t closure_size() const = 0;
+
   virtual ~abstract_entry_action() = 0;
 };
 
@@ -49,7 +58,17 @@ struct entry_action : public abstract_entry_action
   entry_action(const std::function<void(const TTransition&, TArgs...)>& action)
     : execute(action)
   {}
-  
+
+  std::size_t object_size() const
+  {
+    return sizeof(*this);
+  }
+
+  std::size_t closure_size() const
+  {
+    return sizeof(execute);
+  }
+
   std::function<void(const TTransition&, TArgs...)> execute;
 };
   
@@ -61,14 +80,21 @@ public:
   typedef std::shared_ptr<abstract_trigger_behaviour> TTriggerBehaviour;
   typedef std::shared_ptr<abstract_entry_action> TEntryAction;
   typedef std::function<void(const TTransition&)> TExitAction;
+  typedef std::pair<timer_scheduler::TDuration, TTrigger> TTimedTrigger;
+  typedef std::function<void(const state_representation&)> TTimerAction;
 
   state_representation(const TState& state)
     : state_(state)
     , trigger_behaviours_()
     , entry_actions_()
     , exit_actions_()
+    , timed_triggers_()
+    , arm_timers_()
+    , disarm_timers_()
     , super_state_(nullptr)
     , sub_states_()
+    , is_first_match_(false)
+    , has_async_actions_(false)
   {}
 
   bool can_handle(const TTrigger& trigger) const
@@ -78,14 +104,79 @@ public:
 
   const TTriggerBehaviour try_find_handler(const TTrigger& trigger) const
   {
-    auto handler = try_find_local_hander(trigger);
+    return try_find_handler(
+      trigger,
+      [](const abstract_trigger_behaviour& candidate)
+      {
+        return candidate.is_condition_met();
+      });
+  }
+
+  /**
+   * Find the handler for a trigger, evaluating guards through the supplied
+   * function so that the caller can observe them.
+   *
+   * \param trigger The trigger.
+   * \param evaluate_guard Called with each candidate behaviour; returns whether its guard is met.
+   */
+  template<typename TGuardEvaluator>
+  const TTriggerBehaviour try_find_handler(const TTrigger& trigger, TGuardEvaluator evaluate_guard) const
+  {
+    auto handler = try_find_local_hander(trigger, evaluate_guard);
     if (handler == nullptr && super_state_ != nullptr)
     {
-      handler = super_state_->try_find_handler(trigger);
+      handler = super_state_->try_find_handler(trigger, evaluate_guard);
     }
     return handler;
   }
 
+  /**
+   * The behaviours that may handle a trigger: those of the nearest state,
+   * starting with this one and moving up through the super states, that
+   * has any configured for it.
+   *
+   * \return The candidates, or nullptr if no state in the hierarchy handles the trigger.
+   */
+  const std::vector<TTriggerBehaviour>* find_candidates(const TTrigger& trigger) const
+  {
+    auto candidates = trigger_behaviours_.find(trigger);
+    if (candidates != trigger_behaviours_.end())
+    {
+      return &candidates->second;
+    }
+    return super_state_ == nullptr ? nullptr : super_state_->find_candidates(trigger);
+  }
+
+  /// Whether entering via the supplied transition would execute any entry actions.
+  bool has_entry_actions_for(const TTransition& transition) const
+  {
+    if (transition.is_reentry())
+    {
+      return !entry_actions_.empty();
+    }
+    if (includes(transition.source()))
+    {
+      return false;
+    }
+    return !entry_actions_.empty() ||
+      (super_state_ != nullptr && super_state_->has_entry_actions_for(transition));
+  }
+
+  /// Whether leaving via the supplied transition would execute any exit actions.
+  bool has_exit_actions_for(const TTransition& transition) const
+  {
+    if (transition.is_reentry())
+    {
+      return !exit_actions_.empty();
+    }
+    if (includes(transition.destination()))
+    {
+      return false;
+    }
+    return !exit_actions_.empty() ||
+      (super_state_ != nullptr && super_state_->has_exit_actions_for(transition));
+  }
+
   template<typename TCallable, typename... TArgs>
   void add_entry_action(TCallable action)
   {
@@ -119,12 +210,55 @@ public:
     exit_actions_.push_back(exit_action);
   }
 
+  /**
+   * Add a trigger to fire once the state has been occupied for a delay.
+   *
+   * \param delay The delay.
+   * \param trigger The trigger.
+   * \param arm Called on entry to schedule the state's timed triggers.
+   * \param disarm Called on exit to cancel them.
+   */
+  void add_timed_trigger(
+    timer_scheduler::TDuration delay,
+    const TTrigger& trigger,
+    const TTimerAction& arm,
+    const TTimerAction& disarm)
+  {
+    timed_triggers_.push_back(std::make_pair(delay, trigger));
+    arm_timers_ = arm;
+    disarm_timers_ = disarm;
+  }
+
+  const std::vector<TTimedTrigger>& timed_triggers() const
+  {
+    return timed_triggers_;
+  }
+
+  /// Record that some of the state's actions run on the executor.
+  void add_async_actions()
+  {
+    has_async_actions_ = true;
+  }
+
+  bool has_async_actions() const
+  {
+    return has_async_actions_;
+  }
+
+  /// Stop arming timed triggers on entry, for copies that have no timers.
+  void detach_timers()
+  {
+    arm_timers_ = nullptr;
+    disarm_timers_ = nullptr;
+  }
+
   template<typename... TArgs>
   void enter(const TTransition& transition, TArgs&&... args) const
   {
     if (transition.is_reentry())
     {
       execute_entry_actions(transition, std::forward<TArgs>(args)...);
+      arm_timers();
     }
     else if (!includes(transition.source()))
     {
@@ -133,6 +267,7 @@ public:
         super_state_->enter(transition, std::forward<TArgs>(args)...);
       }
       execute_entry_actions(transition, std::forward<TArgs>(args)...);
+      arm_timers();
     }
   }
 
@@ -140,10 +275,12 @@ public:
   {
     if (transition.is_reentry())
     {
+      disarm_timers();
       execute_exit_actions(transition);
     }
     else if (!includes(transition.destination()))
     {
+      disarm_timers();
       execute_exit_actions(transition);
       if (super_state_ != nullptr)
       {
@@ -162,6 +299,16 @@ public:
     return *super_state_;
   }
 
+  bool has_super_state() const
+  {
+    return super_state_ != nullptr;
+  }
+
+  const std::map<TTrigger, std::vector<TTriggerBehaviour>>& trigger_behaviours() const
+  {
+    return trigger_behaviours_;
+  }
+
   void set_super_state(const state_representation* super_state)
   {
     super_state_ = super_state;
@@ -177,6 +324,54 @@ public:
     sub_states_.push_back(sub_state);
   }
 
+  /**
+   * Point the super and sub state links at the equivalent representations
+   * in another collection, after this representation has been copied into it.
+   */
+  template<typename TLookup>
+  void relink(TLookup lookup)
+  {
+    if (super_state_ != nullptr)
+    {
+      super_state_ = lookup(super_state_->underlying_state());
+    }
+    for (auto& sub_state : sub_states_)
+    {
+      sub_state = lookup(sub_state->underlying_state());
+    }
+  }
+
+  /**
+   * Order each trigger's candidate behaviours by rank, highest first, and
+   * from then on stop at the first candidate whose guard is met instead of
+   * checking that no other guard is. Candidates of equal rank keep their
+   * configured order.
+   *
+   * \param rank Called with a trigger and a candidate behaviour; returns its rank.
+   */
+  template<typename TRank>
+  void prioritize(TRank rank)
+  {
+    for (auto& candidates : trigger_behaviours_)
+    {
+      std::vector<std::pair<std::uint64_t, TTriggerBehaviour>> ranked;
+      for (auto& candidate : candidates.second)
+      {
+        ranked.push_back(std::make_pair(rank(candidates.first, *candidate), candidate));
+      }
+      std::stable_sort(ranked.begin(), ranked.end(),
+        [](const std::pair<std::uint64_t, TTriggerBehaviour>& a, const std::pair<std::uint64_t, TTriggerBehaviour>& b)
+        {
+          return a.first > b.first;
+        });
+      for (std::size_t i = 0; i < ranked.size(); ++i)
+      {
+        candidates.second[i] = ranked[i].second;
+      }
+    }
+    is_first_match_ = true;
+  }
+
   bool includes(const TState& state) const
   {
     if (state == state_)
@@ -227,8 +422,47 @@ public:
     return local;
   }
 
+  /**
+   * Add the bytes used by the representation and the behaviours and actions
+   * it holds, other than those already seen.
+   *
+   * \param usage Receives the bytes.
+   * \param seen Shared objects already counted, which are not counted again.
+   */
+  void add_memory_usage(memory_usage& usage, std::set<const void*>& seen) const
+  {
+    const std::size_t timer_closures = sizeof(arm_timers_) + sizeof(disarm_timers_);
+    usage.representations += sizeof(*this) - timer_closures +
+      capacity_bytes(timed_triggers_) + capacity_bytes(sub_states_);
+    usage.closures += timer_closures;
+    for (auto& candidates : trigger_behaviours_)
+    {
+      usage.behaviours += sizeof(candidates) + map_node_overhead + capacity_bytes(candidates.second);
+      for (auto& candidate : candidates.second)
+      {
+        if (seen.insert(candidate.get()).second)
+        {
+          usage.behaviours += candidate->object_size() - candidate->closure_size() + shared_control_block_size;
+          usage.closures += candidate->closure_size();
+        }
+      }
+    }
+    usage.actions += capacity_bytes(entry_actions_);
+    for (auto& action : entry_actions_)
+    {
+      if (seen.insert(action.get()).second)
+      {
+        usage.actions += action->object_size() - action->closure_size() + shared_control_block_size;
+        usage.closures += action->closure_size();
+      }
+    }
+    usage.actions += capacity_bytes(exit_actions_) - exit_actions_.size() * sizeof(TExitAction);
+    usage.closures += exit_actions_.size() * sizeof(TExitAction);
+  }
+
 private:
-  const TTriggerBehaviour try_find_local_hander(const TTrigger& trigger) const
+  template<typename TGuardEvaluator>
+  const TTriggerBehaviour try_find_local_hander(const TTrigger& trigger, TGuardEvaluator& evaluate_guard) const
   {
     TTriggerBehaviour result = nullptr;
 
@@ -240,7 +474,7 @@ private:
 
     for (auto& candidate : candidates->second)
     {
-      if (candidate->is_condition_met())
+      if (evaluate_guard(*candidate))
       {
         if (result != nullptr)
         {
@@ -250,6 +484,10 @@ private:
             "clauses must be mutually exclusive.");
         }
         result = candidate;
+        if (is_first_match_)
+        {
+          break;
+        }
       }
     }
 
@@ -268,6 +506,22 @@ private:
     }
   }
 
+  void arm_timers() const
+  {
+    if (arm_timers_)
+    {
+      arm_timers_(*this);
+    }
+  }
+
+  void disarm_timers() const
+  {
+    if (disarm_timers_)
+    {
+      disarm_timers_(*this);
+    }
+  }
+
   void execute_exit_actions(const TTransition& transition) const
   {
     for (auto& action : exit_actions_)
@@ -281,9 +535,18 @@ private:
   std::map<TTrigger, std::vector<TTriggerBehaviour>> trigger_behaviours_;
   std::vector<TEntryAction> entry_actions_;
   std::vector<TExitAction> exit_actions_;
+  std::vector<TTimedTrigger> timed_triggers_;
+  TTimerAction arm_timers_;
+  TTimerAction disarm_timers_;
 
   const state_representation* super_state_;
   std::vector<const state_representation*> sub_states_;
+
+  /// Whether the first candidate whose guard is met handles a trigger; see prioritize().
+  bool is_first_match_;
+
+  /// Whether any entry or exit action was configured with on_entry_async() or on_exit_async().
+  bool has_async_actions_;
 };
 
 }
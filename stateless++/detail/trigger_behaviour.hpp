@@ -17,9 +17,12 @@
 #ifndef STATELESS_DETAIL_TRIGGER_BEHAVIOUR_HPP
 #define STATELESS_DETAIL_TRIGGER_BEHAVIOUR_HPP
 
+#include <cstddef>
 #include <functional>
+#include <memory>
 
 #include "../error.hpp"
+#include "no_guard.hpp"
 
 namespace stateless
 {
@@ -34,6 +37,7 @@ public:
 
   abstract_trigger_behaviour(const TGuard& guard)
     : guard_(guard)
+    , is_guarded_(is_guard(guard))
   {}
 
   bool is_condition_met() const
@@ -41,10 +45,33 @@ public:
     return guard_();
   }
 
+  /// True unless the guard is the no-op guard used for unconditional behaviours.
+  bool is_guarded() const
+  {
+    return is_guarded_;
+  }
+
+  /// Bytes of the behaviour object, including the closures it holds.
+  virtual std::size_t object_size() const = 0;
+
+  /// Bytes of the closures the behaviour object holds.
+  virtual std::size_t closure_size() const
+  {
+    return sizeof(TGuard);
+  }
+
   virtual ~abstract_trigger_behaviour() = 0;
 
 private:
+  static bool is_guard(const TGuard& guard)
+  {
+    typedef bool (*TGuardFunction)();
+    auto function = guard.target<TGuardFunction>();
+    return function == nullptr || *function != &no_guard;
+  }
+
   TGuard guard_;
+  bool is_guarded_;
 };
 
 inline abstract_trigger_behaviour::~abstract_trigger_behaviour()
@@ -81,6 +108,16 @@ public:
     return decision_(source, destination);
   }
 
+  std::size_t object_size() const
+  {
+    return sizeof(*this);
+  }
+
+  std::size_t closure_size() const
+  {
+    return abstract_trigger_behaviour::closure_size() + sizeof(TDecision);
+  }
+
   trigger_behaviour(
     const TTrigger& trigger,
     const abstract_trigger_behaviour::TGuard& guard)
@@ -93,6 +130,64 @@ private:
   TDecision decision_;
 };
 
+/**
+ * Behaviour that transitions to a destination fixed at configuration time.
+ */
+template<typename TState, typename TTrigger>
+class transitioning_trigger_behaviour
+  : public trigger_behaviour<TState, TTrigger>
+{
+public:
+  transitioning_trigger_behaviour(
+    const TTrigger& trigger,
+    const abstract_trigger_behaviour::TGuard& guard,
+    const TState& destination)
+    : trigger_behaviour<TState, TTrigger>(
+        trigger,
+        guard,
+        [=](const TState&, TState& result) -> bool
+        {
+          result = destination;
+          return true;
+        })
+    , destination_(destination)
+  {}
+
+  const TState& destination() const
+  {
+    return destination_;
+  }
+
+  std::size_t object_size() const
+  {
+    return sizeof(*this);
+  }
+
+private:
+  const TState destination_;
+};
+
+/**
+ * Behaviour that accepts a trigger without a transition.
+ */
+template<typename TState, typename TTrigger>
+class ignored_trigger_behaviour
+  : public trigger_behaviour<TState, TTrigger>
+{
+public:
+  ignored_trigger_behaviour(
+    const TTrigger& trigger,
+    const abstract_trigger_behaviour::TGuard& guard)
+    : trigger_behaviour<TState, TTrigger>(
+        trigger,
+        guard,
+        [](const TState&, TState&) -> bool
+        {
+          return false;
+        })
+  {}
+};
+
 template<typename TState, typename TTrigger, typename... TArgs>
 class dynamic_trigger_behaviour
   : public trigger_behaviour<TState, TTrigger>
@@ -114,10 +209,48 @@ public:
     return true;
   }
 
+  std::size_t object_size() const
+  {
+    return sizeof(*this);
+  }
+
+  std::size_t closure_size() const
+  {
+    return trigger_behaviour<TState, TTrigger>::closure_size() + sizeof(TDecision);
+  }
+
 private:
   TDecision decision_;
 };
 
+/**
+ * Determine the destination of a trigger given the handler found for it.
+ * Arguments are forwarded to dynamic behaviours; static behaviours ignore them.
+ *
+ * \return True if the trigger results in a transition, false if it is ignored.
+ */
+template<typename TState, typename TTrigger, typename... TArgs>
+bool results_in_transition_from(
+  const std::shared_ptr<abstract_trigger_behaviour>& abstract_handler,
+  const TState& source,
+  TState& destination,
+  TArgs&&... args)
+{
+  typedef dynamic_trigger_behaviour<TState, TTrigger, TArgs...> TDynamicTriggerBehaviour;
+  typedef trigger_behaviour<TState, TTrigger> TTriggerBehaviour;
+  if (auto handler = std::dynamic_pointer_cast<TDynamicTriggerBehaviour>(abstract_handler))
+  {
+    // A dynamic behaviour is configured, so forward the arguments to it.
+    return handler->results_in_transition_from(source, destination, std::forward<TArgs>(args)...);
+  }
+  else if (auto handler = std::dynamic_pointer_cast<TTriggerBehaviour>(abstract_handler))
+  {
+    // Fall back to configuration time defined transition.
+    return handler->results_in_transition_from(source, destination);
+  }
+  throw error("Unable to find a suitable handler.");
+}
+
 }
 
 }
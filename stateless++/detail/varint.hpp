@@ -0,0 +1,136 @@
+/**
+ * Copyright 2013 Matt Mason
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#ifndef STATELESS_DETAIL_VARINT_HPP
+#define STATELESS_DETAIL_VARINT_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include "../error.hpp"
+
+namespace stateless
+{
+
+namespace detail
+{
+
+/// Append an unsigned integer in LEB128 form: seven bits per byte, low bits first.
+inline void put_varint(std::vector<unsigned char>& out, std::uint64_t value)
+{
+  while (value >= 0x80)
+  {
+    out.push_back(static_cast<unsigned char>(value | 0x80));
+    value >>= 7;
+  }
+  out.push_back(static_cast<unsigned char>(value));
+}
+
+/**
+ * Read an unsigned integer in LEB128 form.
+ *
+ * \param next The position to read from, advanced past the integer.
+ * \param end The end of the readable bytes.
+ *
+ * \throw error The integer is truncated or too long.
+ */
+inline std::uint64_t get_varint(const unsigned char*& next, const unsigned char* end)
+{
+  std::uint64_t value = 0;
+  for (unsigned shift = 0; shift < 64; shift += 7)
+  {
+    if (next == end)
+    {
+      break;
+    }
+    const unsigned char byte = *next++;
+    value |= static_cast<std::uint64_t>(byte & 0x7F) << shift;
+    if ((byte & 0x80) == 0)
+    {
+      return value;
+    }
+  }
+  throw error("Malformed variable length integer.");
+}
+
+/// Map signed integers to unsigned ones so that small magnitudes stay small.
+inline std::uint64_t zigzag_encode(std::int64_t value)
+{
+  return (static_cast<std::uint64_t>(value) << 1) ^ static_cast<std::uint64_t>(value >> 63);
+}
+
+inline std::int64_t zigzag_decode(std::uint64_t value)
+{
+  return static_cast<std::int64_t>(value >> 1) ^ -static_cast<std::int64_t>(value & 1);
+}
+
+/// CRC-32 (IEEE 802.3) of a buffer, eight bytes at a time.
+inline std::uint32_t crc32(const void* data, std::size_t size)
+{
+  struct table
+  {
+    table()
+    {
+      for (std::uint32_t i = 0; i < 256; ++i)
+      {
+        std::uint32_t c = i;
+        for (int k = 0; k < 8; ++k)
+        {
+          c = (c & 1) != 0 ? 0xEDB88320u ^ (c >> 1) : c >> 1;
+        }
+        entries[0][i] = c;
+      }
+      // entries[k][i] is the CRC of byte i followed by k zero bytes.
+      for (std::uint32_t i = 0; i < 256; ++i)
+      {
+        for (int k = 1; k < 8; ++k)
+        {
+          const std::uint32_t c = entries[k - 1][i];
+          entries[k][i] = (c >> 8) ^ entries[0][c & 0xFF];
+        }
+      }
+    }
+
+    std::uint32_t entries[8][256];
+  };
+  static const table crc_table;
+  const auto& t = crc_table.entries;
+
+  const unsigned char* bytes = static_cast<const unsigned char*>(data);
+  std::uint32_t crc = 0xFFFFFFFFu;
+  for (; size >= 8; bytes += 8, size -= 8)
+  {
+    const std::uint32_t low = crc ^ (std::uint32_t(bytes[0]) | std::uint32_t(bytes[1]) << 8 |
+      std::uint32_t(bytes[2]) << 16 | std::uint32_t(bytes[3]) << 24);
+    const std::uint32_t high = std::uint32_t(bytes[4]) | std::uint32_t(bytes[5]) << 8 |
+      std::uint32_t(bytes[6]) << 16 | std::uint32_t(bytes[7]) << 24;
+    crc = t[7][low & 0xFF] ^ t[6][(low >> 8) & 0xFF] ^ t[5][(low >> 16) & 0xFF] ^ t[4][low >> 24] ^
+      t[3][high & 0xFF] ^ t[2][(high >> 8) & 0xFF] ^ t[1][(high >> 16) & 0xFF] ^ t[0][high >> 24];
+  }
+  for (; size != 0; ++bytes, --size)
+  {
+    crc = t[0][(crc ^ *bytes) & 0xFF] ^ (crc >> 8);
+  }
+  return crc ^ 0xFFFFFFFFu;
+}
+
+}
+
+}
+
+#endif // STATELESS_DETAIL_VARINT_HPP
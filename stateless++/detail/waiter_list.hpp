@@ -0,0 +1,188 @@
+/**
+ * Copyright 2013 Matt Mason
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef STATELESS_DETAIL_WAITER_LIST_HPP
+#define STATELESS_DETAIL_WAITER_LIST_HPP
+
+namespace stateless
+{
+
+namespace detail
+{
+
+template<typename TTransition>
+class waiter_list;
+
+/**
+ * Intrusive node for something waiting on state machine transitions.
+ * The node is owned by the waiter, so waiting never allocates.
+ */
+template<typename TTransition>
+class waiter
+{
+public:
+  waiter()
+    : prev_(nullptr)
+    , next_(nullptr)
+    , owner_(nullptr)
+  {}
+
+  /// Whether the waiter should be notified of the completed transition.
+  virtual bool is_ready(const TTransition& transition) const = 0;
+
+  /// Called once the waiter has been removed from its list.
+  virtual void notify(const TTransition& transition) = 0;
+
+  bool is_waiting() const
+  {
+    return owner_ != nullptr;
+  }
+
+protected:
+  ~waiter()
+  {
+    if (owner_ != nullptr)
+    {
+      owner_->remove(*this);
+    }
+  }
+
+private:
+  friend class waiter_list<TTransition>;
+
+  waiter(const waiter&);
+  waiter& operator=(const waiter&);
+
+  waiter* prev_;
+  waiter* next_;
+  waiter_list<TTransition>* owner_;
+};
+
+/**
+ * Doubly linked list of waiters with constant time insertion and removal.
+ */
+template<typename TTransition>
+class waiter_list
+{
+public:
+  typedef waiter<TTransition> TWaiter;
+
+  waiter_list()
+    : head_(nullptr)
+    , tail_(nullptr)
+  {}
+
+  /// Waiters belong to the original list, so a copy starts empty.
+  waiter_list(const waiter_list&)
+    : head_(nullptr)
+    , tail_(nullptr)
+  {}
+
+  waiter_list& operator=(const waiter_list&)
+  {
+    return *this;
+  }
+
+  ~waiter_list()
+  {
+    while (head_ != nullptr)
+    {
+      remove(*head_);
+    }
+  }
+
+  bool empty() const
+  {
+    return head_ == nullptr;
+  }
+
+  void push_back(TWaiter& w)
+  {
+    w.prev_ = tail_;
+    w.next_ = nullptr;
+    w.owner_ = this;
+    if (tail_ != nullptr)
+    {
+      tail_->next_ = &w;
+    }
+    else
+    {
+      head_ = &w;
+    }
+    tail_ = &w;
+  }
+
+  void remove(TWaiter& w)
+  {
+    if (w.prev_ != nullptr)
+    {
+      w.prev_->next_ = w.next_;
+    }
+    else
+    {
+      head_ = w.next_;
+    }
+    if (w.next_ != nullptr)
+    {
+      w.next_->prev_ = w.prev_;
+    }
+    else
+    {
+      tail_ = w.prev_;
+    }
+    w.prev_ = w.next_ = nullptr;
+    w.owner_ = nullptr;
+  }
+
+  /**
+   * Notify every waiter that is ready for the supplied transition.
+   *
+   * Ready waiters are moved to a local list before any is notified, so a
+   * notified waiter may safely add or remove waiters, including itself.
+   * Waiters added during notification are not considered until the next
+   * transition.
+   */
+  void notify_ready(const TTransition& transition)
+  {
+    waiter_list ready;
+    for (TWaiter* w = head_; w != nullptr; )
+    {
+      TWaiter* next = w->next_;
+      if (w->is_ready(transition))
+      {
+        remove(*w);
+        ready.push_back(*w);
+      }
+      w = next;
+    }
+    while (!ready.empty())
+    {
+      TWaiter& w = *ready.head_;
+      ready.remove(w);
+      w.notify(transition);
+    }
+  }
+
+private:
+  TWaiter* head_;
+  TWaiter* tail_;
+};
+
+}
+
+}
+
+#endif // STATELESS_DETAIL_WAITER_LIST_HPP
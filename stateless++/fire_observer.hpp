@@ -0,0 +1,277 @@
+/**
+ * Copyright 2013 Matt Mason
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#ifndef STATELESS_FIRE_OBSERVER_HPP
+#define STATELESS_FIRE_OBSERVER_HPP
+
+#include <cstddef>
+#include <ostream>
+#include <tuple>
+#include <type_traits>
+#include <typeinfo>
+
+#include "detail/transition.hpp"
+
+/**
+ * Report an event to a fire_observer, if one is set. The calls are compiled
+ * only when STATELESS_ENABLE_INSTRUMENTATION is defined, which must be done
+ * consistently across a program.
+ */
+#ifdef STATELESS_ENABLE_INSTRUMENTATION
+#define STATELESS_OBSERVE(observer, event) \
+  do { if ((observer) != nullptr) { (observer)->event; } } while (false)
+#else
+#define STATELESS_OBSERVE(observer, event) \
+  do {} while (false)
+#endif
+
+namespace stateless
+{
+
+/**
+ * The arguments a trigger was fired with, for observers. They are only
+ * valid during the call that reports them.
+ */
+class fire_arguments
+{
+public:
+  /// The number of arguments.
+  virtual std::size_t size() const = 0;
+
+  /**
+   * Write an argument to a stream with operator<<, or "?" if its type has none.
+   *
+   * \param os The stream.
+   * \param index The index of the argument.
+   */
+  virtual void print(std::ostream& os, std::size_t index) const = 0;
+
+  /**
+   * Access an argument by type.
+   *
+   * \param index The index of the argument.
+   *
+   * \return The argument, or nullptr if it is not of type T.
+   */
+  template<typename T>
+  const T* get(std::size_t index) const
+  {
+    return static_cast<const T*>(find(index, typeid(T)));
+  }
+
+protected:
+  ~fire_arguments()
+  {}
+
+  /// The argument at an index if its type is the supplied one, and otherwise nullptr.
+  virtual const void* find(std::size_t index, const std::type_info& type) const = 0;
+};
+
+namespace detail
+{
+
+template<typename T>
+auto print_argument(std::ostream& os, const T& value, int) -> decltype(os << value, void())
+{
+  os << value;
+}
+
+template<typename T>
+void print_argument(std::ostream& os, const T&, long)
+{
+  os << '?';
+}
+
+/// Calls a visitor with the element of a tuple at a run time index.
+template<std::size_t I, std::size_t N, typename TTuple>
+struct visit_element
+{
+  template<typename TVisitor>
+  static void visit(const TTuple& tuple, std::size_t index, TVisitor& visitor)
+  {
+    if (index == I)
+    {
+      visitor(std::get<I>(tuple));
+    }
+    else
+    {
+      visit_element<I + 1, N, TTuple>::visit(tuple, index, visitor);
+    }
+  }
+};
+
+template<std::size_t N, typename TTuple>
+struct visit_element<N, N, TTuple>
+{
+  template<typename TVisitor>
+  static void visit(const TTuple&, std::size_t, TVisitor&)
+  {}
+};
+
+/// The fire_arguments of a fire with arguments of the supplied types, held by reference.
+template<typename... TArgs>
+class fire_arguments_of : public fire_arguments
+{
+public:
+  fire_arguments_of(const TArgs&... args)
+    : arguments_(args...)
+  {}
+
+  virtual std::size_t size() const
+  {
+    return sizeof...(TArgs);
+  }
+
+  virtual void print(std::ostream& os, std::size_t index) const
+  {
+    printer p = { os };
+    visit_element<0, sizeof...(TArgs), TTuple>::visit(arguments_, index, p);
+  }
+
+private:
+  typedef std::tuple<const TArgs&...> TTuple;
+
+  struct printer
+  {
+    std::ostream& os;
+
+    template<typename T>
+    void operator()(const T& value)
+    {
+      print_argument(os, value, 0);
+    }
+  };
+
+  struct finder
+  {
+    const std::type_info& type;
+    const void* result;
+
+    template<typename T>
+    void operator()(const T& value)
+    {
+      result = typeid(T) == type ? &value : nullptr;
+    }
+  };
+
+  virtual const void* find(std::size_t index, const std::type_info& type) const
+  {
+    finder f = { type, nullptr };
+    visit_element<0, sizeof...(TArgs), TTuple>::visit(arguments_, index, f);
+    return f.result;
+  }
+
+  TTuple arguments_;
+};
+
+/// Refer to the arguments of a fire.
+template<typename... TArgs>
+fire_arguments_of<typename std::decay<TArgs>::type...> make_fire_arguments(const TArgs&... args)
+{
+  return fire_arguments_of<typename std::decay<TArgs>::type...>(args...);
+}
+
+}
+
+/**
+ * Receives the progress of each trigger through a state machine, or through
+ * a definition on behalf of an instance store. Only reported when
+ * STATELESS_ENABLE_INSTRUMENTATION is defined.
+ *
+ * A trigger is reported by on_fire() and then either on_unhandled(),
+ * on_ignored() or the sequence on_resolved(), on_exited(),
+ * on_state_changed(), on_entered() and on_transitioned(), with
+ * on_evaluating_guard() and on_guard() around each guard evaluated along
+ * the way. A trigger fired with arguments is also reported by
+ * on_arguments(), straight after on_fire(). Actions may fire further
+ * triggers, whose events nest within those of the trigger that caused them
+ * when they are not queued. Events stop if an action throws, or after
+ * on_fire() if the observer declines the trigger.
+ *
+ * Calls are made on the thread that fires the trigger.
+ *
+ * \tparam TState The type used to represent the states.
+ * \tparam TTrigger The type used to represent the triggers that cause state transitions.
+ */
+template<typename TState, typename TTrigger>
+class fire_observer
+{
+public:
+  /// Parameterized transition type.
+  typedef detail::transition<TState, TTrigger> TTransition;
+
+  virtual ~fire_observer()
+  {}
+
+  /**
+   * A trigger is about to be handled in the source state.
+   *
+   * \return False to receive no further events for this trigger. Triggers
+   *         fired by its actions are still reported.
+   */
+  virtual bool on_fire(const TState& source, const TTrigger& trigger)
+  {
+    return true;
+  }
+
+  /// The trigger being handled was fired with arguments.
+  virtual void on_arguments(const TTrigger& trigger, const fire_arguments& arguments)
+  {}
+
+  /**
+   * A guard of a behaviour that may handle the trigger is about to be
+   * evaluated. Behaviours configured without a guard are not reported.
+   */
+  virtual void on_evaluating_guard(const TState& source, const TTrigger& trigger)
+  {}
+
+  /// A guard of a behaviour that may handle the trigger has been evaluated.
+  virtual void on_guard(const TState& source, const TTrigger& trigger, bool is_met)
+  {}
+
+  /// No behaviour handles the trigger. Called before the unhandled trigger action.
+  virtual void on_unhandled(const TState& source, const TTrigger& trigger)
+  {}
+
+  /// The trigger was accepted without a transition.
+  virtual void on_ignored(const TState& source, const TTrigger& trigger)
+  {}
+
+  /// The handler and destination have been found. No action has run yet.
+  virtual void on_resolved(const TTransition& transition)
+  {}
+
+  /// The exit actions have run.
+  virtual void on_exited(const TTransition& transition)
+  {}
+
+  /// The state has been set. The entry actions are about to run.
+  virtual void on_state_changed(const TTransition& transition)
+  {}
+
+  /// The entry actions have run.
+  virtual void on_entered(const TTransition& transition)
+  {}
+
+  /// The transition action has run and waiters have been notified.
+  virtual void on_transitioned(const TTransition& transition)
+  {}
+};
+
+}
+
+#endif // STATELESS_FIRE_OBSERVER_HPP
@@ -0,0 +1,401 @@
+/**
+ * Copyright 2013 Matt Mason
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#ifndef STATELESS_FIRE_SAMPLER_HPP
+#define STATELESS_FIRE_SAMPLER_HPP
+
+#include <atomic>
+#include <cstdint>
+#include <functional>
+#include <ostream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "clocks.hpp"
+#include "detail/per_thread.hpp"
+#include "fire_observer.hpp"
+
+namespace stateless
+{
+
+/**
+ * Captures the full detail of one in every N triggers fired through the
+ * state machines and instance stores it observes: the outcome, each guard
+ * result, the time taken by each phase and the arguments, and passes it to
+ * a sink.
+ *
+ * Each thread counts down to its next sample from a random interval whose
+ * mean is the sampling rate, so periodic workloads are not aliased. A
+ * trigger that is not sampled costs a decrement and one predictable branch
+ * in on_fire(), which declines it so that none of its later events are
+ * reported. The rate can be changed at any time from any thread; each
+ * thread adopts it when its current interval ends, or within 1024 triggers
+ * if sampling was off.
+ *
+ * Triggers fired by the actions of a sampled trigger are not sampled, so
+ * a sample describes exactly one trigger. The sink is called on the firing
+ * thread, before any unhandled trigger action and after the transition
+ * action.
+ *
+ * Sampling requires STATELESS_ENABLE_INSTRUMENTATION to be defined; see
+ * state_machine::set_observer() and instance_store::set_observer().
+ *
+ * \tparam TState The type used to represent the states.
+ * \tparam TTrigger The type used to represent the triggers that cause state transitions.
+ * \tparam TClock The clock used to time the phases, as for latency_histograms.
+ */
+template<typename TState, typename TTrigger, typename TClock = cycle_clock>
+class fire_sampler : public fire_observer<TState, TTrigger>
+{
+public:
+  /// Parameterized transition type.
+  typedef typename fire_observer<TState, TTrigger>::TTransition TTransition;
+
+  /// A time or duration in ticks of the clock.
+  typedef typename TClock::rep TTicks;
+
+  /// What a sampled trigger led to.
+  enum class outcome
+  {
+    transition,
+    ignored,
+    unhandled
+  };
+
+  /// The detail of a sampled trigger.
+  struct sample
+  {
+    TState source;
+    TTrigger trigger;
+
+    /// The destination of a transition, and otherwise the source.
+    TState destination;
+
+    outcome result;
+
+    /// The result of each guard evaluated, in order.
+    std::vector<bool> guards;
+
+    /// The arguments as written by the formatter, or empty if there were none.
+    std::string arguments;
+
+    /// Time evaluating guards.
+    TTicks guard_ticks;
+
+    /// Time in exit actions.
+    TTicks exit_ticks;
+
+    /// Time in entry actions.
+    TTicks entry_ticks;
+
+    /// Time in the transition action and notifying waiters.
+    TTicks transition_ticks;
+
+    /// Time from on_fire() to the last event.
+    TTicks total_ticks;
+  };
+
+  /// Signature of the function that receives samples.
+  typedef std::function<void(const sample&)> TSink;
+
+  /// Signature of the function that writes the arguments of a sampled trigger.
+  typedef std::function<void(std::ostream&, const TTrigger&, const fire_arguments&)> TFormatter;
+
+  /// Interval after which a thread checks again whether sampling has been turned on.
+  static const std::uint32_t recheck_interval = 1024;
+
+  /**
+   * Construct a sampler.
+   *
+   * \param rate Sample one in this many triggers on average; 1 samples
+   *             every trigger and 0 none.
+   * \param sink Function called with each sample.
+   * \param formatter Function that writes the arguments of a sampled
+   *                  trigger. By default each is written with operator<<,
+   *                  separated by commas.
+   */
+  fire_sampler(std::uint32_t rate, const TSink& sink, const TFormatter& formatter = TFormatter())
+    : rate_(rate)
+    , sink_(sink)
+    , formatter_(formatter ? formatter : TFormatter(&format_arguments))
+    , threads_()
+  {}
+
+  /// Change the sampling rate. See the constructor.
+  void set_rate(std::uint32_t rate)
+  {
+    rate_.store(rate, std::memory_order_relaxed);
+  }
+
+  /// The sampling rate.
+  std::uint32_t rate() const
+  {
+    return rate_.load(std::memory_order_relaxed);
+  }
+
+  virtual bool on_fire(const TState& source, const TTrigger& trigger)
+  {
+    auto& t = threads_.local();
+    if (t.countdown > 1)
+    {
+      --t.countdown;
+      return false;
+    }
+    return start(t, source, trigger);
+  }
+
+  virtual void on_arguments(const TTrigger& trigger, const fire_arguments& arguments)
+  {
+    auto& t = threads_.local();
+    if (!t.is_active || t.nesting != 0)
+    {
+      return;
+    }
+    std::ostringstream os;
+    formatter_(os, trigger, arguments);
+    t.current.arguments = os.str();
+  }
+
+  virtual void on_evaluating_guard(const TState&, const TTrigger&)
+  {
+    auto& t = threads_.local();
+    if (!t.is_active || t.nesting != 0)
+    {
+      return;
+    }
+    t.phase_start = TClock::now();
+  }
+
+  virtual void on_guard(const TState&, const TTrigger&, bool is_met)
+  {
+    auto& t = threads_.local();
+    if (!t.is_active || t.nesting != 0)
+    {
+      return;
+    }
+    t.current.guard_ticks += TClock::now() - t.phase_start;
+    t.current.guards.push_back(is_met);
+  }
+
+  virtual void on_unhandled(const TState&, const TTrigger&)
+  {
+    finish(outcome::unhandled);
+  }
+
+  virtual void on_ignored(const TState&, const TTrigger&)
+  {
+    finish(outcome::ignored);
+  }
+
+  virtual void on_resolved(const TTransition& transition)
+  {
+    auto& t = threads_.local();
+    if (!t.is_active || t.nesting != 0)
+    {
+      return;
+    }
+    t.current.destination = transition.destination();
+    t.phase_start = TClock::now();
+  }
+
+  virtual void on_exited(const TTransition&)
+  {
+    end_phase(&sample::exit_ticks);
+  }
+
+  virtual void on_state_changed(const TTransition&)
+  {
+    auto& t = threads_.local();
+    if (!t.is_active || t.nesting != 0)
+    {
+      return;
+    }
+    t.phase_start = TClock::now();
+  }
+
+  virtual void on_entered(const TTransition&)
+  {
+    end_phase(&sample::entry_ticks);
+  }
+
+  virtual void on_transitioned(const TTransition&)
+  {
+    end_phase(&sample::transition_ticks);
+    finish(outcome::transition);
+  }
+
+private:
+  fire_sampler(const fire_sampler&);
+  fire_sampler& operator=(const fire_sampler&);
+
+  /// Bound on triggers nested in a sample, beyond which it is assumed to be abandoned.
+  static const unsigned max_nesting = 64;
+
+  /// Sampling state of one thread. The sample is reused to avoid allocating.
+  struct thread_sampling
+  {
+    thread_sampling()
+      : countdown(0)
+      , next_countdown(0)
+      , random(0)
+      , is_active(false)
+      , nesting(0)
+      , start(0)
+      , phase_start(0)
+      , current()
+    {}
+
+    /// Triggers until the next sample; 0 while a sample is active or before first use.
+    std::uint32_t countdown;
+
+    /// The countdown to restore when the active sample finishes.
+    std::uint32_t next_countdown;
+
+    std::uint64_t random;
+    bool is_active;
+
+    /// Triggers fired by the actions of the active sample and not yet finished.
+    unsigned nesting;
+
+    TTicks start;
+    TTicks phase_start;
+    sample current;
+  };
+
+  static void format_arguments(std::ostream& os, const TTrigger&, const fire_arguments& arguments)
+  {
+    for (std::size_t i = 0; i < arguments.size(); ++i)
+    {
+      if (i != 0)
+      {
+        os << ", ";
+      }
+      arguments.print(os, i);
+    }
+  }
+
+  /// Draw the next interval, uniform with a mean of the rate.
+  static std::uint32_t draw(thread_sampling& t, std::uint32_t rate)
+  {
+    if (t.random == 0)
+    {
+      // Seed from the thread's own storage, so threads differ.
+      t.random = 0x9E3779B97F4A7C15ULL ^ static_cast<std::uint64_t>(reinterpret_cast<std::uintptr_t>(&t));
+    }
+    t.random ^= t.random << 13;
+    t.random ^= t.random >> 7;
+    t.random ^= t.random << 17;
+    return rate <= 1 ? 1 : 1 + static_cast<std::uint32_t>(t.random % (2 * static_cast<std::uint64_t>(rate) - 1));
+  }
+
+  /**
+   * The slow path of on_fire(): the countdown has ended, or a sample is active.
+   *
+   * \return Whether the trigger is sampled or nested in a sample.
+   */
+  bool start(thread_sampling& t, const TState& source, const TTrigger& trigger)
+  {
+    if (t.is_active)
+    {
+      if (++t.nesting <= max_nesting)
+      {
+        return true;
+      }
+      // Only reached if actions have thrown, abandoning the sample.
+      t.is_active = false;
+      t.countdown = t.next_countdown;
+    }
+    const std::uint32_t rate = rate_.load(std::memory_order_relaxed);
+    if (t.countdown == 0)
+    {
+      // First use by this thread.
+      t.countdown = rate == 0 ? recheck_interval : draw(t, rate);
+      if (t.countdown > 1)
+      {
+        --t.countdown;
+        return false;
+      }
+    }
+    const bool is_sampled = rate != 0;
+    t.countdown = rate == 0 ? recheck_interval : draw(t, rate);
+    if (!is_sampled)
+    {
+      return false;
+    }
+    t.next_countdown = t.countdown;
+    t.countdown = 0;
+    t.is_active = true;
+    t.nesting = 0;
+    t.current.source = source;
+    t.current.trigger = trigger;
+    t.current.destination = source;
+    t.current.guards.clear();
+    t.current.arguments.clear();
+    t.current.guard_ticks = t.current.exit_ticks = t.current.entry_ticks = 0;
+    t.current.transition_ticks = t.current.total_ticks = 0;
+    t.start = TClock::now();
+    t.phase_start = t.start;
+    return true;
+  }
+
+  void end_phase(TTicks sample::*phase)
+  {
+    auto& t = threads_.local();
+    if (!t.is_active || t.nesting != 0)
+    {
+      return;
+    }
+    const TTicks now = TClock::now();
+    t.current.*phase = now - t.phase_start;
+    t.phase_start = now;
+  }
+
+  void finish(outcome result)
+  {
+    auto& t = threads_.local();
+    if (!t.is_active)
+    {
+      return;
+    }
+    if (t.nesting != 0)
+    {
+      --t.nesting;
+      return;
+    }
+    t.current.result = result;
+    t.current.total_ticks = TClock::now() - t.start;
+    t.is_active = false;
+    t.countdown = t.next_countdown;
+    sink_(t.current);
+  }
+
+  std::atomic<std::uint32_t> rate_;
+  const TSink sink_;
+  const TFormatter formatter_;
+  detail::per_thread<thread_sampling> threads_;
+};
+
+template<typename TState, typename TTrigger, typename TClock>
+const std::uint32_t fire_sampler<TState, TTrigger, TClock>::recheck_interval;
+
+template<typename TState, typename TTrigger, typename TClock>
+const unsigned fire_sampler<TState, TTrigger, TClock>::max_nesting;
+
+}
+
+#endif // STATELESS_FIRE_SAMPLER_HPP
@@ -0,0 +1,444 @@
+/**
+ * Copyright 2013 Matt Mason
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#ifndef STATELESS_FLIGHT_RECORDER_HPP
+#define STATELESS_FLIGHT_RECORDER_HPP
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <type_traits>
+
+#ifdef _WIN32
+#include <io.h>
+#else
+#include <unistd.h>
+#endif
+
+#include "clocks.hpp"
+#include "detail/per_thread.hpp"
+#include "error.hpp"
+#include "fire_observer.hpp"
+
+namespace stateless
+{
+
+namespace detail
+{
+
+/// Write a whole buffer to a file descriptor, using only async-signal-safe calls.
+inline bool write_fully(int fd, const char* data, std::size_t size)
+{
+  while (size > 0)
+  {
+#ifdef _WIN32
+    const int written = ::_write(fd, data, static_cast<unsigned>(size));
+#else
+    const ssize_t written = ::write(fd, data, size);
+#endif
+    if (written <= 0)
+    {
+      return false;
+    }
+    data += written;
+    size -= static_cast<std::size_t>(written);
+  }
+  return true;
+}
+
+/// Append the decimal digits of a value, without allocating or locking.
+inline char* format_decimal(char* out, std::uint64_t value)
+{
+  char digits[20];
+  int n = 0;
+  do
+  {
+    digits[n++] = static_cast<char>('0' + value % 10);
+    value /= 10;
+  } while (value != 0);
+  while (n > 0)
+  {
+    *out++ = digits[--n];
+  }
+  return out;
+}
+
+/// Precedes the records of a binary flight recorder dump.
+struct flight_recording_header
+{
+  char magic[8];
+  std::uint32_t version;
+  std::uint32_t record_size;
+};
+
+/// A record in a binary flight recorder dump.
+struct flight_recording_record
+{
+  std::uint64_t index;
+  std::uint64_t timestamp;
+  std::uint32_t source;
+  std::uint32_t trigger;
+  std::uint32_t destination;
+  std::uint8_t outcome;
+  std::uint8_t guard_rejections;
+  std::uint16_t reserved;
+};
+
+static_assert(sizeof(flight_recording_header) == 16, "Unexpected flight recording header layout.");
+static_assert(sizeof(flight_recording_record) == 32, "Unexpected flight recording record layout.");
+
+}
+
+/**
+ * Keeps the most recent transitions, ignored and unhandled triggers of the
+ * state machines or instance stores it observes in a fixed size ring
+ * buffer, for post-mortem debugging.
+ *
+ * Recording takes a slot with one atomic increment and fills it without
+ * locking or allocating, once a thread has allocated its guard rejection
+ * count on first use. Each slot is guarded by a sequence number, so that
+ * readers skip slots that are being overwritten. dump() uses only
+ * async-signal-safe calls, so it may be called from a signal or crash
+ * handler; it writes numeric codes, as states and triggers cannot be
+ * printed safely there.
+ *
+ * Triggers are recorded when their outcome is known, before any action
+ * runs. Recording requires STATELESS_ENABLE_INSTRUMENTATION to be defined;
+ * see state_machine::set_observer() and instance_store::set_observer().
+ *
+ * \tparam TState The type used to represent the states. Must be an enumeration or integer.
+ * \tparam TTrigger The type used to represent the triggers. Must be an enumeration or integer.
+ * \tparam TClock A clock with a static now() returning an unsigned tick count.
+ */
+template<typename TState, typename TTrigger, typename TClock = cycle_clock>
+class flight_recorder : public fire_observer<TState, TTrigger>
+{
+  static_assert(std::is_enum<TState>::value || std::is_integral<TState>::value,
+    "flight_recorder requires an enumeration or integral state type.");
+  static_assert(std::is_enum<TTrigger>::value || std::is_integral<TTrigger>::value,
+    "flight_recorder requires an enumeration or integral trigger type.");
+
+public:
+  /// Parameterized transition type.
+  typedef typename fire_observer<TState, TTrigger>::TTransition TTransition;
+
+  /// What became of a trigger.
+  enum class outcome : std::uint8_t
+  {
+    transition = 1,
+    ignored = 2,
+    unhandled = 3
+  };
+
+  /// Formats for dump().
+  enum class dump_format
+  {
+    /// One line per record: index, timestamp, source, trigger, destination, outcome and guard rejections.
+    text,
+    /// A flight_recording_header followed by flight_recording_records.
+    binary
+  };
+
+  /// A recorded trigger.
+  struct entry
+  {
+    /// The position of the record among all those made.
+    std::uint64_t index;
+
+    /// The time, in ticks of TClock.
+    std::uint64_t timestamp;
+
+    TState source;
+    TTrigger trigger;
+
+    /// The new state, or the source state if there was no transition.
+    TState destination;
+
+    outcome result;
+
+    /// The number of guards that evaluated to false, up to 255.
+    unsigned guard_rejections;
+  };
+
+  /**
+   * Construct a recorder, allocating all of its storage.
+   *
+   * \param capacity The number of records to keep, rounded up to a power of two.
+   */
+  explicit flight_recorder(std::size_t capacity = 4096)
+    : mask_(round_up(capacity) - 1)
+    , slots_(new slot[mask_ + 1])
+    , next_(0)
+    , rejections_()
+  {
+    for (std::size_t i = 0; i <= mask_; ++i)
+    {
+      slots_[i].sequence.store(0, std::memory_order_relaxed);
+      for (auto& word : slots_[i].words)
+      {
+        word.store(0, std::memory_order_relaxed);
+      }
+    }
+  }
+
+  /// The number of records kept.
+  std::size_t capacity() const
+  {
+    return mask_ + 1;
+  }
+
+  /// The number of records made, including those since overwritten.
+  std::uint64_t recorded() const
+  {
+    return next_.load(std::memory_order_acquire);
+  }
+
+  /**
+   * Visit the records kept, oldest first, skipping any being written.
+   *
+   * \param visitor Function called with each entry.
+   *
+   * \return The number of records visited.
+   */
+  template<typename TCallable>
+  std::size_t for_each(TCallable visitor) const
+  {
+    std::size_t visited = 0;
+    const std::uint64_t end = recorded();
+    for (std::uint64_t i = end > capacity() ? end - capacity() : 0; i < end; ++i)
+    {
+      detail::flight_recording_record record;
+      if (read(i, record))
+      {
+        entry e;
+        e.index = record.index;
+        e.timestamp = record.timestamp;
+        e.source = static_cast<TState>(record.source);
+        e.trigger = static_cast<TTrigger>(record.trigger);
+        e.destination = static_cast<TState>(record.destination);
+        e.result = static_cast<outcome>(record.outcome);
+        e.guard_rejections = record.guard_rejections;
+        visitor(static_cast<const entry&>(e));
+        ++visited;
+      }
+    }
+    return visited;
+  }
+
+  /**
+   * Write the records kept, oldest first, to a file descriptor. Only
+   * async-signal-safe functions are called, and nothing is allocated.
+   *
+   * \param fd The file descriptor.
+   * \param format The format.
+   *
+   * \return False if a write failed.
+   */
+  bool dump(int fd, dump_format format = dump_format::text) const
+  {
+    // Output is assembled in a buffer on the stack and written in chunks.
+    const std::size_t line_size = 128;
+    char buffer[64 * line_size];
+    char* out = buffer;
+    if (format == dump_format::binary)
+    {
+      detail::flight_recording_header header = {
+        { 'S', 'T', 'L', 'S', 'F', 'R', 'E', 'C' },
+        1,
+        sizeof(detail::flight_recording_record) };
+      std::memcpy(out, &header, sizeof(header));
+      out += sizeof(header);
+    }
+    const std::uint64_t end = recorded();
+    for (std::uint64_t i = end > capacity() ? end - capacity() : 0; i < end; ++i)
+    {
+      detail::flight_recording_record record;
+      if (!read(i, record))
+      {
+        continue;
+      }
+      if (format == dump_format::binary)
+      {
+        std::memcpy(out, &record, sizeof(record));
+        out += sizeof(record);
+      }
+      else
+      {
+        out = format_line(out, record);
+      }
+      if (static_cast<std::size_t>(out - buffer) > sizeof(buffer) - line_size)
+      {
+        if (!detail::write_fully(fd, buffer, static_cast<std::size_t>(out - buffer)))
+        {
+          return false;
+        }
+        out = buffer;
+      }
+    }
+    return detail::write_fully(fd, buffer, static_cast<std::size_t>(out - buffer));
+  }
+
+  virtual bool on_fire(const TState&, const TTrigger&)
+  {
+    rejections() = 0;
+    return true;
+  }
+
+  virtual void on_guard(const TState&, const TTrigger&, bool is_met)
+  {
+    if (!is_met && rejections() < 255)
+    {
+      ++rejections();
+    }
+  }
+
+  virtual void on_unhandled(const TState& source, const TTrigger& trigger)
+  {
+    record(source, trigger, source, outcome::unhandled);
+  }
+
+  virtual void on_ignored(const TState& source, const TTrigger& trigger)
+  {
+    record(source, trigger, source, outcome::ignored);
+  }
+
+  virtual void on_resolved(const TTransition& transition)
+  {
+    record(transition.source(), transition.trigger(), transition.destination(), outcome::transition);
+  }
+
+private:
+  flight_recorder(const flight_recorder&);
+  flight_recorder& operator=(const flight_recorder&);
+
+  /// A thread's count of guard rejections.
+  struct thread_rejections
+  {
+    thread_rejections()
+      : count(0)
+    {}
+
+    unsigned count;
+  };
+
+  /**
+   * A record guarded by a sequence number: odd while being written, and
+   * otherwise twice one more than the index of the record it holds.
+   */
+  struct slot
+  {
+    std::atomic<std::uint64_t> sequence;
+
+    /// Timestamp; source and destination; trigger, outcome and guard rejections.
+    std::atomic<std::uint64_t> words[3];
+  };
+
+  static std::size_t round_up(std::size_t capacity)
+  {
+    if (capacity == 0)
+    {
+      throw error("A flight recorder requires a capacity.");
+    }
+    std::size_t result = 1;
+    while (result < capacity)
+    {
+      result <<= 1;
+    }
+    return result;
+  }
+
+  /// Guard rejections of the trigger being handled on this thread.
+  unsigned& rejections()
+  {
+    return rejections_.local().count;
+  }
+
+  void record(const TState& source, const TTrigger& trigger, const TState& destination, outcome result)
+  {
+    const std::uint64_t index = next_.fetch_add(1, std::memory_order_relaxed);
+    slot& s = slots_[static_cast<std::size_t>(index) & mask_];
+    s.sequence.store(2 * index + 1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+    s.words[0].store(TClock::now(), std::memory_order_relaxed);
+    s.words[1].store(
+      (std::uint64_t(static_cast<std::uint32_t>(source)) << 32) | static_cast<std::uint32_t>(destination),
+      std::memory_order_relaxed);
+    s.words[2].store(
+      (std::uint64_t(static_cast<std::uint32_t>(trigger)) << 32) |
+        (std::uint64_t(static_cast<std::uint8_t>(result)) << 8) | rejections(),
+      std::memory_order_relaxed);
+    s.sequence.store(2 * index + 2, std::memory_order_release);
+  }
+
+  /// Read a record if its slot still holds it and is not being written.
+  bool read(std::uint64_t index, detail::flight_recording_record& record) const
+  {
+    const slot& s = slots_[static_cast<std::size_t>(index) & mask_];
+    const std::uint64_t before = s.sequence.load(std::memory_order_acquire);
+    if (before != 2 * index + 2)
+    {
+      return false;
+    }
+    const std::uint64_t timestamp = s.words[0].load(std::memory_order_relaxed);
+    const std::uint64_t states = s.words[1].load(std::memory_order_relaxed);
+    const std::uint64_t rest = s.words[2].load(std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_acquire);
+    if (s.sequence.load(std::memory_order_relaxed) != before)
+    {
+      return false;
+    }
+    record.index = index;
+    record.timestamp = timestamp;
+    record.source = static_cast<std::uint32_t>(states >> 32);
+    record.destination = static_cast<std::uint32_t>(states);
+    record.trigger = static_cast<std::uint32_t>(rest >> 32);
+    record.outcome = static_cast<std::uint8_t>(rest >> 8);
+    record.guard_rejections = static_cast<std::uint8_t>(rest);
+    record.reserved = 0;
+    return true;
+  }
+
+  static char* format_line(char* out, const detail::flight_recording_record& record)
+  {
+    static const char* const outcomes[] = { "?", "transition", "ignored", "unhandled" };
+    const std::uint64_t fields[] = { record.index, record.timestamp, record.source, record.trigger, record.destination };
+    for (auto field : fields)
+    {
+      out = detail::format_decimal(out, field);
+      *out++ = ' ';
+    }
+    const char* name = outcomes[record.outcome < 4 ? record.outcome : 0];
+    const std::size_t length = std::strlen(name);
+    std::memcpy(out, name, length);
+    out += length;
+    *out++ = ' ';
+    out = detail::format_decimal(out, record.guard_rejections);
+    *out++ = '\n';
+    return out;
+  }
+
+  const std::size_t mask_;
+  std::unique_ptr<slot[]> slots_;
+  std::atomic<std::uint64_t> next_;
+  detail::per_thread<thread_rejections> rejections_;
+};
+
+}
+
+#endif // STATELESS_FLIGHT_RECORDER_HPP
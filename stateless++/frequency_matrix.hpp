@@ -0,0 +1,324 @@
+/**
+ * Copyright 2013 Matt Mason
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#ifndef STATELESS_FREQUENCY_MATRIX_HPP
+#define STATELESS_FREQUENCY_MATRIX_HPP
+
+#include <cstdint>
+#include <cstring>
+#include <map>
+#include <ostream>
+#include <sstream>
+#include <string>
+#include <tuple>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#include "definition.hpp"
+#include "print_state.hpp"
+#include "print_trigger.hpp"
+#include "transition_counters.hpp"
+
+namespace stateless
+{
+
+/**
+ * The observed frequency of every outcome of every trigger in every state of
+ * a definition, for offline profiling.
+ *
+ * The rows are taken from the definition, so configured outcomes that were
+ * never observed appear with a count of zero, and are then completed with
+ * the counts of a transition_counters, which adds the destinations of
+ * dynamic transitions and the triggers fired but not configured. Triggers
+ * handled by a super state appear under each of its substates.
+ *
+ * The matrix is a copy of the counts when it was constructed. For a state
+ * machine, use its freeze() for the definition; for an instance store, note
+ * that transitions made by table lookup are not observed.
+ *
+ * \tparam TState The type used to represent the states.
+ * \tparam TTrigger The type used to represent the triggers that cause state transitions.
+ */
+template<typename TState, typename TTrigger>
+class frequency_matrix
+{
+public:
+  /// Parameterized definition type.
+  typedef definition<TState, TTrigger> TDefinition;
+
+  /// Parameterized counters type.
+  typedef transition_counters<TState, TTrigger> TCounters;
+
+  /// Counts for a trigger fired in a state.
+  typedef typename TCounters::trigger_counts trigger_counts;
+
+  /// What firing a trigger in a state led to.
+  enum class outcome : std::uint8_t
+  {
+    /// A transition to the destination.
+    transition = 1,
+    /// The trigger was ignored.
+    ignored = 2,
+    /// No behaviour handled the trigger, because no guard was met or none was configured.
+    unhandled = 3
+  };
+
+  /// An outcome of a trigger in a state, and how often it occurred.
+  struct row
+  {
+    TState source;
+    TTrigger trigger;
+
+    /// The destination of a transition, and otherwise the source.
+    TState destination;
+
+    outcome result;
+
+    /// Whether the outcome is configured, rather than only observed.
+    bool is_configured;
+
+    /// Times the outcome occurred.
+    std::uint64_t count;
+
+    /// The counts for the trigger in the source state, common to all its rows.
+    trigger_counts counts;
+  };
+
+  /// Version of the binary format written by write_binary().
+  static const std::uint32_t binary_version = 1;
+
+  /**
+   * Take the counts for the outcomes of a definition.
+   *
+   * \param definition The definition, which supplies the configured outcomes.
+   * \param counters The counters that observed the machine or store.
+   */
+  frequency_matrix(const TDefinition& definition, const TCounters& counters)
+    : rows_()
+  {
+    typedef detail::transitioning_trigger_behaviour<TState, TTrigger> TTransitioning;
+    typedef detail::ignored_trigger_behaviour<TState, TTrigger> TIgnored;
+
+    std::map<std::tuple<TState, TTrigger, TState, outcome>, row> rows;
+    auto add = [&](const TState& source, const TTrigger& trigger, const TState& destination, outcome result, bool is_configured)
+      -> row&
+      {
+        const auto key = std::make_tuple(source, trigger, destination, result);
+        auto it = rows.find(key);
+        if (it == rows.end())
+        {
+          row r = { source, trigger, destination, result, is_configured, 0, trigger_counts() };
+          it = rows.insert(std::make_pair(key, r)).first;
+        }
+        return it->second;
+      };
+
+    for (auto& entry : definition.representations())
+    {
+      const TState& source = entry.first;
+      for (auto representation = &entry.second;
+        representation != nullptr;
+        representation = representation->has_super_state() ? &representation->super_state() : nullptr)
+      {
+        for (auto& candidates : representation->trigger_behaviours())
+        {
+          bool is_guarded = false;
+          for (auto& behaviour : candidates.second)
+          {
+            is_guarded = is_guarded || behaviour->is_guarded();
+            if (auto t = std::dynamic_pointer_cast<TTransitioning>(behaviour))
+            {
+              add(source, candidates.first, t->destination(), outcome::transition, true);
+            }
+            else if (std::dynamic_pointer_cast<TIgnored>(behaviour))
+            {
+              add(source, candidates.first, source, outcome::ignored, true);
+            }
+          }
+          if (is_guarded)
+          {
+            add(source, candidates.first, source, outcome::unhandled, true);
+          }
+        }
+      }
+    }
+
+    std::map<std::pair<TState, TTrigger>, trigger_counts> counts;
+    counters.for_each([&](const TState& source, const TTrigger& trigger, const trigger_counts& c)
+      {
+        counts[std::make_pair(source, trigger)] = c;
+        if (c.ignored != 0)
+        {
+          add(source, trigger, source, outcome::ignored, false).count = c.ignored;
+        }
+        if (c.unhandled != 0)
+        {
+          add(source, trigger, source, outcome::unhandled, false).count = c.unhandled;
+        }
+      });
+    counters.for_each_transition(
+      [&](const TState& source, const TTrigger& trigger, const TState& destination, std::uint64_t count)
+      {
+        add(source, trigger, destination, outcome::transition, false).count = count;
+      });
+
+    rows_.reserve(rows.size());
+    for (auto& entry : rows)
+    {
+      auto it = counts.find(std::make_pair(entry.second.source, entry.second.trigger));
+      if (it != counts.end())
+      {
+        entry.second.counts = it->second;
+      }
+      rows_.push_back(entry.second);
+    }
+  }
+
+  /// The rows, in order of source, trigger, destination and outcome.
+  const std::vector<row>& rows() const
+  {
+    return rows_;
+  }
+
+  /**
+   * Write the rows as CSV with a header line. States and triggers are
+   * written with print_state() and print_trigger(), quoted if necessary.
+   * Guard pass rates are 1 - guard_rejections / guard_evaluations.
+   *
+   * \param os The stream to write to.
+   */
+  void write_csv(std::ostream& os) const
+  {
+    os << "source,trigger,destination,outcome,configured,count,"
+      "fires,transitions,ignored,unhandled,guard_evaluations,guard_rejections\n";
+    for (auto& r : rows_)
+    {
+      std::ostringstream source, trigger, destination;
+      print_state<TState>(source, r.source);
+      print_trigger<TTrigger>(trigger, r.trigger);
+      if (r.result == outcome::transition)
+      {
+        print_state<TState>(destination, r.destination);
+      }
+      os << csv_field(source.str()) << ','
+        << csv_field(trigger.str()) << ','
+        << csv_field(destination.str()) << ','
+        << outcome_name(r.result) << ','
+        << (r.is_configured ? 1 : 0) << ','
+        << r.count << ','
+        << r.counts.fires << ','
+        << r.counts.transitions << ','
+        << r.counts.ignored << ','
+        << r.counts.unhandled << ','
+        << r.counts.guard_evaluations << ','
+        << r.counts.guard_rejections << '\n';
+    }
+  }
+
+  /**
+   * Write the rows in a compact native endian binary format: a 16 byte
+   * header of the characters "STLSFMAT", the version and the record size,
+   * both 32-bit, then a record per row. A record holds the source, trigger
+   * and destination as 64-bit integers, then the count and the trigger's
+   * fires, transitions, ignored, unhandled, guard evaluations and guard
+   * rejections, also 64-bit, then the outcome and whether it is configured,
+   * one byte each, padded to a multiple of 8 bytes. States and triggers
+   * must be enumerations or integers.
+   *
+   * \param os The stream to write to, which should be opened in binary mode.
+   */
+  void write_binary(std::ostream& os) const
+  {
+    static_assert(std::is_enum<TState>::value || std::is_integral<TState>::value,
+      "Binary frequency matrices require an enumeration or integral state type.");
+    static_assert(std::is_enum<TTrigger>::value || std::is_integral<TTrigger>::value,
+      "Binary frequency matrices require an enumeration or integral trigger type.");
+
+    unsigned char header[16];
+    std::memcpy(header, "STLSFMAT", 8);
+    const std::uint32_t version = binary_version, size = record_size;
+    std::memcpy(header + 8, &version, 4);
+    std::memcpy(header + 12, &size, 4);
+    os.write(reinterpret_cast<const char*>(header), sizeof(header));
+    for (auto& r : rows_)
+    {
+      const std::uint64_t values[] =
+      {
+        static_cast<std::uint64_t>(r.source),
+        static_cast<std::uint64_t>(r.trigger),
+        static_cast<std::uint64_t>(r.destination),
+        r.count,
+        r.counts.fires,
+        r.counts.transitions,
+        r.counts.ignored,
+        r.counts.unhandled,
+        r.counts.guard_evaluations,
+        r.counts.guard_rejections
+      };
+      unsigned char record[record_size] = {};
+      std::memcpy(record, values, sizeof(values));
+      record[sizeof(values)] = static_cast<unsigned char>(r.result);
+      record[sizeof(values) + 1] = r.is_configured ? 1 : 0;
+      os.write(reinterpret_cast<const char*>(record), record_size);
+    }
+  }
+
+private:
+  /// Size of a binary record: ten values and two flags, padded.
+  enum { record_size = 88 };
+
+  static const char* outcome_name(outcome result)
+  {
+    switch (result)
+    {
+    case outcome::transition:
+      return "transition";
+    case outcome::ignored:
+      return "ignored";
+    default:
+      return "unhandled";
+    }
+  }
+
+  static std::string csv_field(const std::string& text)
+  {
+    if (text.find_first_of(",\"\r\n") == std::string::npos)
+    {
+      return text;
+    }
+    std::string result = "\"";
+    for (char c : text)
+    {
+      if (c == '"')
+      {
+        result += '"';
+      }
+      result += c;
+    }
+    return result + "\"";
+  }
+
+  std::vector<row> rows_;
+};
+
+template<typename TState, typename TTrigger>
+const std::uint32_t frequency_matrix<TState, TTrigger>::binary_version;
+
+}
+
+#endif // STATELESS_FREQUENCY_MATRIX_HPP
@@ -0,0 +1,1356 @@
+/**
+ * Copyright 2013 Matt Mason
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#ifndef STATELESS_INSTANCE_STORE_HPP
+#define STATELESS_INSTANCE_STORE_HPP
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <exception>
+#include <limits>
+#include <map>
+#include <memory>
+#include <thread>
+#include <type_traits>
+#include <vector>
+
+#include "clocks.hpp"
+#include "definition.hpp"
+#include "detail/batch_kernel.hpp"
+#include "detail/chunk_queue.hpp"
+#include "detail/code_column.hpp"
+#include "error.hpp"
+#include "memory_usage.hpp"
+
+namespace stateless
+{
+
+/**
+ * A population of instances of one state machine definition, stored as a
+ * contiguous column of small integer state codes.
+ *
+ * The state type must be an enumeration or integral type whose values fit in
+ * the code type, excluding its maximum value which is reserved.
+ *
+ * Triggers can be applied to a range of instances at once. Where the outcome
+ * of a trigger is fixed for a state (no guards, no dynamic destination and no
+ * entry or exit actions) it is applied by table lookup, vectorized where
+ * possible. Remaining instances are fired individually through the definition.
+ *
+ * \tparam TState The type used to represent the states.
+ * \tparam TTrigger The type used to represent the triggers that cause state transitions.
+ * \tparam TCode The unsigned integral type used to store each instance's state.
+ * \tparam TClock The clock used to time the states of instances; see
+ *                enable_dwell_times(). It must provide an unsigned rep
+ *                type and a static now() function.
+ */
+template<
+  typename TState,
+  typename TTrigger,
+  typename TCode = std::uint8_t,
+  typename TClock = coarse_clock>
+class instance_store
+{
+  static_assert(std::is_enum<TState>::value || std::is_integral<TState>::value,
+    "instance_store requires an enumeration or integral state type.");
+  static_assert(std::is_unsigned<TCode>::value,
+    "instance_store requires an unsigned integral code type.");
+
+public:
+  /// Parameterized definition type.
+  typedef definition<TState, TTrigger> TDefinition;
+
+  /// Shared pointer to an immutable definition.
+  typedef std::shared_ptr<const TDefinition> TDefinitionPtr;
+
+  /// Parameterized fire observer type.
+  typedef typename TDefinition::TFireObserver TFireObserver;
+
+  /// A time or duration in ticks of the clock.
+  typedef typename TClock::rep TTicks;
+
+  /// How much time in each state enable_dwell_times() keeps.
+  enum class dwell_tracking
+  {
+    /// Totals for each state over all instances.
+    aggregate,
+    /// Also totals for each state for each instance.
+    per_instance
+  };
+
+  /// Whether replay() runs entry and exit actions.
+  enum class replay_mode
+  {
+    /// Only set the states.
+    state_only,
+    /// Also run the entry and exit actions that take no arguments.
+    with_actions
+  };
+
+  /// Value of current() when no instance is being fired.
+  static const std::size_t npos = static_cast<std::size_t>(-1);
+
+  /**
+   * Construct a store of instances in a common initial state.
+   *
+   * \param definition The definition shared by all instances.
+   * \param size The number of instances.
+   * \param initial_state The initial state of every instance.
+   */
+  instance_store(const TDefinitionPtr& definition, std::size_t size, const TState& initial_state)
+    : definition_(definition)
+    , codes_()
+    , code_limit_(0)
+    , tables_()
+    , slow_indices_()
+    , group_offsets_()
+    , group_cursors_()
+    , grouped_indices_()
+    , current_(npos)
+    , is_indexed_(false)
+    , heads_()
+    , counts_()
+    , super_codes_()
+    , nested_counts_()
+    , prev_()
+    , next_()
+    , is_timed_(false)
+    , is_timed_per_instance_(false)
+    , entered_()
+    , closed_totals_()
+    , occupants_()
+    , entered_sums_()
+    , instance_totals_()
+    , instance_totals_stride_(0)
+#ifdef STATELESS_ENABLE_INSTRUMENTATION
+    , observer_(nullptr)
+#endif
+  {
+    if (definition_ == nullptr)
+    {
+      throw error("An instance store requires a definition.");
+    }
+    codes_.assign(size, encode(initial_state));
+  }
+
+  /**
+   * Construct a store over a column of codes held elsewhere, such as a
+   * copy-on-write mapping of a snapshot. The codes are not copied, and are
+   * modified in place until the store first grows.
+   *
+   * \param definition The definition shared by all instances.
+   * \param codes The codes of the instances' states.
+   * \param size The number of instances.
+   * \param code_limit One more than the highest code present.
+   * \param owner Keeps the codes alive for the lifetime of the store.
+   */
+  instance_store(
+    const TDefinitionPtr& definition,
+    TCode* codes,
+    std::size_t size,
+    std::size_t code_limit,
+    const std::shared_ptr<void>& owner)
+    : definition_(definition)
+    , codes_(codes, size, owner)
+    , code_limit_(code_limit)
+    , tables_()
+    , slow_indices_()
+    , group_offsets_()
+    , group_cursors_()
+    , grouped_indices_()
+    , current_(npos)
+    , is_indexed_(false)
+    , heads_()
+    , counts_()
+    , super_codes_()
+    , nested_counts_()
+    , prev_()
+    , next_()
+    , is_timed_(false)
+    , is_timed_per_instance_(false)
+    , entered_()
+    , closed_totals_()
+    , occupants_()
+    , entered_sums_()
+    , instance_totals_()
+    , instance_totals_stride_(0)
+#ifdef STATELESS_ENABLE_INSTRUMENTATION
+    , observer_(nullptr)
+#endif
+  {
+    if (definition_ == nullptr)
+    {
+      throw error("An instance store requires a definition.");
+    }
+    if (code_limit_ > static_cast<std::size_t>(slow_marker()))
+    {
+      throw error("Code limit is out of range for the instance store's code type.");
+    }
+  }
+
+  /// The number of instances.
+  std::size_t size() const
+  {
+    return codes_.size();
+  }
+
+  /// The definition shared by all instances.
+  const TDefinition& get_definition() const
+  {
+    return *definition_;
+  }
+
+  /**
+   * Add an instance.
+   *
+   * \param initial_state The state of the new instance.
+   *
+   * \return The index of the new instance.
+   */
+  std::size_t add(const TState& initial_state)
+  {
+    const TCode code = encode(initial_state);
+    codes_.push_back(code);
+    if (is_indexed_)
+    {
+      prev_.push_back(nil);
+      next_.push_back(nil);
+      link(codes_.size() - 1, code);
+    }
+    if (is_timed_)
+    {
+      const TTicks now = TClock::now();
+      entered_.push_back(now);
+      occupy(code, now);
+      if (is_timed_per_instance_)
+      {
+        instance_totals_.resize(instance_totals_.size() + instance_totals_stride_, 0);
+      }
+    }
+    return codes_.size() - 1;
+  }
+
+  /// The current state of an instance.
+  TState state(std::size_t instance) const
+  {
+    return decode(codes_.at(instance));
+  }
+
+  /// Set the state of an instance without executing any actions.
+  void set_state(std::size_t instance, const TState& state)
+  {
+    if (instance >= codes_.size())
+    {
+      throw error("Instance index is out of bounds.");
+    }
+    assign(instance, encode(state));
+  }
+
+  /**
+   * Determine whether an instance is in a state.
+   *
+   * \return True if the instance's state is equal to, or a substate of, the supplied state.
+   */
+  bool is_in_state(std::size_t instance, const TState& state) const
+  {
+    return definition_->is_in_state(this->state(instance), state);
+  }
+
+  /**
+   * Transition an instance via the supplied trigger.
+   *
+   * \param instance The index of the instance.
+   * \param trigger The trigger to fire.
+   *
+   * \throw error The instance's state does not allow the trigger to be fired.
+   */
+  void fire(std::size_t instance, const TTrigger& trigger)
+  {
+    TState s = state(instance);
+    current_scope scope(*this, instance);
+    definition_->fire(current_observer(), s, trigger);
+    assign(instance, encode(s));
+  }
+
+  /**
+   * Transition an instance via the supplied trigger.
+   *
+   * \param instance The index of the instance.
+   * \param trigger The trigger to fire.
+   * \param args The arguments to pass in the transition.
+   *
+   * \throw error The instance's state does not allow the trigger to be fired.
+   */
+  template<typename... TArgs>
+  void fire(
+    std::size_t instance,
+    const std::shared_ptr<trigger_with_parameters<TTrigger, TArgs...>>& trigger,
+    TArgs... args)
+  {
+    TState s = state(instance);
+    current_scope scope(*this, instance);
+    definition_->fire(current_observer(), s, trigger, std::move(args)...);
+    assign(instance, encode(s));
+  }
+
+  /**
+   * Transition every instance via the supplied trigger.
+   *
+   * \see apply(const TTrigger&, std::size_t, std::size_t)
+   */
+  std::size_t apply(const TTrigger& trigger)
+  {
+    return apply(trigger, 0, codes_.size());
+  }
+
+  /**
+   * Transition a range of instances via the supplied trigger.
+   *
+   * Instances whose transition is fixed by their state are updated first, by
+   * table lookup. The others are then fired individually, in index order, with
+   * their entry and exit actions executed as usual. Instances whose state
+   * does not permit the trigger are left unchanged.
+   *
+   * \param trigger The trigger to fire. It must not be configured with parameters.
+   * \param first The index of the first instance.
+   * \param last One past the index of the last instance.
+   *
+   * \return The number of instances for which the trigger was not permitted.
+   */
+  std::size_t apply(const TTrigger& trigger, std::size_t first, std::size_t last)
+  {
+    if (first > last || last > codes_.size())
+    {
+      throw error("Instance range is out of bounds.");
+    }
+    apply_table(table_for(trigger), first, last);
+    return fire_slow(trigger);
+  }
+
+  /**
+   * Transition every instance via the supplied trigger, grouping the work by
+   * current state.
+   *
+   * Instances whose transition is fixed by their state are updated by table
+   * lookup, as for apply(). The remainder are sorted by state with a counting
+   * sort; the handler and destination are then resolved once per state, so
+   * guards and dynamic destinations are evaluated once per group rather than
+   * once per instance, and each group's exit and entry actions run back to back.
+   * Groups are processed in order of state code, and instances within a group
+   * in index order.
+   *
+   * \param trigger The trigger to fire. It must not be configured with parameters.
+   *
+   * \return The number of instances for which the trigger was not permitted.
+   */
+  std::size_t broadcast(const TTrigger& trigger)
+  {
+    detail::check_trigger_parameters<TTrigger>(definition_->trigger_configuration(), trigger);
+
+    apply_table(table_for(trigger), 0, codes_.size());
+    if (slow_indices_.empty())
+    {
+      return 0;
+    }
+
+    // Counting sort of the remaining instances by state code.
+    group_offsets_.assign(code_limit_ + 1, 0);
+    for (auto instance : slow_indices_)
+    {
+      ++group_offsets_[codes_[instance] + 1];
+    }
+    for (std::size_t code = 1; code < group_offsets_.size(); ++code)
+    {
+      group_offsets_[code] += group_offsets_[code - 1];
+    }
+    grouped_indices_.resize(slow_indices_.size());
+    {
+      std::vector<std::size_t>& next = group_cursors_;
+      next.assign(group_offsets_.begin(), group_offsets_.end() - 1);
+      for (auto instance : slow_indices_)
+      {
+        grouped_indices_[next[codes_[instance]]++] = instance;
+      }
+    }
+
+    std::size_t unhandled = 0;
+    const std::size_t limit = group_offsets_.size() - 1;
+    for (std::size_t code = 0; code < limit; ++code)
+    {
+      const std::size_t first = group_offsets_[code], last = group_offsets_[code + 1];
+      if (first != last)
+      {
+        unhandled += fire_group(trigger, static_cast<TCode>(code), first, last);
+      }
+    }
+    return unhandled;
+  }
+
+  /**
+   * Set the state of each journaled instance to its last journaled
+   * destination, replaying the journal on several threads.
+   *
+   * Instances are partitioned by id in blocks of 4096, so that threads do
+   * not share cache lines. The calling thread reads the journal once and
+   * passes each record, in chunks, to the thread for its partition, which
+   * replays them in order, so no locks are taken per record. With
+   * replay_mode::with_actions each record's exit and entry actions are also
+   * run, without arguments, so only actions that take none are called. They
+   * run concurrently on the replay threads and current() is not set. The
+   * index, if enabled, is rebuilt afterwards. If dwell times are enabled,
+   * the time instances had spent in their states before the replay is added
+   * to the totals, and timing restarts as though every instance had just
+   * entered its replayed state.
+   *
+   * \param journal A journal, such as a journal_reader, whose for_each()
+   *                visits entries with instance(), source(), destination()
+   *                and trigger().
+   * \param threads The number of replay threads, or 0 for one per core.
+   *                With one, the calling thread replays as it reads.
+   * \param mode Whether to run entry and exit actions.
+   *
+   * \return The number of records replayed.
+   *
+   * \throw error A record's instance is out of bounds or its state is out of range.
+   */
+  template<typename TJournal>
+  std::size_t replay(
+    const TJournal& journal,
+    std::size_t threads = 0,
+    replay_mode mode = replay_mode::state_only)
+  {
+    if (threads == 0)
+    {
+      threads = std::max<std::size_t>(1, std::thread::hardware_concurrency());
+    }
+    if (is_timed_)
+    {
+      close_timing();
+    }
+    std::size_t total = 0;
+    std::size_t limit = code_limit_;
+    std::exception_ptr failure;
+    try
+    {
+      if (threads == 1)
+      {
+        journal.for_each(
+          [&](const typename TJournal::entry& e)
+          {
+            replay_record(e.instance(), e.source(), e.destination(), e.trigger(), mode, limit);
+            ++total;
+          });
+      }
+      else
+      {
+        total = replay_partitioned(journal, threads, mode, limit);
+      }
+    }
+    catch (...)
+    {
+      failure = std::current_exception();
+    }
+    code_limit_ = std::max(code_limit_, limit);
+    if (is_indexed_)
+    {
+      build_index();
+    }
+    if (is_timed_)
+    {
+      restart_timing();
+    }
+    if (failure)
+    {
+      std::rethrow_exception(failure);
+    }
+    return total;
+  }
+
+  /**
+   * Start maintaining per-state instance counts and a state to instance index.
+   *
+   * Building the index takes time proportional to the number of instances;
+   * afterwards each change of state updates it in constant time. Batch
+   * transitions then update instances one at a time rather than with the
+   * vectorized table lookup. Each instance costs two 32-bit links.
+   */
+  void enable_index()
+  {
+    if (is_indexed_)
+    {
+      return;
+    }
+    if (codes_.size() >= nil)
+    {
+      throw error("Too many instances to index.");
+    }
+    build_index();
+    is_indexed_ = true;
+  }
+
+  /// Whether the state index is maintained.
+  bool is_indexed() const
+  {
+    return is_indexed_;
+  }
+
+  /**
+   * The number of instances in a state, including its substates.
+   * Takes constant time, except for a super state whose value is out of
+   * range for the code type, which takes time proportional to the number
+   * of states.
+   *
+   * \throw error The index is not enabled.
+   */
+  std::size_t count(const TState& state) const
+  {
+    enforce_indexed();
+    const unsigned long long value = static_cast<unsigned long long>(state);
+    if (value < static_cast<unsigned long long>(slow_marker()))
+    {
+      const std::size_t code = static_cast<std::size_t>(value);
+      return (code < counts_.size() ? counts_[code] : 0) +
+        (code < nested_counts_.size() ? nested_counts_[code] : 0);
+    }
+    std::size_t result = 0;
+    for (std::size_t code = 0; code < counts_.size(); ++code)
+    {
+      if (counts_[code] != 0 && definition_->is_in_state(decode(static_cast<TCode>(code)), state))
+      {
+        result += counts_[code];
+      }
+    }
+    return result;
+  }
+
+  /**
+   * Visit the instances in a state, including its substates.
+   * Takes time proportional to the number of states plus the number of
+   * instances visited. The visitor must not change instance states.
+   *
+   * \param state The state.
+   * \param visitor Function called with the index of each instance.
+   *
+   * \throw error The index is not enabled.
+   */
+  template<typename TCallable>
+  void for_each_in_state(const TState& state, TCallable visitor) const
+  {
+    enforce_indexed();
+    for (std::size_t code = 0; code < heads_.size(); ++code)
+    {
+      if (heads_[code] != nil && definition_->is_in_state(decode(static_cast<TCode>(code)), state))
+      {
+        for (std::uint32_t instance = heads_[code]; instance != nil; instance = next_[instance])
+        {
+          visitor(static_cast<std::size_t>(instance));
+        }
+      }
+    }
+  }
+
+  /**
+   * Start timing how long instances spend in each state.
+   *
+   * Every instance is treated as having just entered its current state.
+   * Switching from dwell_tracking::aggregate to per_instance keeps the
+   * aggregate totals, including the time instances have spent so far in
+   * their current states, and starts each instance's totals from zero.
+   * Each change of state then reads TClock once and updates the totals in
+   * constant time. Each instance costs one TTicks for its time of entry,
+   * plus one per state in use with dwell_tracking::per_instance. As with
+   * the index, batch transitions then update instances one at a time.
+   *
+   * Time is counted per state rather than per entry: a transition from a
+   * state to itself does not restart time_in_current_state().
+   *
+   * \param tracking Whether to keep totals for each instance.
+   */
+  void enable_dwell_times(dwell_tracking tracking = dwell_tracking::aggregate)
+  {
+    static_assert(std::is_unsigned<TTicks>::value,
+      "Dwell times require a clock with an unsigned rep type.");
+    if (is_timed_ && (is_timed_per_instance_ || tracking == dwell_tracking::aggregate))
+    {
+      return;
+    }
+    if (is_timed_)
+    {
+      close_timing();
+    }
+    else
+    {
+      closed_totals_.assign(code_limit_, 0);
+    }
+    is_timed_per_instance_ = tracking == dwell_tracking::per_instance;
+    instance_totals_stride_ = is_timed_per_instance_ ? code_limit_ : 0;
+    instance_totals_.assign(codes_.size() * instance_totals_stride_, 0);
+    is_timed_ = true;
+    restart_timing();
+  }
+
+  /// Whether dwell times are kept.
+  bool has_dwell_times() const
+  {
+    return is_timed_;
+  }
+
+  /**
+   * The time an instance has spent in its current state.
+   *
+   * \throw error Dwell times are not enabled.
+   */
+  TTicks time_in_current_state(std::size_t instance) const
+  {
+    enforce_timed();
+    return TClock::now() - entered_.at(instance);
+  }
+
+  /**
+   * The total time all instances have spent in a state, including its
+   * substates, since dwell times were enabled. Time in the instances'
+   * current states is included. Takes time proportional to the number of
+   * states, not instances.
+   *
+   * \throw error Dwell times are not enabled.
+   */
+  TTicks total_time_in_state(const TState& state) const
+  {
+    enforce_timed();
+    const TTicks now = TClock::now();
+    TTicks result = 0;
+    for (std::size_t code = 0; code < closed_totals_.size(); ++code)
+    {
+      if (definition_->is_in_state(decode(static_cast<TCode>(code)), state))
+      {
+        // Modular arithmetic: the sum of entry times may wrap, the difference does not.
+        result += closed_totals_[code] + static_cast<TTicks>(occupants_[code]) * now - entered_sums_[code];
+      }
+    }
+    return result;
+  }
+
+  /**
+   * The total time an instance has spent in a state, including its
+   * substates, since dwell times were enabled, including any time in its
+   * current state.
+   *
+   * \throw error Dwell times are not enabled with dwell_tracking::per_instance,
+   *              or the instance index is out of bounds.
+   */
+  TTicks total_time_in_state(std::size_t instance, const TState& state) const
+  {
+    if (!is_timed_per_instance_)
+    {
+      throw error("Per instance dwell times are not enabled.");
+    }
+    if (instance >= codes_.size())
+    {
+      throw error("Instance index is out of bounds.");
+    }
+    TTicks result = 0;
+    const TTicks* totals = instance_totals_.data() + instance * instance_totals_stride_;
+    for (std::size_t code = 0; code < instance_totals_stride_; ++code)
+    {
+      if (totals[code] != 0 && definition_->is_in_state(decode(static_cast<TCode>(code)), state))
+      {
+        result += totals[code];
+      }
+    }
+    if (is_in_state(instance, state))
+    {
+      result += time_in_current_state(instance);
+    }
+    return result;
+  }
+
+  /**
+   * The bytes used by the store, by category, including the definition it
+   * may share with other stores. Codes borrowed from a snapshot mapping are
+   * counted as instances.
+   */
+  stateless::memory_usage memory_usage() const
+  {
+    auto usage = definition_->memory_usage();
+    usage.instances += codes_.bytes() +
+      detail::capacity_bytes(prev_) + detail::capacity_bytes(next_) +
+      detail::capacity_bytes(entered_) + detail::capacity_bytes(instance_totals_);
+    usage.other += sizeof(*this) +
+      detail::capacity_bytes(slow_indices_) + detail::capacity_bytes(group_offsets_) +
+      detail::capacity_bytes(group_cursors_) + detail::capacity_bytes(grouped_indices_) +
+      detail::capacity_bytes(heads_) + detail::capacity_bytes(counts_) +
+      detail::capacity_bytes(nested_counts_) +
+      detail::capacity_bytes(closed_totals_) + detail::capacity_bytes(occupants_) +
+      detail::capacity_bytes(entered_sums_);
+    for (auto& table : tables_)
+    {
+      usage.other += sizeof(table) + detail::map_node_overhead + detail::capacity_bytes(table.second);
+    }
+    for (auto& codes : super_codes_)
+    {
+      usage.other += sizeof(codes) + detail::capacity_bytes(codes);
+    }
+    return usage;
+  }
+
+  /**
+   * The index of the instance being fired, for use by actions.
+   *
+   * \return The index, or npos outside of fire() and apply().
+   */
+  std::size_t current() const
+  {
+    return current_;
+  }
+
+#ifdef STATELESS_ENABLE_INSTRUMENTATION
+  /**
+   * Report the progress of triggers fired for individual instances to an
+   * observer; current() identifies the instance. Transitions made by table
+   * lookup, and the grouped transitions of broadcast(), are not reported.
+   * Only available when STATELESS_ENABLE_INSTRUMENTATION is defined.
+   *
+   * \param observer The observer, or nullptr to stop reporting.
+   */
+  void set_observer(TFireObserver* observer)
+  {
+    observer_ = observer;
+  }
+
+  /// The observer, or nullptr if none is set.
+  TFireObserver* observer() const
+  {
+    return observer_;
+  }
+#endif
+
+  /// The state code column.
+  const TCode* codes() const
+  {
+    return codes_.data();
+  }
+
+  /// One more than the highest code that has been in use.
+  std::size_t code_limit() const
+  {
+    return code_limit_;
+  }
+
+  /// Encode a state as stored in the column.
+  static TCode encode_state(const TState& state)
+  {
+    const unsigned long long value = static_cast<unsigned long long>(state);
+    if (value >= static_cast<unsigned long long>(slow_marker()))
+    {
+      throw error("State value is out of range for the instance store's code type.");
+    }
+    return static_cast<TCode>(value);
+  }
+
+  /// Decode a state stored in the column.
+  static TState decode(TCode code)
+  {
+    return static_cast<TState>(code);
+  }
+
+private:
+  instance_store(const instance_store&);
+  instance_store& operator=(const instance_store&);
+
+  /// The observer to pass to the definition, if instrumentation is enabled.
+  TFireObserver* current_observer() const
+  {
+#ifdef STATELESS_ENABLE_INSTRUMENTATION
+    return observer_;
+#else
+    return nullptr;
+#endif
+  }
+
+  /// Code marking table entries that must be fired individually.
+  static TCode slow_marker()
+  {
+    return std::numeric_limits<TCode>::max();
+  }
+
+  /// Sets current() for the lifetime of the scope, restoring it for nested fires.
+  class current_scope
+  {
+  public:
+    current_scope(instance_store& store, std::size_t instance)
+      : store_(store)
+      , previous_(store.current_)
+    {
+      store_.current_ = instance;
+    }
+
+    ~current_scope()
+    {
+      store_.current_ = previous_;
+    }
+
+  private:
+    current_scope(const current_scope&);
+    current_scope& operator=(const current_scope&);
+
+    instance_store& store_;
+    const std::size_t previous_;
+  };
+
+  /// Encode a state, keeping track of the highest code in use.
+  TCode encode(const TState& state)
+  {
+    TCode code = encode_state(state);
+    if (static_cast<std::size_t>(code) >= code_limit_)
+    {
+      code_limit_ = static_cast<std::size_t>(code) + 1;
+    }
+    return code;
+  }
+
+  /**
+   * The transition table for a trigger, covering every code in use.
+   * Built on first use and rebuilt if new codes come into use.
+   */
+  const std::vector<TCode>& table_for(const TTrigger& trigger)
+  {
+    auto& table = tables_[trigger];
+    while (table.size() < code_limit_)
+    {
+      // Destinations may bring new codes into use, so repeat until stable.
+      const std::size_t limit = code_limit_;
+      table.assign(limit, slow_marker());
+      for (std::size_t code = 0; code < limit; ++code)
+      {
+        TState destination;
+        if (definition_->try_resolve_statically(decode(static_cast<TCode>(code)), trigger, destination))
+        {
+          table[code] = encode(destination);
+        }
+      }
+    }
+    return table;
+  }
+
+  /// Build the state index from scratch.
+  void build_index()
+  {
+    heads_.assign(code_limit_, nil);
+    counts_.assign(code_limit_, 0);
+    super_codes_.clear();
+    nested_counts_.clear();
+    add_super_codes(code_limit_);
+    prev_.assign(codes_.size(), nil);
+    next_.assign(codes_.size(), nil);
+    for (std::size_t instance = codes_.size(); instance-- > 0; )
+    {
+      link(instance, codes_[instance]);
+    }
+  }
+
+  /// Link terminator in the state index.
+  static const std::uint32_t nil = 0xFFFFFFFFu;
+
+  void enforce_indexed() const
+  {
+    if (!is_indexed_)
+    {
+      throw error("The instance store index is not enabled.");
+    }
+  }
+
+  void enforce_timed() const
+  {
+    if (!is_timed_)
+    {
+      throw error("Dwell times are not enabled.");
+    }
+  }
+
+  /// Add the time every instance has spent in its current state so far to the totals.
+  void close_timing()
+  {
+    const TTicks now = TClock::now();
+    for (std::size_t code = 0; code < occupants_.size(); ++code)
+    {
+      // Unsigned arithmetic: the sum of (now - entered) over the occupants.
+      closed_totals_[code] += static_cast<TTicks>(occupants_[code]) * now - entered_sums_[code];
+    }
+    if (is_timed_per_instance_)
+    {
+      if (occupants_.size() > instance_totals_stride_)
+      {
+        widen_instance_totals(occupants_.size());
+      }
+      for (std::size_t instance = 0; instance < codes_.size(); ++instance)
+      {
+        instance_totals_[instance * instance_totals_stride_ + codes_[instance]] += now - entered_[instance];
+      }
+    }
+  }
+
+  /// Treat every instance as entering its current state now.
+  void restart_timing()
+  {
+    const TTicks now = TClock::now();
+    entered_.assign(codes_.size(), now);
+    closed_totals_.resize(std::max(closed_totals_.size(), code_limit_), 0);
+    occupants_.assign(closed_totals_.size(), 0);
+    entered_sums_.assign(closed_totals_.size(), 0);
+    for (std::size_t instance = 0; instance < codes_.size(); ++instance)
+    {
+      occupy(codes_[instance], now);
+    }
+  }
+
+  /// Count an instance entering the state with a code at a time.
+  void occupy(TCode code, TTicks now)
+  {
+    if (static_cast<std::size_t>(code) >= occupants_.size())
+    {
+      closed_totals_.resize(static_cast<std::size_t>(code) + 1, 0);
+      occupants_.resize(static_cast<std::size_t>(code) + 1, 0);
+      entered_sums_.resize(static_cast<std::size_t>(code) + 1, 0);
+    }
+    ++occupants_[code];
+    entered_sums_[code] += now;
+  }
+
+  /// Move an instance's time in its current state to the totals, and start timing the next.
+  void time_change(std::size_t instance, TCode from, TCode to)
+  {
+    const TTicks now = TClock::now();
+    const TTicks since = entered_[instance];
+    closed_totals_[from] += now - since;
+    --occupants_[from];
+    entered_sums_[from] -= since;
+    occupy(to, now);
+    entered_[instance] = now;
+    if (is_timed_per_instance_)
+    {
+      if (static_cast<std::size_t>(from) >= instance_totals_stride_)
+      {
+        widen_instance_totals(static_cast<std::size_t>(from) + 1);
+      }
+      instance_totals_[instance * instance_totals_stride_ + from] += now - since;
+    }
+  }
+
+  /// Give each instance's row of totals room for more codes.
+  void widen_instance_totals(std::size_t stride)
+  {
+    stride = std::max(stride, std::max<std::size_t>(code_limit_, 2 * instance_totals_stride_));
+    std::vector<TTicks> widened(codes_.size() * stride, 0);
+    for (std::size_t instance = 0; instance < codes_.size(); ++instance)
+    {
+      std::copy(
+        instance_totals_.begin() + instance * instance_totals_stride_,
+        instance_totals_.begin() + (instance + 1) * instance_totals_stride_,
+        widened.begin() + instance * stride);
+    }
+    instance_totals_.swap(widened);
+    instance_totals_stride_ = stride;
+  }
+
+  /**
+   * Find the codes of the super states of each code's state, up to a limit,
+   * so that the instances in a super state are counted as they change state.
+   * Super states whose values are out of range for the code type are not counted.
+   */
+  void add_super_codes(std::size_t limit)
+  {
+    for (std::size_t code = super_codes_.size(); code < limit; ++code)
+    {
+      std::vector<TCode> supers;
+      auto representation = definition_->find_representation(decode(static_cast<TCode>(code)));
+      while (representation != nullptr && representation->has_super_state())
+      {
+        representation = &representation->super_state();
+        const unsigned long long value =
+          static_cast<unsigned long long>(representation->underlying_state());
+        if (value < static_cast<unsigned long long>(slow_marker()))
+        {
+          supers.push_back(static_cast<TCode>(value));
+          if (value >= nested_counts_.size())
+          {
+            nested_counts_.resize(static_cast<std::size_t>(value) + 1, 0);
+          }
+        }
+      }
+      super_codes_.push_back(std::move(supers));
+    }
+  }
+
+  /// Add an instance to the front of the index list for a code.
+  void link(std::size_t instance, TCode code)
+  {
+    if (static_cast<std::size_t>(code) >= heads_.size())
+    {
+      heads_.resize(static_cast<std::size_t>(code) + 1, nil);
+      counts_.resize(static_cast<std::size_t>(code) + 1, 0);
+      add_super_codes(static_cast<std::size_t>(code) + 1);
+    }
+    const std::uint32_t head = heads_[code];
+    prev_[instance] = nil;
+    next_[instance] = head;
+    if (head != nil)
+    {
+      prev_[head] = static_cast<std::uint32_t>(instance);
+    }
+    heads_[code] = static_cast<std::uint32_t>(instance);
+    ++counts_[code];
+    for (TCode super : super_codes_[code])
+    {
+      ++nested_counts_[super];
+    }
+  }
+
+  /// Remove an instance from the index list for a code.
+  void unlink(std::size_t instance, TCode code)
+  {
+    const std::uint32_t prev = prev_[instance], next = next_[instance];
+    if (prev != nil)
+    {
+      next_[prev] = next;
+    }
+    else
+    {
+      heads_[code] = next;
+    }
+    if (next != nil)
+    {
+      prev_[next] = prev;
+    }
+    --counts_[code];
+    for (TCode super : super_codes_[code])
+    {
+      --nested_counts_[super];
+    }
+  }
+
+  /// Change the state code of an instance, keeping the index and dwell times up to date.
+  void assign(std::size_t instance, TCode code)
+  {
+    if (codes_[instance] != code)
+    {
+      if (is_indexed_)
+      {
+        unlink(instance, codes_[instance]);
+        link(instance, code);
+      }
+      if (is_timed_)
+      {
+        time_change(instance, codes_[instance], code);
+      }
+    }
+    codes_[instance] = code;
+  }
+
+  /**
+   * Apply a transition table to a range of instances, collecting those that
+   * need firing individually in slow_indices_.
+   */
+  void apply_table(const std::vector<TCode>& table, std::size_t first, std::size_t last)
+  {
+    slow_indices_.clear();
+    if (!is_indexed_ && !is_timed_)
+    {
+      detail::apply_table<TCode>(
+        codes_.data() + first, last - first, table.data(), table.size(),
+        slow_marker(), slow_indices_, first);
+      return;
+    }
+    for (std::size_t instance = first; instance < last; ++instance)
+    {
+      const TCode next = table[codes_[instance]];
+      if (next == slow_marker())
+      {
+        slow_indices_.push_back(instance);
+      }
+      else
+      {
+        assign(instance, next);
+      }
+    }
+  }
+
+  /// A journaled transition passed to a replay thread.
+  struct replay_item
+  {
+    std::uint64_t instance;
+    TState source;
+    TState destination;
+    TTrigger trigger;
+  };
+
+  /**
+   * Replay a journal on several threads, each replaying the records for its
+   * partitions as the calling thread reads them. Each thread counts in its
+   * own variables, which are merged once it has finished.
+   *
+   * \param limit Raised to the code limit of the replayed destinations.
+   *
+   * \return The number of records replayed.
+   */
+  template<typename TJournal>
+  std::size_t replay_partitioned(
+    const TJournal& journal,
+    std::size_t threads,
+    replay_mode mode,
+    std::size_t& limit)
+  {
+    typedef detail::chunk_queue<replay_item> TQueue;
+    const std::size_t chunk_size = 4096;
+    std::vector<std::unique_ptr<TQueue>> queues;
+    std::vector<typename TQueue::TChunk> chunks(threads);
+    for (std::size_t partition = 0; partition < threads; ++partition)
+    {
+      queues.emplace_back(new TQueue(4));
+      chunks[partition].reserve(chunk_size);
+    }
+    std::vector<std::size_t> replayed(threads, 0);
+    std::vector<std::size_t> limits(threads, 0);
+    std::vector<std::exception_ptr> failures(threads + 1);
+
+    auto replay_partition = [&](std::size_t partition)
+      {
+        std::size_t partition_replayed = 0, partition_limit = 0;
+        typename TQueue::TChunk chunk;
+        try
+        {
+          while (queues[partition]->pop(chunk))
+          {
+            for (auto& item : chunk)
+            {
+              replay_record(item.instance, item.source, item.destination, item.trigger,
+                mode, partition_limit);
+              ++partition_replayed;
+            }
+          }
+        }
+        catch (...)
+        {
+          failures[partition] = std::current_exception();
+          queues[partition]->abandon();
+        }
+        replayed[partition] = partition_replayed;
+        limits[partition] = partition_limit;
+      };
+    std::vector<std::thread> workers;
+    for (std::size_t partition = 0; partition < threads; ++partition)
+    {
+      workers.emplace_back(replay_partition, partition);
+    }
+
+    try
+    {
+      journal.for_each(
+        [&](const typename TJournal::entry& e)
+        {
+          const std::size_t partition = static_cast<std::size_t>((e.instance() >> 12) % threads);
+          const replay_item item = { e.instance(), e.source(), e.destination(), e.trigger() };
+          auto& chunk = chunks[partition];
+          chunk.push_back(item);
+          if (chunk.size() == chunk_size)
+          {
+            queues[partition]->push(chunk);
+          }
+        });
+      for (std::size_t partition = 0; partition < threads; ++partition)
+      {
+        if (!chunks[partition].empty())
+        {
+          queues[partition]->push(chunks[partition]);
+        }
+      }
+    }
+    catch (...)
+    {
+      failures[threads] = std::current_exception();
+    }
+    for (auto& queue : queues)
+    {
+      queue->close();
+    }
+    for (auto& worker : workers)
+    {
+      worker.join();
+    }
+
+    limit = std::max(limit, *std::max_element(limits.begin(), limits.end()));
+    for (auto& failure : failures)
+    {
+      if (failure)
+      {
+        std::rethrow_exception(failure);
+      }
+    }
+    std::size_t total = 0;
+    for (auto count : replayed)
+    {
+      total += count;
+    }
+    return total;
+  }
+
+  /**
+   * Replay one journaled transition. Called concurrently for instances in
+   * different partitions, so it must not modify any shared member.
+   */
+  void replay_record(
+    std::uint64_t instance,
+    const TState& source,
+    const TState& destination,
+    const TTrigger& trigger,
+    replay_mode mode,
+    std::size_t& limit)
+  {
+    if (instance >= codes_.size())
+    {
+      throw error("Journaled instance is out of bounds.");
+    }
+    const TCode code = encode_state(destination);
+    limit = std::max(limit, static_cast<std::size_t>(code) + 1);
+    if (mode == replay_mode::state_only)
+    {
+      codes_[static_cast<std::size_t>(instance)] = code;
+      return;
+    }
+    typedef typename TDefinition::TTransition TTransition;
+    const TTransition transition(source, destination, trigger);
+    auto source_representation = definition_->find_representation(source);
+    if (source_representation != nullptr)
+    {
+      source_representation->exit(transition);
+    }
+    codes_[static_cast<std::size_t>(instance)] = code;
+    auto destination_representation = definition_->find_representation(destination);
+    if (destination_representation != nullptr)
+    {
+      destination_representation->enter(transition);
+    }
+  }
+
+  /// Fire the trigger for the instances left by the table lookup.
+  std::size_t fire_slow(const TTrigger& trigger)
+  {
+    std::size_t unhandled = 0;
+    for (auto instance : slow_indices_)
+    {
+      TState s = decode(codes_[instance]);
+      current_scope scope(*this, instance);
+      if (!definition_->try_fire(current_observer(), s, trigger))
+      {
+        ++unhandled;
+        continue;
+      }
+      assign(instance, encode(s));
+    }
+    return unhandled;
+  }
+
+  /**
+   * Fire the trigger for a group of instances that share a state, resolving
+   * the handler once for the whole group.
+   *
+   * \return The number of instances for which the trigger was not permitted.
+   */
+  std::size_t fire_group(const TTrigger& trigger, TCode code, std::size_t first, std::size_t last)
+  {
+    const TState source = decode(code);
+    auto handler = definition_->find_handler(source, trigger);
+    if (handler == nullptr)
+    {
+      return last - first;
+    }
+    TState destination;
+    if (!detail::results_in_transition_from<TState, TTrigger>(handler, source, destination))
+    {
+      return 0;
+    }
+
+    typedef typename TDefinition::TTransition TTransition;
+    const TTransition transition(source, destination, trigger);
+    const TCode destination_code = encode(destination);
+    auto source_representation = definition_->find_representation(source);
+    auto destination_representation = definition_->find_representation(destination);
+    for (std::size_t i = first; i < last; ++i)
+    {
+      const std::size_t instance = grouped_indices_[i];
+      current_scope scope(*this, instance);
+      source_representation->exit(transition);
+      assign(instance, destination_code);
+      if (destination_representation != nullptr)
+      {
+        destination_representation->enter(transition);
+      }
+    }
+    return 0;
+  }
+
+  TDefinitionPtr definition_;
+  detail::code_column<TCode> codes_;
+  std::size_t code_limit_;
+  std::map<TTrigger, std::vector<TCode>> tables_;
+  std::vector<std::size_t> slow_indices_;
+  std::vector<std::size_t> group_offsets_;
+  std::vector<std::size_t> group_cursors_;
+  std::vector<std::size_t> grouped_indices_;
+  std::size_t current_;
+
+  /**
+   * State index: per code list heads and counts, the codes of each code's
+   * super states and the number of instances in their substates, and per
+   * instance links.
+   */
+  bool is_indexed_;
+  std::vector<std::uint32_t> heads_;
+  std::vector<std::size_t> counts_;
+  std::vector<std::vector<TCode>> super_codes_;
+  std::vector<std::size_t> nested_counts_;
+  std::vector<std::uint32_t> prev_;
+  std::vector<std::uint32_t> next_;
+
+  /**
+   * Dwell times: per instance entry times, and per code the time closed by
+   * leaving the state, the number of instances in it and the sum of their
+   * entry times. Optionally per instance totals, a row of stride per instance.
+   */
+  bool is_timed_;
+  bool is_timed_per_instance_;
+  std::vector<TTicks> entered_;
+  std::vector<TTicks> closed_totals_;
+  std::vector<std::size_t> occupants_;
+  std::vector<TTicks> entered_sums_;
+  std::vector<TTicks> instance_totals_;
+  std::size_t instance_totals_stride_;
+
+#ifdef STATELESS_ENABLE_INSTRUMENTATION
+  TFireObserver* observer_;
+#endif
+};
+
+template<typename TState, typename TTrigger, typename TCode, typename TClock>
+const std::size_t instance_store<TState, TTrigger, TCode, TClock>::npos;
+
+template<typename TState, typename TTrigger, typename TCode, typename TClock>
+const std::uint32_t instance_store<TState, TTrigger, TCode, TClock>::nil;
+
+}
+
+#endif // STATELESS_INSTANCE_STORE_HPP
@@ -0,0 +1,593 @@
+/**
+ * Copyright 2013 Matt Mason
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#ifndef STATELESS_JOURNAL_HPP
+#define STATELESS_JOURNAL_HPP
+
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <mutex>
+#include <string>
+#include <type_traits>
+#include <vector>
+
+#include "detail/posix_file.hpp"
+#include "detail/transition.hpp"
+#include "detail/varint.hpp"
+#include "error.hpp"
+
+namespace stateless
+{
+
+namespace detail
+{
+
+/// Identifies a journal file and the version of its record format.
+struct journal_file_header
+{
+  char magic[8];
+  std::uint32_t version;
+  std::uint32_t reserved;
+};
+
+/**
+ * The fixed-width part of a journal record. It is followed by the packed
+ * transition arguments, padded so that the next record is 8-byte aligned.
+ * The checksum is the CRC-32 of the rest of the record, padding included.
+ */
+struct journal_record_header
+{
+  std::uint32_t checksum;
+  std::uint32_t argument_size;
+  std::uint64_t instance;
+  std::int64_t timestamp;
+  std::uint32_t source;
+  std::uint32_t destination;
+  std::uint32_t trigger;
+  std::uint32_t reserved;
+};
+
+static_assert(sizeof(journal_file_header) == 16, "Unexpected journal file header layout.");
+static_assert(sizeof(journal_record_header) == 40, "Unexpected journal record layout.");
+
+inline journal_file_header journal_header()
+{
+  journal_file_header header = { { 'S', 'T', 'L', 'S', 'J', 'R', 'N', 'L' }, 2, 0 };
+  return header;
+}
+
+inline bool is_journal_header(const unsigned char* data, std::size_t size)
+{
+  const auto expected = journal_header();
+  return size >= sizeof(expected) && std::memcmp(data, &expected, sizeof(expected)) == 0;
+}
+
+inline std::size_t journal_record_size(std::size_t argument_size)
+{
+  return sizeof(journal_record_header) + ((argument_size + 7) & ~std::size_t(7));
+}
+
+/// The checksum of a complete record.
+inline std::uint32_t journal_record_checksum(const unsigned char* record, std::size_t record_size)
+{
+  const std::size_t skip = sizeof(journal_record_header().checksum);
+  return crc32(record + skip, record_size - skip);
+}
+
+/**
+ * The length of the intact records at the start of a journal, so that a
+ * record torn or corrupted by a crash during a write, and everything after
+ * it, is ignored.
+ */
+inline std::size_t journal_valid_size(const unsigned char* data, std::size_t size)
+{
+  std::size_t offset = sizeof(journal_file_header);
+  while (size - offset >= sizeof(journal_record_header))
+  {
+    const auto& header = *reinterpret_cast<const journal_record_header*>(data + offset);
+    const std::size_t record_size = journal_record_size(header.argument_size);
+    if (size - offset < record_size ||
+        journal_record_checksum(data + offset, record_size) != header.checksum)
+    {
+      break;
+    }
+    offset += record_size;
+  }
+  return offset;
+}
+
+/// The code with which a state or trigger is journaled.
+template<typename T>
+std::uint32_t journal_code(const T& value)
+{
+  static_assert(std::is_enum<T>::value || std::is_integral<T>::value,
+    "Journaled states and triggers must be enumerations or integers.");
+  return static_cast<std::uint32_t>(value);
+}
+
+inline std::size_t packed_size()
+{
+  return 0;
+}
+
+template<typename TArg, typename... TArgs>
+std::size_t packed_size(const TArg&, const TArgs&... args)
+{
+  static_assert(std::is_trivially_copyable<TArg>::value,
+    "Journaled arguments must be trivially copyable.");
+  return sizeof(TArg) + packed_size(args...);
+}
+
+inline void pack(unsigned char*)
+{}
+
+template<typename TArg, typename... TArgs>
+void pack(unsigned char* out, const TArg& arg, const TArgs&... args)
+{
+  std::memcpy(out, &arg, sizeof(TArg));
+  pack(out + sizeof(TArg), args...);
+}
+
+inline void unpack(const unsigned char*)
+{}
+
+template<typename TArg, typename... TArgs>
+void unpack(const unsigned char* in, TArg& arg, TArgs&... args)
+{
+  std::memcpy(&arg, in, sizeof(TArg));
+  unpack(in + sizeof(TArg), args...);
+}
+
+}
+
+/**
+ * Appends transitions to a binary journal file.
+ *
+ * Records are buffered in memory and written when the buffer fills, on
+ * flush() and on commit(). Records are durable once a commit() that
+ * follows them returns. Any number of threads may append and commit
+ * concurrently: appending does not wait for writes in progress, and a
+ * commit that finds its records already synced by another returns at once,
+ * so one sync serves every thread that was waiting.
+ *
+ * If writing a batch of records fails, for example because the disk is
+ * full, whatever part of it reached the file is truncated away and the
+ * batch is kept, ahead of any records appended since, to be written again
+ * by the next flush() or commit(). The failing call raises the error and
+ * the records are not durable until a later commit() succeeds, so the
+ * file only ever holds a prefix of the appended records, in order, each
+ * written once.
+ *
+ * Each record holds the instance id, source and destination states,
+ * trigger, timestamp and packed arguments of a transition, and a CRC-32
+ * with which readers detect a record that was not completely written.
+ * States and triggers must be enumerations or integers, and arguments
+ * trivially copyable. The file format is native endian.
+ *
+ * \tparam TState The type used to represent the states.
+ * \tparam TTrigger The type used to represent the triggers that cause state transitions.
+ */
+template<typename TState, typename TTrigger>
+class journal_writer
+{
+public:
+  /// Parameterized transition type.
+  typedef detail::transition<TState, TTrigger> TTransition;
+
+  /**
+   * Open a journal for appending, creating it if necessary.
+   * A record torn or corrupted by a crash in an existing journal is removed,
+   * along with every record after it.
+   *
+   * \param path The journal file.
+   * \param buffer_size The number of bytes to buffer before writing.
+   *
+   * \throw error The file cannot be opened or is not a journal.
+   */
+  journal_writer(const std::string& path, std::size_t buffer_size = 1 << 16)
+    : file_(path, O_RDWR | O_CREAT | O_APPEND)
+    , buffer_size_(buffer_size)
+    , mutex_()
+    , buffer_()
+    , appended_(0)
+    , io_mutex_()
+    , spare_()
+    , durable_(0)
+    , written_size_(0)
+    , is_torn_(false)
+  {
+    buffer_.reserve(buffer_size_);
+    spare_.reserve(buffer_size_);
+    const std::size_t size = file_.size();
+    if (size == 0)
+    {
+      const auto header = detail::journal_header();
+      file_.write_all(&header, sizeof(header));
+      file_.sync();
+      written_size_ = sizeof(header);
+      return;
+    }
+    std::size_t valid_size = 0;
+    {
+      detail::mapped_file existing(path);
+      if (!detail::is_journal_header(existing.data(), existing.size()))
+      {
+        throw error("The file is not a journal.");
+      }
+      valid_size = detail::journal_valid_size(existing.data(), existing.size());
+    }
+    if (valid_size != size && ::ftruncate(file_.get(), static_cast<off_t>(valid_size)) != 0)
+    {
+      throw error("Unable to remove a torn record from the journal.");
+    }
+    written_size_ = valid_size;
+  }
+
+  /// Write any buffered records. They are not synced.
+  ~journal_writer()
+  {
+    try
+    {
+      flush();
+    }
+    catch (...)
+    {}
+  }
+
+  /**
+   * Append a transition, timestamped with the system clock.
+   *
+   * \param instance The id of the instance that made the transition.
+   * \param transition The transition.
+   * \param args The arguments passed in the transition.
+   */
+  template<typename... TArgs>
+  void append(std::uint64_t instance, const TTransition& transition, const TArgs&... args)
+  {
+    const auto now = std::chrono::duration_cast<std::chrono::nanoseconds>(
+      std::chrono::system_clock::now().time_since_epoch());
+    append_at(now.count(), instance, transition, args...);
+  }
+
+  /**
+   * Append a transition with the supplied timestamp.
+   *
+   * \param timestamp The time of the transition, in nanoseconds since the epoch.
+   * \param instance The id of the instance that made the transition.
+   * \param transition The transition.
+   * \param args The arguments passed in the transition.
+   */
+  template<typename... TArgs>
+  void append_at(
+    std::int64_t timestamp,
+    std::uint64_t instance,
+    const TTransition& transition,
+    const TArgs&... args)
+  {
+    detail::journal_record_header header;
+    header.checksum = 0;
+    header.reserved = 0;
+    header.instance = instance;
+    header.timestamp = timestamp;
+    header.source = detail::journal_code(transition.source());
+    header.destination = detail::journal_code(transition.destination());
+    header.trigger = detail::journal_code(transition.trigger());
+    header.argument_size = static_cast<std::uint32_t>(detail::packed_size(args...));
+    const std::size_t record_size = detail::journal_record_size(header.argument_size);
+
+    bool is_full;
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      const std::size_t offset = buffer_.size();
+      buffer_.resize(offset + record_size);
+      unsigned char* out = buffer_.data() + offset;
+      std::memcpy(out, &header, sizeof(header));
+      detail::pack(out + sizeof(header), args...);
+      // Zero the padding so that journals are reproducible.
+      std::memset(out + sizeof(header) + header.argument_size, 0,
+        record_size - sizeof(header) - header.argument_size);
+      const std::uint32_t checksum = detail::journal_record_checksum(out, record_size);
+      std::memcpy(out, &checksum, sizeof(checksum));
+      ++appended_;
+      is_full = buffer_.size() >= buffer_size_;
+    }
+    if (is_full)
+    {
+      flush();
+    }
+  }
+
+  /**
+   * Write the buffered records to the file, without syncing.
+   *
+   * \throw error The records cannot be written; they are kept to be
+   *              written again.
+   */
+  void flush()
+  {
+    std::lock_guard<std::mutex> io_lock(io_mutex_);
+    write_buffered();
+  }
+
+  /**
+   * Write the buffered records and make them, and every record appended
+   * before them, durable.
+   *
+   * \throw error The records cannot be written; they are kept to be
+   *              written again.
+   */
+  void commit()
+  {
+    std::uint64_t target;
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      target = appended_;
+    }
+    std::lock_guard<std::mutex> io_lock(io_mutex_);
+    if (durable_ >= target)
+    {
+      return;
+    }
+    const std::uint64_t written = write_buffered();
+    file_.sync();
+    durable_ = written;
+  }
+
+  /// The number of records appended since the journal was opened.
+  std::uint64_t appended() const
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return appended_;
+  }
+
+  /// The number of records appended since the journal was opened that are durable.
+  std::uint64_t durable() const
+  {
+    return durable_;
+  }
+
+private:
+  journal_writer(const journal_writer&);
+  journal_writer& operator=(const journal_writer&);
+
+  /**
+   * Take the buffer, leaving the spare one to append to, and write it.
+   * Called with io_mutex_ held, so batches are written in order.
+   *
+   * \return The number of records appended up to the end of the batch.
+   */
+  std::uint64_t write_buffered()
+  {
+    std::uint64_t count;
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      buffer_.swap(spare_);
+      count = appended_;
+    }
+    if (spare_.empty())
+    {
+      return count;
+    }
+    try
+    {
+      if (is_torn_)
+      {
+        remove_torn_batch();
+      }
+      file_.write_all(spare_.data(), spare_.size());
+    }
+    catch (...)
+    {
+      // Part of the batch may have been written. Remove it now if possible,
+      // and put the batch back ahead of the records appended since.
+      is_torn_ = ::ftruncate(file_.get(), static_cast<off_t>(written_size_)) != 0;
+      {
+        std::lock_guard<std::mutex> lock(mutex_);
+        spare_.insert(spare_.end(), buffer_.begin(), buffer_.end());
+        buffer_.swap(spare_);
+      }
+      spare_.clear();
+      throw;
+    }
+    written_size_ += spare_.size();
+    spare_.clear();
+    return count;
+  }
+
+  /// Truncate the file to the end of the last batch written in full.
+  void remove_torn_batch()
+  {
+    if (::ftruncate(file_.get(), static_cast<off_t>(written_size_)) != 0)
+    {
+      throw error("Unable to remove a partly written batch from the journal.");
+    }
+    is_torn_ = false;
+  }
+
+  detail::file_descriptor file_;
+  const std::size_t buffer_size_;
+
+  /// Guards the buffer being appended to.
+  mutable std::mutex mutex_;
+  std::vector<unsigned char> buffer_;
+  std::uint64_t appended_;
+
+  /// Serializes writes and syncs, and guards the buffer being written.
+  std::mutex io_mutex_;
+  std::vector<unsigned char> spare_;
+  std::atomic<std::uint64_t> durable_;
+
+  /// The size of the file up to the end of the last batch written in full.
+  std::size_t written_size_;
+
+  /// Whether part of a failed batch may remain after written_size_.
+  bool is_torn_;
+};
+
+/**
+ * Reads a journal written by journal_writer, in place in a read-only
+ * memory mapping of the file. Reading does not allocate per record.
+ *
+ * \tparam TState The type used to represent the states.
+ * \tparam TTrigger The type used to represent the triggers that cause state transitions.
+ */
+template<typename TState, typename TTrigger>
+class journal_reader
+{
+public:
+  /// A view of one record in the mapped journal.
+  class entry
+  {
+  public:
+    /// The id of the instance that made the transition.
+    std::uint64_t instance() const
+    {
+      return header().instance;
+    }
+
+    TState source() const
+    {
+      return static_cast<TState>(header().source);
+    }
+
+    TState destination() const
+    {
+      return static_cast<TState>(header().destination);
+    }
+
+    TTrigger trigger() const
+    {
+      return static_cast<TTrigger>(header().trigger);
+    }
+
+    /// The time of the transition, in nanoseconds since the epoch.
+    std::int64_t timestamp() const
+    {
+      return header().timestamp;
+    }
+
+    /// The packed arguments.
+    const unsigned char* arguments() const
+    {
+      return data_ + sizeof(detail::journal_record_header);
+    }
+
+    std::size_t argument_size() const
+    {
+      return header().argument_size;
+    }
+
+    /**
+     * Unpack the arguments.
+     *
+     * \throw error The arguments were not packed from the supplied types.
+     */
+    template<typename... TArgs>
+    void read_arguments(TArgs&... args) const
+    {
+      if (detail::packed_size(args...) != argument_size())
+      {
+        throw error("The journaled arguments do not match the supplied types.");
+      }
+      detail::unpack(arguments(), args...);
+    }
+
+  private:
+    friend class journal_reader;
+
+    explicit entry(const unsigned char* data)
+      : data_(data)
+    {}
+
+    const detail::journal_record_header& header() const
+    {
+      return *reinterpret_cast<const detail::journal_record_header*>(data_);
+    }
+
+    const unsigned char* data_;
+  };
+
+  /**
+   * Map a journal. Records appended after it is mapped are not read.
+   *
+   * \param path The journal file.
+   *
+   * \throw error The file cannot be mapped or is not a journal.
+   */
+  explicit journal_reader(const std::string& path)
+    : file_(path)
+    , size_(0)
+  {
+    if (!detail::is_journal_header(file_.data(), file_.size()))
+    {
+      throw error("The file is not a journal.");
+    }
+    size_ = detail::journal_valid_size(file_.data(), file_.size());
+    file_.advise_sequential();
+  }
+
+  /**
+   * Visit every intact record, in the order in which they were appended.
+   *
+   * \param visitor Function called with each entry.
+   *
+   * \return The number of records visited.
+   */
+  template<typename TCallable>
+  std::size_t for_each(TCallable visitor) const
+  {
+    std::size_t count = 0;
+    const unsigned char* data = file_.data();
+    for (std::size_t offset = sizeof(detail::journal_file_header); offset < size_; ++count)
+    {
+      const entry e(data + offset);
+      visitor(e);
+      offset += detail::journal_record_size(e.argument_size());
+    }
+    return count;
+  }
+
+  /**
+   * Set the state of each journaled instance in a store to its last
+   * journaled destination.
+   *
+   * \param store A store, such as an instance_store, with set_state(id, state).
+   *              It must already hold every journaled instance.
+   *
+   * \return The number of records replayed.
+   */
+  template<typename TStore>
+  std::size_t replay_into(TStore& store) const
+  {
+    return for_each(
+      [&](const entry& e)
+      {
+        store.set_state(static_cast<std::size_t>(e.instance()), e.destination());
+      });
+  }
+
+private:
+  detail::mapped_file file_;
+  std::size_t size_;
+};
+
+}
+
+#endif // STATELESS_JOURNAL_HPP
@@ -0,0 +1,296 @@
+/**
+ * Copyright 2013 Matt Mason
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#ifndef STATELESS_LATENCY_HISTOGRAMS_HPP
+#define STATELESS_LATENCY_HISTOGRAMS_HPP
+
+#include <array>
+#include <cstddef>
+#include <map>
+#include <mutex>
+#include <tuple>
+#include <utility>
+#include <vector>
+
+#include "clocks.hpp"
+#include "detail/per_thread.hpp"
+#include "fire_observer.hpp"
+#include "log_histogram.hpp"
+
+namespace stateless
+{
+
+/**
+ * Records how long each phase of handling a trigger takes, in histograms
+ * for each combination of source state and trigger, so that a slow action
+ * can be told apart from time spent in the library.
+ *
+ * Each thread records into its own histograms, which are merged when read.
+ * Times are in ticks of TClock; cycle_clock::ticks_per_nanosecond()
+ * converts cycles.
+ *
+ * Recording requires STATELESS_ENABLE_INSTRUMENTATION to be defined; see
+ * state_machine::set_observer() and instance_store::set_observer().
+ *
+ * \tparam TState The type used to represent the states.
+ * \tparam TTrigger The type used to represent the triggers that cause state transitions.
+ * \tparam TClock A clock with a static now() returning an unsigned tick count.
+ */
+template<typename TState, typename TTrigger, typename TClock = cycle_clock>
+class latency_histograms : public fire_observer<TState, TTrigger>
+{
+public:
+  /// Parameterized transition type.
+  typedef typename fire_observer<TState, TTrigger>::TTransition TTransition;
+
+  /// The phases of handling a trigger.
+  enum class phase
+  {
+    /// Finding the handler and destination, excluding guards.
+    lookup,
+    /// Evaluating guards.
+    guards,
+    /// Executing exit actions.
+    exit,
+    /// Setting the new state.
+    state_change,
+    /// Executing entry actions.
+    entry,
+    /// Executing the transition action and notifying waiters.
+    transition_action,
+    /// Handling the trigger from start to finish.
+    total
+  };
+
+  /// The number of phases.
+  static const std::size_t phase_count = 7;
+
+  latency_histograms()
+    : threads_()
+  {}
+
+  /**
+   * The times taken by a phase when a trigger was fired in a state.
+   *
+   * \param p The phase.
+   * \param source The state in which the trigger was fired.
+   * \param trigger The trigger.
+   */
+  log_histogram histogram(phase p, const TState& source, const TTrigger& trigger) const
+  {
+    return merged(p, [&](const TState& s, const TTrigger& t){ return s == source && t == trigger; });
+  }
+
+  /**
+   * The times taken by a phase for every trigger fired in a state.
+   *
+   * \param p The phase.
+   * \param source The state in which the triggers were fired.
+   */
+  log_histogram histogram_for_state(phase p, const TState& source) const
+  {
+    return merged(p, [&](const TState& s, const TTrigger&){ return s == source; });
+  }
+
+  /**
+   * The times taken by a phase whenever a trigger was fired.
+   *
+   * \param p The phase.
+   * \param trigger The trigger.
+   */
+  log_histogram histogram_for_trigger(phase p, const TTrigger& trigger) const
+  {
+    return merged(p, [&](const TState&, const TTrigger& t){ return t == trigger; });
+  }
+
+  virtual bool on_fire(const TState& source, const TTrigger& trigger)
+  {
+    auto& t = threads_.local();
+    const auto key = std::make_pair(source, trigger);
+    auto it = t.histograms.find(key);
+    if (it == t.histograms.end())
+    {
+      std::lock_guard<std::mutex> lock(t.mutex);
+      it = t.histograms.emplace(
+        std::piecewise_construct, std::forward_as_tuple(key), std::forward_as_tuple()).first;
+    }
+    if (t.frames.size() == max_depth)
+    {
+      // Only reached if actions have thrown, abandoning frames.
+      t.frames.clear();
+    }
+    const typename TClock::rep now = TClock::now();
+    frame f = { &it->second, now, now, now, 0, false };
+    t.frames.push_back(f);
+    return true;
+  }
+
+  virtual void on_evaluating_guard(const TState&, const TTrigger&)
+  {
+    current().guard_start = TClock::now();
+  }
+
+  virtual void on_guard(const TState&, const TTrigger&, bool)
+  {
+    auto& f = current();
+    f.guards += TClock::now() - f.guard_start;
+    f.has_guards = true;
+  }
+
+  virtual void on_unhandled(const TState&, const TTrigger&)
+  {
+    resolve(TClock::now());
+    finish();
+  }
+
+  virtual void on_ignored(const TState&, const TTrigger&)
+  {
+    resolve(TClock::now());
+    finish();
+  }
+
+  virtual void on_resolved(const TTransition&)
+  {
+    resolve(TClock::now());
+  }
+
+  virtual void on_exited(const TTransition&)
+  {
+    lap(phase::exit);
+  }
+
+  virtual void on_state_changed(const TTransition&)
+  {
+    lap(phase::state_change);
+  }
+
+  virtual void on_entered(const TTransition&)
+  {
+    lap(phase::entry);
+  }
+
+  virtual void on_transitioned(const TTransition&)
+  {
+    lap(phase::transition_action);
+    finish();
+  }
+
+private:
+  latency_histograms(const latency_histograms&);
+  latency_histograms& operator=(const latency_histograms&);
+
+  /// Bound on nested triggers, beyond which frames are assumed to be abandoned.
+  static const std::size_t max_depth = 64;
+
+  typedef std::array<detail::owned_log_histogram, phase_count> TPhaseHistograms;
+
+  /// Timing of a trigger being handled.
+  struct frame
+  {
+    TPhaseHistograms* histograms;
+    typename TClock::rep start;
+    typename TClock::rep last;
+    typename TClock::rep guard_start;
+    typename TClock::rep guards;
+    bool has_guards;
+  };
+
+  /// The histograms of one thread. The map only grows, so readers can iterate it under the lock.
+  struct thread_histograms
+  {
+    thread_histograms()
+      : mutex()
+      , histograms()
+      , frames()
+    {}
+
+    /// Held by the owning thread while it adds an entry, and by readers.
+    mutable std::mutex mutex;
+    std::map<std::pair<TState, TTrigger>, TPhaseHistograms> histograms;
+
+    /// The triggers being handled, innermost last.
+    std::vector<frame> frames;
+  };
+
+  frame& current()
+  {
+    return threads_.local().frames.back();
+  }
+
+  void record(frame& f, phase p, typename TClock::rep ticks)
+  {
+    (*f.histograms)[static_cast<std::size_t>(p)].record(ticks);
+  }
+
+  /// Record the lookup and guards once the handler has been resolved.
+  void resolve(typename TClock::rep now)
+  {
+    auto& f = current();
+    record(f, phase::lookup, now - f.start - f.guards);
+    if (f.has_guards)
+    {
+      record(f, phase::guards, f.guards);
+    }
+    f.last = now;
+  }
+
+  /// Record the time since the previous phase.
+  void lap(phase p)
+  {
+    auto& f = current();
+    const typename TClock::rep now = TClock::now();
+    record(f, p, now - f.last);
+    f.last = now;
+  }
+
+  void finish()
+  {
+    auto& t = threads_.local();
+    record(t.frames.back(), phase::total, t.frames.back().last - t.frames.back().start);
+    t.frames.pop_back();
+  }
+
+  template<typename TPredicate>
+  log_histogram merged(phase p, TPredicate matches) const
+  {
+    log_histogram result;
+    threads_.for_each([&](const thread_histograms& t)
+      {
+        std::lock_guard<std::mutex> lock(t.mutex);
+        for (auto& entry : t.histograms)
+        {
+          if (matches(entry.first.first, entry.first.second))
+          {
+            entry.second[static_cast<std::size_t>(p)].add_to(result);
+          }
+        }
+      });
+    return result;
+  }
+
+  detail::per_thread<thread_histograms> threads_;
+};
+
+template<typename TState, typename TTrigger, typename TClock>
+const std::size_t latency_histograms<TState, TTrigger, TClock>::phase_count;
+
+template<typename TState, typename TTrigger, typename TClock>
+const std::size_t latency_histograms<TState, TTrigger, TClock>::max_depth;
+
+}
+
+#endif // STATELESS_LATENCY_HISTOGRAMS_HPP
@@ -0,0 +1,266 @@
+/**
+ * Copyright 2013 Matt Mason
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#ifndef STATELESS_LOG_HISTOGRAM_HPP
+#define STATELESS_LOG_HISTOGRAM_HPP
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+
+namespace stateless
+{
+
+namespace detail
+{
+
+/// The index of the most significant set bit of a non-zero value.
+inline unsigned most_significant_bit(std::uint64_t value)
+{
+#if defined(__GNUC__)
+  return 63 - static_cast<unsigned>(__builtin_clzll(value));
+#elif defined(_MSC_VER) && defined(_M_X64)
+  unsigned long index;
+  _BitScanReverse64(&index, value);
+  return static_cast<unsigned>(index);
+#else
+  unsigned index = 0;
+  while (value >>= 1)
+  {
+    ++index;
+  }
+  return index;
+#endif
+}
+
+class owned_log_histogram;
+
+}
+
+/**
+ * A histogram of unsigned 64 bit values, such as latencies, in buckets whose
+ * width grows with their value. Each power of two is divided into eight
+ * buckets, so recorded values are resolved to within 12.5% across the whole
+ * range in under 4 KiB.
+ */
+class log_histogram
+{
+public:
+  /// The number of bits of each value, below the most significant, that select its bucket.
+  static const unsigned sub_bucket_bits = 3;
+
+  /// The number of buckets.
+  static const std::size_t bucket_count = (64 - sub_bucket_bits + 1) << sub_bucket_bits;
+
+  log_histogram()
+    : buckets_()
+    , count_(0)
+    , sum_(0)
+    , max_(0)
+  {
+    buckets_.fill(0);
+  }
+
+  /// The bucket that holds a value.
+  static std::size_t bucket_of(std::uint64_t value)
+  {
+    const std::uint64_t sub_buckets = std::uint64_t(1) << sub_bucket_bits;
+    if (value < sub_buckets)
+    {
+      return static_cast<std::size_t>(value);
+    }
+    const unsigned shift = detail::most_significant_bit(value) - sub_bucket_bits;
+    return static_cast<std::size_t>(((shift + 1) << sub_bucket_bits) + (value >> shift) - sub_buckets);
+  }
+
+  /// The smallest value held by a bucket.
+  static std::uint64_t lowest_value(std::size_t bucket)
+  {
+    const std::uint64_t sub_buckets = std::uint64_t(1) << sub_bucket_bits;
+    if (bucket < sub_buckets)
+    {
+      return bucket;
+    }
+    const std::size_t group = bucket >> sub_bucket_bits;
+    return (sub_buckets + (bucket & (sub_buckets - 1))) << (group - 1);
+  }
+
+  /// The largest value held by a bucket.
+  static std::uint64_t highest_value(std::size_t bucket)
+  {
+    return bucket + 1 == bucket_count ? ~std::uint64_t(0) : lowest_value(bucket + 1) - 1;
+  }
+
+  void record(std::uint64_t value)
+  {
+    record(value, 1);
+  }
+
+  /// Record a value a number of times.
+  void record(std::uint64_t value, std::uint64_t times)
+  {
+    buckets_[bucket_of(value)] += times;
+    count_ += times;
+    sum_ += value * times;
+    max_ = std::max(max_, value);
+  }
+
+  /// Add the values recorded in another histogram.
+  void merge(const log_histogram& other)
+  {
+    for (std::size_t i = 0; i < bucket_count; ++i)
+    {
+      buckets_[i] += other.buckets_[i];
+    }
+    count_ += other.count_;
+    sum_ += other.sum_;
+    max_ = std::max(max_, other.max_);
+  }
+
+  /// The number of values recorded.
+  std::uint64_t count() const
+  {
+    return count_;
+  }
+
+  /// The number of values recorded in a bucket.
+  std::uint64_t count_in_bucket(std::size_t bucket) const
+  {
+    return buckets_[bucket];
+  }
+
+  /// The largest value recorded, or zero.
+  std::uint64_t max() const
+  {
+    return max_;
+  }
+
+  /// The mean of the values recorded, or zero.
+  double mean() const
+  {
+    return count_ == 0 ? 0.0 : static_cast<double>(sum_) / static_cast<double>(count_);
+  }
+
+  /**
+   * A value that the supplied percentage of recorded values do not exceed:
+   * the highest value of the bucket holding that percentile, or the largest
+   * value recorded if that is lower.
+   *
+   * \param percentile The percentile, from 0 to 100.
+   *
+   * \return The value, or zero if none has been recorded.
+   */
+  std::uint64_t value_at_percentile(double percentile) const
+  {
+    if (count_ == 0)
+    {
+      return 0;
+    }
+    const double clamped = std::min(100.0, std::max(0.0, percentile));
+    std::uint64_t rank = static_cast<std::uint64_t>(clamped / 100.0 * static_cast<double>(count_) + 0.5);
+    rank = std::max<std::uint64_t>(1, std::min(rank, count_));
+    std::uint64_t seen = 0;
+    for (std::size_t i = 0; i < bucket_count; ++i)
+    {
+      seen += buckets_[i];
+      if (seen >= rank)
+      {
+        return std::min(highest_value(i), max_);
+      }
+    }
+    return max_;
+  }
+
+private:
+  friend class detail::owned_log_histogram;
+
+  std::array<std::uint64_t, bucket_count> buckets_;
+  std::uint64_t count_;
+  std::uint64_t sum_;
+  std::uint64_t max_;
+};
+
+namespace detail
+{
+
+/**
+ * A log_histogram recorded by one thread and read by any. Recording uses
+ * relaxed loads and stores rather than atomic read-modify-write operations.
+ */
+class owned_log_histogram
+{
+public:
+  owned_log_histogram()
+    : buckets_()
+    , sum_(0)
+    , max_(0)
+  {
+    for (auto& bucket : buckets_)
+    {
+      bucket.store(0, std::memory_order_relaxed);
+    }
+  }
+
+  void record(std::uint64_t value)
+  {
+    bump(buckets_[log_histogram::bucket_of(value)], 1);
+    bump(sum_, value);
+    if (value > max_.load(std::memory_order_relaxed))
+    {
+      max_.store(value, std::memory_order_relaxed);
+    }
+  }
+
+  /// Add the recorded values to a histogram.
+  void add_to(log_histogram& result) const
+  {
+    for (std::size_t i = 0; i < log_histogram::bucket_count; ++i)
+    {
+      // The count is taken from the buckets so that it matches them.
+      const std::uint64_t n = buckets_[i].load(std::memory_order_relaxed);
+      result.buckets_[i] += n;
+      result.count_ += n;
+    }
+    result.sum_ += sum_.load(std::memory_order_relaxed);
+    result.max_ = std::max(result.max_, max_.load(std::memory_order_relaxed));
+  }
+
+private:
+  owned_log_histogram(const owned_log_histogram&);
+  owned_log_histogram& operator=(const owned_log_histogram&);
+
+  static void bump(std::atomic<std::uint64_t>& value, std::uint64_t n)
+  {
+    value.store(value.load(std::memory_order_relaxed) + n, std::memory_order_relaxed);
+  }
+
+  std::array<std::atomic<std::uint64_t>, log_histogram::bucket_count> buckets_;
+  std::atomic<std::uint64_t> sum_;
+  std::atomic<std::uint64_t> max_;
+};
+
+}
+
+}
+
+#endif // STATELESS_LOG_HISTOGRAM_HPP
@@ -0,0 +1,145 @@
+/**
+ * Copyright 2013 Matt Mason
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#ifndef STATELESS_MEMORY_USAGE_HPP
+#define STATELESS_MEMORY_USAGE_HPP
+
+#include <cstddef>
+#include <set>
+#include <vector>
+
+namespace stateless
+{
+
+/**
+ * The bytes used by a state machine, definition or instance store, by category.
+ *
+ * Bytes are worked out from the sizes of the objects held and the capacities
+ * of the containers holding them, with the overhead of each map node and of
+ * each shared object's control block estimated for a typical 64-bit standard
+ * library; allocator rounding and headers are not included. Each
+ * std::function is counted under closures, whatever holds it, but anything
+ * it allocates for a large captured state is not visible and not counted.
+ * Behaviours and actions shared with a frozen definition are counted by each.
+ */
+struct memory_usage
+{
+  memory_usage()
+    : representations(0)
+    , behaviours(0)
+    , closures(0)
+    , actions(0)
+    , trigger_parameters(0)
+    , instances(0)
+    , other(0)
+  {}
+
+  /// State representations and the map that holds them, including any arranged copies.
+  std::size_t representations;
+
+  /// Trigger behaviours and the lists of them for each trigger.
+  std::size_t behaviours;
+
+  /// Guards, decisions, actions and callbacks held as std::function.
+  std::size_t closures;
+
+  /// Entry and exit action lists and entry action objects.
+  std::size_t actions;
+
+  /// Parameter configurations of triggers that take arguments.
+  std::size_t trigger_parameters;
+
+  /// Columns that hold a value for each instance of an instance store.
+  std::size_t instances;
+
+  /// The objects themselves, queues, lookup tables and working buffers.
+  std::size_t other;
+
+  /// The sum of every category.
+  std::size_t total() const
+  {
+    return representations + behaviours + closures + actions +
+      trigger_parameters + instances + other;
+  }
+
+  memory_usage& operator+=(const memory_usage& rhs)
+  {
+    representations += rhs.representations;
+    behaviours += rhs.behaviours;
+    closures += rhs.closures;
+    actions += rhs.actions;
+    trigger_parameters += rhs.trigger_parameters;
+    instances += rhs.instances;
+    other += rhs.other;
+    return *this;
+  }
+};
+
+namespace detail
+{
+
+/// Estimated bytes of the control block std::make_shared allocates with an object.
+const std::size_t shared_control_block_size = sizeof(void*) + 2 * sizeof(int);
+
+/// Estimated bytes of a std::map node, beyond the value it holds.
+const std::size_t map_node_overhead = 4 * sizeof(void*);
+
+/// Bytes reserved by a vector.
+template<typename T, typename TAllocator>
+std::size_t capacity_bytes(const std::vector<T, TAllocator>& v)
+{
+  return v.capacity() * sizeof(T);
+}
+
+/**
+ * Add the bytes used by a state machine configuration.
+ *
+ * \param usage Receives the bytes.
+ * \param representations Mapping from state to representation.
+ * \param trigger_configuration Mapping of triggers with arguments to their parameter configuration.
+ * \param seen Shared objects already counted, which are not counted again.
+ */
+template<typename TRepresentations, typename TTriggerConfiguration>
+void add_configuration_usage(
+  memory_usage& usage,
+  const TRepresentations& representations,
+  const TTriggerConfiguration& trigger_configuration,
+  std::set<const void*>& seen)
+{
+  typedef typename TRepresentations::mapped_type TRepresentation;
+  for (auto& entry : representations)
+  {
+    usage.representations +=
+      sizeof(typename TRepresentations::value_type) - sizeof(TRepresentation) + map_node_overhead;
+    entry.second.add_memory_usage(usage, seen);
+  }
+  for (auto& entry : trigger_configuration)
+  {
+    usage.trigger_parameters += sizeof(typename TTriggerConfiguration::value_type) + map_node_overhead;
+    if (entry.second != nullptr && seen.insert(entry.second.get()).second)
+    {
+      // Parameter configurations differ only in type, so share one size.
+      usage.trigger_parameters += sizeof(*entry.second) + shared_control_block_size;
+    }
+  }
+}
+
+}
+
+}
+
+#endif // STATELESS_MEMORY_USAGE_HPP
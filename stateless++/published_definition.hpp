@@ -0,0 +1,271 @@
+/**
+ * Copyright 2013 Matt Mason
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#ifndef STATELESS_PUBLISHED_DEFINITION_HPP
+#define STATELESS_PUBLISHED_DEFINITION_HPP
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+#include "definition.hpp"
+#include "error.hpp"
+#include "detail/per_thread.hpp"
+
+namespace stateless
+{
+
+/**
+ * Holds the current definition of a state machine, which can be replaced
+ * while other threads are firing triggers.
+ *
+ * Publication follows read-copy-update with epoch based reclamation: a new
+ * definition is built and frozen off to the side, then published by swapping
+ * a pointer and advancing an epoch. Each fire() records the epoch it started
+ * in, in a slot owned by the calling thread, and clears it when it returns,
+ * so firing takes no lock and touches no shared reference count. A fire()
+ * completes against the definition that was current when it started, as do
+ * any fires nested inside its actions. A replaced definition is destroyed as
+ * soon as no fire() that started before its replacement is still running:
+ * by publish() when none is, otherwise by the last such fire() to return,
+ * which then takes the publication lock. Idle threads never hold a
+ * definition.
+ *
+ * \tparam TState The type used to represent the states.
+ * \tparam TTrigger The type used to represent the triggers that cause state transitions.
+ */
+template<typename TState, typename TTrigger>
+class published_definition
+{
+public:
+  /// Parameterized definition type.
+  typedef definition<TState, TTrigger> TDefinition;
+
+  /// Shared pointer to an immutable definition.
+  typedef std::shared_ptr<const TDefinition> TDefinitionPtr;
+
+  /**
+   * Construct with an initial definition.
+   *
+   * \param initial The definition to use until another is published.
+   */
+  published_definition(const TDefinitionPtr& initial)
+    : mutex_()
+    , owner_()
+    , current_(nullptr)
+    , epoch_(1)
+    , retired_()
+    , threads_()
+  {
+    publish(initial);
+  }
+
+  /**
+   * Replace the current definition. Calls already in progress complete
+   * against the definition they started with, which is destroyed when the
+   * last of them returns.
+   *
+   * \param next The definition for subsequent calls to use.
+   */
+  void publish(const TDefinitionPtr& next)
+  {
+    if (next == nullptr)
+    {
+      throw error("Cannot publish an empty definition.");
+    }
+    std::vector<TDefinitionPtr> reclaimed;
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      current_.store(next.get());
+      if (owner_ != nullptr)
+      {
+        // Only fires that started before this epoch can still see the old one.
+        retired_.push_back(retired_definition(owner_, epoch_.fetch_add(1) + 1));
+      }
+      owner_ = next;
+      reclaim(reclaimed);
+    }
+  }
+
+  /**
+   * The current definition. Holding the returned pointer keeps the
+   * definition alive after it has been replaced. This takes the publication
+   * lock; fire() is the path for calls that need no reference.
+   */
+  TDefinitionPtr acquire() const
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return owner_;
+  }
+
+  /**
+   * Transition the supplied state via the supplied trigger using the
+   * current definition.
+   *
+   * \param state The current state, which is updated with the new state.
+   * \param trigger The trigger to fire.
+   *
+   * \throw error The current state does not allow the trigger to be fired.
+   */
+  void fire(TState& state, const TTrigger& trigger) const
+  {
+    thread_scope scope(*this);
+    scope.definition().fire(state, trigger);
+  }
+
+  /**
+   * Transition the supplied state via the supplied trigger using the
+   * current definition.
+   *
+   * \param state The current state, which is updated with the new state.
+   * \param trigger The trigger to fire.
+   * \param args The arguments to pass in the transition.
+   *
+   * \throw error The current state does not allow the trigger to be fired.
+   */
+  template<typename... TArgs>
+  void fire(
+    TState& state,
+    const std::shared_ptr<trigger_with_parameters<TTrigger, TArgs...>>& trigger,
+    TArgs... args) const
+  {
+    thread_scope scope(*this);
+    scope.definition().fire(state, trigger, std::move(args)...);
+  }
+
+private:
+  published_definition(const published_definition&);
+  published_definition& operator=(const published_definition&);
+
+  /// A replaced definition and the first epoch that cannot see it.
+  struct retired_definition
+  {
+    retired_definition(const TDefinitionPtr& definition, std::uint64_t epoch)
+      : definition(definition)
+      , epoch(epoch)
+    {}
+
+    TDefinitionPtr definition;
+    std::uint64_t epoch;
+  };
+
+  /// The epoch a thread's outermost fire() started in, zero when idle.
+  struct thread_slot
+  {
+    thread_slot()
+      : epoch(0)
+      , definition(nullptr)
+      , depth(0)
+    {}
+
+    std::atomic<std::uint64_t> epoch;
+    const TDefinition* definition;
+    unsigned depth;
+  };
+
+  /// Pins a definition for the calling thread for the duration of a fire().
+  class thread_scope
+  {
+  public:
+    thread_scope(const published_definition& owner)
+      : owner_(owner)
+      , slot_(owner.threads_.local())
+    {
+      // Only the outermost fire pins; nested ones share its definition. The
+      // epoch is announced before the pointer is read, so a writer that does
+      // not see the announcement has already published a newer definition.
+      if (slot_.depth++ == 0)
+      {
+        slot_.epoch.store(owner.epoch_.load());
+        slot_.definition = owner.current_.load();
+      }
+    }
+
+    ~thread_scope()
+    {
+      // A fire that outlived a publish may be the last to hold the old
+      // definition; a writer that saw it running left reclamation to it.
+      if (--slot_.depth == 0)
+      {
+        std::uint64_t started = slot_.epoch.load(std::memory_order_relaxed);
+        slot_.epoch.store(0);
+        if (owner_.epoch_.load() != started)
+        {
+          std::vector<TDefinitionPtr> reclaimed;
+          std::lock_guard<std::mutex> lock(owner_.mutex_);
+          owner_.reclaim(reclaimed);
+        }
+      }
+    }
+
+    const TDefinition& definition() const
+    {
+      return *slot_.definition;
+    }
+
+  private:
+    thread_scope(const thread_scope&);
+    thread_scope& operator=(const thread_scope&);
+
+    const published_definition& owner_;
+    thread_slot& slot_;
+  };
+
+  /**
+   * Move the retired definitions no running fire() can see into reclaimed,
+   * to be destroyed once the publication lock is released.
+   */
+  void reclaim(std::vector<TDefinitionPtr>& reclaimed) const
+  {
+    std::uint64_t oldest = UINT64_MAX;
+    threads_.for_each([&oldest](const thread_slot& slot)
+      {
+        std::uint64_t epoch = slot.epoch.load();
+        if (epoch != 0 && epoch < oldest)
+        {
+          oldest = epoch;
+        }
+      });
+    auto kept = retired_.begin();
+    for (auto& retired : retired_)
+    {
+      if (retired.epoch <= oldest)
+      {
+        reclaimed.push_back(std::move(retired.definition));
+      }
+      else
+      {
+        *kept++ = std::move(retired);
+      }
+    }
+    retired_.erase(kept, retired_.end());
+  }
+
+  /// Guards owner_ and retired_.
+  mutable std::mutex mutex_;
+  TDefinitionPtr owner_;
+  std::atomic<const TDefinition*> current_;
+  std::atomic<std::uint64_t> epoch_;
+  mutable std::vector<retired_definition> retired_;
+  mutable detail::per_thread<thread_slot> threads_;
+};
+
+}
+
+#endif // STATELESS_PUBLISHED_DEFINITION_HPP
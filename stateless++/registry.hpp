@@ -0,0 +1,321 @@
+/**
+ * Copyright 2013 Matt Mason
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef STATELESS_REGISTRY_HPP
+#define STATELESS_REGISTRY_HPP
+
+#include <cstddef>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
+
+#include "error.hpp"
+#include "state_machine.hpp"
+
+namespace stateless
+{
+
+/**
+ * A concurrent collection of state machine instances keyed by id.
+ *
+ * Instances are stored compactly as their current state only. The ids are
+ * spread over a number of shards, each with its own lock and its own
+ * configured state machine, which is pointed at an instance's state while a
+ * trigger is fired for it. Operations on ids in different shards proceed in
+ * parallel.
+ *
+ * Actions are called with the shard lock held, so they must not call back
+ * into the registry. Triggers fired on the supplied state machine from within
+ * an action are queued and apply to the same instance; those passed to
+ * fire_async() are handled before the registry's fire() returns. A shard's
+ * machine only points at an instance during a fire(), so the states must not
+ * have timed triggers or asynchronous actions, which would run outside it.
+ *
+ * \tparam TKey The type used to identify instances.
+ * \tparam TState The type used to represent the states.
+ * \tparam TTrigger The type used to represent the triggers that cause state transitions.
+ * \tparam THash Hash function for keys.
+ */
+template<typename TKey, typename TState, typename TTrigger, typename THash = std::hash<TKey>>
+class registry
+{
+public:
+  /// Parameterized state machine type.
+  typedef state_machine<TState, TTrigger> TStateMachine;
+
+  /// Signature for the function that configures each shard's state machine.
+  typedef std::function<void(TStateMachine&)> TConfigure;
+
+  /**
+   * Construct an empty registry.
+   *
+   * \param configure Function called once per shard to configure its state machine.
+   * \param shard_count The number of independently locked shards.
+   *
+   * \throw error The configuration has timed triggers or asynchronous actions.
+   */
+  registry(const TConfigure& configure, std::size_t shard_count = 64)
+    : hash_()
+    , shards_()
+  {
+    if (shard_count == 0)
+    {
+      throw error("A registry requires at least one shard.");
+    }
+    shards_.reserve(shard_count);
+    for (std::size_t i = 0; i < shard_count; ++i)
+    {
+      shards_.emplace_back(new shard());
+      auto& machine = *shards_.back()->machine;
+      configure(machine);
+      if (!machine.is_synchronous())
+      {
+        throw error("Registry state machines cannot use timed triggers or asynchronous actions.");
+      }
+      // Queued asynchronous triggers must run while the instance is current.
+      machine.set_executor([](const std::function<void()>& job){ job(); });
+    }
+  }
+
+  /**
+   * Add an instance.
+   *
+   * \param id The id of the new instance.
+   * \param initial_state The initial state of the new instance.
+   *
+   * \return True if the instance was added, false if the id is already in use.
+   */
+  bool create(const TKey& id, const TState& initial_state)
+  {
+    auto& s = shard_for(id);
+    std::lock_guard<std::mutex> lock(s.mutex);
+    return s.instances.insert(std::make_pair(id, initial_state)).second;
+  }
+
+  /**
+   * Remove an instance.
+   *
+   * \param id The id of the instance to remove.
+   *
+   * \return True if the instance was removed, false if there was no such instance.
+   */
+  bool erase(const TKey& id)
+  {
+    auto& s = shard_for(id);
+    std::lock_guard<std::mutex> lock(s.mutex);
+    return s.instances.erase(id) != 0;
+  }
+
+  /// Determine whether an instance with the supplied id exists.
+  bool contains(const TKey& id) const
+  {
+    auto& s = shard_for(id);
+    std::lock_guard<std::mutex> lock(s.mutex);
+    return s.instances.find(id) != s.instances.end();
+  }
+
+  /**
+   * The current state of an instance.
+   *
+   * \param id The id of the instance.
+   *
+   * \throw error There is no instance with the supplied id.
+   */
+  TState state_of(const TKey& id) const
+  {
+    auto& s = shard_for(id);
+    std::lock_guard<std::mutex> lock(s.mutex);
+    return find(s, id);
+  }
+
+  /**
+   * Transition an instance via the supplied trigger.
+   *
+   * \param id The id of the instance.
+   * \param trigger The trigger to fire.
+   *
+   * \throw error There is no instance with the supplied id, or its current
+   *              state does not allow the trigger to be fired.
+   */
+  void fire(const TKey& id, const TTrigger& trigger)
+  {
+    auto& s = shard_for(id);
+    std::lock_guard<std::mutex> lock(s.mutex);
+    current_scope scope(s, find(s, id));
+    s.machine->fire(trigger);
+  }
+
+  /**
+   * Transition an instance via the supplied trigger.
+   *
+   * \param id The id of the instance.
+   * \param trigger The trigger to fire.
+   * \param args The arguments to pass in the transition.
+   *
+   * \throw error There is no instance with the supplied id, or its current
+   *              state does not allow the trigger to be fired.
+   */
+  template<typename... TArgs>
+  void fire(
+    const TKey& id,
+    const std::shared_ptr<trigger_with_parameters<TTrigger, TArgs...>>& trigger,
+    TArgs... args)
+  {
+    auto& s = shard_for(id);
+    std::lock_guard<std::mutex> lock(s.mutex);
+    current_scope scope(s, find(s, id));
+    s.machine->fire(trigger, std::move(args)...);
+  }
+
+  /// The number of shards.
+  std::size_t shard_count() const
+  {
+    return shards_.size();
+  }
+
+  /// The shard that holds the supplied id.
+  std::size_t shard_of(const TKey& id) const
+  {
+    return shard_index(id);
+  }
+
+  /// The total number of instances. Shards are counted one at a time.
+  std::size_t size() const
+  {
+    std::size_t result = 0;
+    for (auto& s : shards_)
+    {
+      std::lock_guard<std::mutex> lock(s->mutex);
+      result += s->instances.size();
+    }
+    return result;
+  }
+
+  /**
+   * Visit every instance in a shard, with the shard locked.
+   *
+   * \param index The shard to visit.
+   * \param visitor Function called with the id and state of each instance.
+   */
+  template<typename TCallable>
+  void for_each_in_shard(std::size_t index, TCallable visitor) const
+  {
+    auto& s = *shards_.at(index);
+    std::lock_guard<std::mutex> lock(s.mutex);
+    for (auto& instance : s.instances)
+    {
+      visitor(instance.first, instance.second);
+    }
+  }
+
+private:
+  /**
+   * A locked partition of the instances with its own state machine.
+   * Each shard is allocated separately so that shard locks do not share cache lines.
+   */
+  struct shard
+  {
+    shard()
+      : mutex()
+      , instances()
+      , current(nullptr)
+      , machine()
+    {
+      using namespace std::placeholders;
+      machine.reset(new TStateMachine(
+        std::bind(&shard::get, this),
+        std::bind(&shard::set, this, _1)));
+    }
+
+    const TState get() const
+    {
+      check_current();
+      return *current;
+    }
+
+    void set(const TState& new_state)
+    {
+      check_current();
+      *current = new_state;
+    }
+
+    void check_current() const
+    {
+      if (current == nullptr)
+      {
+        throw error("A registry state machine can only be used while the registry fires it.");
+      }
+    }
+
+    mutable std::mutex mutex;
+    std::unordered_map<TKey, TState, THash> instances;
+    TState* current;
+    std::unique_ptr<TStateMachine> machine;
+  };
+
+  /// Points a shard's state machine at an instance for the lifetime of the scope.
+  class current_scope
+  {
+  public:
+    current_scope(shard& s, TState& state)
+      : shard_(s)
+    {
+      shard_.current = &state;
+    }
+
+    ~current_scope()
+    {
+      shard_.current = nullptr;
+    }
+
+  private:
+    shard& shard_;
+  };
+
+  std::size_t shard_index(const TKey& id) const
+  {
+    // Mix the hash so that identity hashes of sequential ids spread evenly.
+    std::size_t h = hash_(id);
+    h ^= h >> 17;
+    h *= static_cast<std::size_t>(0x9E3779B97F4A7C15ULL);
+    h ^= h >> 29;
+    return h % shards_.size();
+  }
+
+  shard& shard_for(const TKey& id) const
+  {
+    return *shards_[shard_index(id)];
+  }
+
+  static TState& find(shard& s, const TKey& id)
+  {
+    auto it = s.instances.find(id);
+    if (it == s.instances.end())
+    {
+      throw error("No instance is registered with the supplied id.");
+    }
+    return it->second;
+  }
+
+  THash hash_;
+  std::vector<std::unique_ptr<shard>> shards_;
+};
+
+}
+
+#endif // STATELESS_REGISTRY_HPP
@@ -0,0 +1,421 @@
+/**
+ * Copyright 2013 Matt Mason
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#ifndef STATELESS_SNAPSHOT_HPP
+#define STATELESS_SNAPSHOT_HPP
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <functional>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <sys/wait.h>
+
+#include "definition.hpp"
+#include "detail/posix_file.hpp"
+#include "error.hpp"
+#include "instance_store.hpp"
+
+namespace stateless
+{
+
+namespace detail
+{
+
+/**
+ * The start of a snapshot file. The state codes follow at data_offset,
+ * which is a multiple of the page size so that they can be mapped in place.
+ */
+struct snapshot_header
+{
+  char magic[8];
+  std::uint32_t version;
+  std::uint32_t code_size;
+  std::uint64_t size;
+  std::uint64_t code_limit;
+  std::uint64_t fingerprint;
+  std::uint64_t data_offset;
+};
+
+inline snapshot_header empty_snapshot_header()
+{
+  snapshot_header header = { { 'S', 'T', 'L', 'S', 'S', 'N', 'A', 'P' }, 1, 0, 0, 0, 0, 0 };
+  return header;
+}
+
+/**
+ * Check that a mapped file is a complete snapshot with the expected code size.
+ *
+ * \return The header.
+ */
+inline const snapshot_header& check_snapshot(const mapped_file& file, std::size_t code_size)
+{
+  const auto expected = empty_snapshot_header();
+  if (file.size() < sizeof(snapshot_header) ||
+    std::memcmp(file.data(), &expected, sizeof(expected.magic) + sizeof(expected.version)) != 0)
+  {
+    throw error("The file is not a snapshot.");
+  }
+  const auto& header = *reinterpret_cast<const snapshot_header*>(file.data());
+  if (header.code_size != code_size)
+  {
+    throw error("The snapshot was taken with a different code type.");
+  }
+  if (header.data_offset < sizeof(snapshot_header) ||
+    header.data_offset > file.size() ||
+    (file.size() - header.data_offset) / code_size < header.size)
+  {
+    throw error("The snapshot is truncated.");
+  }
+  return header;
+}
+
+inline std::size_t page_size()
+{
+  const long size = ::sysconf(_SC_PAGESIZE);
+  return size < 4096 ? 4096 : static_cast<std::size_t>(size);
+}
+
+/// The header of a snapshot of a store, padded to a page.
+template<typename TState, typename TTrigger, typename TCode, typename TClock>
+std::vector<unsigned char> snapshot_first_page(const instance_store<TState, TTrigger, TCode, TClock>& store)
+{
+  auto header = empty_snapshot_header();
+  header.code_size = sizeof(TCode);
+  header.size = store.size();
+  header.code_limit = store.code_limit();
+  header.fingerprint = store.get_definition().fingerprint();
+  header.data_offset = page_size();
+  std::vector<unsigned char> first_page(static_cast<std::size_t>(header.data_offset), 0);
+  std::memcpy(first_page.data(), &header, sizeof(header));
+  return first_page;
+}
+
+/// Move a completed temporary snapshot over the destination.
+inline bool replace_snapshot(const std::string& temporary, const std::string& path)
+{
+  if (std::rename(temporary.c_str(), path.c_str()) != 0)
+  {
+    std::remove(temporary.c_str());
+    return false;
+  }
+  return true;
+}
+
+}
+
+/**
+ * Write the states of every instance in a store to a snapshot file.
+ *
+ * The file holds a header, padded to a page, followed by the state code
+ * column exactly as it is held in memory. It is written to a temporary file
+ * which is synced and then renamed over the destination, so an existing
+ * snapshot is replaced atomically. The file format is native endian.
+ *
+ * \param store The store.
+ * \param path The snapshot file.
+ *
+ * \throw error The file cannot be written.
+ */
+template<typename TState, typename TTrigger, typename TCode, typename TClock>
+void save_snapshot(const instance_store<TState, TTrigger, TCode, TClock>& store, const std::string& path)
+{
+  const auto first_page = detail::snapshot_first_page(store);
+  const std::string temporary = path + ".tmp";
+  {
+    detail::file_descriptor file(temporary, O_WRONLY | O_CREAT | O_TRUNC);
+    file.write_all(first_page.data(), first_page.size());
+    file.write_all(store.codes(), store.size() * sizeof(TCode));
+    file.sync();
+  }
+  if (!detail::replace_snapshot(temporary, path))
+  {
+    throw error("Unable to replace the snapshot file.");
+  }
+}
+
+/**
+ * A snapshot of a store written by a forked child process, from its
+ * copy-on-write image of the store at the time of the fork, while the
+ * parent continues to fire triggers. The parent pauses only for the fork.
+ *
+ * The child makes only write and sync system calls, so it is safe to start
+ * a background snapshot from a multithreaded process. Completion is
+ * detected by poll() or wait(), which also move the file into place and
+ * call the completion callback, on the calling thread. Only one snapshot
+ * should be written to a path at a time.
+ *
+ * The file is the same as one written by save_snapshot().
+ */
+class background_snapshot
+{
+public:
+  /// Signature for the completion callback, passed whether the snapshot succeeded.
+  typedef std::function<void(bool)> TCompletion;
+
+  /**
+   * Start writing a snapshot of a store.
+   *
+   * \param store The store.
+   * \param path The snapshot file.
+   * \param on_complete Function called once the snapshot has been written, or has failed.
+   *
+   * \throw error The temporary file cannot be created or the process cannot fork.
+   */
+  template<typename TState, typename TTrigger, typename TCode, typename TClock>
+  background_snapshot(
+    const instance_store<TState, TTrigger, TCode, TClock>& store,
+    const std::string& path,
+    const TCompletion& on_complete = TCompletion())
+    : path_(path)
+    , temporary_(path + ".tmp")
+    , on_complete_(on_complete)
+    , child_(-1)
+    , is_complete_(false)
+    , succeeded_(false)
+  {
+    // Everything that allocates is done before forking.
+    const auto first_page = detail::snapshot_first_page(store);
+    detail::file_descriptor file(temporary_, O_WRONLY | O_CREAT | O_TRUNC);
+    const void* codes = store.codes();
+    const std::size_t size = store.size() * sizeof(TCode);
+
+    child_ = ::fork();
+    if (child_ == 0)
+    {
+      const bool written =
+        file.try_write_all(first_page.data(), first_page.size()) &&
+        file.try_write_all(codes, size) &&
+        file.try_sync();
+      ::_exit(written ? 0 : 1);
+    }
+    if (child_ == -1)
+    {
+      std::remove(temporary_.c_str());
+      throw error("Unable to fork a snapshot process.");
+    }
+  }
+
+  /// Waits for the snapshot to complete.
+  ~background_snapshot()
+  {
+    try
+    {
+      wait();
+    }
+    catch (...)
+    {}
+  }
+
+  /**
+   * Check, without blocking, whether the snapshot has completed.
+   *
+   * \return True if it has completed.
+   */
+  bool poll()
+  {
+    return reap(WNOHANG);
+  }
+
+  /// Block until the snapshot has completed.
+  void wait()
+  {
+    reap(0);
+  }
+
+  bool is_complete() const
+  {
+    return is_complete_;
+  }
+
+  /// Whether the snapshot was written successfully. Valid once complete.
+  bool succeeded() const
+  {
+    return succeeded_;
+  }
+
+private:
+  background_snapshot(const background_snapshot&);
+  background_snapshot& operator=(const background_snapshot&);
+
+  bool reap(int options)
+  {
+    if (is_complete_)
+    {
+      return true;
+    }
+    int status = 0;
+    pid_t result;
+    do
+    {
+      result = ::waitpid(child_, &status, options);
+    } while (result == -1 && errno == EINTR);
+    if (result == 0)
+    {
+      return false;
+    }
+    is_complete_ = true;
+    succeeded_ = result == child_ && WIFEXITED(status) && WEXITSTATUS(status) == 0;
+    if (succeeded_)
+    {
+      succeeded_ = detail::replace_snapshot(temporary_, path_);
+    }
+    else
+    {
+      std::remove(temporary_.c_str());
+    }
+    if (on_complete_)
+    {
+      on_complete_(succeeded_);
+    }
+    return true;
+  }
+
+  const std::string path_;
+  const std::string temporary_;
+  TCompletion on_complete_;
+  pid_t child_;
+  bool is_complete_;
+  bool succeeded_;
+};
+
+/**
+ * Restore a store from a snapshot file.
+ *
+ * The file is mapped copy-on-write and the store uses the mapped codes in
+ * place, so restoring reads the codes once to check them rather than
+ * parsing them into a new column. Pages are copied as instances in them
+ * change state, and the file itself is never modified. Adding an instance
+ * copies the codes into memory owned by the store.
+ *
+ * \param definition The definition shared by all instances. It must be
+ *                   equivalent to the one the snapshot was taken with.
+ * \param path The snapshot file.
+ *
+ * \return The restored store, with its index not enabled.
+ *
+ * \throw error The file is not a snapshot taken with the code type, its
+ *              definition fingerprint does not match, or it holds a code
+ *              outside the code limit it records.
+ */
+template<
+  typename TCode = std::uint8_t,
+  typename TClock = coarse_clock,
+  typename TState,
+  typename TTrigger>
+std::unique_ptr<instance_store<TState, TTrigger, TCode, TClock>> restore_snapshot(
+  const std::shared_ptr<const definition<TState, TTrigger>>& definition,
+  const std::string& path)
+{
+  typedef instance_store<TState, TTrigger, TCode, TClock> TStore;
+  if (definition == nullptr)
+  {
+    throw error("An instance store requires a definition.");
+  }
+  auto file = std::make_shared<detail::mapped_file>(path, true);
+  const auto& header = detail::check_snapshot(*file, sizeof(TCode));
+  if (header.fingerprint != definition->fingerprint())
+  {
+    throw error("The snapshot was taken with a different definition.");
+  }
+  TCode* codes = reinterpret_cast<TCode*>(file->data() + header.data_offset);
+  const std::size_t size = static_cast<std::size_t>(header.size);
+  // The store indexes its tables by code, so a corrupt code must not reach it.
+  TCode highest = 0;
+  for (std::size_t i = 0; i < size; ++i)
+  {
+    highest = std::max(highest, codes[i]);
+  }
+  if (size != 0 && static_cast<std::uint64_t>(highest) >= header.code_limit)
+  {
+    throw error("The snapshot holds a state code outside its code limit.");
+  }
+  return std::unique_ptr<TStore>(new TStore(
+    definition,
+    codes,
+    size,
+    static_cast<std::size_t>(header.code_limit),
+    file));
+}
+
+/**
+ * Read-only access to the states in a snapshot file, mapped in place
+ * without a definition or store.
+ *
+ * \tparam TState The type used to represent the states.
+ * \tparam TCode The code type of the store the snapshot was taken from.
+ */
+template<typename TState, typename TCode = std::uint8_t>
+class snapshot_view
+{
+public:
+  /**
+   * Map a snapshot.
+   *
+   * \param path The snapshot file.
+   *
+   * \throw error The file is not a snapshot taken with the code type.
+   */
+  explicit snapshot_view(const std::string& path)
+    : file_(path)
+    , header_(detail::check_snapshot(file_, sizeof(TCode)))
+  {}
+
+  /// The number of instances.
+  std::size_t size() const
+  {
+    return static_cast<std::size_t>(header_.size);
+  }
+
+  /// The state of an instance.
+  TState state(std::size_t instance) const
+  {
+    if (instance >= size())
+    {
+      throw error("Instance index is out of bounds.");
+    }
+    return static_cast<TState>(codes()[instance]);
+  }
+
+  /// The state code column.
+  const TCode* codes() const
+  {
+    return reinterpret_cast<const TCode*>(file_.data() + header_.data_offset);
+  }
+
+  /// The fingerprint of the definition the snapshot was taken with.
+  std::uint64_t fingerprint() const
+  {
+    return header_.fingerprint;
+  }
+
+private:
+  snapshot_view(const snapshot_view&);
+  snapshot_view& operator=(const snapshot_view&);
+
+  detail::mapped_file file_;
+  const detail::snapshot_header& header_;
+};
+
+}
+
+#endif // STATELESS_SNAPSHOT_HPP
@@ -20,6 +20,7 @@
 #include "detail/no_guard.hpp"
 #include "detail/state_representation.hpp"
 #include "detail/transition.hpp"
+#include "timer_scheduler.hpp"
 #include "trigger_with_parameters.hpp"
 
 #include <functional>
@@ -64,6 +65,18 @@ public:
   ///Signature for lookup function.
   typedef std::function<TStateRepresentation*(const TState&)> TLookup;
 
+  /// Signature for an executor that runs, or schedules, a job.
+  typedef std::function<void(const std::function<void()>&)> TExecutor;
+
+  /// Type used for the delays of timed triggers.
+  typedef timer_scheduler::TDuration TDuration;
+
+  /// Signature for the functions that arm and disarm a state's timed triggers.
+  typedef typename TStateRepresentation::TTimerAction TTimerAction;
+
+  /// Signature for a check that raises an error if timed triggers cannot be armed.
+  typedef std::function<void()> TTimerCheck;
+
   /**
    * Accept the specified trigger and transition to the destination state.
    *
@@ -154,13 +167,8 @@ public:
    */
   state_configuration& ignore_if(const TTrigger& trigger, const TGuard& guard)
   {
-    auto decision =
-      [=](const TState& source, TState& destination)
-      {
-        return false;
-      };
-    auto behaviour = std::make_shared<detail::trigger_behaviour<TState, TTrigger>>(
-      trigger, guard, decision);
+    auto behaviour = std::make_shared<detail::ignored_trigger_behaviour<TState, TTrigger>>(
+      trigger, guard);
     representation_->add_trigger_behaviour(trigger, behaviour);
     return *this;
   }
@@ -226,6 +234,102 @@ public:
     return *this;
   }
 
+  /**
+   * Specify an action that will execute on the state machine's executor
+   * after transitioning into the configured state.
+   *
+   * Asynchronous actions run after all synchronous actions of the transition,
+   * in the order in which they would have run synchronously.
+   *
+   * \param entry_action Action to execute, providing details of the transition.
+   *
+   * \return This configuration object.
+   */
+  template<typename... TArgs, typename TCallable>
+  state_configuration& on_entry_async(TCallable entry_action)
+  {
+    auto defer = defer_;
+    auto wrapper =
+      [=](const TTransition& transition, TArgs... args)
+      {
+        defer(std::bind(entry_action, transition, args...));
+      };
+    representation_->template add_entry_action<decltype(wrapper), TArgs...>(wrapper);
+    representation_->add_async_actions();
+    return *this;
+  }
+
+  /**
+   * Specify an action that will execute on the state machine's executor
+   * after transitioning from the configured state.
+   *
+   * \param exit_action Action to execute, providing details of the transition.
+   *
+   * \return This configuration object.
+   */
+  template<typename TCallable>
+  state_configuration& on_exit_async(TCallable exit_action)
+  {
+    auto defer = defer_;
+    representation_->add_exit_action(
+      [=](const TTransition& transition)
+      {
+        defer(std::bind(exit_action, transition));
+      });
+    representation_->add_async_actions();
+    return *this;
+  }
+
+  /**
+   * Fire the specified trigger once the configured state has been occupied
+   * for a delay.
+   *
+   * The timer is armed on the state machine's timer scheduler whenever the
+   * state is entered, including on reentry, and cancelled when it is exited.
+   * Moving between substates of the configured state leaves it running.
+   * The trigger must be accepted by the configured state, for example with
+   * permit(); it is fired as if by fire().
+   *
+   * \param delay The time for which the state must be occupied.
+   * \param trigger The trigger to fire.
+   *
+   * \return This configuration object.
+   *
+   * \throw error The state machine has no timer scheduler.
+   *
+   * \note Timers are not armed for the initial state of the state machine.
+   */
+  state_configuration& fire_after(TDuration delay, const TTrigger& trigger)
+  {
+    // Checked now, since arming fails after the state has changed.
+    check_timers_();
+    representation_->add_timed_trigger(delay, trigger, arm_timers_, disarm_timers_);
+    return *this;
+  }
+
+  /**
+   * Accept the specified trigger and transition to the destination state,
+   * and fire the trigger once the configured state has been occupied for a
+   * delay.
+   *
+   * \param delay The time for which the state must be occupied.
+   * \param trigger The accepted trigger.
+   * \param destination_state The state that the trigger will cause a transition to.
+   *
+   * \return This configuration object.
+   *
+   * \throw error The state machine has no timer scheduler.
+   *
+   * \see fire_after()
+   */
+  state_configuration& permit_after(
+    TDuration delay, const TTrigger& trigger, const TState& destination_state)
+  {
+    check_timers_();
+    permit(trigger, destination_state);
+    return fire_after(delay, trigger);
+  }
+
   /**
    * Set the superstate that the configured state is a substate of.
    *
@@ -326,9 +430,18 @@ private:
    * Not for client use; configuration objects are created by the state_machine.
    */
   state_configuration(
-    TStateRepresentation* representation, const TLookup& lookup)
+    TStateRepresentation* representation,
+    const TLookup& lookup,
+    const TExecutor& defer,
+    const TTimerAction& arm_timers,
+    const TTimerAction& disarm_timers,
+    const TTimerCheck& check_timers)
     : representation_(representation)
     , lookup_(lookup)
+    , defer_(defer)
+    , arm_timers_(arm_timers)
+    , disarm_timers_(disarm_timers)
+    , check_timers_(check_timers)
   {}
 
   void enforce_not_identity_transition(const TState& destination)
@@ -356,15 +469,8 @@ private:
     const TState& destination_state,
     const TGuard& guard)
   {
-    auto decision =
-      [=](const TState& source, TState& destination)
-      -> bool
-      {
-        destination = destination_state;
-        return true;
-      };
-    auto behaviour = std::make_shared<detail::trigger_behaviour<TState, TTrigger>>(
-      trigger, guard, decision);
+    auto behaviour = std::make_shared<detail::transitioning_trigger_behaviour<TState, TTrigger>>(
+      trigger, guard, destination_state);
     representation_->add_trigger_behaviour(trigger, behaviour);
     return *this;
   }
@@ -384,6 +490,10 @@ private:
 
   TStateRepresentation* representation_;
   TLookup lookup_;
+  TExecutor defer_;
+  TTimerAction arm_timers_;
+  TTimerAction disarm_timers_;
+  TTimerCheck check_timers_;
 };
 
 }
@@ -17,17 +17,41 @@
 #ifndef STATELESS_STATE_MACHINE_HPP
 #define STATELESS_STATE_MACHINE_HPP
 
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <exception>
 #include <functional>
+#include <future>
+#include <list>
 #include <map>
 #include <memory>
+#include <mutex>
 #include <set>
 #include <sstream>
+#include <thread>
+#include <vector>
 
+#include "definition.hpp"
+#include "detail/probes.hpp"
+#include "detail/waiter_list.hpp"
+#include "fire_observer.hpp"
+#include "memory_usage.hpp"
 #include "print_state.hpp"
 #include "print_trigger.hpp"
 #include "state_configuration.hpp"
+#include "timer_scheduler.hpp"
 #include "trigger_with_parameters.hpp"
 
+#if defined(__cpp_impl_coroutine) && defined(__has_include)
+#if __has_include(<coroutine>)
+#define STATELESS_HAS_COROUTINES
+#include <coroutine>
+#include <optional>
+#endif
+#endif
+
 namespace stateless
 {
 
@@ -62,6 +86,15 @@ public:
   /// Signature for handler for state transition. Does nothing by default.
   typedef std::function<void(const TTransition&)> TTransitionAction;
 
+  /// Parameterized definition type.
+  typedef definition<TState, TTrigger> TDefinition;
+
+  /// Signature for an executor of asynchronous actions.
+  typedef typename TStateConfiguration::TExecutor TExecutor;
+
+  /// Parameterized fire observer type.
+  typedef fire_observer<TState, TTrigger> TFireObserver;
+
   /**
    * Construct a state machine with external state storage.
    *
@@ -87,6 +120,59 @@ public:
       std::bind(&state_reference::set, state, _1));
   }
 
+  /**
+   * Destroy the state machine. Triggers still queued by fire_async() are
+   * abandoned, and their futures report a broken promise. A trigger that is
+   * being fired on another thread is waited for; asynchronous actions that
+   * have already been posted to the executor still run.
+   */
+  ~state_machine()
+  {
+    std::unique_lock<std::mutex> lock(async_lane_->mutex);
+    async_lane_->machine = nullptr;
+    async_lane_->queue.clear();
+    const auto lane = async_lane_;
+    lane->idle.wait(lock, [&lane]()
+      {
+        return !lane->is_active || lane->active_thread == std::this_thread::get_id();
+      });
+  }
+
+  /**
+   * Take an immutable copy of the configuration, which can be shared by many
+   * instances whose states are stored elsewhere.
+   * Further configuration of this state machine does not affect the copy.
+   *
+   * \return The frozen definition.
+   */
+  std::shared_ptr<const TDefinition> freeze() const
+  {
+    return std::make_shared<TDefinition>(
+      state_configuration_, trigger_configuration_);
+  }
+
+  /**
+   * Take an immutable copy of the configuration arranged for a recorded
+   * profile of transition frequencies, such as one taken from a definition
+   * frozen earlier and the transition_counters that observed it.
+   *
+   * Each trigger's candidate behaviours are ordered by how often they were
+   * taken, most often first, and the first whose guard is met handles the
+   * trigger, so the remaining guards are not evaluated. Guards must be
+   * mutually exclusive, as always, but this is no longer checked. The
+   * states' representations are copied into a contiguous array, hottest
+   * first, and the hottest are found by a short linear scan.
+   *
+   * \param profile The frequencies of the outcomes of each trigger in each state.
+   *
+   * \return The frozen definition.
+   */
+  std::shared_ptr<const TDefinition> freeze(const frequency_matrix<TState, TTrigger>& profile) const
+  {
+    return std::make_shared<TDefinition>(
+      state_configuration_, trigger_configuration_, profile);
+  }
+
   /// The current state.
   const TState state() const
   {
@@ -107,7 +193,11 @@ public:
     typedef state_machine<TState, TTrigger> TSelf;
     return TStateConfiguration(
       get_representation(state),
-      std::bind(&TSelf::get_representation, this, _1));
+      std::bind(&TSelf::get_representation, this, _1),
+      std::bind(&TSelf::defer_async_action, this, _1),
+      std::bind(&TSelf::arm_timers, this, _1),
+      std::bind(&TSelf::disarm_timers, this, _1),
+      std::bind(&TSelf::check_timer_scheduler, this));
   }
 
   /**
@@ -116,13 +206,17 @@ public:
    * Actions associated with leaving the current state and entering the new one
    * will be invoked.
    *
+   * If called from an action while a transition is in progress, the trigger is
+   * queued and fired once the current transition has completed.
+   *
    * \param trigger The trigger to fire.
    *
    * \throw error The current state does not allow the trigger to be fired.
    */
   void fire(const TTrigger& trigger)
   {
-    internal_fire(trigger);
+    fire_trigger(trigger);
+    post_async_actions();
   }
 
   /**
@@ -131,6 +225,10 @@ public:
    * Actions associated with leaving the current state and entering the new one
    * will be invoked.
    *
+   * If called from an action while a transition is in progress, the trigger and
+   * a copy of the arguments are queued and fired once the current transition
+   * has completed.
+   *
    * \param trigger The trigger to fire.
    * \param args The arguments to pass in the transition.
    *
@@ -141,7 +239,83 @@ public:
     const std::shared_ptr<trigger_with_parameters<TTrigger, TArgs...>>& trigger,
     TArgs... args)
   {
-    internal_fire(trigger->trigger(), std::move(args)...);
+    fire_trigger(trigger->trigger(), std::move(args)...);
+    post_async_actions();
+  }
+
+  /**
+   * Transition from the current state via the supplied trigger, without
+   * waiting for asynchronous entry and exit actions.
+   *
+   * Triggers fired with fire_async() are handled one at a time, in order: the
+   * next one is not fired until the asynchronous actions of the previous one
+   * have completed on the executor. Synchronous actions run on the thread that
+   * fires the trigger, which is the executor thread for queued triggers.
+   *
+   * \param trigger The trigger to fire.
+   *
+   * \return A future that is satisfied once the transition and its
+   *         asynchronous actions have completed, or that holds the error
+   *         raised by either.
+   */
+  std::shared_future<void> fire_async(const TTrigger& trigger)
+  {
+    typedef state_machine<TState, TTrigger> TSelf;
+    return enqueue_async(
+      std::bind(&TSelf::template fire_trigger<>, this, trigger));
+  }
+
+  /**
+   * Transition from the current state via the supplied trigger, without
+   * waiting for asynchronous entry and exit actions.
+   *
+   * \param trigger The trigger to fire.
+   * \param args The arguments to pass in the transition.
+   *
+   * \return A future that is satisfied once the transition and its
+   *         asynchronous actions have completed.
+   *
+   * \see fire_async(const TTrigger&)
+   */
+  template<typename... TArgs>
+  std::shared_future<void> fire_async(
+    const std::shared_ptr<trigger_with_parameters<TTrigger, TArgs...>>& trigger,
+    TArgs... args)
+  {
+    typedef state_machine<TState, TTrigger> TSelf;
+    return enqueue_async(
+      std::bind(
+        &TSelf::template fire_trigger<TArgs...>, this, trigger->trigger(), std::move(args)...));
+  }
+
+  /**
+   * Set the executor that runs asynchronous entry and exit actions.
+   * By default they run inline, on the thread that fired the trigger.
+   *
+   * \param executor A function that runs, or schedules, the supplied job.
+   */
+  void set_executor(const TExecutor& executor)
+  {
+    executor_ = executor;
+  }
+
+  /**
+   * Set the scheduler on which the timed triggers configured with
+   * fire_after() and permit_after() are armed. It must be set before they
+   * are configured, must outlive the state machine, and must not be changed
+   * while timers are armed.
+   *
+   * \param scheduler The timer scheduler.
+   *
+   * \throw error Timers are armed on the current scheduler.
+   */
+  void set_timer_scheduler(timer_scheduler& scheduler)
+  {
+    if (!armed_timers_.entries.empty() && armed_timers_.scheduler != &scheduler)
+    {
+      throw error("The timer scheduler cannot be changed while timers are armed.");
+    }
+    armed_timers_.scheduler = &scheduler;
   }
 
   /**
@@ -166,6 +340,26 @@ public:
     on_unhandled_trigger_ = action;
   }
 
+#ifdef STATELESS_ENABLE_INSTRUMENTATION
+  /**
+   * Report the progress of every trigger to an observer. Only available
+   * when STATELESS_ENABLE_INSTRUMENTATION is defined.
+   *
+   * \param observer The observer, which must outlive the state machine or be
+   *                 replaced first, or nullptr to stop reporting.
+   */
+  void set_observer(TFireObserver* observer)
+  {
+    observer_ = observer;
+  }
+
+  /// The observer, or nullptr if none is set.
+  TFireObserver* observer() const
+  {
+    return observer_;
+  }
+#endif
+
   /**
    * Determine whether the state machine is in the supplied state.
    *
@@ -190,6 +384,24 @@ public:
     return current_representation()->can_handle(trigger);
   }
 
+  /**
+   * Determine whether every action runs on the thread that fires a trigger.
+   *
+   * \return False if any state has timed triggers or asynchronous entry or
+   *         exit actions, true otherwise.
+   */
+  bool is_synchronous() const
+  {
+    for (auto& entry : state_configuration_)
+    {
+      if (!entry.second.timed_triggers().empty() || entry.second.has_async_actions())
+      {
+        return false;
+      }
+    }
+    return true;
+  }
+
   /**
    * Specify the arguments that must be supplied when a specific trigger is fired.
    *
@@ -243,7 +455,184 @@ public:
     return os;
   }
 
+  /**
+   * The bytes used by the state machine, by category, including the
+   * behaviours and actions it shares with any definitions frozen from it.
+   * Not to be called while the state machine is being configured.
+   */
+  stateless::memory_usage memory_usage() const
+  {
+    stateless::memory_usage usage;
+    std::set<const void*> seen;
+    const std::size_t callbacks = sizeof(state_accessor_) + sizeof(state_mutator_) +
+      sizeof(on_unhandled_trigger_) + sizeof(on_transition_) + sizeof(executor_);
+    usage.other += sizeof(*this) - callbacks + detail::capacity_bytes(armed_timers_.entries);
+    usage.closures += callbacks +
+      detail::capacity_bytes(queued_triggers_) + detail::capacity_bytes(pending_async_actions_);
+    if (async_lane_ != nullptr)
+    {
+      std::lock_guard<std::mutex> lock(async_lane_->mutex);
+      usage.other += sizeof(async_lane) + detail::shared_control_block_size +
+        async_lane_->queue.size() * (sizeof(async_item) + 2 * sizeof(void*));
+    }
+    detail::add_configuration_usage(usage, state_configuration_, trigger_configuration_, seen);
+    return usage;
+  }
+
+#ifdef STATELESS_HAS_COROUTINES
+private:
+  /**
+   * Base for awaitables that suspend a coroutine until a transition satisfies
+   * some condition. The awaitable lives in the coroutine frame and is linked
+   * into the state machine directly, so waiting does not allocate.
+   * Suspended coroutines are resumed from within fire(), after the
+   * on_transition action; triggers they fire are queued.
+   */
+  class transition_awaitable : public detail::waiter<TTransition>
+  {
+  public:
+    transition_awaitable(state_machine& sm)
+      : sm_(sm)
+    {}
+
+    void await_suspend(std::coroutine_handle<> handle)
+    {
+      handle_ = handle;
+      sm_.waiters_.push_back(*this);
+    }
+
+    void notify(const TTransition& transition) override
+    {
+      transition_.emplace(transition);
+      handle_.resume();
+    }
+
+  protected:
+    state_machine& sm_;
+    std::optional<TTransition> transition_;
+
+  private:
+    std::coroutine_handle<> handle_;
+  };
+
+public:
+  /// Awaitable that completes once the state machine is in a state.
+  class state_awaitable : public transition_awaitable
+  {
+  public:
+    state_awaitable(state_machine& sm, const TState& state)
+      : transition_awaitable(sm)
+      , state_(state)
+    {}
+
+    bool await_ready() const
+    {
+      return this->sm_.is_in_state(state_);
+    }
+
+    bool is_ready(const TTransition&) const override
+    {
+      return this->sm_.is_in_state(state_);
+    }
+
+    void await_resume() const
+    {}
+
+  private:
+    const TState state_;
+  };
+
+  /// Awaitable that completes with the next transition.
+  class next_transition_awaitable : public transition_awaitable
+  {
+  public:
+    next_transition_awaitable(state_machine& sm)
+      : transition_awaitable(sm)
+    {}
+
+    bool await_ready() const
+    {
+      return false;
+    }
+
+    bool is_ready(const TTransition&) const override
+    {
+      return true;
+    }
+
+    TTransition await_resume() const
+    {
+      return *this->transition_;
+    }
+  };
+
+  /// Awaitable that completes once a trigger can be fired.
+  class trigger_awaitable : public transition_awaitable
+  {
+  public:
+    trigger_awaitable(state_machine& sm, const TTrigger& trigger)
+      : transition_awaitable(sm)
+      , trigger_(trigger)
+    {}
+
+    bool await_ready() const
+    {
+      return this->sm_.can_fire(trigger_);
+    }
+
+    bool is_ready(const TTransition&) const override
+    {
+      return this->sm_.can_fire(trigger_);
+    }
+
+    void await_resume() const
+    {}
+
+  private:
+    const TTrigger trigger_;
+  };
+
+  /**
+   * Suspend the awaiting coroutine until the state machine is in the supplied state.
+   *
+   * \param state The state to wait for. Substates of the state also satisfy the wait.
+   *
+   * \return An awaitable that completes immediately if the machine is already in the state.
+   */
+  state_awaitable until_in_state(const TState& state)
+  {
+    return state_awaitable(*this, state);
+  }
+
+  /**
+   * Suspend the awaiting coroutine until the next transition completes.
+   *
+   * \return An awaitable that yields the transition.
+   */
+  next_transition_awaitable next_transition()
+  {
+    return next_transition_awaitable(*this);
+  }
+
+  /**
+   * Suspend the awaiting coroutine until the supplied trigger can be fired.
+   *
+   * \param trigger The trigger to wait for.
+   *
+   * \return An awaitable that completes immediately if the trigger can already be fired.
+   *
+   * \note Guards are only re-evaluated after a transition.
+   */
+  trigger_awaitable until_can_fire(const TTrigger& trigger)
+  {
+    return trigger_awaitable(*this, trigger);
+  }
+#endif // STATELESS_HAS_COROUTINES
+
 private:
+  /// Parameterized state representation type.
+  typedef detail::state_representation<TState, TTrigger> TStateRepresentation;
+
   /**
    * Wrapper class for internal state storage.
    */
@@ -268,6 +657,114 @@ private:
     TState state_;
   };
 
+  /**
+   * The timers armed for the timed triggers of occupied states.
+   * A copy starts with none, and the timers are cancelled on destruction.
+   */
+  class armed_timers
+  {
+  public:
+    struct entry
+    {
+      TState state;
+      std::uint64_t token;
+      timer_scheduler::TTimerId id;
+    };
+
+    armed_timers()
+      : scheduler(nullptr)
+      , entries()
+      , next_token(0)
+    {}
+
+    armed_timers(const armed_timers& other)
+      : scheduler(other.scheduler)
+      , entries()
+      , next_token(0)
+    {}
+
+    armed_timers& operator=(const armed_timers&)
+    {
+      return *this;
+    }
+
+    ~armed_timers()
+    {
+      for (auto& e : entries)
+      {
+        scheduler->cancel(e.id);
+      }
+    }
+
+    timer_scheduler* scheduler;
+    std::vector<entry> entries;
+    std::uint64_t next_token;
+  };
+
+  /// Require a scheduler before timed triggers are configured, so that arming cannot fail.
+  void check_timer_scheduler() const
+  {
+    if (armed_timers_.scheduler == nullptr)
+    {
+      throw error("A timer scheduler must be set before timed triggers are configured.");
+    }
+  }
+
+  /// Schedule the timed triggers of a state that has been entered.
+  void arm_timers(const TStateRepresentation& representation)
+  {
+    const TState state = representation.underlying_state();
+    for (auto& timed : representation.timed_triggers())
+    {
+      const std::uint64_t token = ++armed_timers_.next_token;
+      const TTrigger trigger = timed.second;
+      auto id = armed_timers_.scheduler->schedule(
+        timed.first,
+        [this, token, state, trigger]()
+        {
+          this->fire_timed_trigger(token, state, trigger);
+        });
+      typename armed_timers::entry e = { state, token, id };
+      armed_timers_.entries.push_back(e);
+    }
+  }
+
+  /// Cancel the timed triggers of a state that has been exited.
+  void disarm_timers(const TStateRepresentation& representation)
+  {
+    const TState state = representation.underlying_state();
+    auto& entries = armed_timers_.entries;
+    auto first = std::remove_if(entries.begin(), entries.end(),
+      [&](const typename armed_timers::entry& e)
+      {
+        if (e.state == state)
+        {
+          armed_timers_.scheduler->cancel(e.id);
+          return true;
+        }
+        return false;
+      });
+    entries.erase(first, entries.end());
+  }
+
+  /// Fire the trigger of an expired timer.
+  void fire_timed_trigger(std::uint64_t token, const TState& state, const TTrigger& trigger)
+  {
+    auto& entries = armed_timers_.entries;
+    entries.erase(
+      std::remove_if(entries.begin(), entries.end(),
+        [=](const typename armed_timers::entry& e){ return e.token == token; }),
+      entries.end());
+    // The state may have been changed externally since the timer was armed.
+    if (is_in_state(state))
+    {
+      fire(trigger);
+    }
+  }
+
+  state_machine(const state_machine&);
+  state_machine& operator=(const state_machine&);
+
   /**
    * Perform initialization.
    *
@@ -280,6 +777,12 @@ private:
   {
     state_accessor_ = state_accessor;
     state_mutator_ = state_mutator;
+    is_firing_ = false;
+    async_lane_ = std::make_shared<async_lane>(this);
+#ifdef STATELESS_ENABLE_INSTRUMENTATION
+    observer_ = nullptr;
+#endif
+    executor_ = [](const std::function<void()>& job){ job(); };
     on_unhandled_trigger_ = [](const TState& state, const TTrigger& trigger)
     {
       throw error(
@@ -288,9 +791,6 @@ private:
     };
   }
 
-  /// Parameterized state representation type.
-  typedef detail::state_representation<TState, TTrigger> TStateRepresentation;
-
   /// The current representation.
   const TStateRepresentation* current_representation() const
   {
@@ -317,62 +817,341 @@ private:
     state_mutator_(new_state);
   }
 
-  /// Implementation of state transition given a trigger.
+  /**
+   * Marks the state machine as firing for the lifetime of the scope.
+   * Discards any queued triggers if the scope is left by an exception.
+   */
+  class firing_scope
+  {
+  public:
+    firing_scope(state_machine& sm)
+      : sm_(sm)
+    {
+      sm_.is_firing_ = true;
+    }
+
+    ~firing_scope()
+    {
+      sm_.queued_triggers_.clear();
+      sm_.is_firing_ = false;
+    }
+
+  private:
+    state_machine& sm_;
+  };
+
+  /**
+   * Fire a trigger and then drain the queue of triggers fired by actions,
+   * so that each transition runs to completion before the next one starts.
+   */
+  template<typename TCallable>
+  void run_to_completion(TCallable fire_first)
+  {
+    firing_scope scope(*this);
+    fire_first();
+    for (std::size_t i = 0; i < queued_triggers_.size(); ++i)
+    {
+      // Take ownership first; the call may queue more triggers and reallocate.
+      auto queued = std::move(queued_triggers_[i]);
+      queued();
+    }
+  }
+
+  /// Fire a trigger now, or queue it if a transition is in progress.
   template<typename... TArgs>
-  void internal_fire(const TTrigger& trigger, TArgs&&... args)
+  void fire_trigger(const TTrigger& trigger, TArgs... args)
   {
-    auto abstract_configuration = trigger_configuration_.find(trigger);
-    if (abstract_configuration != trigger_configuration_.end())
+    typedef state_machine<TState, TTrigger> TSelf;
+    if (is_firing_)
     {
-      typedef trigger_with_parameters<TTrigger, TArgs...> TParameterizedTrigger;
-      auto configuration =
-        std::dynamic_pointer_cast<TParameterizedTrigger>(
-          abstract_configuration->second);
-      if (configuration == nullptr)
-      {
-        throw error("Invalid number or type of parameters.");
-      }
+      queued_triggers_.push_back(
+        std::bind(&TSelf::template queued_fire<TArgs...>, this, trigger, std::move(args)...));
+      return;
     }
+    run_to_completion([&](){ internal_fire(trigger, std::move(args)...); });
+  }
 
-    auto abstract_handler = current_representation()->try_find_handler(trigger);
-    if (abstract_handler == nullptr)
+  /// Fire a queued trigger with its stored copy of the arguments.
+  template<typename... TArgs>
+  void queued_fire(const TTrigger& trigger, TArgs... args)
+  {
+    internal_fire(trigger, std::move(args)...);
+  }
+
+  /// Collect an asynchronous action to run once the current trigger has been handled.
+  void defer_async_action(const std::function<void()>& action)
+  {
+    pending_async_actions_.push_back(action);
+  }
+
+  /// Run the asynchronous actions collected by fire() on the executor.
+  void post_async_actions()
+  {
+    if (is_firing_)
     {
-      on_unhandled_trigger_(
-        current_representation()->underlying_state(), trigger);
       return;
     }
+    if (!pending_async_actions_.empty())
+    {
+      auto actions = std::make_shared<std::vector<std::function<void()>>>();
+      actions->swap(pending_async_actions_);
+      executor_([=]()
+        {
+          for (auto& action : *actions)
+          {
+            action();
+          }
+        });
+    }
+    // Triggers passed to fire_async() from actions wait until now.
+    start_async();
+  }
 
-    const auto& source = state();
-    TState destination;
-    bool is_transition = false;
+  /// A trigger passed to fire_async() and the promise to satisfy when it completes.
+  struct async_item
+  {
+    std::function<void()> fire;
+    std::shared_ptr<std::promise<void>> done;
+  };
+
+  /**
+   * Triggers waiting to be handled by fire_async(). The lane is shared with
+   * the jobs posted to the executor, which reach the machine through it, so
+   * that the machine can be destroyed while they are pending.
+   */
+  struct async_lane
+  {
+    async_lane(state_machine* owner)
+      : mutex()
+      , idle()
+      , queue()
+      , machine(owner)
+      , is_busy(false)
+      , is_active(false)
+      , active_thread()
+    {}
+
+    std::mutex mutex;
+
+    /// Notified when a queued trigger has been fired.
+    std::condition_variable idle;
+
+    std::list<async_item> queue;
 
-    typedef detail::dynamic_trigger_behaviour<TState, TTrigger, TArgs...> TDynamicTriggerBehaviour;
-    typedef detail::trigger_behaviour<TState, TTrigger> TTriggerBehaviour;
-    if (auto handler = std::dynamic_pointer_cast<TDynamicTriggerBehaviour>(abstract_handler))
+    /// The machine, or nullptr once it has been destroyed.
+    state_machine* machine;
+
+    /// Whether a thread is handling the queue, firing or waiting on actions.
+    bool is_busy;
+
+    /// Whether a queued trigger is being fired on active_thread.
+    bool is_active;
+    std::thread::id active_thread;
+  };
+
+  /// Queue a trigger for fire_async() and start handling it if the machine is idle.
+  std::shared_future<void> enqueue_async(const std::function<void()>& fire)
+  {
+    async_item item;
+    item.fire = fire;
+    item.done = std::make_shared<std::promise<void>>();
+    std::shared_future<void> result = item.done->get_future().share();
     {
-      // A dynamic behaviour is configured, so forward the arguments to it.
-      is_transition = handler->results_in_transition_from(source, destination, std::forward<TArgs>(args)...);
+      std::lock_guard<std::mutex> lock(async_lane_->mutex);
+      async_lane_->queue.push_back(item);
+      // While the lane is not busy only this thread can be firing, from an
+      // action, in which case the trigger waits until fire() completes.
+      if (async_lane_->is_busy || is_firing_)
+      {
+        return result;
+      }
+      async_lane_->is_busy = true;
     }
-    else if (auto handler = std::dynamic_pointer_cast<TTriggerBehaviour>(abstract_handler))
+    run_async(async_lane_);
+    return result;
+  }
+
+  /// Start handling queued fire_async() triggers unless already doing so.
+  void start_async()
+  {
     {
-      // Fall back to configuration time defined transition.
-      is_transition = handler->results_in_transition_from(source, destination);
+      std::lock_guard<std::mutex> lock(async_lane_->mutex);
+      if (async_lane_->is_busy || async_lane_->queue.empty())
+      {
+        return;
+      }
+      async_lane_->is_busy = true;
     }
-    else
+    run_async(async_lane_);
+  }
+
+  /**
+   * Fire the queued fire_async() triggers in turn, posting the asynchronous
+   * actions of each to the executor and firing the next once they complete.
+   * Whichever of this loop and the posted job finishes second carries on, so
+   * an inline executor continues the loop instead of recursing.
+   *
+   * \param lane The lane of the machine, which must be busy on this thread.
+   */
+  static void run_async(const std::shared_ptr<async_lane>& lane)
+  {
+    for (;;)
+    {
+      async_item item;
+      state_machine* machine = nullptr;
+      {
+        std::lock_guard<std::mutex> lock(lane->mutex);
+        if (lane->machine == nullptr || lane->queue.empty())
+        {
+          lane->is_busy = false;
+          return;
+        }
+        item = lane->queue.front();
+        lane->queue.pop_front();
+        machine = lane->machine;
+        lane->is_active = true;
+        lane->active_thread = std::this_thread::get_id();
+      }
+
+      std::exception_ptr failure;
+      try
+      {
+        item.fire();
+      }
+      catch (...)
+      {
+        failure = std::current_exception();
+      }
+      auto actions = std::make_shared<std::vector<std::function<void()>>>();
+      TExecutor executor;
+      {
+        std::lock_guard<std::mutex> lock(lane->mutex);
+        if (!failure)
+        {
+          actions->swap(machine->pending_async_actions_);
+        }
+        machine->pending_async_actions_.clear();
+        executor = machine->executor_;
+        lane->is_active = false;
+      }
+      lane->idle.notify_all();
+
+      auto handoff = std::make_shared<std::atomic<int>>(0);
+      const std::weak_ptr<async_lane> weak_lane = lane;
+      const auto done = item.done;
+      executor([failure, actions, done, handoff, weak_lane]()
+        {
+          auto result = failure;
+          if (!result)
+          {
+            try
+            {
+              for (auto& action : *actions)
+              {
+                action();
+              }
+            }
+            catch (...)
+            {
+              result = std::current_exception();
+            }
+          }
+          if (result)
+          {
+            done->set_exception(result);
+          }
+          else
+          {
+            done->set_value();
+          }
+          if (handoff->fetch_add(1) == 1)
+          {
+            if (auto next = weak_lane.lock())
+            {
+              run_async(next);
+            }
+          }
+        });
+      if (handoff->fetch_add(1) == 0)
+      {
+        return;
+      }
+    }
+  }
+
+  /// Implementation of state transition given a trigger.
+  template<typename... TArgs>
+  void internal_fire(const TTrigger& trigger, TArgs&&... args)
+  {
+    detail::check_trigger_parameters<TTrigger, TArgs...>(trigger_configuration_, trigger);
+
+    const auto representation = current_representation();
+    STATELESS_PROBE3(trigger_received, this, representation->underlying_state(), trigger);
+#ifdef STATELESS_ENABLE_INSTRUMENTATION
+    // An observer that declines the trigger is not told the rest of it.
+    TFireObserver* const observer =
+      observer_ != nullptr && observer_->on_fire(representation->underlying_state(), trigger)
+        ? observer_ : nullptr;
+#endif
+    if (sizeof...(TArgs) != 0)
     {
-      throw error("Unable to find a suitable handler.");
+      STATELESS_OBSERVE(observer, on_arguments(trigger, detail::make_fire_arguments(args...)));
+    }
+    auto abstract_handler = representation->try_find_handler(
+      trigger,
+      [&](const detail::abstract_trigger_behaviour& candidate) -> bool
+      {
+#ifdef STATELESS_ENABLE_INSTRUMENTATION
+        if (observer != nullptr && candidate.is_guarded())
+        {
+          observer->on_evaluating_guard(representation->underlying_state(), trigger);
+          const bool is_met = candidate.is_condition_met();
+          observer->on_guard(representation->underlying_state(), trigger, is_met);
+          return is_met;
+        }
+#endif
+        return candidate.is_condition_met();
+      });
+    if (abstract_handler == nullptr)
+    {
+      STATELESS_PROBE3(unhandled_trigger, this, representation->underlying_state(), trigger);
+      STATELESS_OBSERVE(observer, on_unhandled(representation->underlying_state(), trigger));
+      on_unhandled_trigger_(
+        representation->underlying_state(), trigger);
+      return;
     }
 
+    const auto& source = state();
+    TState destination;
+    bool is_transition = detail::results_in_transition_from<TState, TTrigger>(
+      abstract_handler, source, destination, std::forward<TArgs>(args)...);
+    // An ignored trigger resolves to its source.
+    STATELESS_PROBE4(handler_resolved, this, source, trigger, is_transition ? destination : source);
+
     if (is_transition)
     {
       TTransition transition(source, destination, trigger);
-      current_representation()->exit(transition);
+      STATELESS_OBSERVE(observer, on_resolved(transition));
+      representation->exit(transition);
+      STATELESS_OBSERVE(observer, on_exited(transition));
       set_state(transition.destination());
+      STATELESS_PROBE4(transition_committed, this, transition.source(), trigger, transition.destination());
+      STATELESS_OBSERVE(observer, on_state_changed(transition));
       current_representation()->enter(transition, std::forward<TArgs>(args)...);
+      STATELESS_OBSERVE(observer, on_entered(transition));
       if (on_transition_)
       {
         on_transition_(transition);
       }
+      if (!waiters_.empty())
+      {
+        waiters_.notify_ready(transition);
+      }
+      STATELESS_OBSERVE(observer, on_transitioned(transition));
+    }
+    else
+    {
+      STATELESS_OBSERVE(observer, on_ignored(source, trigger));
     }
   }
 
@@ -417,6 +1196,32 @@ private:
 
   /// Function to call on state transition.
   TTransitionAction on_transition_;
+
+  /// True while a trigger is being fired.
+  bool is_firing_;
+
+  /// Triggers fired by actions while a transition was in progress.
+  std::vector<std::function<void()>> queued_triggers_;
+
+  /// Asynchronous actions collected while handling the current trigger.
+  std::vector<std::function<void()>> pending_async_actions_;
+
+  /// Runs asynchronous actions.
+  TExecutor executor_;
+
+  /// Triggers passed to fire_async().
+  std::shared_ptr<async_lane> async_lane_;
+
+  /// Coroutines, and anything else, waiting on transitions.
+  detail::waiter_list<TTransition> waiters_;
+
+  /// Timers armed for timed triggers.
+  armed_timers armed_timers_;
+
+#ifdef STATELESS_ENABLE_INSTRUMENTATION
+  /// Receives the progress of each trigger.
+  TFireObserver* observer_;
+#endif
 };
 
 }
@@ -0,0 +1,69 @@
+/**
+ * Copyright 2013 Matt Mason
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#ifndef STATELESS_TIMER_SCHEDULER_HPP
+#define STATELESS_TIMER_SCHEDULER_HPP
+
+#include <chrono>
+#include <cstdint>
+#include <functional>
+
+namespace stateless
+{
+
+/**
+ * Interface to a source of one-shot timers, used by state machines to fire
+ * timed triggers.
+ */
+class timer_scheduler
+{
+public:
+  /// Type used for timer delays.
+  typedef std::chrono::nanoseconds TDuration;
+
+  /// Identifies a scheduled timer. Zero never identifies a timer.
+  typedef std::uint64_t TTimerId;
+
+  /// Signature for the function called when a timer expires.
+  typedef std::function<void()> TCallback;
+
+  virtual ~timer_scheduler()
+  {}
+
+  /**
+   * Schedule a callback to run once the supplied delay has elapsed.
+   *
+   * \param delay The time to wait.
+   * \param callback The function to call.
+   *
+   * \return An id with which the timer can be cancelled.
+   */
+  virtual TTimerId schedule(TDuration delay, const TCallback& callback) = 0;
+
+  /**
+   * Cancel a timer that has not yet expired.
+   *
+   * \param id The id returned when the timer was scheduled.
+   *
+   * \return True if the timer was cancelled, false if it had already expired or been cancelled.
+   */
+  virtual bool cancel(TTimerId id) = 0;
+};
+
+}
+
+#endif // STATELESS_TIMER_SCHEDULER_HPP
@@ -0,0 +1,378 @@
+/**
+ * Copyright 2013 Matt Mason
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#ifndef STATELESS_TIMING_WHEEL_HPP
+#define STATELESS_TIMING_WHEEL_HPP
+
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <vector>
+
+#include "error.hpp"
+#include "timer_scheduler.hpp"
+
+namespace stateless
+{
+
+/**
+ * A hierarchical timing wheel.
+ *
+ * Time is divided into ticks of a fixed resolution. Timers due within 256
+ * ticks are kept in the slots of the first wheel, those due later in
+ * coarser wheels whose slots are redistributed to the finer ones as time
+ * reaches them. Scheduling and cancelling are constant time, and expiry
+ * costs constant time per timer plus one step per elapsed tick.
+ *
+ * Timers expire when poll() is called, on the calling thread. The wheel is
+ * not thread safe.
+ */
+class timing_wheel : public timer_scheduler
+{
+public:
+  /// Signature for the clock: the time elapsed since an arbitrary fixed epoch.
+  typedef std::function<TDuration()> TClock;
+
+  /**
+   * Construct an empty timing wheel.
+   *
+   * \param resolution The length of a tick. Delays are rounded up to whole ticks.
+   * \param clock The clock to read. Supply a function returning a variable
+   *              to drive the wheel in virtual time.
+   */
+  timing_wheel(
+    TDuration resolution = std::chrono::milliseconds(1),
+    const TClock& clock = steady_clock)
+    : resolution_(resolution)
+    , clock_(clock)
+    , origin_(clock())
+    , current_(0)
+    , size_(0)
+    , nodes_()
+    , free_(nil)
+    , heads_(list_count, static_cast<std::uint32_t>(nil))
+    , level_sizes_(levels + 1, 0)
+  {
+    if (resolution_.count() <= 0)
+    {
+      throw error("The timing wheel resolution must be positive.");
+    }
+  }
+
+  /**
+   * Schedule a callback to run once the supplied delay has elapsed.
+   * The callback runs from the first call to poll() at or after that time.
+   */
+  TTimerId schedule(TDuration delay, const TCallback& callback) override
+  {
+    std::uint64_t expiry = ticks_at(clock_()) + ticks_in(delay);
+    if (expiry <= current_)
+    {
+      expiry = current_ + 1;
+    }
+    const std::uint32_t index = allocate();
+    node& n = nodes_[index];
+    n.expiry = expiry;
+    n.callback = callback;
+    insert(index);
+    ++size_;
+    return (static_cast<TTimerId>(n.generation) << 32) | index;
+  }
+
+  bool cancel(TTimerId id) override
+  {
+    const std::uint32_t index = static_cast<std::uint32_t>(id);
+    if (index >= nodes_.size())
+    {
+      return false;
+    }
+    node& n = nodes_[index];
+    if (n.list == nil || n.generation != static_cast<std::uint32_t>(id >> 32))
+    {
+      return false;
+    }
+    unlink(index);
+    release(index);
+    --size_;
+    return true;
+  }
+
+  /**
+   * Advance to the current time, calling the callbacks of expired timers.
+   * Callbacks may schedule and cancel timers. If a callback throws, the
+   * exception propagates and the remaining expired timers run on the next
+   * call.
+   *
+   * \return The number of callbacks called.
+   */
+  std::size_t poll()
+  {
+    const std::uint64_t target = ticks_at(clock_());
+    std::size_t fired = 0;
+    while (current_ < target)
+    {
+      if (size_ == 0)
+      {
+        current_ = target;
+        break;
+      }
+      skip_idle_ticks(target);
+      ++current_;
+      cascade();
+      fired += expire(static_cast<std::uint32_t>(current_ & slot_mask));
+    }
+    return fired;
+  }
+
+  /// The number of scheduled timers.
+  std::size_t size() const
+  {
+    return size_;
+  }
+
+  /// The length of a tick.
+  TDuration resolution() const
+  {
+    return resolution_;
+  }
+
+  /// The default clock, based on std::chrono::steady_clock.
+  static TDuration steady_clock()
+  {
+    return std::chrono::duration_cast<TDuration>(
+      std::chrono::steady_clock::now().time_since_epoch());
+  }
+
+private:
+  enum
+  {
+    slot_bits = 8,
+    slots = 1 << slot_bits,
+    slot_mask = slots - 1,
+    levels = 4,
+    /// Timers beyond the last wheel wait in one list until it wraps.
+    overflow = levels * slots,
+    list_count = overflow + 1
+  };
+
+  /// Marks the end of a list, and a node that is in no list.
+  static const std::uint32_t nil = 0xFFFFFFFFu;
+
+  struct node
+  {
+    node()
+      : expiry(0)
+      , prev(nil)
+      , next(nil)
+      , list(nil)
+      , generation(1)
+      , callback()
+    {}
+
+    std::uint64_t expiry;
+    std::uint32_t prev;
+    std::uint32_t next;
+    std::uint32_t list;
+    std::uint32_t generation;
+    TCallback callback;
+  };
+
+  std::uint64_t ticks_at(TDuration time) const
+  {
+    return time <= origin_ ? 0 : static_cast<std::uint64_t>((time - origin_) / resolution_);
+  }
+
+  std::uint64_t ticks_in(TDuration delay) const
+  {
+    if (delay.count() <= 0)
+    {
+      return 0;
+    }
+    return static_cast<std::uint64_t>((delay + resolution_ - TDuration(1)) / resolution_);
+  }
+
+  std::uint32_t allocate()
+  {
+    if (free_ == nil)
+    {
+      if (nodes_.size() >= nil)
+      {
+        throw error("Too many timers are scheduled.");
+      }
+      nodes_.push_back(node());
+      return static_cast<std::uint32_t>(nodes_.size() - 1);
+    }
+    const std::uint32_t index = free_;
+    free_ = nodes_[index].next;
+    return index;
+  }
+
+  /// Return a node to the free list, invalidating ids that refer to it.
+  void release(std::uint32_t index)
+  {
+    node& n = nodes_[index];
+    n.callback = nullptr;
+    n.list = nil;
+    ++n.generation;
+    if (n.generation == 0)
+    {
+      n.generation = 1;
+    }
+    n.next = free_;
+    free_ = index;
+  }
+
+  /**
+   * Place a node in the slot of the wheel for the most significant tick
+   * digit in which its expiry differs from the current time. The slot is
+   * reached, and redistributed, exactly when the lower digits roll over.
+   */
+  void insert(std::uint32_t index)
+  {
+    node& n = nodes_[index];
+    const std::uint64_t difference = n.expiry ^ current_;
+    std::uint32_t list = overflow;
+    for (unsigned level = 0; level < levels; ++level)
+    {
+      if ((difference >> (slot_bits * (level + 1))) == 0)
+      {
+        list = level * slots +
+          static_cast<std::uint32_t>((n.expiry >> (slot_bits * level)) & slot_mask);
+        break;
+      }
+    }
+    n.list = list;
+    ++level_sizes_[list / slots];
+    n.prev = nil;
+    n.next = heads_[list];
+    if (n.next != nil)
+    {
+      nodes_[n.next].prev = index;
+    }
+    heads_[list] = index;
+  }
+
+  void unlink(std::uint32_t index)
+  {
+    node& n = nodes_[index];
+    --level_sizes_[n.list / slots];
+    if (n.prev != nil)
+    {
+      nodes_[n.prev].next = n.next;
+    }
+    else
+    {
+      heads_[n.list] = n.next;
+    }
+    if (n.next != nil)
+    {
+      nodes_[n.next].prev = n.prev;
+    }
+  }
+
+  /**
+   * With the finer wheels empty nothing can happen until the finest
+   * occupied wheel next redistributes a slot, so move to just before that.
+   */
+  void skip_idle_ticks(std::uint64_t target)
+  {
+    unsigned level = 0;
+    while (level_sizes_[level] == 0)
+    {
+      ++level;
+    }
+    if (level == 0)
+    {
+      return;
+    }
+    const unsigned shift = slot_bits * level;
+    const std::uint64_t boundary = ((current_ >> shift) + 1) << shift;
+    current_ = (boundary < target ? boundary : target) - 1;
+  }
+
+  /// Move the timers of every coarser slot reached at the current tick to finer ones.
+  void cascade()
+  {
+    for (unsigned level = 1; level < levels; ++level)
+    {
+      if ((current_ & ((std::uint64_t(1) << (slot_bits * level)) - 1)) != 0)
+      {
+        return;
+      }
+      redistribute(level * slots +
+        static_cast<std::uint32_t>((current_ >> (slot_bits * level)) & slot_mask));
+    }
+    if ((current_ & ((std::uint64_t(1) << (slot_bits * levels)) - 1)) == 0)
+    {
+      redistribute(overflow);
+    }
+  }
+
+  void redistribute(std::uint32_t list)
+  {
+    std::uint32_t index = heads_[list];
+    heads_[list] = nil;
+    while (index != nil)
+    {
+      const std::uint32_t next = nodes_[index].next;
+      --level_sizes_[list / slots];
+      insert(index);
+      index = next;
+    }
+  }
+
+  /// Call the callbacks of the timers in a slot of the finest wheel.
+  std::size_t expire(std::uint32_t list)
+  {
+    std::size_t fired = 0;
+    while (heads_[list] != nil)
+    {
+      const std::uint32_t index = heads_[list];
+      unlink(index);
+      TCallback callback;
+      callback.swap(nodes_[index].callback);
+      release(index);
+      --size_;
+      ++fired;
+      callback();
+    }
+    return fired;
+  }
+
+  TDuration resolution_;
+  TClock clock_;
+  TDuration origin_;
+
+  /// The number of ticks from the origin up to which timers have expired.
+  std::uint64_t current_;
+  std::size_t size_;
+
+  /// Timer storage, with unused nodes linked through next from free_.
+  std::vector<node> nodes_;
+  std::uint32_t free_;
+
+  /// The first node of each slot list.
+  std::vector<std::uint32_t> heads_;
+
+  /// The number of timers in each wheel, and in the overflow list.
+  std::vector<std::size_t> level_sizes_;
+};
+
+}
+
+#endif // STATELESS_TIMING_WHEEL_HPP
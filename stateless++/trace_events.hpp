@@ -0,0 +1,498 @@
+/**
+ * Copyright 2013 Matt Mason
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#ifndef STATELESS_TRACE_EVENTS_HPP
+#define STATELESS_TRACE_EVENTS_HPP
+
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <cstdio>
+#include <functional>
+#include <mutex>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "detail/per_thread.hpp"
+#include "error.hpp"
+#include "fire_observer.hpp"
+#include "print_state.hpp"
+#include "print_trigger.hpp"
+
+namespace stateless
+{
+
+/**
+ * A file of events in the Chrome trace event JSON format, which can be
+ * opened in Perfetto or chrome://tracing.
+ *
+ * Each thread appends events to its own buffer, and a background thread
+ * writes the buffers to the file periodically. The file is completed when
+ * the object is destroyed, which must happen after every tracer using it.
+ */
+class trace_event_file
+{
+public:
+  /// Process id under which state occupancy is shown.
+  static const int states_process = 1;
+
+  /// Process id under which the handling of triggers is shown.
+  static const int triggers_process = 2;
+
+  /**
+   * Create a trace file.
+   *
+   * \param path The file to create.
+   * \param flush_interval How often buffered events are written.
+   *
+   * \throw error The file cannot be created.
+   */
+  trace_event_file(
+    const std::string& path,
+    std::chrono::milliseconds flush_interval = std::chrono::milliseconds(100))
+    : file_(std::fopen(path.c_str(), "w"))
+    , start_(std::chrono::steady_clock::now())
+    , buffers_()
+    , file_mutex_()
+    , stop_mutex_()
+    , stop_condition_()
+    , is_stopping_(false)
+    , flusher_()
+  {
+    if (file_ == nullptr)
+    {
+      throw error("Unable to create the trace file.");
+    }
+    std::fputs("[\n", file_);
+    flusher_ = std::thread([this, flush_interval]()
+      {
+        std::unique_lock<std::mutex> lock(stop_mutex_);
+        while (!stop_condition_.wait_for(lock, flush_interval, [this](){ return is_stopping_; }))
+        {
+          lock.unlock();
+          flush();
+          lock.lock();
+        }
+      });
+  }
+
+  /// Write any buffered events and complete the file.
+  ~trace_event_file()
+  {
+    {
+      std::lock_guard<std::mutex> lock(stop_mutex_);
+      is_stopping_ = true;
+    }
+    stop_condition_.notify_one();
+    flusher_.join();
+    flush();
+    std::fprintf(file_,
+      "{\"ph\":\"M\",\"pid\":%d,\"name\":\"process_name\",\"args\":{\"name\":\"state occupancy\"}},\n"
+      "{\"ph\":\"M\",\"pid\":%d,\"name\":\"process_name\",\"args\":{\"name\":\"triggers\"}}\n]\n",
+      states_process, triggers_process);
+    std::fclose(file_);
+  }
+
+  /// Microseconds since the file was created, the time base of its events.
+  double now() const
+  {
+    const std::chrono::duration<double, std::micro> elapsed = std::chrono::steady_clock::now() - start_;
+    return elapsed.count();
+  }
+
+  /**
+   * Add a complete event: a span of time on a track.
+   *
+   * \param name The name of the span, already escaped for JSON.
+   * \param category The category of the span.
+   * \param process The process id under which the track is shown.
+   * \param track The thread id of the track.
+   * \param start The start of the span, from now().
+   * \param end The end of the span, from now().
+   */
+  void add_span(
+    const std::string& name,
+    const char* category,
+    int process,
+    std::uint64_t track,
+    double start,
+    double end)
+  {
+    char numbers[128];
+    std::snprintf(numbers, sizeof(numbers),
+      "\",\"ph\":\"X\",\"ts\":%.3f,\"dur\":%.3f,\"pid\":%d,\"tid\":%llu},\n",
+      start, end - start, process, static_cast<unsigned long long>(track));
+    auto& buffer = buffers_.local();
+    std::lock_guard<std::mutex> lock(buffer.mutex);
+    buffer.text += "{\"name\":\"";
+    buffer.text += name;
+    buffer.text += "\",\"cat\":\"";
+    buffer.text += category;
+    buffer.text += numbers;
+  }
+
+  /// Write the events buffered by every thread.
+  void flush()
+  {
+    std::lock_guard<std::mutex> file_lock(file_mutex_);
+    std::string text;
+    buffers_.for_each([&](thread_buffer& buffer)
+      {
+        {
+          std::lock_guard<std::mutex> lock(buffer.mutex);
+          text.swap(buffer.text);
+        }
+        std::fwrite(text.data(), 1, text.size(), file_);
+        text.clear();
+      });
+    std::fflush(file_);
+  }
+
+  /// Escape a string for inclusion in JSON.
+  static std::string escape(const std::string& text)
+  {
+    std::string result;
+    result.reserve(text.size());
+    for (char c : text)
+    {
+      if (c == '"' || c == '\\')
+      {
+        result += '\\';
+        result += c;
+      }
+      else if (static_cast<unsigned char>(c) < 0x20)
+      {
+        char code[8];
+        std::snprintf(code, sizeof(code), "\\u%04x", static_cast<unsigned>(c));
+        result += code;
+      }
+      else
+      {
+        result += c;
+      }
+    }
+    return result;
+  }
+
+private:
+  trace_event_file(const trace_event_file&);
+  trace_event_file& operator=(const trace_event_file&);
+
+  struct thread_buffer
+  {
+    thread_buffer()
+      : mutex()
+      , text()
+    {}
+
+    std::mutex mutex;
+    std::string text;
+  };
+
+  std::FILE* file_;
+  const std::chrono::steady_clock::time_point start_;
+  detail::per_thread<thread_buffer> buffers_;
+
+  /// Serializes writes to the file.
+  std::mutex file_mutex_;
+
+  std::mutex stop_mutex_;
+  std::condition_variable stop_condition_;
+  bool is_stopping_;
+  std::thread flusher_;
+};
+
+/**
+ * Traces the state machines or instances it observes to a trace_event_file.
+ *
+ * Each machine or instance is shown as a track. Under the state occupancy
+ * process, its track has a span for each state it occupied, from its entry
+ * to the next transition out of it; a state occupied when tracing started
+ * is shown from the first trigger fired in it. Under the triggers process,
+ * each trigger handled has a span, within which are spans for its guards,
+ * exit actions, entry actions and the transition action. States and
+ * triggers are named with print_state() and print_trigger().
+ *
+ * Each thread records when the tracks it fires enter and leave states, and
+ * the occupancy spans are built from those records when the tracer is
+ * destroyed, so that firing on different threads shares no lock. The
+ * records are kept until then.
+ *
+ * Tracing requires STATELESS_ENABLE_INSTRUMENTATION to be defined; see
+ * state_machine::set_observer() and instance_store::set_observer(). A
+ * tracer must be destroyed before its file.
+ *
+ * \tparam TState The type used to represent the states.
+ * \tparam TTrigger The type used to represent the triggers that cause state transitions.
+ */
+template<typename TState, typename TTrigger>
+class state_tracer : public fire_observer<TState, TTrigger>
+{
+public:
+  /// Parameterized transition type.
+  typedef typename fire_observer<TState, TTrigger>::TTransition TTransition;
+
+  /// Signature of a function that identifies the track of the trigger being fired.
+  typedef std::function<std::uint64_t()> TTrack;
+
+  /**
+   * Construct a tracer for a single state machine.
+   *
+   * \param file The file to write to.
+   * \param track The id of the machine's track.
+   */
+  state_tracer(trace_event_file& file, std::uint64_t track)
+    : file_(file)
+    , track_([track](){ return track; })
+    , threads_()
+  {}
+
+  /**
+   * Construct a tracer for many instances, such as those of an instance store.
+   *
+   * \param file The file to write to.
+   * \param track Called as each trigger is fired to identify the instance,
+   *              for example with instance_store::current().
+   */
+  state_tracer(trace_event_file& file, const TTrack& track)
+    : file_(file)
+    , track_(track)
+    , threads_()
+  {}
+
+  /// Add the occupancy spans, including those of the states still occupied.
+  ~state_tracer()
+  {
+    const double now = file_.now();
+    std::vector<occupancy_event> events;
+    threads_.for_each([&](thread_frames& t)
+      {
+        events.insert(events.end(), t.events.begin(), t.events.end());
+      });
+    // A track's events are ordered by time; a thread's own stay in order on ties.
+    std::stable_sort(events.begin(), events.end(),
+      [](const occupancy_event& a, const occupancy_event& b)
+      {
+        return a.track < b.track || (a.track == b.track && a.time < b.time);
+      });
+    bool is_occupied = false;
+    occupancy_event occupied = occupancy_event();
+    for (auto& e : events)
+    {
+      if (is_occupied && e.track != occupied.track)
+      {
+        add_occupancy(occupied, now);
+        is_occupied = false;
+      }
+      switch (e.kind)
+      {
+      case occupancy_event::observed:
+        // A state occupied before tracing started is shown from its first trigger.
+        if (!is_occupied)
+        {
+          occupied = e;
+          is_occupied = true;
+        }
+        break;
+      case occupancy_event::left:
+        if (is_occupied)
+        {
+          add_occupancy(occupied, e.time);
+          is_occupied = false;
+        }
+        break;
+      case occupancy_event::entered:
+        occupied = e;
+        is_occupied = true;
+        break;
+      }
+    }
+    if (is_occupied)
+    {
+      add_occupancy(occupied, now);
+    }
+  }
+
+  virtual bool on_fire(const TState& source, const TTrigger& trigger)
+  {
+    const double now = file_.now();
+    frame f = { track_(), now, now, source, trigger };
+    auto& thread = threads_.local();
+    thread.events.push_back(occupancy_event{ f.track, now, source, occupancy_event::observed });
+    auto& frames = thread.frames;
+    if (frames.size() == max_depth)
+    {
+      // Only reached if actions have thrown, abandoning frames.
+      frames.clear();
+    }
+    frames.push_back(f);
+    return true;
+  }
+
+  virtual void on_evaluating_guard(const TState&, const TTrigger&)
+  {
+    current().phase_start = file_.now();
+  }
+
+  virtual void on_guard(const TState&, const TTrigger& trigger, bool is_met)
+  {
+    auto& f = current();
+    span(f, (is_met ? "guard met: " : "guard not met: ") + trigger_name(trigger), "guard", f.phase_start);
+  }
+
+  virtual void on_unhandled(const TState&, const TTrigger&)
+  {
+    finish(" (unhandled)");
+  }
+
+  virtual void on_ignored(const TState&, const TTrigger&)
+  {
+    finish(" (ignored)");
+  }
+
+  virtual void on_resolved(const TTransition& transition)
+  {
+    auto& thread = threads_.local();
+    auto& f = thread.frames.back();
+    const double now = file_.now();
+    thread.events.push_back(occupancy_event{ f.track, now, transition.source(), occupancy_event::left });
+    f.phase_start = now;
+  }
+
+  virtual void on_exited(const TTransition& transition)
+  {
+    auto& f = current();
+    f.phase_start = span(f, "exit " + state_name(transition.source()), "action", f.phase_start);
+  }
+
+  virtual void on_state_changed(const TTransition&)
+  {
+    current().phase_start = file_.now();
+  }
+
+  virtual void on_entered(const TTransition& transition)
+  {
+    auto& f = current();
+    const double now = span(f, "entry " + state_name(transition.destination()), "action", f.phase_start);
+    threads_.local().events.push_back(
+      occupancy_event{ f.track, now, transition.destination(), occupancy_event::entered });
+    f.phase_start = now;
+  }
+
+  virtual void on_transitioned(const TTransition&)
+  {
+    auto& f = current();
+    span(f, "on_transition", "action", f.phase_start);
+    finish("");
+  }
+
+private:
+  state_tracer(const state_tracer&);
+  state_tracer& operator=(const state_tracer&);
+
+  /// Bound on nested triggers, beyond which frames are assumed to be abandoned.
+  static const std::size_t max_depth = 64;
+
+  /// A trigger being handled.
+  struct frame
+  {
+    std::uint64_t track;
+    double start;
+    double phase_start;
+    TState source;
+    TTrigger trigger;
+  };
+
+  /// A track starting or ceasing to occupy a state.
+  struct occupancy_event
+  {
+    enum kind_type { observed, left, entered };
+
+    std::uint64_t track;
+    double time;
+    TState state;
+    kind_type kind;
+  };
+
+  struct thread_frames
+  {
+    thread_frames()
+      : frames()
+      , events()
+    {}
+
+    std::vector<frame> frames;
+    std::vector<occupancy_event> events;
+  };
+
+  static std::string state_name(const TState& state)
+  {
+    std::ostringstream os;
+    print_state<TState>(os, state);
+    return trace_event_file::escape(os.str());
+  }
+
+  static std::string trigger_name(const TTrigger& trigger)
+  {
+    std::ostringstream os;
+    print_trigger<TTrigger>(os, trigger);
+    return trace_event_file::escape(os.str());
+  }
+
+  frame& current()
+  {
+    return threads_.local().frames.back();
+  }
+
+  /// Add a span on the triggers track, ending now. Returns the end.
+  double span(const frame& f, const std::string& name, const char* category, double start)
+  {
+    const double end = file_.now();
+    file_.add_span(name, category, trace_event_file::triggers_process, f.track, start, end);
+    return end;
+  }
+
+  /// Add a span on the state occupancy track, from the time of an event.
+  void add_occupancy(const occupancy_event& since, double end)
+  {
+    file_.add_span(state_name(since.state), "state",
+      trace_event_file::states_process, since.track, since.time, end);
+  }
+
+  /// Add the span of the trigger being handled, which has finished.
+  void finish(const char* suffix)
+  {
+    auto& frames = threads_.local().frames;
+    const frame& f = frames.back();
+    span(f, trigger_name(f.trigger) + suffix, "trigger", f.start);
+    frames.pop_back();
+  }
+
+  trace_event_file& file_;
+  const TTrack track_;
+  detail::per_thread<thread_frames> threads_;
+};
+
+template<typename TState, typename TTrigger>
+const std::size_t state_tracer<TState, TTrigger>::max_depth;
+
+}
+
+#endif // STATELESS_TRACE_EVENTS_HPP
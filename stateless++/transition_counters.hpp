@@ -0,0 +1,300 @@
+/**
+ * Copyright 2013 Matt Mason
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#ifndef STATELESS_TRANSITION_COUNTERS_HPP
+#define STATELESS_TRANSITION_COUNTERS_HPP
+
+#include <cstdint>
+#include <map>
+#include <mutex>
+#include <tuple>
+#include <utility>
+
+#include "detail/per_thread.hpp"
+#include "fire_observer.hpp"
+
+namespace stateless
+{
+
+/**
+ * Counts the fires, transitions, ignored and unhandled triggers and guard
+ * evaluations and rejections of the state machines and instance stores it observes.
+ *
+ * Each thread counts into its own set of counters, which only that thread
+ * writes, so threads never contend on a shared cache line. Reads merge the
+ * counters of every thread that has used the object, including threads
+ * that have since exited. A thread takes a lock only the first time it
+ * sees a combination of states and trigger.
+ *
+ * Counting requires STATELESS_ENABLE_INSTRUMENTATION to be defined; see
+ * state_machine::set_observer() and instance_store::set_observer().
+ *
+ * \tparam TState The type used to represent the states.
+ * \tparam TTrigger The type used to represent the triggers that cause state transitions.
+ */
+template<typename TState, typename TTrigger>
+class transition_counters : public fire_observer<TState, TTrigger>
+{
+public:
+  /// Parameterized transition type.
+  typedef typename fire_observer<TState, TTrigger>::TTransition TTransition;
+
+  /// The counts for a trigger fired in a state.
+  struct trigger_counts
+  {
+    /// Times the trigger was fired.
+    std::uint64_t fires;
+
+    /// Fires that resulted in a transition.
+    std::uint64_t transitions;
+
+    /// Fires accepted without a transition.
+    std::uint64_t ignored;
+
+    /// Fires that no behaviour handled.
+    std::uint64_t unhandled;
+
+    /// Guards evaluated to false.
+    std::uint64_t guard_rejections;
+
+    /// Guards evaluated, whether true or false.
+    std::uint64_t guard_evaluations;
+  };
+
+  transition_counters()
+    : threads_()
+  {}
+
+  /**
+   * The counts for a trigger fired in a state.
+   *
+   * \param source The state in which the trigger was fired.
+   * \param trigger The trigger.
+   */
+  trigger_counts counts(const TState& source, const TTrigger& trigger) const
+  {
+    trigger_counts result = {};
+    const auto key = std::make_pair(source, trigger);
+    threads_.for_each([&](const thread_counts& t)
+      {
+        std::lock_guard<std::mutex> lock(t.mutex);
+        auto it = t.triggers.find(key);
+        if (it != t.triggers.end())
+        {
+          it->second.add_to(result);
+        }
+      });
+    return result;
+  }
+
+  /**
+   * The number of transitions between two states via a trigger.
+   *
+   * \param source The state in which the trigger was fired.
+   * \param trigger The trigger.
+   * \param destination The state entered.
+   */
+  std::uint64_t transitions(
+    const TState& source, const TTrigger& trigger, const TState& destination) const
+  {
+    std::uint64_t result = 0;
+    const auto key = std::make_tuple(source, trigger, destination);
+    threads_.for_each([&](const thread_counts& t)
+      {
+        std::lock_guard<std::mutex> lock(t.mutex);
+        auto it = t.transitions.find(key);
+        if (it != t.transitions.end())
+        {
+          result += it->second.get();
+        }
+      });
+    return result;
+  }
+
+  /**
+   * Visit the counts of every trigger that has been fired.
+   *
+   * \param visitor Function called with the source state, trigger and
+   *                trigger_counts, in order of state and then trigger.
+   */
+  template<typename TCallable>
+  void for_each(TCallable visitor) const
+  {
+    std::map<std::pair<TState, TTrigger>, trigger_counts> merged;
+    threads_.for_each([&](const thread_counts& t)
+      {
+        std::lock_guard<std::mutex> lock(t.mutex);
+        for (auto& entry : t.triggers)
+        {
+          entry.second.add_to(merged[entry.first]);
+        }
+      });
+    for (auto& entry : merged)
+    {
+      visitor(entry.first.first, entry.first.second, entry.second);
+    }
+  }
+
+  /**
+   * Visit the count of every transition that has been made.
+   *
+   * \param visitor Function called with the source state, trigger, destination
+   *                state and count, in order of source, trigger and destination.
+   */
+  template<typename TCallable>
+  void for_each_transition(TCallable visitor) const
+  {
+    std::map<std::tuple<TState, TTrigger, TState>, std::uint64_t> merged;
+    threads_.for_each([&](const thread_counts& t)
+      {
+        std::lock_guard<std::mutex> lock(t.mutex);
+        for (auto& entry : t.transitions)
+        {
+          merged[entry.first] += entry.second.get();
+        }
+      });
+    for (auto& entry : merged)
+    {
+      visitor(std::get<0>(entry.first), std::get<1>(entry.first), std::get<2>(entry.first), entry.second);
+    }
+  }
+
+  virtual bool on_fire(const TState& source, const TTrigger& trigger)
+  {
+    auto& t = threads_.local();
+    const auto key = std::make_pair(source, trigger);
+    auto it = t.triggers.find(key);
+    if (it == t.triggers.end())
+    {
+      std::lock_guard<std::mutex> lock(t.mutex);
+      it = t.triggers.emplace(
+        std::piecewise_construct, std::forward_as_tuple(key), std::forward_as_tuple()).first;
+    }
+    // The remaining events for this trigger precede any action that could fire another.
+    t.current = &it->second;
+    t.current->fires.increment();
+    return true;
+  }
+
+  virtual void on_guard(const TState&, const TTrigger&, bool is_met)
+  {
+    auto& block = *threads_.local().current;
+    block.guard_evaluations.increment();
+    if (!is_met)
+    {
+      block.guard_rejections.increment();
+    }
+  }
+
+  virtual void on_unhandled(const TState&, const TTrigger&)
+  {
+    threads_.local().current->unhandled.increment();
+  }
+
+  virtual void on_ignored(const TState&, const TTrigger&)
+  {
+    threads_.local().current->ignored.increment();
+  }
+
+  virtual void on_resolved(const TTransition& transition)
+  {
+    auto& t = threads_.local();
+    auto& block = *t.current;
+    block.transitions.increment();
+    // Most triggers lead to the same destination from a given state every time.
+    if (block.last_transition == nullptr || !(block.last_destination == transition.destination()))
+    {
+      const auto key = std::make_tuple(transition.source(), transition.trigger(), transition.destination());
+      auto it = t.transitions.find(key);
+      if (it == t.transitions.end())
+      {
+        std::lock_guard<std::mutex> lock(t.mutex);
+        it = t.transitions.emplace(
+          std::piecewise_construct, std::forward_as_tuple(key), std::forward_as_tuple()).first;
+      }
+      block.last_destination = transition.destination();
+      block.last_transition = &it->second;
+    }
+    block.last_transition->increment();
+  }
+
+private:
+  transition_counters(const transition_counters&);
+  transition_counters& operator=(const transition_counters&);
+
+  typedef detail::owned_counter counter;
+
+  struct trigger_block
+  {
+    trigger_block()
+      : fires()
+      , transitions()
+      , ignored()
+      , unhandled()
+      , guard_rejections()
+      , guard_evaluations()
+      , last_destination()
+      , last_transition(nullptr)
+    {}
+
+    void add_to(trigger_counts& result) const
+    {
+      result.fires += fires.get();
+      result.transitions += transitions.get();
+      result.ignored += ignored.get();
+      result.unhandled += unhandled.get();
+      result.guard_rejections += guard_rejections.get();
+      result.guard_evaluations += guard_evaluations.get();
+    }
+
+    counter fires;
+    counter transitions;
+    counter ignored;
+    counter unhandled;
+    counter guard_rejections;
+    counter guard_evaluations;
+
+    /// The owning thread's most recent transition for the trigger.
+    TState last_destination;
+    counter* last_transition;
+  };
+
+  /// The counters of one thread. The maps only grow, so readers can iterate them under the lock.
+  struct thread_counts
+  {
+    thread_counts()
+      : mutex()
+      , triggers()
+      , transitions()
+      , current(nullptr)
+    {}
+
+    /// Held by the owning thread while it adds an entry, and by readers.
+    mutable std::mutex mutex;
+    std::map<std::pair<TState, TTrigger>, trigger_block> triggers;
+    std::map<std::tuple<TState, TTrigger, TState>, counter> transitions;
+
+    /// The counts for the trigger being fired.
+    trigger_block* current;
+  };
+
+  detail::per_thread<thread_counts> threads_;
+};
+
+}
+
+#endif // STATELESS_TRANSITION_COUNTERS_HPP
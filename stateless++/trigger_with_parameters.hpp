@@ -17,6 +17,10 @@
 #ifndef STATELESS_TRIGGER_WITH_PARAMETERS_HPP
 #define STATELESS_TRIGGER_WITH_PARAMETERS_HPP
 
+#include <memory>
+
+#include "error.hpp"
+
 namespace stateless
 {
 
@@ -56,6 +60,36 @@ public:
   {}
 };
 
+namespace detail
+{
+
+/**
+ * Check that the argument types match those configured for a trigger, if any.
+ *
+ * \param configuration Mapping of triggers with arguments to the underlying trigger.
+ * \param trigger The trigger being fired.
+ *
+ * \throw error The arguments do not match the configured parameters.
+ */
+template<typename TTrigger, typename... TArgs, typename TConfiguration>
+void check_trigger_parameters(const TConfiguration& configuration, const TTrigger& trigger)
+{
+  auto abstract_configuration = configuration.find(trigger);
+  if (abstract_configuration != configuration.end())
+  {
+    typedef trigger_with_parameters<TTrigger, TArgs...> TParameterizedTrigger;
+    auto parameterized =
+      std::dynamic_pointer_cast<TParameterizedTrigger>(
+        abstract_configuration->second);
+    if (parameterized == nullptr)
+    {
+      throw error("Invalid number or type of parameters.");
+    }
+  }
+}
+
+}
+
 }
 
 #endif // STATELESS_TRIGGER_WITH_PARAMETERS_HPP
@@ -0,0 +1,30 @@
+# Copyright 2013 Matt Mason
+#
+# Licensed under the Apache License, Version 2.0 (the "License");
+# you may not use this file except in compliance with the License.
+# You may obtain a copy of the License at
+#
+# http://www.apache.org/licenses/LICENSE-2.0
+#
+# Unless required by applicable law or agreed to in writing, software
+# distributed under the License is distributed on an "AS IS" BASIS,
+# WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+# See the License for the specific language governing permissions and
+# limitations under the License.
+
+# Fail unless BINARY has a stateless USDT probe note for each probe point.
+# Run with: cmake -DREADELF=<readelf> -DBINARY=<binary> -P check_probes.cmake
+
+execute_process(
+  COMMAND ${READELF} --notes ${BINARY}
+  OUTPUT_VARIABLE notes
+  RESULT_VARIABLE result)
+if (NOT result EQUAL 0)
+  message(FATAL_ERROR "Unable to read the notes of ${BINARY}.")
+endif (NOT result EQUAL 0)
+
+foreach (probe trigger_received handler_resolved transition_committed unhandled_trigger)
+  if (NOT notes MATCHES "Provider: stateless[\r\n]+ *Name: ${probe}[\r\n]")
+    message(FATAL_ERROR "${BINARY} has no stateless:${probe} probe.")
+  endif (NOT notes MATCHES "Provider: stateless[\r\n]+ *Name: ${probe}[\r\n]")
+endforeach (probe)
@@ -0,0 +1,259 @@
+/**
+ * Copyright 2013 Matt Mason
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#ifndef _WIN32
+
+#include <stateless++/compact_journal.hpp>
+#include <stateless++/instance_store.hpp>
+#include <stateless++/journal.hpp>
+#include <stateless++/state_machine.hpp>
+
+#include <state.hpp>
+#include <temporary_file.hpp>
+#include <trigger.hpp>
+
+#include <gtest/gtest.h>
+
+#include <cstdint>
+#include <fstream>
+#include <vector>
+
+#include <unistd.h>
+
+using namespace stateless;
+using namespace testing;
+
+namespace
+{
+
+using TStateMachine = state_machine<state, trigger>;
+using TStore = instance_store<state, trigger>;
+using TWriter = compact_journal_writer<state, trigger>;
+using TReader = compact_journal_reader<state, trigger>;
+using TTransition = TWriter::TTransition;
+
+const state states[] = { state::A, state::B, state::C };
+
+/// Append n transitions to the journal and apply them to the store.
+void transition(TWriter& writer, TStore& store, std::size_t first, std::size_t n)
+{
+  for (std::size_t i = first; i < first + n; ++i)
+  {
+    const std::size_t instance = (i * 7919) % store.size();
+    const state destination = states[(i / 3) % 3];
+    writer.append_at(static_cast<std::int64_t>(1000 + i), instance,
+      TTransition(store.state(instance), destination, trigger::X));
+    store.set_state(instance, destination);
+  }
+}
+
+off_t file_size(const std::string& path)
+{
+  std::ifstream in(path, std::ios::binary | std::ios::ate);
+  return static_cast<off_t>(in.tellg());
+}
+
+TEST(CompactJournal, WhenTransitionsAreAppended_ThenTheyAreReadBackInOrder)
+{
+  temporary_file file;
+  {
+    TWriter writer(file.path(), 64);
+    for (std::uint64_t i = 0; i < 100; ++i)
+    {
+      writer.append_at(static_cast<std::int64_t>(1000000 - i * i), i * 1000, TTransition(state::A, state::B, trigger::Y), 'c', static_cast<int>(i));
+    }
+  }
+
+  std::uint64_t i = 0;
+  const std::size_t count = TReader(file.path()).for_each([&](const TReader::entry& e)
+    {
+      ASSERT_EQ(i * 1000, e.instance());
+      ASSERT_EQ(static_cast<std::int64_t>(1000000 - i * i), e.timestamp());
+      ASSERT_EQ(state::A, e.source());
+      ASSERT_EQ(state::B, e.destination());
+      ASSERT_EQ(trigger::Y, e.trigger());
+      char c = 0;
+      int n = -1;
+      e.read_arguments(c, n);
+      ASSERT_EQ('c', c);
+      ASSERT_EQ(static_cast<int>(i), n);
+      ++i;
+    });
+  ASSERT_EQ(100u, count);
+}
+
+TEST(CompactJournal, WhenBlockHasMoreShapesThanItNumbers_ThenAllAreReadBack)
+{
+  temporary_file file;
+  const std::uint64_t shapes = 2 * detail::compact_shape_limit;
+  {
+    TWriter writer(file.path(), 1 << 16);
+    for (std::uint64_t i = 0; i < 3 * shapes; ++i)
+    {
+      const state source = static_cast<state>(i % shapes);
+      writer.append_at(static_cast<std::int64_t>(i * i), 5000 - i * 3, TTransition(source, state::C, trigger::Z));
+    }
+  }
+
+  std::uint64_t i = 0;
+  const std::size_t count = TReader(file.path()).for_each([&](const TReader::entry& e)
+    {
+      ASSERT_EQ(5000 - i * 3, e.instance());
+      ASSERT_EQ(static_cast<std::int64_t>(i * i), e.timestamp());
+      ASSERT_EQ(static_cast<state>(i % shapes), e.source());
+      ASSERT_EQ(state::C, e.destination());
+      ASSERT_EQ(trigger::Z, e.trigger());
+      ++i;
+    });
+  ASSERT_EQ(3 * shapes, count);
+}
+
+TEST(CompactJournal, WhenRecoveredFromCheckpoint_ThenStoreMatches)
+{
+  temporary_file file;
+  TStateMachine sm(state::A);
+  TStore expected(sm.freeze(), 5000, state::A);
+  std::size_t tail = 0;
+  {
+    TWriter writer(file.path(), 1024);
+    transition(writer, expected, 0, 20000);
+    writer.checkpoint(expected);
+    transition(writer, expected, 20000, 3000);
+    writer.commit();
+    tail = 3000;
+  }
+
+  TReader reader(file.path());
+  ASSERT_TRUE(reader.has_checkpoint());
+  TStore recovered(sm.freeze(), 5000, state::A);
+  ASSERT_EQ(tail, reader.recover(recovered));
+  TStore parallel(sm.freeze(), 5000, state::A);
+  ASSERT_TRUE(reader.apply_checkpoint(parallel));
+  ASSERT_EQ(tail, parallel.replay(reader.tail(), 3));
+  TStore replayed(sm.freeze(), 5000, state::A);
+  ASSERT_EQ(23000u, reader.for_each([&](const TReader::entry& e)
+    {
+      replayed.set_state(static_cast<std::size_t>(e.instance()), e.destination());
+    }));
+
+  for (std::size_t i = 0; i < expected.size(); ++i)
+  {
+    ASSERT_EQ(expected.state(i), recovered.state(i));
+    ASSERT_EQ(expected.state(i), parallel.state(i));
+    ASSERT_EQ(expected.state(i), replayed.state(i));
+  }
+}
+
+TEST(CompactJournal, WhenCompacted_ThenFileShrinksAndRecoveryMatches)
+{
+  temporary_file file;
+  TStateMachine sm(state::A);
+  TStore expected(sm.freeze(), 1000, state::A);
+  {
+    TWriter writer(file.path());
+    ASSERT_EQ(0u, writer.compact());
+    transition(writer, expected, 0, 50000);
+    writer.checkpoint(expected);
+    const off_t before = file_size(file.path());
+    ASSERT_LT(0u, writer.compact());
+    ASSERT_GT(before / 10, file_size(file.path()));
+    // The writer keeps appending to the compacted journal.
+    transition(writer, expected, 50000, 100);
+  }
+
+  TStore recovered(sm.freeze(), 1000, state::A);
+  ASSERT_EQ(100u, TReader(file.path()).recover(recovered));
+  for (std::size_t i = 0; i < expected.size(); ++i)
+  {
+    ASSERT_EQ(expected.state(i), recovered.state(i));
+  }
+}
+
+TEST(CompactJournal, WhenEncoded_ThenRecordsAreSmallerThanFixedSizeJournal)
+{
+  temporary_file compact, fixed;
+  {
+    TWriter compact_writer(compact.path());
+    journal_writer<state, trigger> fixed_writer(fixed.path());
+    for (std::uint64_t i = 0; i < 1000; ++i)
+    {
+      const TTransition t(state::A, state::B, trigger::X);
+      compact_writer.append_at(static_cast<std::int64_t>(i * 1000), i, t);
+      fixed_writer.append_at(static_cast<std::int64_t>(i * 1000), i, t);
+    }
+  }
+
+  ASSERT_GT(file_size(fixed.path()) / 3, file_size(compact.path()));
+}
+
+TEST(CompactJournal, WhenLastBlockIsTorn_ThenItIsIgnoredAndOverwritten)
+{
+  temporary_file file;
+  {
+    TWriter writer(file.path());
+    writer.append(1, TTransition(state::A, state::B, trigger::X));
+    writer.flush();
+    writer.append(2, TTransition(state::A, state::C, trigger::Y));
+  }
+  // Simulate a crash part way through writing the second block.
+  ASSERT_EQ(0, ::truncate(file.path().c_str(), file_size(file.path()) - 3));
+  ASSERT_EQ(1u, TReader(file.path()).for_each([](const TReader::entry&){}));
+
+  {
+    TWriter writer(file.path());
+    writer.append(3, TTransition(state::B, state::C, trigger::Z));
+  }
+  std::vector<std::uint64_t> instances;
+  TReader(file.path()).for_each([&](const TReader::entry& e){ instances.push_back(e.instance()); });
+  ASSERT_EQ(2u, instances.size());
+  ASSERT_EQ(1u, instances[0]);
+  ASSERT_EQ(3u, instances[1]);
+}
+
+TEST(CompactJournal, WhenBlockIsCorrupt_ThenErrorIsRaised)
+{
+  temporary_file file;
+  {
+    TWriter writer(file.path());
+    writer.append(1, TTransition(state::A, state::B, trigger::X));
+    writer.flush();
+    writer.append(2, TTransition(state::A, state::C, trigger::Y));
+  }
+  // Flip a bit in the first record.
+  {
+    std::fstream io(file.path(), std::ios::binary | std::ios::in | std::ios::out);
+    io.seekp(sizeof(detail::journal_file_header) + sizeof(detail::compact_block_header));
+    io.put(static_cast<char>(0x7F));
+  }
+
+  ASSERT_THROW(TReader(file.path()).for_each([](const TReader::entry&){}), stateless::error);
+}
+
+TEST(CompactJournal, WhenFileIsNotACompactJournal_ThenErrorIsRaised)
+{
+  temporary_file file;
+  {
+    journal_writer<state, trigger> writer(file.path());
+  }
+
+  ASSERT_THROW(TReader reader(file.path()), stateless::error);
+  ASSERT_THROW(TWriter writer(file.path()), stateless::error);
+}
+
+}
+
+#endif // _WIN32
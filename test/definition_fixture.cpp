@@ -0,0 +1,332 @@
+/**
+ * Copyright 2013 Matt Mason
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#include <stateless++/definition.hpp>
+#include <stateless++/frequency_matrix.hpp>
+#include <stateless++/state_machine.hpp>
+
+#include <state.hpp>
+#include <trigger.hpp>
+
+#include <gtest/gtest.h>
+
+#include <algorithm>
+#include <string>
+#include <thread>
+#include <vector>
+
+using namespace stateless;
+using namespace testing;
+
+namespace
+{
+
+#ifdef _WIN32
+typedef state_machine<state, trigger> TStateMachine;
+#else
+using TStateMachine = state_machine<state, trigger>;
+#endif
+
+TEST(Definition, WhenFired_ThenSuppliedStateTransitions)
+{
+  TStateMachine sm(state::A);
+  sm.configure(state::A).permit(trigger::X, state::B);
+  auto d = sm.freeze();
+
+  state s1 = state::A, s2 = state::A;
+  d->fire(s1, trigger::X);
+
+  ASSERT_EQ(state::B, s1);
+  ASSERT_EQ(state::A, s2);
+  ASSERT_EQ(state::A, sm.state());
+}
+
+TEST(Definition, WhenMachineIsReconfiguredOrDestroyed_ThenDefinitionIsUnaffected)
+{
+  std::shared_ptr<const TStateMachine::TDefinition> d;
+  {
+    TStateMachine sm(state::A);
+    sm.configure(state::B).sub_state_of(state::C);
+    sm.configure(state::C).permit(trigger::X, state::A);
+    d = sm.freeze();
+    sm.configure(state::A).permit(trigger::X, state::B);
+  }
+
+  state s = state::B;
+  ASSERT_TRUE(d->is_in_state(s, state::C));
+  d->fire(s, trigger::X);
+  ASSERT_EQ(state::A, s);
+  ASSERT_THROW(d->fire(s, trigger::X), stateless::error);
+}
+
+TEST(Definition, WhenEnteringSubstate_ThenSuperstateActionsExecute)
+{
+  TStateMachine sm(state::A);
+  std::vector<std::string> actions;
+  sm.configure(state::A).permit(trigger::X, state::B);
+  sm.configure(state::B)
+    .sub_state_of(state::C)
+    .on_entry([&](const TStateMachine::TTransition&){ actions.push_back("B"); });
+  sm.configure(state::C)
+    .on_entry([&](const TStateMachine::TTransition&){ actions.push_back("C"); });
+  auto d = sm.freeze();
+
+  state s = state::A;
+  d->fire(s, trigger::X);
+
+  ASSERT_EQ(2, actions.size());
+  EXPECT_EQ("C", actions[0]);
+  EXPECT_EQ("B", actions[1]);
+}
+
+TEST(Definition, WhenParametersSuppliedToFire_ThenTheyArePassedToEntryAction)
+{
+  TStateMachine sm(state::A);
+  auto x = sm.set_trigger_parameters<int>(trigger::X);
+  int assigned = 0;
+  sm.configure(state::A).permit(trigger::X, state::B);
+  sm.configure(state::B)
+    .on_entry_from(x, [&](const TStateMachine::TTransition&, int i){ assigned = i; });
+  auto d = sm.freeze();
+
+  state s = state::A;
+  ASSERT_THROW(d->fire(s, trigger::X), stateless::error);
+  d->fire(s, x, 42);
+
+  ASSERT_EQ(state::B, s);
+  ASSERT_EQ(42, assigned);
+}
+
+TEST(Definition, WhenFiredConcurrently_ThenEachInstanceTransitionsIndependently)
+{
+  TStateMachine sm(state::A);
+  sm.configure(state::A).permit(trigger::X, state::B);
+  sm.configure(state::B).permit(trigger::X, state::C);
+  sm.configure(state::C).permit(trigger::X, state::A);
+  auto d = sm.freeze();
+
+  std::vector<state> states(4, state::A);
+  std::vector<std::thread> workers;
+  for (std::size_t i = 0; i < states.size(); ++i)
+  {
+    workers.push_back(std::thread([&, i]()
+      {
+        for (int n = 0; n < 1000; ++n)
+        {
+          d->fire(states[i], trigger::X);
+        }
+      }));
+  }
+  for (auto& w : workers)
+  {
+    w.join();
+  }
+
+  for (auto s : states)
+  {
+    ASSERT_EQ(state::B, s);
+  }
+}
+
+TEST(Definition, WhenAskedForNextState_ThenNoActionsExecute)
+{
+  TStateMachine sm(state::A);
+  bool executed = false;
+  sm.configure(state::A)
+    .on_exit([&](const TStateMachine::TTransition&){ executed = true; })
+    .permit(trigger::X, state::B)
+    .ignore(trigger::Y);
+  sm.configure(state::B)
+    .on_entry([&](const TStateMachine::TTransition&){ executed = true; })
+    .permit_if(trigger::X, state::C, [](){ return false; });
+  auto d = sm.freeze();
+
+  state destination = state::C;
+  ASSERT_TRUE(d->next(state::A, trigger::X, destination));
+  ASSERT_EQ(state::B, destination);
+  ASSERT_TRUE(d->next(state::A, trigger::Y, destination));
+  ASSERT_EQ(state::A, destination);
+  ASSERT_FALSE(d->next(state::B, trigger::X, destination));
+  ASSERT_FALSE(d->next(state::C, trigger::X, destination));
+  ASSERT_FALSE(executed);
+
+  ASSERT_TRUE(d->can_fire(state::A, trigger::X));
+  ASSERT_FALSE(d->can_fire(state::B, trigger::X));
+  ASSERT_FALSE(d->can_fire(state::C, trigger::Z));
+}
+
+TEST(Definition, WhenTransformingStatesInParallel_ThenEachResultMatchesNext)
+{
+  TStateMachine sm(state::A);
+  sm.configure(state::A).permit(trigger::X, state::B);
+  sm.configure(state::B).permit_dynamic(trigger::X, [](){ return state::C; });
+  sm.configure(state::C).ignore(trigger::X);
+  auto d = sm.freeze();
+
+  std::vector<state> states;
+  for (int i = 0; i < 3000; ++i)
+  {
+    states.push_back(static_cast<state>(i % 3));
+  }
+  std::vector<state> results(states.size());
+
+  auto step = [&](const state& s)
+  {
+    state destination = s;
+    d->next(s, trigger::X, destination);
+    return destination;
+  };
+  const std::size_t slices = 4, slice = states.size() / slices;
+  std::vector<std::thread> workers;
+  for (std::size_t i = 0; i < slices; ++i)
+  {
+    workers.push_back(std::thread([&, i]()
+      {
+        std::transform(
+          states.begin() + i * slice, states.begin() + (i + 1) * slice,
+          results.begin() + i * slice, step);
+      }));
+  }
+  for (auto& w : workers)
+  {
+    w.join();
+  }
+
+  for (std::size_t i = 0; i < states.size(); ++i)
+  {
+    ASSERT_EQ(states[i] == state::A ? state::B : state::C, results[i]);
+  }
+}
+
+TEST(Definition, WhenConfigurationsAreEquivalent_ThenFingerprintsMatch)
+{
+  auto configure = [](TStateMachine& sm, state destination)
+    {
+      sm.configure(state::A).permit(trigger::X, destination).ignore(trigger::Y);
+      sm.configure(state::C).sub_state_of(state::B);
+    };
+  TStateMachine first(state::A), second(state::C), third(state::A);
+  configure(first, state::B);
+  configure(second, state::B);
+  configure(third, state::C);
+
+  ASSERT_EQ(first.freeze()->fingerprint(), second.freeze()->fingerprint());
+  ASSERT_NE(first.freeze()->fingerprint(), third.freeze()->fingerprint());
+
+  second.configure(state::B).permit_if(trigger::X, state::A, [](){ return true; });
+  ASSERT_NE(first.freeze()->fingerprint(), second.freeze()->fingerprint());
+}
+
+TEST(Definition, WhenFrozenWithProfile_ThenHotCandidateIsEvaluatedFirst)
+{
+  bool to_c = true;
+  int b_guard_calls = 0, c_guard_calls = 0;
+  TStateMachine sm(state::A);
+  sm.configure(state::A)
+    .permit_if(trigger::X, state::B, [&](){ ++b_guard_calls; return !to_c; })
+    .permit_if(trigger::X, state::C, [&](){ ++c_guard_calls; return to_c; });
+  sm.configure(state::B).permit(trigger::Y, state::A);
+  sm.configure(state::C).permit(trigger::Y, state::A);
+
+  auto plain = sm.freeze();
+  transition_counters<state, trigger> counters;
+  for (int i = 0; i < 10; ++i)
+  {
+    state s = state::A;
+    to_c = i != 0;
+    plain->fire(&counters, s, trigger::X);
+    plain->fire(&counters, s, trigger::Y);
+  }
+  auto arranged = sm.freeze(frequency_matrix<state, trigger>(*plain, counters));
+  ASSERT_TRUE(arranged->is_arranged());
+  ASSERT_FALSE(plain->is_arranged());
+
+  b_guard_calls = c_guard_calls = 0;
+  state s = state::A;
+  arranged->fire(s, trigger::X);
+  ASSERT_EQ(state::C, s);
+  ASSERT_EQ(0, b_guard_calls);
+  ASSERT_EQ(1, c_guard_calls);
+
+  // The cold candidate is still found.
+  s = state::A;
+  to_c = false;
+  arranged->fire(s, trigger::X);
+  ASSERT_EQ(state::B, s);
+}
+
+TEST(Definition, WhenFrozenWithProfile_ThenBehaviourIsUnchanged)
+{
+  TStateMachine sm(state::A);
+  sm.configure(state::A).permit(trigger::X, state::B);
+  sm.configure(state::B).permit(trigger::X, state::C).permit(trigger::Y, state::A);
+  sm.configure(state::C).sub_state_of(state::B).ignore(trigger::X);
+  auto plain = sm.freeze();
+  transition_counters<state, trigger> counters;
+  state s = state::A;
+  for (int i = 0; i < 5; ++i)
+  {
+    plain->fire(&counters, s, trigger::X);
+    plain->fire(&counters, s, trigger::X);
+    plain->fire(&counters, s, trigger::Y);
+  }
+  auto arranged = sm.freeze(frequency_matrix<state, trigger>(*plain, counters));
+
+  ASSERT_EQ(plain->fingerprint(), arranged->fingerprint());
+  ASSERT_TRUE(arranged->is_in_state(state::C, state::B));
+  ASSERT_FALSE(arranged->is_in_state(state::B, state::C));
+  const state states[] = { state::A, state::B, state::C };
+  const trigger triggers[] = { trigger::X, trigger::Y, trigger::Z };
+  for (auto from : states)
+  {
+    ASSERT_EQ(from, arranged->find_representation(from)->underlying_state());
+    for (auto t : triggers)
+    {
+      state expected = from, actual = from;
+      ASSERT_EQ(plain->next(from, t, expected), arranged->next(from, t, actual));
+      ASSERT_EQ(expected, actual);
+    }
+  }
+}
+
+
+TEST(Definition, WhenArranged_ThenSharedBehavioursAreCountedOnce)
+{
+  TStateMachine sm(state::A);
+  sm.configure(state::A).permit(trigger::X, state::B);
+  sm.configure(state::B).permit(trigger::Y, state::A);
+  sm.set_trigger_parameters<int>(trigger::Z);
+  auto plain = sm.freeze();
+  transition_counters<state, trigger> counters;
+  state s = state::A;
+  plain->fire(&counters, s, trigger::X);
+  auto arranged = sm.freeze(frequency_matrix<state, trigger>(*plain, counters));
+
+  const auto machine_usage = sm.memory_usage();
+  const auto plain_usage = plain->memory_usage();
+  const auto arranged_usage = arranged->memory_usage();
+  ASSERT_EQ(machine_usage.representations, plain_usage.representations);
+  ASSERT_EQ(machine_usage.trigger_parameters, plain_usage.trigger_parameters);
+  ASSERT_GT(arranged_usage.representations, plain_usage.representations);
+  // The copies in the layout add candidate lists, not behaviour objects.
+  const std::size_t behaviour_objects =
+    plain_usage.behaviours - 2 * (sizeof(std::pair<const trigger, std::vector<std::shared_ptr<void>>>) +
+      detail::map_node_overhead + sizeof(std::shared_ptr<void>));
+  ASSERT_EQ(2 * plain_usage.behaviours - behaviour_objects, arranged_usage.behaviours);
+}
+
+}
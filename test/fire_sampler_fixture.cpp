@@ -0,0 +1,215 @@
+/**
+ * Copyright 2013 Matt Mason
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#include <stateless++/definition.hpp>
+#include <stateless++/fire_sampler.hpp>
+#include <stateless++/state_machine.hpp>
+
+#include <state.hpp>
+#include <trigger.hpp>
+
+#include <gtest/gtest.h>
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+using namespace stateless;
+using namespace testing;
+
+namespace
+{
+
+struct test_clock
+{
+  typedef std::uint64_t rep;
+
+  static rep now()
+  {
+    return time;
+  }
+
+  static rep time;
+};
+
+test_clock::rep test_clock::time = 0;
+
+#ifdef _WIN32
+typedef state_machine<state, trigger> TStateMachine;
+typedef fire_sampler<state, trigger, test_clock> TSampler;
+#else
+using TStateMachine = state_machine<state, trigger>;
+using TSampler = fire_sampler<state, trigger, test_clock>;
+#endif
+
+/// Counts the events it receives, declining triggers other than X.
+struct declining_observer : fire_observer<state, trigger>
+{
+  declining_observer()
+    : events(0)
+  {}
+
+  virtual bool on_fire(const state&, const trigger& t)
+  {
+    ++events;
+    return t == trigger::X;
+  }
+
+  virtual void on_evaluating_guard(const state&, const trigger&) { ++events; }
+  virtual void on_guard(const state&, const trigger&, bool) { ++events; }
+  virtual void on_resolved(const TTransition&) { ++events; }
+  virtual void on_exited(const TTransition&) { ++events; }
+  virtual void on_state_changed(const TTransition&) { ++events; }
+  virtual void on_entered(const TTransition&) { ++events; }
+  virtual void on_transitioned(const TTransition&) { ++events; }
+
+  unsigned events;
+};
+
+TEST(FireSampler, WhenEveryTriggerIsSampled_ThenDetailIsCaptured)
+{
+  TStateMachine sm(state::A);
+  auto x = sm.set_trigger_parameters<int, std::string>(trigger::X);
+  sm.configure(state::A)
+    .permit_if(trigger::X, state::C, [](){ test_clock::time += 1; return false; })
+    .permit_if(trigger::X, state::B, [](){ test_clock::time += 2; return true; })
+    .on_exit([](const TStateMachine::TTransition&){ test_clock::time += 3; });
+  sm.configure(state::B)
+    .on_entry_from(x, [](const TStateMachine::TTransition&, int, const std::string&){ test_clock::time += 5; });
+  sm.on_transition([](const TStateMachine::TTransition&){ test_clock::time += 7; });
+  sm.on_unhandled_trigger([](const state&, const trigger&){});
+  std::vector<TSampler::sample> samples;
+  TSampler sampler(1, [&](const TSampler::sample& s){ samples.push_back(s); });
+  sm.set_observer(&sampler);
+
+  sm.fire(x, 42, std::string("text"));
+  sm.fire(trigger::Z);
+
+  ASSERT_EQ(2, samples.size());
+  const auto& s = samples[0];
+  EXPECT_EQ(state::A, s.source);
+  EXPECT_EQ(trigger::X, s.trigger);
+  EXPECT_EQ(state::B, s.destination);
+  EXPECT_EQ(TSampler::outcome::transition, s.result);
+  ASSERT_EQ(2, s.guards.size());
+  EXPECT_FALSE(s.guards[0]);
+  EXPECT_TRUE(s.guards[1]);
+  EXPECT_EQ("42, text", s.arguments);
+  EXPECT_EQ(3, s.guard_ticks);
+  EXPECT_EQ(3, s.exit_ticks);
+  EXPECT_EQ(5, s.entry_ticks);
+  EXPECT_EQ(7, s.transition_ticks);
+  EXPECT_EQ(18, s.total_ticks);
+
+  EXPECT_EQ(state::B, samples[1].source);
+  EXPECT_EQ(TSampler::outcome::unhandled, samples[1].result);
+  EXPECT_TRUE(samples[1].arguments.empty());
+}
+
+TEST(FireSampler, WhenTriggerIsNotSampled_ThenOnFireDeclinesIt)
+{
+  TSampler never(0, [](const TSampler::sample&){});
+  TSampler always(1, [](const TSampler::sample&){});
+
+  ASSERT_FALSE(never.on_fire(state::A, trigger::X));
+  ASSERT_TRUE(always.on_fire(state::A, trigger::X));
+}
+
+TEST(FireSampler, WhenObserverDeclinesTrigger_ThenItReceivesNoFurtherEvents)
+{
+  TStateMachine sm(state::A);
+  sm.configure(state::A)
+    .permit_if(trigger::X, state::B, [](){ return true; })
+    .permit_if(trigger::Y, state::B, [](){ return true; });
+  sm.configure(state::B).permit(trigger::X, state::A);
+  declining_observer observer;
+  sm.set_observer(&observer);
+
+  sm.fire(trigger::Y);
+  ASSERT_EQ(1u, observer.events);
+
+  sm.fire(trigger::X);
+  ASSERT_EQ(7u, observer.events);
+
+  auto frozen = sm.freeze();
+  state s = state::A;
+  frozen->fire(&observer, s, trigger::Y);
+  ASSERT_EQ(state::B, s);
+  ASSERT_EQ(8u, observer.events);
+}
+
+TEST(FireSampler, WhenFormatterIsSupplied_ThenItWritesTheArguments)
+{
+  TStateMachine sm(state::A);
+  auto x = sm.set_trigger_parameters<int>(trigger::X);
+  sm.configure(state::A).permit(trigger::X, state::B);
+  std::string arguments;
+  TSampler sampler(
+    1,
+    [&](const TSampler::sample& s){ arguments = s.arguments; },
+    [](std::ostream& os, const trigger&, const fire_arguments& a)
+    {
+      os << "count=" << *a.get<int>(0) << (a.get<std::string>(0) == nullptr ? "" : "?");
+    });
+  sm.set_observer(&sampler);
+
+  sm.fire(x, 3);
+
+  ASSERT_EQ("count=3", arguments);
+}
+
+TEST(FireSampler, WhenRateIsN_ThenAboutOneInNIsSampled)
+{
+  TStateMachine sm(state::A);
+  sm.configure(state::A).permit_reentry(trigger::X);
+  unsigned samples = 0;
+  TSampler sampler(10, [&](const TSampler::sample&){ ++samples; });
+  sm.set_observer(&sampler);
+
+  for (int i = 0; i < 20000; ++i)
+  {
+    sm.fire(trigger::X);
+  }
+
+  EXPECT_LT(1600, samples);
+  EXPECT_GT(2400, samples);
+}
+
+TEST(FireSampler, WhenRateIsChanged_ThenSamplingFollows)
+{
+  TStateMachine sm(state::A);
+  sm.configure(state::A).ignore(trigger::Y);
+  unsigned samples = 0;
+  TSampler sampler(0, [&](const TSampler::sample&){ ++samples; });
+  sm.set_observer(&sampler);
+
+  for (int i = 0; i < 3000; ++i)
+  {
+    sm.fire(trigger::Y);
+  }
+  ASSERT_EQ(0, samples);
+
+  sampler.set_rate(1);
+  ASSERT_EQ(1, sampler.rate());
+  for (std::uint32_t i = 0; i < TSampler::recheck_interval + 10; ++i)
+  {
+    sm.fire(trigger::Y);
+  }
+  ASSERT_LE(10, samples);
+}
+
+}
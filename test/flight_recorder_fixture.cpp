@@ -0,0 +1,276 @@
+/**
+ * Copyright 2013 Matt Mason
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#ifndef _WIN32
+
+#include <stateless++/flight_recorder.hpp>
+#include <stateless++/instance_store.hpp>
+#include <stateless++/state_machine.hpp>
+
+#include <state.hpp>
+#include <temporary_file.hpp>
+#include <trigger.hpp>
+
+#include <gtest/gtest.h>
+
+#include <csignal>
+#include <cstdint>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <fcntl.h>
+#include <unistd.h>
+
+using namespace stateless;
+using namespace testing;
+
+namespace
+{
+
+using TStateMachine = state_machine<state, trigger>;
+using TRecorder = flight_recorder<state, trigger>;
+
+void configure(TStateMachine& sm, const bool& allow)
+{
+  sm.configure(state::A)
+    .permit_if(trigger::X, state::B, [&](){ return allow; })
+    .ignore(trigger::Y);
+  sm.configure(state::B).permit(trigger::X, state::A);
+  sm.on_unhandled_trigger([](const state&, const trigger&){});
+}
+
+TEST(FlightRecorder, WhenTriggersAreFired_ThenOutcomesAreRecordedInOrder)
+{
+  bool allow = false;
+  TStateMachine sm(state::A);
+  configure(sm, allow);
+  TRecorder recorder(16);
+  sm.set_observer(&recorder);
+
+  sm.fire(trigger::X);
+  sm.fire(trigger::Y);
+  allow = true;
+  sm.fire(trigger::X);
+
+  std::vector<TRecorder::entry> entries;
+  ASSERT_EQ(3, recorder.for_each([&](const TRecorder::entry& e){ entries.push_back(e); }));
+  ASSERT_EQ(TRecorder::outcome::unhandled, entries[0].result);
+  ASSERT_EQ(1, entries[0].guard_rejections);
+  ASSERT_EQ(TRecorder::outcome::ignored, entries[1].result);
+  ASSERT_EQ(state::A, entries[1].destination);
+  ASSERT_EQ(TRecorder::outcome::transition, entries[2].result);
+  ASSERT_EQ(state::A, entries[2].source);
+  ASSERT_EQ(trigger::X, entries[2].trigger);
+  ASSERT_EQ(state::B, entries[2].destination);
+  ASSERT_EQ(0, entries[2].guard_rejections);
+  ASSERT_LE(entries[1].timestamp, entries[2].timestamp);
+}
+
+TEST(FlightRecorder, WhenRecordersShareAThread_ThenEachCountsItsOwnRejections)
+{
+  bool allow = false;
+  TStateMachine inner(state::A);
+  configure(inner, allow);
+  TRecorder inner_recorder(16);
+  inner.set_observer(&inner_recorder);
+
+  TStateMachine outer(state::A);
+  outer.configure(state::A)
+    .permit_if(trigger::X, state::B, [&](){ inner.fire(trigger::X); return false; })
+    .permit_if(trigger::X, state::C, [](){ return true; });
+  TRecorder outer_recorder(16);
+  outer.set_observer(&outer_recorder);
+
+  outer.fire(trigger::X);
+
+  std::vector<TRecorder::entry> entries;
+  ASSERT_EQ(1, outer_recorder.for_each([&](const TRecorder::entry& e){ entries.push_back(e); }));
+  ASSERT_EQ(state::C, entries[0].destination);
+  ASSERT_EQ(1, entries[0].guard_rejections);
+  entries.clear();
+  ASSERT_EQ(1, inner_recorder.for_each([&](const TRecorder::entry& e){ entries.push_back(e); }));
+  ASSERT_EQ(1, entries[0].guard_rejections);
+}
+
+TEST(FlightRecorder, WhenFull_ThenOldestRecordsAreOverwritten)
+{
+  bool allow = true;
+  TStateMachine sm(state::A);
+  configure(sm, allow);
+  TRecorder recorder(5);
+  sm.set_observer(&recorder);
+  ASSERT_EQ(8, recorder.capacity());
+
+  for (int i = 0; i < 20; ++i)
+  {
+    sm.fire(trigger::X);
+  }
+
+  std::vector<std::uint64_t> indices;
+  recorder.for_each([&](const TRecorder::entry& e){ indices.push_back(e.index); });
+  ASSERT_EQ(20, recorder.recorded());
+  ASSERT_EQ(8, indices.size());
+  ASSERT_EQ(12, indices.front());
+  ASSERT_EQ(19, indices.back());
+}
+
+TEST(FlightRecorder, WhenDumpedAsText_ThenOneLinePerRecordIsWritten)
+{
+  bool allow = true;
+  TStateMachine sm(state::A);
+  configure(sm, allow);
+  TRecorder recorder;
+  sm.set_observer(&recorder);
+  sm.fire(trigger::X);
+  sm.fire(trigger::Z);
+  temporary_file file;
+
+  {
+    const int fd = ::open(file.path().c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    ASSERT_TRUE(recorder.dump(fd));
+    ::close(fd);
+  }
+
+  std::ifstream in(file.path());
+  std::vector<std::string> lines;
+  for (std::string line; std::getline(in, line); )
+  {
+    lines.push_back(line);
+  }
+  ASSERT_EQ(2, lines.size());
+  std::istringstream first(lines[0]);
+  std::uint64_t index, timestamp;
+  int source, trigger_code, destination;
+  std::string result;
+  unsigned rejections;
+  first >> index >> timestamp >> source >> trigger_code >> destination >> result >> rejections;
+  ASSERT_EQ(0, index);
+  ASSERT_EQ(static_cast<int>(state::A), source);
+  ASSERT_EQ(static_cast<int>(trigger::X), trigger_code);
+  ASSERT_EQ(static_cast<int>(state::B), destination);
+  ASSERT_EQ("transition", result);
+  ASSERT_NE(std::string::npos, lines[1].find(" unhandled 0"));
+}
+
+TEST(FlightRecorder, WhenDumpedAsBinary_ThenRecordsFollowTheHeader)
+{
+  TStateMachine sm(state::A);
+  sm.configure(state::A).permit(trigger::X, state::B);
+  sm.configure(state::B).permit(trigger::X, state::A);
+  TRecorder recorder(4);
+  sm.set_observer(&recorder);
+  for (int i = 0; i < 6; ++i)
+  {
+    sm.fire(trigger::X);
+  }
+  temporary_file file;
+
+  {
+    const int fd = ::open(file.path().c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    ASSERT_TRUE(recorder.dump(fd, TRecorder::dump_format::binary));
+    ::close(fd);
+  }
+
+  std::ifstream in(file.path(), std::ios::binary);
+  detail::flight_recording_header header;
+  in.read(reinterpret_cast<char*>(&header), sizeof(header));
+  ASSERT_EQ(0, std::memcmp(header.magic, "STLSFREC", 8));
+  ASSERT_EQ(sizeof(detail::flight_recording_record), header.record_size);
+  std::vector<detail::flight_recording_record> records;
+  detail::flight_recording_record record;
+  while (in.read(reinterpret_cast<char*>(&record), sizeof(record)))
+  {
+    records.push_back(record);
+  }
+  ASSERT_EQ(4, records.size());
+  ASSERT_EQ(2, records[0].index);
+  ASSERT_EQ(static_cast<std::uint32_t>(state::A), records[0].source);
+  ASSERT_EQ(static_cast<std::uint32_t>(state::B), records[0].destination);
+}
+
+TEST(FlightRecorder, WhenStoreIsFiredFromManyThreads_ThenEveryKeptRecordIsConsistent)
+{
+  TStateMachine sm(state::A);
+  sm.configure(state::A).permit(trigger::X, state::B);
+  sm.configure(state::B).permit(trigger::Y, state::C);
+  instance_store<state, trigger> store(sm.freeze(), 4000, state::A);
+  TRecorder recorder(256);
+  store.set_observer(&recorder);
+
+  // Each thread fires its own range of instances, so only the recorder is shared.
+  std::vector<std::thread> workers;
+  for (std::size_t t = 0; t < 4; ++t)
+  {
+    workers.emplace_back([&, t]()
+      {
+        for (std::size_t i = t * 1000; i < (t + 1) * 1000; ++i)
+        {
+          store.fire(i, trigger::X);
+          store.fire(i, trigger::Y);
+        }
+      });
+  }
+  for (auto& worker : workers)
+  {
+    worker.join();
+  }
+
+  ASSERT_EQ(8000, recorder.recorded());
+  ASSERT_EQ(256, recorder.for_each([](const TRecorder::entry& e)
+    {
+      const bool x = e.trigger == trigger::X && e.source == state::A && e.destination == state::B;
+      const bool y = e.trigger == trigger::Y && e.source == state::B && e.destination == state::C;
+      ASSERT_TRUE(x || y);
+    }));
+}
+
+TRecorder* signalled_recorder = nullptr;
+int signalled_fd = -1;
+
+extern "C" void dump_on_signal(int)
+{
+  signalled_recorder->dump(signalled_fd);
+}
+
+TEST(FlightRecorder, WhenSignalled_ThenHandlerDumpsRecords)
+{
+  TStateMachine sm(state::A);
+  sm.configure(state::A).permit(trigger::X, state::B);
+  TRecorder recorder;
+  sm.set_observer(&recorder);
+  sm.fire(trigger::X);
+  temporary_file file;
+  signalled_recorder = &recorder;
+  signalled_fd = ::open(file.path().c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+  auto previous = std::signal(SIGUSR1, dump_on_signal);
+
+  std::raise(SIGUSR1);
+
+  std::signal(SIGUSR1, previous);
+  ::close(signalled_fd);
+  std::ifstream in(file.path());
+  std::string line;
+  ASSERT_TRUE(static_cast<bool>(std::getline(in, line)));
+  ASSERT_NE(std::string::npos, line.find(" transition 0"));
+}
+
+}
+
+#endif // _WIN32
@@ -0,0 +1,165 @@
+/**
+ * Copyright 2013 Matt Mason
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#include <stateless++/frequency_matrix.hpp>
+#include <stateless++/state_machine.hpp>
+
+#include <state.hpp>
+#include <trigger.hpp>
+
+#include <gtest/gtest.h>
+
+#include <cstdint>
+#include <cstring>
+#include <sstream>
+#include <string>
+
+using namespace stateless;
+using namespace testing;
+
+namespace
+{
+
+#ifdef _WIN32
+typedef state_machine<state, trigger> TStateMachine;
+typedef transition_counters<state, trigger> TCounters;
+typedef frequency_matrix<state, trigger> TMatrix;
+#else
+using TStateMachine = state_machine<state, trigger>;
+using TCounters = transition_counters<state, trigger>;
+using TMatrix = frequency_matrix<state, trigger>;
+#endif
+
+void configure(TStateMachine& sm, const bool& allow)
+{
+  sm.configure(state::A)
+    .permit_if(trigger::X, state::B, [&](){ return allow; })
+    .ignore(trigger::Y)
+    .permit_dynamic(trigger::Z, [](){ return state::C; });
+  sm.configure(state::B).permit(trigger::X, state::A);
+  sm.configure(state::C).sub_state_of(state::B);
+  sm.on_unhandled_trigger([](const state&, const trigger&){});
+}
+
+void fire_all(TStateMachine& sm, bool& allow)
+{
+  sm.fire(trigger::X);
+  sm.fire(trigger::Y);
+  sm.fire(trigger::Z);
+  sm.fire(trigger::X);
+  allow = true;
+  sm.fire(trigger::X);
+}
+
+TEST(FrequencyMatrix, WhenBuilt_ThenConfiguredAndObservedOutcomesAreRows)
+{
+  bool allow = false;
+  TStateMachine sm(state::A);
+  configure(sm, allow);
+  TCounters counters;
+  sm.set_observer(&counters);
+  fire_all(sm, allow);
+
+  TMatrix matrix(*sm.freeze(), counters);
+  const auto& rows = matrix.rows();
+
+  ASSERT_EQ(6, rows.size());
+  EXPECT_EQ(state::A, rows[0].source);
+  EXPECT_EQ(trigger::X, rows[0].trigger);
+  EXPECT_EQ(TMatrix::outcome::unhandled, rows[0].result);
+  EXPECT_EQ(1, rows[0].count);
+  EXPECT_EQ(2, rows[0].counts.guard_evaluations);
+  EXPECT_EQ(1, rows[0].counts.guard_rejections);
+  EXPECT_EQ(state::B, rows[1].destination);
+  EXPECT_EQ(TMatrix::outcome::transition, rows[1].result);
+  EXPECT_EQ(1, rows[1].count);
+  EXPECT_EQ(TMatrix::outcome::ignored, rows[2].result);
+  EXPECT_EQ(1, rows[2].count);
+
+  // The dynamic destination is only known from observation.
+  EXPECT_EQ(trigger::Z, rows[3].trigger);
+  EXPECT_EQ(state::C, rows[3].destination);
+  EXPECT_FALSE(rows[3].is_configured);
+
+  // A configured edge that was never taken.
+  EXPECT_EQ(state::B, rows[4].source);
+  EXPECT_TRUE(rows[4].is_configured);
+  EXPECT_EQ(0, rows[4].count);
+
+  // Inherited from the super state.
+  EXPECT_EQ(state::C, rows[5].source);
+  EXPECT_EQ(state::A, rows[5].destination);
+  EXPECT_TRUE(rows[5].is_configured);
+  EXPECT_EQ(1, rows[5].count);
+}
+
+TEST(FrequencyMatrix, WhenWrittenAsCsv_ThenEachRowIsALine)
+{
+  bool allow = false;
+  TStateMachine sm(state::A);
+  configure(sm, allow);
+  TCounters counters;
+  sm.set_observer(&counters);
+  fire_all(sm, allow);
+
+  std::ostringstream os;
+  TMatrix(*sm.freeze(), counters).write_csv(os);
+
+  const std::string expected =
+    "source,trigger,destination,outcome,configured,count,"
+      "fires,transitions,ignored,unhandled,guard_evaluations,guard_rejections\n"
+    "0,0,,unhandled,1,1,2,1,0,1,2,1\n"
+    "0,0,1,transition,1,1,2,1,0,1,2,1\n"
+    "0,1,,ignored,1,1,1,0,1,0,0,0\n"
+    "0,2,2,transition,0,1,1,1,0,0,0,0\n"
+    "1,0,0,transition,1,0,0,0,0,0,0,0\n"
+    "2,0,0,transition,1,1,1,1,0,0,0,0\n";
+  ASSERT_EQ(expected, os.str());
+}
+
+TEST(FrequencyMatrix, WhenWrittenAsBinary_ThenRecordsFollowHeader)
+{
+  bool allow = false;
+  TStateMachine sm(state::A);
+  configure(sm, allow);
+  TCounters counters;
+  sm.set_observer(&counters);
+  fire_all(sm, allow);
+
+  std::ostringstream os;
+  TMatrix(*sm.freeze(), counters).write_binary(os);
+  const std::string data = os.str();
+
+  std::uint32_t version = 0, record_size = 0;
+  ASSERT_EQ(0, data.compare(0, 8, "STLSFMAT"));
+  std::memcpy(&version, data.data() + 8, 4);
+  std::memcpy(&record_size, data.data() + 12, 4);
+  ASSERT_EQ(TMatrix::binary_version, version);
+  ASSERT_EQ(16 + 6 * record_size, data.size());
+
+  // The sixth record: C --X--> A, taken once.
+  std::uint64_t values[4];
+  std::memcpy(values, data.data() + 16 + 5 * record_size, sizeof(values));
+  EXPECT_EQ(2, values[0]);
+  EXPECT_EQ(0, values[1]);
+  EXPECT_EQ(0, values[2]);
+  EXPECT_EQ(1, values[3]);
+  EXPECT_EQ(1, data[16 + 5 * record_size + 80]);
+  EXPECT_EQ(1, data[16 + 5 * record_size + 81]);
+}
+
+}
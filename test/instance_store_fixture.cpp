@@ -0,0 +1,570 @@
+/**
+ * Copyright 2013 Matt Mason
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#include <stateless++/instance_store.hpp>
+#include <stateless++/state_machine.hpp>
+
+#include <state.hpp>
+#include <trigger.hpp>
+
+#include <gtest/gtest.h>
+
+#include <algorithm>
+#include <cstdint>
+#include <vector>
+
+using namespace stateless;
+using namespace testing;
+
+namespace
+{
+
+struct test_clock
+{
+  typedef std::uint64_t rep;
+
+  static rep now()
+  {
+    return time;
+  }
+
+  static rep time;
+};
+
+test_clock::rep test_clock::time = 0;
+
+/// A journal of transitions held in memory, for replay().
+struct test_journal
+{
+  struct entry
+  {
+    std::uint64_t instance() const
+    {
+      return id;
+    }
+
+    state source() const
+    {
+      return from;
+    }
+
+    state destination() const
+    {
+      return to;
+    }
+
+    ::trigger trigger() const
+    {
+      return via;
+    }
+
+    std::uint64_t id;
+    state from;
+    state to;
+    ::trigger via;
+  };
+
+  template<typename TCallable>
+  std::size_t for_each(TCallable visitor) const
+  {
+    for (auto& e : entries)
+    {
+      visitor(e);
+    }
+    return entries.size();
+  }
+
+  std::vector<entry> entries;
+};
+
+#ifdef _WIN32
+typedef state_machine<state, trigger> TStateMachine;
+typedef instance_store<state, trigger> TStore;
+typedef instance_store<state, trigger, std::uint8_t, test_clock> TTimedStore;
+#else
+using TStateMachine = state_machine<state, trigger>;
+using TStore = instance_store<state, trigger>;
+using TTimedStore = instance_store<state, trigger, std::uint8_t, test_clock>;
+#endif
+
+TEST(InstanceStore, WhenConstructed_ThenInstancesAreInInitialState)
+{
+  TStateMachine sm(state::A);
+  TStore store(sm.freeze(), 3, state::B);
+
+  ASSERT_EQ(3, store.size());
+  ASSERT_EQ(state::B, store.state(2));
+}
+
+TEST(InstanceStore, WhenApplied_ThenStaticTransitionsUseTheTable)
+{
+  TStateMachine sm(state::A);
+  sm.configure(state::A).permit(trigger::X, state::B);
+  sm.configure(state::B).permit(trigger::X, state::C);
+  sm.configure(state::C).ignore(trigger::X);
+  TStore store(sm.freeze(), 0, state::A);
+  for (int i = 0; i < 100; ++i)
+  {
+    store.add(static_cast<state>(i % 3));
+  }
+
+  ASSERT_EQ(0, store.apply(trigger::X));
+
+  for (std::size_t i = 0; i < store.size(); ++i)
+  {
+    const state expected[] = { state::B, state::C, state::C };
+    ASSERT_EQ(expected[i % 3], store.state(i));
+  }
+}
+
+TEST(InstanceStore, WhenTransitionHasActionsOrGuards_ThenInstancesAreFiredIndividually)
+{
+  TStateMachine sm(state::A);
+  std::vector<std::size_t> entered;
+  TStore* store_ptr = nullptr;
+  bool allow = false;
+  sm.configure(state::A).permit(trigger::X, state::B);
+  sm.configure(state::B)
+    .on_entry([&](const TStateMachine::TTransition&){ entered.push_back(store_ptr->current()); })
+    .permit_if(trigger::X, state::C, [&](){ return allow; });
+  TStore store(sm.freeze(), 40, state::A);
+  store_ptr = &store;
+  store.set_state(5, state::C);
+
+  ASSERT_EQ(1, store.apply(trigger::X, 0, 40));
+
+  ASSERT_EQ(39, entered.size());
+  EXPECT_EQ(0, entered.front());
+  EXPECT_EQ(39, entered.back());
+  EXPECT_EQ(TStore::npos, store.current());
+  EXPECT_EQ(state::C, store.state(5));
+
+  ASSERT_EQ(40, store.apply(trigger::X, 0, 40));
+  allow = true;
+  ASSERT_EQ(1, store.apply(trigger::X, 0, 40));
+  ASSERT_EQ(state::C, store.state(0));
+}
+
+TEST(InstanceStore, WhenInstancesAreFiredIndividually_ThenGuardsAreEvaluatedOnce)
+{
+  TStateMachine sm(state::A);
+  int guard_calls = 0;
+  bool allow = true;
+  sm.configure(state::A).permit_if(trigger::X, state::B, [&](){ ++guard_calls; return allow; });
+  TStore store(sm.freeze(), 10, state::A);
+
+  ASSERT_EQ(0, store.apply(trigger::X, 0, 5));
+  ASSERT_EQ(5, guard_calls);
+
+  allow = false;
+  ASSERT_EQ(5, store.apply(trigger::X, 5, 10));
+  ASSERT_EQ(10, guard_calls);
+  ASSERT_EQ(state::A, store.state(9));
+}
+
+TEST(InstanceStore, WhenRangeIsApplied_ThenOtherInstancesAreUnchanged)
+{
+  TStateMachine sm(state::A);
+  sm.configure(state::A).permit(trigger::X, state::B);
+  TStore store(sm.freeze(), 50, state::A);
+
+  store.apply(trigger::X, 10, 45);
+
+  for (std::size_t i = 0; i < store.size(); ++i)
+  {
+    ASSERT_EQ(i >= 10 && i < 45 ? state::B : state::A, store.state(i));
+  }
+  ASSERT_THROW(store.apply(trigger::X, 10, 51), stateless::error);
+}
+
+void expect_table_lookup_matches_individual_firing(const int states)
+{
+  state_machine<int, int> sm(0);
+  for (int s = 0; s < states; ++s)
+  {
+    if (s % 7 == 0)
+    {
+      sm.configure(s).permit_dynamic(1, [=](){ return (s * 3) % states; });
+    }
+    else if (s % 5 != 0)
+    {
+      sm.configure(s).permit(1, (s + 11) % states == s ? (s + 1) % states : (s + 11) % states);
+    }
+  }
+  auto d = sm.freeze();
+
+  instance_store<int, int> batch(d, 0, 0);
+  instance_store<int, int, std::uint16_t> wide(d, 0, 0);
+  std::vector<int> expected;
+  for (int i = 0; i < 1000; ++i)
+  {
+    const int s = (i * 13) % states;
+    batch.add(s);
+    wide.add(s);
+    expected.push_back(s);
+  }
+
+  std::size_t unhandled = 0;
+  for (auto& s : expected)
+  {
+    if (s % 5 == 0 && s % 7 != 0)
+    {
+      ++unhandled;
+    }
+    else
+    {
+      d->fire(s, 1);
+    }
+  }
+
+  ASSERT_EQ(unhandled, batch.apply(1));
+  ASSERT_EQ(unhandled, wide.apply(1));
+  for (std::size_t i = 0; i < expected.size(); ++i)
+  {
+    ASSERT_EQ(expected[i], batch.state(i));
+    ASSERT_EQ(expected[i], wide.state(i));
+  }
+}
+
+TEST(InstanceStore, WhenManyStates_ThenTableLookupMatchesIndividualFiring)
+{
+  expect_table_lookup_matches_individual_firing(28);
+  expect_table_lookup_matches_individual_firing(40);
+}
+
+TEST(InstanceStore, WhenActionFiresAnotherInstance_ThenCurrentIsRestored)
+{
+  TStateMachine sm(state::A);
+  TStore* store_ptr = nullptr;
+  std::vector<std::size_t> seen;
+  sm.configure(state::A).permit(trigger::X, state::B);
+  sm.configure(state::B)
+    .on_entry([&](const TStateMachine::TTransition&)
+      {
+        if (store_ptr->current() == 0)
+        {
+          store_ptr->fire(1, trigger::X);
+        }
+      })
+    .on_entry([&](const TStateMachine::TTransition&){ seen.push_back(store_ptr->current()); });
+  TStore store(sm.freeze(), 2, state::A);
+  store_ptr = &store;
+
+  store.fire(0, trigger::X);
+
+  ASSERT_EQ(2u, seen.size());
+  EXPECT_EQ(1u, seen[0]);
+  EXPECT_EQ(0u, seen[1]);
+  EXPECT_EQ(TStore::npos, store.current());
+  EXPECT_EQ(state::B, store.state(1));
+}
+
+TEST(InstanceStore, WhenStateIsOutOfRange_ThenErrorIsRaised)
+{
+  state_machine<int, int> sm(0);
+  instance_store<int, int> store(sm.freeze(), 1, 0);
+
+  ASSERT_THROW(store.set_state(0, 255), stateless::error);
+  ASSERT_THROW(store.set_state(0, -1), stateless::error);
+}
+
+TEST(InstanceStore, WhenBroadcast_ThenGuardsAreEvaluatedOncePerState)
+{
+  TStateMachine sm(state::A);
+  int guard_calls = 0;
+  std::vector<std::size_t> entered;
+  TStore* store_ptr = nullptr;
+  sm.configure(state::A).permit_if(trigger::X, state::C, [&](){ ++guard_calls; return true; });
+  sm.configure(state::B).permit(trigger::X, state::C);
+  sm.configure(state::C)
+    .on_entry([&](const TStateMachine::TTransition&){ entered.push_back(store_ptr->current()); });
+  TStore store(sm.freeze(), 0, state::A);
+  store_ptr = &store;
+  for (int i = 0; i < 30; ++i)
+  {
+    store.add(i % 2 == 0 ? state::A : state::B);
+  }
+  store.add(state::C);
+
+  ASSERT_EQ(1, store.broadcast(trigger::X));
+
+  EXPECT_EQ(1, guard_calls);
+  ASSERT_EQ(30, entered.size());
+  // Instances in A are entered first, then those in B, each in index order.
+  EXPECT_EQ(0, entered[0]);
+  EXPECT_EQ(28, entered[14]);
+  EXPECT_EQ(1, entered[15]);
+  EXPECT_EQ(29, entered[29]);
+  for (std::size_t i = 0; i < store.size(); ++i)
+  {
+    ASSERT_EQ(state::C, store.state(i));
+  }
+}
+
+TEST(InstanceStore, WhenBroadcastTriggerIsIgnored_ThenNoActionsExecute)
+{
+  TStateMachine sm(state::A);
+  bool executed = false;
+  sm.configure(state::A)
+    .on_exit([&](const TStateMachine::TTransition&){ executed = true; })
+    .ignore_if(trigger::X, [](){ return true; });
+  TStore store(sm.freeze(), 20, state::A);
+
+  ASSERT_EQ(0, store.broadcast(trigger::X));
+  ASSERT_FALSE(executed);
+  ASSERT_EQ(state::A, store.state(0));
+}
+
+TEST(InstanceStore, WhenIndexed_ThenCountsFollowTransitions)
+{
+  TStateMachine sm(state::A);
+  sm.configure(state::A).permit(trigger::X, state::B);
+  sm.configure(state::B).permit(trigger::X, state::C);
+  sm.configure(state::C).sub_state_of(state::B).ignore(trigger::X);
+  TStore store(sm.freeze(), 10, state::A);
+  store.enable_index();
+
+  ASSERT_EQ(10, store.count(state::A));
+  store.fire(3, trigger::X);
+  EXPECT_EQ(9, store.count(state::A));
+  EXPECT_EQ(1, store.count(state::B));
+  store.apply(trigger::X, 0, 5);
+  EXPECT_EQ(5, store.count(state::A));
+  EXPECT_EQ(5, store.count(state::B));  // Includes the substate C.
+  EXPECT_EQ(1, store.count(state::C));
+  store.broadcast(trigger::X);
+  EXPECT_EQ(0, store.count(state::A));
+  EXPECT_EQ(10, store.count(state::B));
+  EXPECT_EQ(5, store.count(state::C));
+  store.set_state(0, state::A);
+  store.add(state::A);
+  EXPECT_EQ(2, store.count(state::A));
+  EXPECT_EQ(9, store.count(state::B));
+  EXPECT_EQ(4, store.count(state::C));
+}
+
+TEST(InstanceStore, WhenIndexed_ThenEnclosingSuperStatesAreCounted)
+{
+  TStateMachine sm(state::C);
+  sm.configure(state::B).sub_state_of(state::A);
+  sm.configure(state::C).sub_state_of(state::B).permit(trigger::X, state::B);
+  TStore store(sm.freeze(), 0, state::C);
+  store.enable_index();
+  ASSERT_EQ(0, store.count(state::A));
+
+  for (int i = 0; i < 4; ++i)
+  {
+    store.add(state::C);
+  }
+  store.fire(1, trigger::X);
+  EXPECT_EQ(4, store.count(state::A));
+  EXPECT_EQ(4, store.count(state::B));
+  EXPECT_EQ(3, store.count(state::C));
+  store.set_state(2, state::A);
+  EXPECT_EQ(4, store.count(state::A));
+  EXPECT_EQ(3, store.count(state::B));
+  EXPECT_EQ(2, store.count(state::C));
+}
+
+TEST(InstanceStore, WhenIndexed_ThenInstancesInStateIncludeSubstates)
+{
+  TStateMachine sm(state::A);
+  sm.configure(state::C).sub_state_of(state::B);
+  TStore store(sm.freeze(), 0, state::A);
+  store.add(state::A);
+  store.add(state::B);
+  store.add(state::C);
+  store.add(state::B);
+  store.enable_index();
+
+  std::vector<std::size_t> in_b;
+  store.for_each_in_state(state::B, [&](std::size_t i){ in_b.push_back(i); });
+  std::sort(in_b.begin(), in_b.end());
+  ASSERT_EQ(3, in_b.size());
+  EXPECT_EQ(1, in_b[0]);
+  EXPECT_EQ(2, in_b[1]);
+  EXPECT_EQ(3, in_b[2]);
+
+  std::vector<std::size_t> in_c;
+  store.for_each_in_state(state::C, [&](std::size_t i){ in_c.push_back(i); });
+  ASSERT_EQ(1, in_c.size());
+  EXPECT_EQ(2, in_c[0]);
+}
+
+TEST(InstanceStore, WhenIndexed_ThenIndexMatchesScan)
+{
+  TStateMachine sm(state::A);
+  sm.configure(state::A).permit(trigger::X, state::B).permit(trigger::Y, state::C);
+  sm.configure(state::B).permit(trigger::X, state::A).permit(trigger::Y, state::C);
+  sm.configure(state::C).permit(trigger::X, state::A).ignore(trigger::Y);
+  TStore store(sm.freeze(), 0, state::A);
+  for (int i = 0; i < 200; ++i)
+  {
+    store.add(i % 3 == 0 ? state::A : (i % 3 == 1 ? state::B : state::C));
+  }
+  store.enable_index();
+  for (int round = 0; round < 20; ++round)
+  {
+    store.fire((round * 37) % 200, round % 2 == 0 ? trigger::X : trigger::Y);
+    store.apply(round % 3 == 0 ? trigger::Y : trigger::X, round * 5, round * 5 + 50);
+    if (round % 4 == 0)
+    {
+      store.broadcast(trigger::X);
+    }
+  }
+
+  const state states[] = { state::A, state::B, state::C };
+  for (auto s : states)
+  {
+    std::size_t scanned = 0;
+    for (std::size_t i = 0; i < store.size(); ++i)
+    {
+      scanned += store.is_in_state(i, s) ? 1 : 0;
+    }
+    std::size_t visited = 0;
+    store.for_each_in_state(s, [&](std::size_t i){ ASSERT_TRUE(store.is_in_state(i, s)); ++visited; });
+    EXPECT_EQ(scanned, store.count(s));
+    EXPECT_EQ(scanned, visited);
+  }
+}
+
+TEST(InstanceStore, WhenNotIndexed_ThenCountRaisesError)
+{
+  TStateMachine sm(state::A);
+  TStore store(sm.freeze(), 1, state::A);
+
+  ASSERT_FALSE(store.is_indexed());
+  ASSERT_THROW(store.count(state::A), stateless::error);
+}
+
+TEST(InstanceStore, WhenDwellTimesEnabled_ThenTimeInStatesIsTotalled)
+{
+  TStateMachine sm(state::A);
+  sm.configure(state::A).permit(trigger::X, state::B);
+  sm.configure(state::B).permit(trigger::X, state::C);
+  sm.configure(state::C).sub_state_of(state::B).permit(trigger::Y, state::A);
+  TTimedStore store(sm.freeze(), 3, state::A);
+  test_clock::time = 100;
+  store.enable_dwell_times(TTimedStore::dwell_tracking::per_instance);
+
+  test_clock::time += 5;
+  store.fire(0, trigger::X);
+  test_clock::time += 3;
+  store.apply(trigger::X, 0, 2);
+  EXPECT_EQ(0, store.time_in_current_state(0));
+  EXPECT_EQ(8, store.time_in_current_state(2));
+  test_clock::time += 2;
+
+  EXPECT_EQ(2, store.time_in_current_state(0));
+  EXPECT_EQ(5 + 8 + 10, store.total_time_in_state(state::A));
+  EXPECT_EQ(3 + 2 + 2, store.total_time_in_state(state::B));  // Includes the substate C.
+  EXPECT_EQ(2, store.total_time_in_state(state::C));
+  EXPECT_EQ(5, store.total_time_in_state(0, state::A));
+  EXPECT_EQ(5, store.total_time_in_state(0, state::B));
+  EXPECT_EQ(2, store.total_time_in_state(1, state::B));
+  EXPECT_EQ(0, store.total_time_in_state(2, state::B));
+
+  store.broadcast(trigger::Y);  // Only instance 0, in C, leaves.
+  store.add(state::C);
+  test_clock::time += 4;
+  EXPECT_EQ(5 + 8 + 14 + 4, store.total_time_in_state(state::A));
+  EXPECT_EQ(2 + 4, store.total_time_in_state(state::C));
+  EXPECT_EQ(9, store.total_time_in_state(0, state::A));
+  EXPECT_EQ(4, store.total_time_in_state(3, state::B));
+}
+
+TEST(InstanceStore, WhenInstanceIsOutOfRange_ThenTotalTimeInStateRaisesError)
+{
+  TStateMachine sm(state::A);
+  TTimedStore store(sm.freeze(), 2, state::A);
+  store.enable_dwell_times(TTimedStore::dwell_tracking::per_instance);
+
+  ASSERT_THROW(store.total_time_in_state(2, state::A), stateless::error);
+}
+
+TEST(InstanceStore, WhenDwellTrackingBecomesPerInstance_ThenTimeSoFarIsKept)
+{
+  TStateMachine sm(state::A);
+  sm.configure(state::A).permit(trigger::X, state::B);
+  TTimedStore store(sm.freeze(), 2, state::A);
+  test_clock::time = 0;
+  store.enable_dwell_times();
+
+  test_clock::time += 10;
+  store.fire(0, trigger::X);
+  test_clock::time += 5;
+  store.enable_dwell_times(TTimedStore::dwell_tracking::per_instance);
+  EXPECT_EQ(10 + 15, store.total_time_in_state(state::A));
+  EXPECT_EQ(5, store.total_time_in_state(state::B));
+
+  test_clock::time += 3;
+  EXPECT_EQ(10 + 18, store.total_time_in_state(state::A));
+  EXPECT_EQ(8, store.total_time_in_state(state::B));
+  EXPECT_EQ(3, store.total_time_in_state(0, state::B));
+  EXPECT_EQ(3, store.total_time_in_state(1, state::A));
+}
+
+TEST(InstanceStore, WhenJournalIsReplayed_ThenTimeSoFarIsKept)
+{
+  TStateMachine sm(state::A);
+  sm.configure(state::A).permit(trigger::X, state::B);
+  TTimedStore store(sm.freeze(), 2, state::A);
+  test_clock::time = 0;
+  store.enable_dwell_times(TTimedStore::dwell_tracking::per_instance);
+
+  test_clock::time += 10;
+  test_journal j;
+  const test_journal::entry e = { 0, state::A, state::B, trigger::X };
+  j.entries.push_back(e);
+  ASSERT_EQ(1, store.replay(j, 2));
+  test_clock::time += 5;
+
+  EXPECT_EQ(20 + 5, store.total_time_in_state(state::A));
+  EXPECT_EQ(5, store.total_time_in_state(state::B));
+  EXPECT_EQ(10, store.total_time_in_state(0, state::A));
+  EXPECT_EQ(15, store.total_time_in_state(1, state::A));
+}
+
+TEST(InstanceStore, WhenDwellTimesAreAggregate_ThenInstanceTotalsRaiseError)
+{
+  TStateMachine sm(state::A);
+  TTimedStore store(sm.freeze(), 1, state::A);
+
+  ASSERT_THROW(store.time_in_current_state(0), stateless::error);
+  store.enable_dwell_times();
+  ASSERT_TRUE(store.has_dwell_times());
+  ASSERT_EQ(0, store.total_time_in_state(state::A));
+  ASSERT_THROW(store.total_time_in_state(0, state::A), stateless::error);
+}
+
+
+TEST(InstanceStore, WhenIndexed_ThenMemoryUsageIncludesLinksPerInstance)
+{
+  TStateMachine sm(state::A);
+  sm.configure(state::A).permit(trigger::X, state::B);
+  auto d = sm.freeze();
+  TStore store(d, 1000, state::A);
+
+  const auto usage = store.memory_usage();
+  ASSERT_EQ(d->memory_usage().behaviours, usage.behaviours);
+  ASSERT_EQ(1000 * sizeof(std::uint8_t), usage.instances);
+
+  store.enable_index();
+  ASSERT_EQ(1000 * (sizeof(std::uint8_t) + 2 * sizeof(std::uint32_t)), store.memory_usage().instances);
+}
+
+}
@@ -0,0 +1,377 @@
+/**
+ * Copyright 2013 Matt Mason
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+
+#ifndef _WIN32
+
+#include <stateless++/instance_store.hpp>
+#include <stateless++/journal.hpp>
+#include <stateless++/state_machine.hpp>
+
+#include <state.hpp>
+#include <temporary_file.hpp>
+#include <trigger.hpp>
+
+#include <gtest/gtest.h>
+
+#include <atomic>
+#include <csignal>
+#include <cstdint>
+#include <fstream>
+#include <memory>
+#include <thread>
+#include <vector>
+
+#include <sys/resource.h>
+#include <unistd.h>
+
+using namespace stateless;
+using namespace testing;
+
+namespace
+{
+
+using TStateMachine = state_machine<state, trigger>;
+using TWriter = journal_writer<state, trigger>;
+using TReader = journal_reader<state, trigger>;
+using TTransition = TWriter::TTransition;
+
+TEST(Journal, WhenTransitionsAreAppended_ThenTheyAreReadBackInOrder)
+{
+  temporary_file file;
+  {
+    TWriter writer(file.path());
+    writer.append_at(100, 7, TTransition(state::A, state::B, trigger::X));
+    writer.append_at(200, 3, TTransition(state::B, state::C, trigger::Y));
+  }
+
+  TReader reader(file.path());
+  std::vector<std::uint64_t> instances;
+  std::vector<std::int64_t> timestamps;
+  std::size_t count = reader.for_each([&](const TReader::entry& e)
+    {
+      instances.push_back(e.instance());
+      timestamps.push_back(e.timestamp());
+      if (e.instance() == 3)
+      {
+        EXPECT_EQ(state::B, e.source());
+        EXPECT_EQ(state::C, e.destination());
+        EXPECT_EQ(trigger::Y, e.trigger());
+      }
+    });
+
+  ASSERT_EQ(2, count);
+  ASSERT_EQ(7, instances[0]);
+  ASSERT_EQ(3, instances[1]);
+  ASSERT_EQ(100, timestamps[0]);
+  ASSERT_EQ(200, timestamps[1]);
+}
+
+TEST(Journal, WhenArgumentsAreAppended_ThenTheyAreUnpacked)
+{
+  temporary_file file;
+  {
+    TWriter writer(file.path());
+    writer.append(1, TTransition(state::A, state::B, trigger::X), 42, 2.5, 'c');
+  }
+
+  TReader reader(file.path());
+  reader.for_each([&](const TReader::entry& e)
+    {
+      int i = 0;
+      double d = 0;
+      char c = 0;
+      ASSERT_EQ(sizeof(i) + sizeof(d) + sizeof(c), e.argument_size());
+      e.read_arguments(i, d, c);
+      EXPECT_EQ(42, i);
+      EXPECT_EQ(2.5, d);
+      EXPECT_EQ('c', c);
+      EXPECT_THROW(e.read_arguments(i), stateless::error);
+    });
+}
+
+TEST(Journal, WhenMachinesTransition_ThenJournalRebuildsTheirStates)
+{
+  temporary_file file;
+  std::vector<std::unique_ptr<TStateMachine>> machines;
+  {
+    TWriter writer(file.path());
+    for (std::uint64_t id = 0; id < 3; ++id)
+    {
+      machines.emplace_back(new TStateMachine(state::A));
+      auto& sm = *machines.back();
+      sm.configure(state::A).permit(trigger::X, state::B);
+      sm.configure(state::B).permit(trigger::X, state::C);
+      sm.on_transition([&writer, id](const TTransition& t){ writer.append(id, t); });
+      for (std::uint64_t i = 0; i < id; ++i)
+      {
+        sm.fire(trigger::X);
+      }
+    }
+    writer.commit();
+    ASSERT_EQ(3, writer.durable());
+  }
+
+  instance_store<state, trigger> store(machines[0]->freeze(), 3, state::A);
+  TReader reader(file.path());
+  ASSERT_EQ(3, reader.replay_into(store));
+  for (std::size_t i = 0; i < store.size(); ++i)
+  {
+    ASSERT_EQ(machines[i]->state(), store.state(i));
+  }
+}
+
+TEST(Journal, WhenLastRecordIsTorn_ThenItIsIgnoredAndOverwritten)
+{
+  temporary_file file;
+  {
+    TWriter writer(file.path());
+    writer.append(1, TTransition(state::A, state::B, trigger::X));
+    writer.append(2, TTransition(state::A, state::C, trigger::Y));
+  }
+  // Simulate a crash part way through writing the second record.
+  {
+    std::ifstream in(file.path(), std::ios::binary | std::ios::ate);
+    const auto size = static_cast<off_t>(in.tellg());
+    ASSERT_EQ(0, ::truncate(file.path().c_str(), size - 5));
+  }
+  ASSERT_EQ(1, TReader(file.path()).for_each([](const TReader::entry&){}));
+
+  {
+    TWriter writer(file.path());
+    writer.append(3, TTransition(state::B, state::C, trigger::Z));
+  }
+  std::vector<std::uint64_t> instances;
+  TReader(file.path()).for_each([&](const TReader::entry& e){ instances.push_back(e.instance()); });
+  ASSERT_EQ(2, instances.size());
+  ASSERT_EQ(1, instances[0]);
+  ASSERT_EQ(3, instances[1]);
+}
+
+TEST(Journal, WhenRecordIsCorrupted_ThenItAndLaterRecordsAreDropped)
+{
+  temporary_file file;
+  {
+    TWriter writer(file.path());
+    writer.append(1, TTransition(state::A, state::B, trigger::X));
+    writer.append(2, TTransition(state::A, state::C, trigger::Y), 42);
+    writer.append(3, TTransition(state::B, state::C, trigger::Z));
+  }
+  // Simulate a crash that left the second record's argument unwritten.
+  {
+    std::fstream io(file.path(), std::ios::binary | std::ios::in | std::ios::out);
+    io.seekp(sizeof(detail::journal_file_header) + 2 * sizeof(detail::journal_record_header));
+    io.put(0);
+  }
+  ASSERT_EQ(1, TReader(file.path()).for_each([](const TReader::entry&){}));
+
+  {
+    TWriter writer(file.path());
+    writer.append(4, TTransition(state::B, state::C, trigger::Z));
+  }
+  std::vector<std::uint64_t> instances;
+  TReader(file.path()).for_each([&](const TReader::entry& e){ instances.push_back(e.instance()); });
+  ASSERT_EQ(2, instances.size());
+  ASSERT_EQ(1, instances[0]);
+  ASSERT_EQ(4, instances[1]);
+}
+
+TEST(Journal, WhenWriteFails_ThenRecordsAreWrittenOnceInOrderByNextFlush)
+{
+  temporary_file file;
+  TWriter writer(file.path());
+  writer.append_at(0, 0, TTransition(state::A, state::B, trigger::X));
+  writer.commit();
+
+  // Limit the file size so that the next batch is only partly written.
+  const auto previous_handler = std::signal(SIGXFSZ, SIG_IGN);
+  rlimit previous_limit;
+  ASSERT_EQ(0, ::getrlimit(RLIMIT_FSIZE, &previous_limit));
+  rlimit limit = previous_limit;
+  std::ifstream in(file.path(), std::ios::binary | std::ios::ate);
+  limit.rlim_cur = static_cast<rlim_t>(in.tellg()) + 60;
+  ASSERT_EQ(0, ::setrlimit(RLIMIT_FSIZE, &limit));
+  for (std::uint64_t i = 1; i < 10; ++i)
+  {
+    writer.append_at(i, i, TTransition(state::A, state::B, trigger::X));
+  }
+  EXPECT_THROW(writer.commit(), stateless::error);
+  ASSERT_EQ(0, ::setrlimit(RLIMIT_FSIZE, &previous_limit));
+  std::signal(SIGXFSZ, previous_handler);
+  EXPECT_EQ(1, writer.durable());
+  EXPECT_EQ(1, TReader(file.path()).for_each([](const TReader::entry&){}));
+
+  writer.append_at(10, 10, TTransition(state::A, state::B, trigger::X));
+  writer.commit();
+
+  std::vector<std::uint64_t> instances;
+  TReader(file.path()).for_each([&](const TReader::entry& e){ instances.push_back(e.instance()); });
+  ASSERT_EQ(11u, instances.size());
+  for (std::uint64_t i = 0; i < instances.size(); ++i)
+  {
+    ASSERT_EQ(i, instances[i]);
+  }
+  ASSERT_EQ(11, writer.durable());
+}
+
+TEST(Journal, WhenFileIsNotAJournal_ThenErrorIsRaised)
+{
+  temporary_file file;
+  {
+    std::ofstream out(file.path());
+    out << "not a journal";
+  }
+
+  ASSERT_THROW(TReader reader(file.path()), stateless::error);
+  ASSERT_THROW(TWriter writer(file.path()), stateless::error);
+}
+
+TEST(Journal, WhenThreadsAppendAndCommit_ThenEveryRecordIsDurable)
+{
+  temporary_file file;
+  const int threads = 4, records = 5000;
+  {
+    TWriter writer(file.path(), 4096);
+    std::vector<std::thread> workers;
+    for (int t = 0; t < threads; ++t)
+    {
+      workers.emplace_back([&, t]()
+        {
+          for (int i = 0; i < records; ++i)
+          {
+            writer.append(static_cast<std::uint64_t>(t), TTransition(state::A, state::B, trigger::X), i);
+            if (i % 500 == 499)
+            {
+              writer.commit();
+            }
+          }
+        });
+    }
+    for (auto& worker : workers)
+    {
+      worker.join();
+    }
+    ASSERT_EQ(threads * records, writer.durable());
+  }
+
+  std::vector<int> next(threads, 0);
+  std::size_t count = TReader(file.path()).for_each([&](const TReader::entry& e)
+    {
+      int i = -1;
+      e.read_arguments(i);
+      // Each thread's records appear in the order it appended them.
+      ASSERT_EQ(next[e.instance()], i);
+      ++next[e.instance()];
+    });
+  ASSERT_EQ(threads * records, count);
+}
+
+
+TEST(Journal, WhenReplayedInParallel_ThenStoreMatchesSequentialReplay)
+{
+  temporary_file file;
+  const std::size_t instances = 20000;
+  {
+    TWriter writer(file.path());
+    const state states[] = { state::A, state::B, state::C };
+    for (std::size_t i = 0; i < 3 * instances; ++i)
+    {
+      const std::size_t instance = (i * 7919) % instances;
+      writer.append(instance, TTransition(states[i % 3], states[(i + 1) % 3], trigger::X));
+    }
+  }
+  TStateMachine sm(state::A);
+  TReader reader(file.path());
+  instance_store<state, trigger> sequential(sm.freeze(), instances, state::A);
+  instance_store<state, trigger> parallel(sm.freeze(), instances, state::A);
+  parallel.enable_index();
+
+  reader.replay_into(sequential);
+  ASSERT_EQ(3 * instances, parallel.replay(reader, 4));
+
+  for (std::size_t i = 0; i < instances; ++i)
+  {
+    ASSERT_EQ(sequential.state(i), parallel.state(i));
+  }
+  std::size_t in_b = 0;
+  for (std::size_t i = 0; i < instances; ++i)
+  {
+    in_b += sequential.state(i) == state::B ? 1 : 0;
+  }
+  ASSERT_EQ(in_b, parallel.count(state::B));
+}
+
+TEST(Journal, WhenReplayedWithActions_ThenEntryAndExitActionsRun)
+{
+  temporary_file file;
+  {
+    TWriter writer(file.path());
+    for (std::uint64_t instance = 0; instance < 10000; ++instance)
+    {
+      writer.append(instance, TTransition(state::A, state::B, trigger::X));
+    }
+  }
+  std::atomic<int> exits(0), entries(0);
+  TStateMachine sm(state::A);
+  sm.configure(state::A)
+    .permit(trigger::X, state::B)
+    .on_exit([&](const TTransition&){ ++exits; });
+  sm.configure(state::B).on_entry([&](const TTransition&){ ++entries; });
+  instance_store<state, trigger> store(sm.freeze(), 10000, state::A);
+  TReader reader(file.path());
+
+  store.replay(reader, 3, instance_store<state, trigger>::replay_mode::state_only);
+  ASSERT_EQ(0, entries);
+  store.replay(reader, 3, instance_store<state, trigger>::replay_mode::with_actions);
+  ASSERT_EQ(10000, exits);
+  ASSERT_EQ(10000, entries);
+  ASSERT_EQ(state::B, store.state(9999));
+}
+
+TEST(Journal, WhenReplayedInstanceIsOutOfBounds_ThenErrorIsRaised)
+{
+  temporary_file file;
+  {
+    TWriter writer(file.path());
+    writer.append(5, TTransition(state::A, state::B, trigger::X));
+  }
+  TStateMachine sm(state::A);
+  instance_store<state, trigger> store(sm.freeze(), 5, state::A);
+
+  ASSERT_THROW(store.replay(TReader(file.path()), 2), stateless::error);
+}
+
+TEST(Journal, WhenReplayThreadFailsBeforeJournalIsRead_ThenErrorIsRaised)
+{
+  temporary_file file;
+  {
+    TWriter writer(file.path());
+    writer.append(5, TTransition(state::A, state::B, trigger::X));
+    for (std::size_t i = 0; i < 100000; ++i)
+    {
+      writer.append(i % 5, TTransition(state::A, state::B, trigger::X));
+    }
+  }
+  TStateMachine sm(state::A);
+  instance_store<state, trigger> store(sm.freeze(), 5, state::A);
+
+  ASSERT_THROW(store.replay(TReader(file.path()), 2), stateless::error);
+}
+
+}
+
+#endif // _WIN32
@@ -0,0 +1,141 @@
+/**
+ * Copyright 2013 Matt Mason
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#include <stateless++/instance_store.hpp>
+#include <stateless++/latency_histograms.hpp>
+#include <stateless++/state_machine.hpp>
+
+#include <state.hpp>
+#include <trigger.hpp>
+
+#include <gtest/gtest.h>
+
+#include <cstdint>
+
+using namespace stateless;
+using namespace testing;
+
+namespace
+{
+
+/// A clock advanced by the test's actions.
+struct test_clock
+{
+  typedef std::uint64_t rep;
+
+  static rep now()
+  {
+    return time;
+  }
+
+  static rep time;
+};
+
+test_clock::rep test_clock::time = 0;
+
+#ifdef _WIN32
+typedef state_machine<state, trigger> TStateMachine;
+typedef latency_histograms<state, trigger, test_clock> THistograms;
+#else
+using TStateMachine = state_machine<state, trigger>;
+using THistograms = latency_histograms<state, trigger, test_clock>;
+#endif
+
+TEST(LatencyHistograms, WhenTransitionIsMade_ThenEachPhaseIsTimed)
+{
+  state s = state::A;
+  TStateMachine sm(
+    [&](){ return s; },
+    [&](const state& new_state){ test_clock::time += 3; s = new_state; });
+  sm.configure(state::A)
+    .permit_if(trigger::X, state::B, [](){ test_clock::time += 5; return true; })
+    .on_exit([](const TStateMachine::TTransition&){ test_clock::time += 100; });
+  sm.configure(state::B)
+    .on_entry([](const TStateMachine::TTransition&){ test_clock::time += 1000; });
+  sm.on_transition([](const TStateMachine::TTransition&){ test_clock::time += 10000; });
+  THistograms histograms;
+  sm.set_observer(&histograms);
+
+  sm.fire(trigger::X);
+
+  typedef THistograms::phase phase;
+  ASSERT_EQ(0, histograms.histogram(phase::lookup, state::A, trigger::X).max());
+  ASSERT_EQ(5, histograms.histogram(phase::guards, state::A, trigger::X).max());
+  ASSERT_EQ(100, histograms.histogram(phase::exit, state::A, trigger::X).max());
+  ASSERT_EQ(3, histograms.histogram(phase::state_change, state::A, trigger::X).max());
+  ASSERT_EQ(1000, histograms.histogram(phase::entry, state::A, trigger::X).max());
+  ASSERT_EQ(10000, histograms.histogram(phase::transition_action, state::A, trigger::X).max());
+  const auto total = histograms.histogram(phase::total, state::A, trigger::X);
+  ASSERT_EQ(1, total.count());
+  ASSERT_EQ(11108, total.max());
+}
+
+TEST(LatencyHistograms, WhenQueriedByStateOrTrigger_ThenHistogramsAreMerged)
+{
+  TStateMachine sm(state::A);
+  sm.configure(state::A).permit(trigger::X, state::B).ignore(trigger::Y);
+  sm.configure(state::B)
+    .permit(trigger::X, state::A)
+    .on_entry([](const TStateMachine::TTransition&){ test_clock::time += 50; });
+  THistograms histograms;
+  sm.set_observer(&histograms);
+
+  for (int i = 0; i < 4; ++i)
+  {
+    sm.fire(trigger::Y);
+    sm.fire(trigger::X);
+    sm.fire(trigger::X);
+  }
+
+  typedef THistograms::phase phase;
+  ASSERT_EQ(8, histograms.histogram_for_state(phase::total, state::A).count());
+  ASSERT_EQ(4, histograms.histogram_for_state(phase::entry, state::A).count());
+  ASSERT_EQ(8, histograms.histogram_for_trigger(phase::entry, trigger::X).count());
+  ASSERT_EQ(50, histograms.histogram_for_trigger(phase::entry, trigger::X).max());
+  ASSERT_EQ(0, histograms.histogram(phase::guards, state::A, trigger::X).count());
+}
+
+TEST(LatencyHistograms, WhenStoreActionFiresAnotherInstance_ThenTimingsNest)
+{
+  TStateMachine sm(state::A);
+  instance_store<state, trigger>* store = nullptr;
+  sm.configure(state::A).permit(trigger::X, state::B);
+  sm.configure(state::B)
+    .permit(trigger::Y, state::C)
+    .on_entry([&](const TStateMachine::TTransition&)
+      {
+        test_clock::time += 7;
+        if (store->current() == 0)
+        {
+          store->fire(1, trigger::X);
+        }
+      });
+  instance_store<state, trigger> instances(sm.freeze(), 2, state::A);
+  store = &instances;
+  THistograms histograms;
+  instances.set_observer(&histograms);
+
+  instances.fire(0, trigger::X);
+
+  typedef THistograms::phase phase;
+  const auto entry = histograms.histogram(phase::entry, state::A, trigger::X);
+  ASSERT_EQ(2, entry.count());
+  ASSERT_EQ(14, entry.max());
+  ASSERT_EQ(14, histograms.histogram(phase::total, state::A, trigger::X).max());
+}
+
+}
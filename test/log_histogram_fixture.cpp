@@ -0,0 +1,78 @@
+/**
+ * Copyright 2013 Matt Mason
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#include <stateless++/log_histogram.hpp>
+
+#include <gtest/gtest.h>
+
+#include <cstdint>
+
+using namespace stateless;
+using namespace testing;
+
+namespace
+{
+
+TEST(LogHistogram, WhenBucketBoundsAreComputed_ThenBucketsAreContiguous)
+{
+  const std::size_t buckets = log_histogram::bucket_count;
+  ASSERT_EQ(0, log_histogram::lowest_value(0));
+  for (std::size_t i = 0; i + 1 < buckets; ++i)
+  {
+    ASSERT_EQ(i, log_histogram::bucket_of(log_histogram::lowest_value(i)));
+    ASSERT_EQ(i, log_histogram::bucket_of(log_histogram::highest_value(i)));
+    ASSERT_EQ(log_histogram::highest_value(i) + 1, log_histogram::lowest_value(i + 1));
+  }
+  ASSERT_EQ(buckets - 1, log_histogram::bucket_of(~std::uint64_t(0)));
+}
+
+TEST(LogHistogram, WhenValuesAreRecorded_ThenPercentilesAreWithinBucketPrecision)
+{
+  log_histogram h;
+  for (std::uint64_t v = 1; v <= 10000; ++v)
+  {
+    h.record(v);
+  }
+
+  ASSERT_EQ(10000, h.count());
+  ASSERT_EQ(10000, h.max());
+  ASSERT_DOUBLE_EQ(5000.5, h.mean());
+  const std::uint64_t p50 = h.value_at_percentile(50);
+  ASSERT_LE(5000, p50);
+  ASSERT_GE(5000 * 1.125, p50);
+  const std::uint64_t p99 = h.value_at_percentile(99);
+  ASSERT_LE(9900, p99);
+  ASSERT_GE(10000, p99);
+  ASSERT_EQ(10000, h.value_at_percentile(100));
+}
+
+TEST(LogHistogram, WhenMerged_ThenCountsAreCombined)
+{
+  log_histogram a, b;
+  a.record(3);
+  b.record(300, 4);
+
+  a.merge(b);
+
+  ASSERT_EQ(5, a.count());
+  ASSERT_EQ(300, a.max());
+  ASSERT_EQ(3, a.value_at_percentile(20));
+  ASSERT_EQ(4, a.count_in_bucket(log_histogram::bucket_of(300)));
+  ASSERT_EQ(0, log_histogram().value_at_percentile(99));
+}
+
+}
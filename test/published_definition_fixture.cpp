@@ -0,0 +1,171 @@
+/**
+ * Copyright 2013 Matt Mason
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#include <stateless++/published_definition.hpp>
+#include <stateless++/state_machine.hpp>
+
+#include <state.hpp>
+#include <trigger.hpp>
+
+#include <gtest/gtest.h>
+
+#include <atomic>
+#include <thread>
+#include <vector>
+
+using namespace stateless;
+using namespace testing;
+
+namespace
+{
+
+#ifdef _WIN32
+typedef state_machine<state, trigger> TStateMachine;
+typedef published_definition<state, trigger> TPublished;
+#else
+using TStateMachine = state_machine<state, trigger>;
+using TPublished = published_definition<state, trigger>;
+#endif
+
+TPublished::TDefinitionPtr build(state destination)
+{
+  TStateMachine sm(state::A);
+  sm.configure(state::A).permit(trigger::X, destination);
+  return sm.freeze();
+}
+
+TEST(PublishedDefinition, WhenPublished_ThenSubsequentFiresUseNewDefinition)
+{
+  TPublished published(build(state::B));
+
+  state s = state::A;
+  published.fire(s, trigger::X);
+  ASSERT_EQ(state::B, s);
+
+  published.publish(build(state::C));
+
+  s = state::A;
+  published.fire(s, trigger::X);
+  ASSERT_EQ(state::C, s);
+}
+
+TEST(PublishedDefinition, WhenReplaced_ThenOldDefinitionLivesUntilReleased)
+{
+  TPublished published(build(state::B));
+  auto in_flight = published.acquire();
+  std::weak_ptr<const TPublished::TDefinition> old = in_flight;
+
+  published.publish(build(state::C));
+
+  state s = state::A;
+  in_flight->fire(s, trigger::X);
+  ASSERT_EQ(state::B, s);
+  ASSERT_FALSE(old.expired());
+
+  in_flight.reset();
+  ASSERT_TRUE(old.expired());
+}
+
+TEST(PublishedDefinition, WhenPublishedWhileFiring_ThenOldDefinitionIsFreedWhenFireReturns)
+{
+  TPublished* published = nullptr;
+  std::weak_ptr<const TPublished::TDefinition> old;
+  bool alive_during_fire = false;
+
+  TStateMachine sm(state::A);
+  sm.configure(state::A).permit(trigger::X, state::B);
+  sm.configure(state::B).on_entry([&](const TStateMachine::TTransition&)
+    {
+      published->publish(build(state::C));
+      alive_during_fire = !old.expired();
+    });
+  TPublished instance(sm.freeze());
+  published = &instance;
+  old = instance.acquire();
+
+  state s = state::A;
+  instance.fire(s, trigger::X);
+  ASSERT_EQ(state::B, s);
+  ASSERT_TRUE(alive_during_fire);
+  ASSERT_TRUE(old.expired());
+}
+
+TEST(PublishedDefinition, WhenPublishedWhileOtherThreadIsIdle_ThenOldDefinitionIsFreed)
+{
+  TPublished published(build(state::B));
+  std::weak_ptr<const TPublished::TDefinition> old = published.acquire();
+  std::atomic<bool> fired(false);
+  std::atomic<bool> stop(false);
+
+  std::thread idle([&]()
+    {
+      state s = state::A;
+      published.fire(s, trigger::X);
+      fired = true;
+      while (!stop)
+      {
+        std::this_thread::yield();
+      }
+    });
+  while (!fired)
+  {
+    std::this_thread::yield();
+  }
+
+  published.publish(build(state::C));
+  bool expired = old.expired();
+  stop = true;
+  idle.join();
+  ASSERT_TRUE(expired);
+}
+
+TEST(PublishedDefinition, WhenPublishingWhileFiring_ThenEveryFireCompletes)
+{
+  TPublished published(build(state::B));
+  std::atomic<bool> stop(false);
+  std::atomic<int> fires(0);
+
+  std::vector<std::thread> firing;
+  for (int t = 0; t < 3; ++t)
+  {
+    firing.push_back(std::thread([&]()
+      {
+        while (!stop)
+        {
+          state s = state::A;
+          published.fire(s, trigger::X);
+          EXPECT_NE(state::A, s);
+          ++fires;
+        }
+      }));
+  }
+  for (int i = 0; i < 200; ++i)
+  {
+    published.publish(build(i % 2 == 0 ? state::C : state::B));
+  }
+  while (fires < 100)
+  {
+    std::this_thread::yield();
+  }
+  stop = true;
+  for (auto& t : firing)
+  {
+    t.join();
+  }
+}
+
+}
@@ -0,0 +1,205 @@
+/**
+ * Copyright 2013 Matt Mason
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#include <stateless++/registry.hpp>
+#include <stateless++/timing_wheel.hpp>
+
+#include <state.hpp>
+#include <trigger.hpp>
+
+#include <gtest/gtest.h>
+
+#include <chrono>
+#include <functional>
+#include <set>
+#include <string>
+#include <thread>
+#include <vector>
+
+using namespace stateless;
+using namespace testing;
+
+namespace
+{
+
+#ifdef _WIN32
+typedef registry<int, state, trigger> TRegistry;
+#else
+using TRegistry = registry<int, state, trigger>;
+#endif
+
+void configure_cycle(TRegistry::TStateMachine& sm)
+{
+  sm.configure(state::A).permit(trigger::X, state::B);
+  sm.configure(state::B).permit(trigger::X, state::C);
+  sm.configure(state::C).permit(trigger::X, state::A);
+}
+
+TEST(Registry, WhenCreated_ThenInstanceIsInInitialState)
+{
+  TRegistry r(configure_cycle, 4);
+
+  ASSERT_TRUE(r.create(1, state::B));
+  ASSERT_TRUE(r.contains(1));
+  ASSERT_EQ(state::B, r.state_of(1));
+}
+
+TEST(Registry, WhenIdIsInUse_ThenCreateFails)
+{
+  TRegistry r(configure_cycle, 4);
+  r.create(1, state::A);
+
+  ASSERT_FALSE(r.create(1, state::B));
+  ASSERT_EQ(state::A, r.state_of(1));
+}
+
+TEST(Registry, WhenErased_ThenInstanceIsUnknown)
+{
+  TRegistry r(configure_cycle, 4);
+  r.create(1, state::A);
+
+  ASSERT_TRUE(r.erase(1));
+  ASSERT_FALSE(r.erase(1));
+  ASSERT_FALSE(r.contains(1));
+  ASSERT_THROW(r.state_of(1), stateless::error);
+  ASSERT_THROW(r.fire(1, trigger::X), stateless::error);
+}
+
+TEST(Registry, WhenFired_ThenOnlyTheIdentifiedInstanceTransitions)
+{
+  TRegistry r(configure_cycle, 1);
+  r.create(1, state::A);
+  r.create(2, state::A);
+
+  r.fire(1, trigger::X);
+
+  ASSERT_EQ(state::B, r.state_of(1));
+  ASSERT_EQ(state::A, r.state_of(2));
+}
+
+TEST(Registry, WhenFiredWithParameters_ThenTheyArePassedToEntryAction)
+{
+  std::string assigned;
+  std::shared_ptr<trigger_with_parameters<trigger, std::string>> y;
+  TRegistry r(
+    [&](TRegistry::TStateMachine& sm)
+    {
+      y = sm.set_trigger_parameters<std::string>(trigger::Y);
+      sm.configure(state::A).permit(trigger::Y, state::B);
+      sm.configure(state::B).on_entry_from(
+        y, [&](const TRegistry::TStateMachine::TTransition&, const std::string& s){ assigned = s; });
+    },
+    2);
+  r.create(7, state::A);
+
+  r.fire(7, y, std::string("seven"));
+
+  ASSERT_EQ(state::B, r.state_of(7));
+  ASSERT_EQ("seven", assigned);
+}
+
+TEST(Registry, WhenVisitingShards_ThenEveryInstanceIsVisitedOnce)
+{
+  TRegistry r(configure_cycle, 8);
+  for (int id = 0; id < 100; ++id)
+  {
+    r.create(id, state::A);
+  }
+
+  std::multiset<int> visited;
+  for (std::size_t shard = 0; shard < r.shard_count(); ++shard)
+  {
+    r.for_each_in_shard(shard,
+      [&](const int& id, const state&)
+      {
+        EXPECT_EQ(shard, r.shard_of(id));
+        visited.insert(id);
+      });
+  }
+
+  ASSERT_EQ(100, visited.size());
+  ASSERT_EQ(100, std::set<int>(visited.begin(), visited.end()).size());
+  ASSERT_EQ(100, r.size());
+}
+
+TEST(Registry, WhenConfiguredWithTimersOrAsyncActions_ThenErrorIsRaised)
+{
+  timing_wheel wheel(std::chrono::milliseconds(1));
+  ASSERT_THROW(TRegistry([&](TRegistry::TStateMachine& sm)
+    {
+      sm.set_timer_scheduler(wheel);
+      sm.configure(state::A).fire_after(std::chrono::milliseconds(10), trigger::X);
+    }), stateless::error);
+  ASSERT_THROW(TRegistry([](TRegistry::TStateMachine& sm)
+    {
+      sm.configure(state::A).on_exit_async([](const TRegistry::TStateMachine::TTransition&){});
+    }), stateless::error);
+}
+
+TEST(Registry, WhenActionFiresAsync_ThenTriggerAppliesBeforeFireReturns)
+{
+  TRegistry r([](TRegistry::TStateMachine& sm)
+    {
+      sm.set_executor([](const std::function<void()>&){ FAIL(); });
+      sm.configure(state::A).permit(trigger::X, state::B);
+      sm.configure(state::B)
+        .on_entry([&sm](const TRegistry::TStateMachine::TTransition&){ sm.fire_async(trigger::X); })
+        .permit(trigger::X, state::C);
+    }, 4);
+  r.create(1, state::A);
+
+  r.fire(1, trigger::X);
+  ASSERT_EQ(state::C, r.state_of(1));
+}
+
+TEST(Registry, WhenFiredConcurrently_ThenEveryTransitionIsApplied)
+{
+  TRegistry r(configure_cycle, 16);
+  const int instances = 64, threads = 4, fires = 300;
+  for (int id = 0; id < instances; ++id)
+  {
+    r.create(id, state::A);
+  }
+
+  std::vector<std::thread> workers;
+  for (int t = 0; t < threads; ++t)
+  {
+    workers.push_back(std::thread([&]()
+      {
+        for (int i = 0; i < fires; ++i)
+        {
+          for (int id = 0; id < instances; ++id)
+          {
+            r.fire(id, trigger::X);
+          }
+        }
+      }));
+  }
+  for (auto& w : workers)
+  {
+    w.join();
+  }
+
+  // Each instance cycles through three states.
+  const state expected = static_cast<state>((threads * fires) % 3);
+  for (int id = 0; id < instances; ++id)
+  {
+    ASSERT_EQ(expected, r.state_of(id));
+  }
+}
+
+}
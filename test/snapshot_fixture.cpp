@@ -0,0 +1,188 @@
+/**
+ * Copyright 2013 Matt Mason
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+
+#ifndef _WIN32
+
+#include <stateless++/snapshot.hpp>
+#include <stateless++/state_machine.hpp>
+
+#include <state.hpp>
+#include <temporary_file.hpp>
+#include <trigger.hpp>
+
+#include <gtest/gtest.h>
+
+#include <cstdint>
+#include <fstream>
+
+using namespace stateless;
+using namespace testing;
+
+namespace
+{
+
+using TStateMachine = state_machine<state, trigger>;
+using TStore = instance_store<state, trigger>;
+
+TStore::TDefinitionPtr define()
+{
+  TStateMachine sm(state::A);
+  sm.configure(state::A).permit(trigger::X, state::B);
+  sm.configure(state::B).permit(trigger::X, state::C);
+  sm.configure(state::C).ignore(trigger::X);
+  return sm.freeze();
+}
+
+TEST(Snapshot, WhenRestored_ThenInstancesHaveSavedStates)
+{
+  temporary_file file;
+  auto definition = define();
+  TStore store(definition, 1000, state::A);
+  store.apply(trigger::X, 0, 600);
+  store.apply(trigger::X, 0, 300);
+  save_snapshot(store, file.path());
+
+  auto restored = restore_snapshot(definition, file.path());
+
+  ASSERT_EQ(store.size(), restored->size());
+  for (std::size_t i = 0; i < store.size(); ++i)
+  {
+    ASSERT_EQ(store.state(i), restored->state(i));
+  }
+}
+
+TEST(Snapshot, WhenRestoredStoreChanges_ThenFileIsUnchanged)
+{
+  temporary_file file;
+  auto definition = define();
+  TStore store(definition, 100, state::A);
+  save_snapshot(store, file.path());
+
+  auto restored = restore_snapshot(definition, file.path());
+  restored->apply(trigger::X);
+  restored->fire(5, trigger::X);
+  restored->add(state::C);
+
+  ASSERT_EQ(state::C, restored->state(5));
+  ASSERT_EQ(state::B, restored->state(6));
+  ASSERT_EQ(101, restored->size());
+  snapshot_view<state> view(file.path());
+  ASSERT_EQ(100, view.size());
+  ASSERT_EQ(state::A, view.state(5));
+  ASSERT_EQ(definition->fingerprint(), view.fingerprint());
+}
+
+TEST(Snapshot, WhenRestoredAndIndexed_ThenCountsMatch)
+{
+  temporary_file file;
+  auto definition = define();
+  TStore store(definition, 50, state::A);
+  store.apply(trigger::X, 10, 30);
+  save_snapshot(store, file.path());
+
+  auto restored = restore_snapshot(definition, file.path());
+  restored->enable_index();
+
+  ASSERT_EQ(30, restored->count(state::A));
+  ASSERT_EQ(20, restored->count(state::B));
+}
+
+TEST(Snapshot, WhenDefinitionDiffers_ThenRestoreRaisesError)
+{
+  temporary_file file;
+  TStore store(define(), 10, state::A);
+  save_snapshot(store, file.path());
+
+  TStateMachine other(state::A);
+  other.configure(state::A).permit(trigger::X, state::C);
+
+  ASSERT_THROW(restore_snapshot(other.freeze(), file.path()), stateless::error);
+}
+
+TEST(Snapshot, WhenCodeTypeDiffers_ThenRestoreRaisesError)
+{
+  temporary_file file;
+  auto definition = define();
+  TStore store(definition, 10, state::A);
+  save_snapshot(store, file.path());
+
+  ASSERT_THROW(restore_snapshot<std::uint16_t>(definition, file.path()), stateless::error);
+}
+
+TEST(Snapshot, WhenCodeIsOutsideCodeLimit_ThenRestoreRaisesError)
+{
+  temporary_file file;
+  auto definition = define();
+  TStore store(definition, 10, state::A);
+  save_snapshot(store, file.path());
+  {
+    std::fstream io(file.path(), std::ios::binary | std::ios::in | std::ios::out);
+    io.seekp(static_cast<std::streamoff>(detail::page_size()) + 7);
+    io.put(static_cast<char>(store.code_limit()));
+  }
+
+  ASSERT_THROW(restore_snapshot(definition, file.path()), stateless::error);
+}
+
+TEST(Snapshot, WhenFileIsNotASnapshot_ThenRestoreRaisesError)
+{
+  temporary_file file;
+  {
+    std::ofstream out(file.path());
+    out << "not a snapshot";
+  }
+
+  ASSERT_THROW(restore_snapshot(define(), file.path()), stateless::error);
+}
+
+TEST(Snapshot, WhenTakenInBackground_ThenFileHoldsStatesAtTheTimeOfTheFork)
+{
+  temporary_file file;
+  auto definition = define();
+  TStore store(definition, 10000, state::A);
+  store.apply(trigger::X, 0, 100);
+  int completions = 0;
+  bool succeeded = false;
+
+  background_snapshot snapshot(store, file.path(),
+    [&](bool success){ ++completions; succeeded = success; });
+  store.apply(trigger::X);
+  store.apply(trigger::X);
+  snapshot.wait();
+  snapshot.wait();
+
+  ASSERT_TRUE(snapshot.is_complete());
+  ASSERT_TRUE(snapshot.poll());
+  ASSERT_EQ(1, completions);
+  ASSERT_TRUE(succeeded);
+  auto restored = restore_snapshot(definition, file.path());
+  ASSERT_EQ(state::B, restored->state(0));
+  ASSERT_EQ(state::A, restored->state(100));
+  ASSERT_EQ(state::C, store.state(100));
+}
+
+TEST(Snapshot, WhenBackgroundSnapshotCannotCreateFile_ThenErrorIsRaised)
+{
+  TStore store(define(), 10, state::A);
+
+  ASSERT_THROW(background_snapshot(store, "/nonexistent/directory/snapshot"), stateless::error);
+}
+
+}
+
+#endif // _WIN32
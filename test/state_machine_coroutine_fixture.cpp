@@ -0,0 +1,149 @@
+/**
+ * Copyright 2013 Matt Mason
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <stateless++/state_machine.hpp>
+
+#ifdef STATELESS_HAS_COROUTINES
+
+#include <state.hpp>
+#include <trigger.hpp>
+
+#include <gtest/gtest.h>
+
+#include <vector>
+
+using namespace stateless;
+using namespace testing;
+
+namespace
+{
+
+using TStateMachine = state_machine<state, trigger>;
+
+/// Minimal eagerly started coroutine that is destroyed when it finishes.
+struct fire_and_forget
+{
+  struct promise_type
+  {
+    fire_and_forget get_return_object() { return {}; }
+    std::suspend_never initial_suspend() { return {}; }
+    std::suspend_never final_suspend() noexcept { return {}; }
+    void return_void() {}
+    void unhandled_exception() { std::terminate(); }
+  };
+};
+
+fire_and_forget wait_for_state(TStateMachine& sm, state s, bool& done)
+{
+  co_await sm.until_in_state(s);
+  done = true;
+}
+
+fire_and_forget wait_for_transitions(
+  TStateMachine& sm, int count, std::vector<state>& destinations)
+{
+  for (int i = 0; i < count; ++i)
+  {
+    auto t = co_await sm.next_transition();
+    destinations.push_back(t.destination());
+  }
+}
+
+fire_and_forget wait_for_trigger(TStateMachine& sm, trigger t, bool& done)
+{
+  co_await sm.until_can_fire(t);
+  done = true;
+}
+
+TEST(StateMachineCoroutine, WhenAlreadyInState_ThenAwaitCompletesImmediately)
+{
+  TStateMachine sm(state::A);
+  bool done = false;
+  wait_for_state(sm, state::A, done);
+  ASSERT_TRUE(done);
+}
+
+TEST(StateMachineCoroutine, WhenSubstateIsEntered_ThenSuperstateAwaitCompletes)
+{
+  TStateMachine sm(state::A);
+  sm.configure(state::A).permit(trigger::X, state::B);
+  sm.configure(state::B).sub_state_of(state::C);
+
+  bool done = false;
+  wait_for_state(sm, state::C, done);
+  ASSERT_FALSE(done);
+
+  sm.fire(trigger::X);
+  ASSERT_TRUE(done);
+}
+
+TEST(StateMachineCoroutine, WhenAwaitingNextTransition_ThenEachTransitionIsYielded)
+{
+  TStateMachine sm(state::A);
+  sm.configure(state::A).permit(trigger::X, state::B);
+  sm.configure(state::B).permit(trigger::X, state::C);
+  sm.configure(state::C).permit(trigger::X, state::A);
+
+  std::vector<state> destinations;
+  wait_for_transitions(sm, 2, destinations);
+  sm.fire(trigger::X);
+  sm.fire(trigger::X);
+  sm.fire(trigger::X);
+
+  ASSERT_EQ(2, destinations.size());
+  EXPECT_EQ(state::B, destinations[0]);
+  EXPECT_EQ(state::C, destinations[1]);
+}
+
+TEST(StateMachineCoroutine, WhenTriggerBecomesPermitted_ThenAwaitCompletes)
+{
+  TStateMachine sm(state::A);
+  sm.configure(state::A).permit(trigger::X, state::B);
+  sm.configure(state::B).permit(trigger::Y, state::C);
+
+  bool done = false;
+  wait_for_trigger(sm, trigger::Y, done);
+  ASSERT_FALSE(done);
+
+  sm.fire(trigger::X);
+  ASSERT_TRUE(done);
+}
+
+TEST(StateMachineCoroutine, WhenResumedCoroutineFires_ThenTriggerIsQueued)
+{
+  TStateMachine sm(state::A);
+  sm.configure(state::A).permit(trigger::X, state::B);
+  sm.configure(state::B).permit(trigger::Y, state::C);
+
+  std::vector<state> observed;
+  sm.on_transition(
+    [&](const TStateMachine::TTransition& t){ observed.push_back(t.destination()); });
+
+  auto advance = [](TStateMachine& sm) -> fire_and_forget
+  {
+    co_await sm.until_in_state(state::B);
+    sm.fire(trigger::Y);
+  };
+  advance(sm);
+  sm.fire(trigger::X);
+
+  ASSERT_EQ(state::C, sm.state());
+  ASSERT_EQ(2, observed.size());
+}
+
+}
+
+#endif // STATELESS_HAS_COROUTINES
@@ -15,12 +15,19 @@
  */
 
 #include <stateless++/state_machine.hpp>
+#include <stateless++/timing_wheel.hpp>
 
 #include <state.hpp>
 #include <trigger.hpp>
 
 #include <gtest/gtest.h>
 
+#include <atomic>
+#include <chrono>
+#include <future>
+#include <thread>
+#include <vector>
+
 using namespace stateless;
 using namespace testing;
 
@@ -237,4 +244,345 @@ TEST(StateMachine, WhenTransitionOccurs_ThenTheOnTransitionEventFires)
     sm.fire(trigger::X);
 }
 
+TEST(StateMachine, WhenFiredFromEntryAction_ThenTriggerIsQueuedUntilTransitionCompletes)
+{
+  TStateMachine sm(state::A);
+
+  std::vector<state> transitions;
+  sm.configure(state::A).permit(trigger::X, state::B);
+  sm.configure(state::B)
+    .on_entry([&](const TStateMachine::TTransition&){ sm.fire(trigger::Y); })
+    .permit(trigger::Y, state::C);
+  sm.on_transition(
+    [&](const TStateMachine::TTransition& t){ transitions.push_back(t.destination()); });
+
+  sm.fire(trigger::X);
+
+  ASSERT_EQ(state::C, sm.state());
+  ASSERT_EQ(2, transitions.size());
+  EXPECT_EQ(state::B, transitions[0]);
+  EXPECT_EQ(state::C, transitions[1]);
+}
+
+TEST(StateMachine, WhenParameterizedTriggerFiredFromExitAction_ThenArgumentsAreQueued)
+{
+  TStateMachine sm(state::A);
+  auto y = sm.set_trigger_parameters<std::string>(trigger::Y);
+
+  std::string assigned;
+  sm.configure(state::A)
+    .on_exit([&](const TStateMachine::TTransition&){ sm.fire(y, std::string("queued")); })
+    .permit(trigger::X, state::B);
+  sm.configure(state::B).permit(trigger::Y, state::C);
+  sm.configure(state::C)
+    .on_entry_from(y, [&](const TStateMachine::TTransition&, const std::string& s){ assigned = s; });
+
+  sm.fire(trigger::X);
+
+  ASSERT_EQ(state::C, sm.state());
+  ASSERT_EQ("queued", assigned);
+}
+
+TEST(StateMachine, WhenQueuedTriggerThrows_ThenQueueIsDiscarded)
+{
+  TStateMachine sm(state::A);
+  sm.configure(state::A).permit(trigger::X, state::B);
+  sm.configure(state::B)
+    .on_entry([&](const TStateMachine::TTransition&)
+      {
+        sm.fire(trigger::Z);
+        sm.fire(trigger::Y);
+      })
+    .permit(trigger::Y, state::C);
+
+  ASSERT_THROW(sm.fire(trigger::X), stateless::error);
+  ASSERT_EQ(state::B, sm.state());
+
+  sm.fire(trigger::Y);
+  ASSERT_EQ(state::C, sm.state());
+}
+
+TEST(StateMachine, WhenAsyncActionsConfigured_ThenTheyRunAfterSynchronousActions)
+{
+  TStateMachine sm(state::A);
+
+  std::vector<std::string> actions;
+  sm.configure(state::A)
+    .on_exit_async([&](const TStateMachine::TTransition&){ actions.push_back("exit async"); })
+    .on_exit([&](const TStateMachine::TTransition&){ actions.push_back("exit"); })
+    .permit(trigger::X, state::B);
+  sm.configure(state::B)
+    .on_entry_async([&](const TStateMachine::TTransition&){ actions.push_back("entry async"); })
+    .on_entry([&](const TStateMachine::TTransition&){ actions.push_back("entry"); });
+
+  auto done = sm.fire_async(trigger::X);
+
+  ASSERT_EQ(std::future_status::ready, done.wait_for(std::chrono::seconds(0)));
+  ASSERT_EQ(4, actions.size());
+  EXPECT_EQ("exit", actions[0]);
+  EXPECT_EQ("entry", actions[1]);
+  EXPECT_EQ("exit async", actions[2]);
+  EXPECT_EQ("entry async", actions[3]);
+}
+
+TEST(StateMachine, WhenFiredAsync_ThenNextTriggerWaitsForAsyncActions)
+{
+  TStateMachine sm(state::A);
+
+  std::vector<std::function<void()>> jobs;
+  sm.set_executor([&](const std::function<void()>& job){ jobs.push_back(job); });
+
+  auto y = sm.set_trigger_parameters<int>(trigger::Y);
+  int assigned = 0;
+  sm.configure(state::A).permit(trigger::X, state::B);
+  sm.configure(state::B)
+    .on_entry_async([](const TStateMachine::TTransition&){})
+    .permit(trigger::Y, state::C);
+  sm.configure(state::C)
+    .on_entry_async<int>([&](const TStateMachine::TTransition&, int i){ assigned = i; });
+
+  auto x_done = sm.fire_async(trigger::X);
+  auto y_done = sm.fire_async(y, 42);
+
+  ASSERT_EQ(state::B, sm.state());
+  ASSERT_EQ(1, jobs.size());
+  ASSERT_EQ(std::future_status::timeout, x_done.wait_for(std::chrono::seconds(0)));
+
+  auto job = jobs[0];
+  job();
+
+  ASSERT_EQ(std::future_status::ready, x_done.wait_for(std::chrono::seconds(0)));
+  ASSERT_EQ(state::C, sm.state());
+  ASSERT_EQ(0, assigned);
+  ASSERT_EQ(2, jobs.size());
+
+  job = jobs[1];
+  job();
+
+  ASSERT_EQ(std::future_status::ready, y_done.wait_for(std::chrono::seconds(0)));
+  ASSERT_EQ(42, assigned);
+}
+
+TEST(StateMachine, WhenFiredAsyncTriggerIsUnhandled_ThenFutureHoldsError)
+{
+  TStateMachine sm(state::A);
+
+  auto done = sm.fire_async(trigger::X);
+
+  ASSERT_THROW(done.get(), stateless::error);
+}
+
+TEST(StateMachine, WhenExecutorRunsOnAnotherThread_ThenAsyncTriggersAreHandledInOrder)
+{
+  TStateMachine sm(state::A);
+  sm.set_executor([](const std::function<void()>& job){ std::thread(job).detach(); });
+
+  std::atomic<int> entries(0);
+  sm.configure(state::A).permit(trigger::X, state::B);
+  sm.configure(state::B)
+    .on_entry_async([&](const TStateMachine::TTransition&){ ++entries; })
+    .permit(trigger::Y, state::A);
+
+  std::vector<std::shared_future<void>> done;
+  for (int i = 0; i < 200; ++i)
+  {
+    done.push_back(sm.fire_async(i % 2 == 0 ? trigger::X : trigger::Y));
+  }
+  for (auto& d : done)
+  {
+    d.get();
+  }
+
+  ASSERT_EQ(100, entries);
+  ASSERT_EQ(state::A, sm.state());
+}
+
+TEST(StateMachine, WhenDestroyedWithAsyncTriggersQueued_ThenTheyAreAbandoned)
+{
+  std::vector<std::function<void()>> jobs;
+  std::shared_future<void> x_done, y_done;
+  {
+    TStateMachine sm(state::A);
+    sm.set_executor([&](const std::function<void()>& job){ jobs.push_back(job); });
+    sm.configure(state::A).permit(trigger::X, state::B);
+    sm.configure(state::B).permit(trigger::Y, state::A);
+
+    x_done = sm.fire_async(trigger::X);
+    y_done = sm.fire_async(trigger::Y);
+    ASSERT_EQ(1, jobs.size());
+  }
+  jobs[0]();
+
+  ASSERT_EQ(std::future_status::ready, x_done.wait_for(std::chrono::seconds(0)));
+  ASSERT_THROW(y_done.get(), std::future_error);
+}
+
+TEST(StateMachine, WhenManyAsyncTriggersAreQueuedWithInlineExecutor_ThenTheyRunWithoutRecursion)
+{
+  TStateMachine sm(state::A);
+  const int count = 200000;
+  int fired = 0;
+  sm.configure(state::A)
+    .permit_reentry(trigger::X)
+    .permit(trigger::Y, state::B);
+  sm.configure(state::B)
+    .on_entry_from(trigger::Y, [&](const TStateMachine::TTransition&)
+      {
+        for (int i = 0; i < count; ++i)
+        {
+          sm.fire_async(trigger::Z);
+        }
+      })
+    .permit_reentry(trigger::Z)
+    .on_exit([&](const TStateMachine::TTransition&){ ++fired; });
+
+  sm.fire(trigger::Y);
+
+  ASSERT_EQ(count, fired);
+  ASSERT_EQ(state::B, sm.state());
+}
+
+TEST(StateMachine, WhenStateIsOccupiedForDelay_ThenTimedTriggerFires)
+{
+  std::chrono::milliseconds now(0);
+  timing_wheel wheel(std::chrono::milliseconds(1), [&](){ return now; });
+  TStateMachine sm(state::A);
+  sm.set_timer_scheduler(wheel);
+  sm.configure(state::A).permit(trigger::X, state::B);
+  sm.configure(state::B).permit_after(std::chrono::seconds(30), trigger::Y, state::C);
+
+  sm.fire(trigger::X);
+  ASSERT_EQ(1, wheel.size());
+  now = std::chrono::milliseconds(29999);
+  wheel.poll();
+  ASSERT_EQ(state::B, sm.state());
+
+  now = std::chrono::milliseconds(30000);
+  wheel.poll();
+  ASSERT_EQ(state::C, sm.state());
+  ASSERT_EQ(0, wheel.size());
+}
+
+TEST(StateMachine, WhenStateIsExited_ThenTimedTriggerIsCancelled)
+{
+  std::chrono::milliseconds now(0);
+  timing_wheel wheel(std::chrono::milliseconds(1), [&](){ return now; });
+  TStateMachine sm(state::A);
+  sm.set_timer_scheduler(wheel);
+  sm.configure(state::A).permit(trigger::X, state::B);
+  sm.configure(state::B)
+    .permit(trigger::X, state::A)
+    .permit_after(std::chrono::milliseconds(10), trigger::Y, state::C);
+
+  sm.fire(trigger::X);
+  sm.fire(trigger::X);
+  ASSERT_EQ(0, wheel.size());
+
+  now = std::chrono::milliseconds(20);
+  wheel.poll();
+  ASSERT_EQ(state::A, sm.state());
+}
+
+TEST(StateMachine, WhenMovingBetweenSubstates_ThenSuperstateTimerKeepsRunning)
+{
+  std::chrono::milliseconds now(0);
+  timing_wheel wheel(std::chrono::milliseconds(1), [&](){ return now; });
+  state_machine<int, trigger> sm(0);
+  sm.set_timer_scheduler(wheel);
+  sm.configure(0).permit(trigger::X, 2);
+  sm.configure(1)
+    .fire_after(std::chrono::milliseconds(10), trigger::Z)
+    .permit(trigger::Z, 0);
+  sm.configure(2).sub_state_of(1).permit(trigger::Y, 3);
+  sm.configure(3).sub_state_of(1);
+
+  sm.fire(trigger::X);
+  now = std::chrono::milliseconds(6);
+  sm.fire(trigger::Y);
+  ASSERT_EQ(1, wheel.size());
+
+  now = std::chrono::milliseconds(10);
+  wheel.poll();
+  ASSERT_EQ(0, sm.state());
+  ASSERT_EQ(0, wheel.size());
+}
+
+TEST(StateMachine, WhenStateIsReentered_ThenTimedTriggerRestarts)
+{
+  std::chrono::milliseconds now(0);
+  timing_wheel wheel(std::chrono::milliseconds(1), [&](){ return now; });
+  TStateMachine sm(state::A);
+  sm.set_timer_scheduler(wheel);
+  sm.configure(state::A).permit(trigger::X, state::B);
+  sm.configure(state::B)
+    .permit_reentry(trigger::X)
+    .permit_after(std::chrono::milliseconds(10), trigger::Y, state::C);
+
+  sm.fire(trigger::X);
+  now = std::chrono::milliseconds(8);
+  sm.fire(trigger::X);
+  now = std::chrono::milliseconds(12);
+  wheel.poll();
+  ASSERT_EQ(state::B, sm.state());
+
+  now = std::chrono::milliseconds(18);
+  wheel.poll();
+  ASSERT_EQ(state::C, sm.state());
+}
+
+TEST(StateMachine, WhenDestroyed_ThenTimedTriggersAreCancelled)
+{
+  timing_wheel wheel;
+  {
+    TStateMachine sm(state::A);
+    sm.set_timer_scheduler(wheel);
+    sm.configure(state::A).permit(trigger::X, state::B);
+    sm.configure(state::B).permit_after(std::chrono::hours(1), trigger::Y, state::C);
+    sm.fire(trigger::X);
+    ASSERT_EQ(1, wheel.size());
+  }
+  ASSERT_EQ(0, wheel.size());
+}
+
+TEST(StateMachine, WhenTimedTriggerHasNoScheduler_ThenConfigurationRaisesError)
+{
+  TStateMachine sm(state::A);
+  sm.configure(state::A).permit(trigger::X, state::B);
+
+  ASSERT_THROW(
+    sm.configure(state::B).permit_after(std::chrono::seconds(1), trigger::Y, state::C),
+    stateless::error);
+  sm.fire(trigger::X);
+  ASSERT_EQ(state::B, sm.state());
+  ASSERT_FALSE(sm.can_fire(trigger::Y));
+}
+
+
+TEST(StateMachine, WhenConfigured_ThenMemoryUsageGrowsInEachCategory)
+{
+  TStateMachine sm(state::A);
+  const auto empty = sm.memory_usage();
+  ASSERT_EQ(0, empty.representations);
+  ASSERT_EQ(0, empty.behaviours);
+
+  sm.configure(state::A)
+    .permit(trigger::X, state::B)
+    .on_entry([](const TStateMachine::TTransition&){})
+    .on_exit([](const TStateMachine::TTransition&){});
+  sm.set_trigger_parameters<std::string, int>(trigger::Y);
+  const auto usage = sm.memory_usage();
+
+  ASSERT_GT(usage.representations, 0);
+  ASSERT_GT(usage.behaviours, 0);
+  ASSERT_GT(usage.actions, 0);
+  ASSERT_GT(usage.trigger_parameters, 0);
+  ASSERT_GT(usage.closures, empty.closures);
+  ASSERT_EQ(empty.other, usage.other);
+  ASSERT_EQ(0, usage.instances);
+  ASSERT_EQ(
+    usage.representations + usage.behaviours + usage.closures + usage.actions +
+      usage.trigger_parameters + usage.other,
+    usage.total());
+}
+
 }
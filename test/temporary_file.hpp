@@ -0,0 +1,64 @@
+/**
+ * Copyright 2013 Matt Mason
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#ifndef STATELESS_TEST_TEMPORARY_FILE_HPP
+#define STATELESS_TEST_TEMPORARY_FILE_HPP
+
+#include <cstdlib>
+#include <string>
+#include <vector>
+
+#include <unistd.h>
+
+/// A uniquely named file that is removed when the object is destroyed.
+class temporary_file
+{
+public:
+  temporary_file()
+    : path_()
+  {
+    const char* dir = std::getenv("TMPDIR");
+    std::string pattern = std::string(dir != nullptr ? dir : "/tmp") + "/stateless_XXXXXX";
+    std::vector<char> name(pattern.begin(), pattern.end());
+    name.push_back('\0');
+    const int fd = ::mkstemp(name.data());
+    if (fd != -1)
+    {
+      ::close(fd);
+      ::unlink(name.data());
+    }
+    path_ = name.data();
+  }
+
+  ~temporary_file()
+  {
+    ::unlink(path_.c_str());
+  }
+
+  const std::string& path() const
+  {
+    return path_;
+  }
+
+private:
+  temporary_file(const temporary_file&);
+  temporary_file& operator=(const temporary_file&);
+
+  std::string path_;
+};
+
+#endif // STATELESS_TEST_TEMPORARY_FILE_HPP
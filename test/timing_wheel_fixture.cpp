@@ -0,0 +1,186 @@
+/**
+ * Copyright 2013 Matt Mason
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+
+#include <stateless++/timing_wheel.hpp>
+
+#include <gtest/gtest.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <iterator>
+#include <vector>
+
+using namespace stateless;
+using namespace testing;
+
+namespace
+{
+
+typedef std::chrono::milliseconds ms;
+
+/// A clock that only moves when told to.
+struct virtual_clock
+{
+  virtual_clock()
+    : now(0)
+  {}
+
+  timing_wheel::TClock reader()
+  {
+    return [this](){ return timing_wheel::TDuration(now); };
+  }
+
+  ms now;
+};
+
+TEST(TimingWheel, WhenDelayElapses_ThenCallbackIsCalled)
+{
+  virtual_clock clock;
+  timing_wheel wheel(ms(1), clock.reader());
+  int calls = 0;
+  wheel.schedule(ms(10), [&](){ ++calls; });
+
+  clock.now = ms(9);
+  ASSERT_EQ(0, wheel.poll());
+  ASSERT_EQ(1, wheel.size());
+
+  clock.now = ms(10);
+  ASSERT_EQ(1, wheel.poll());
+  ASSERT_EQ(1, calls);
+  ASSERT_EQ(0, wheel.size());
+}
+
+TEST(TimingWheel, WhenCancelled_ThenCallbackIsNotCalled)
+{
+  virtual_clock clock;
+  timing_wheel wheel(ms(1), clock.reader());
+  bool called = false;
+  auto id = wheel.schedule(ms(5), [&](){ called = true; });
+
+  ASSERT_TRUE(wheel.cancel(id));
+  ASSERT_FALSE(wheel.cancel(id));
+  clock.now = ms(100);
+  wheel.poll();
+
+  ASSERT_FALSE(called);
+  ASSERT_EQ(0, wheel.size());
+}
+
+TEST(TimingWheel, WhenTimerHasExpired_ThenItsIdIsNotReused)
+{
+  virtual_clock clock;
+  timing_wheel wheel(ms(1), clock.reader());
+  auto first = wheel.schedule(ms(1), [](){});
+  clock.now = ms(1);
+  wheel.poll();
+
+  bool called = false;
+  auto second = wheel.schedule(ms(1), [&](){ called = true; });
+
+  ASSERT_NE(first, second);
+  ASSERT_FALSE(wheel.cancel(first));
+  clock.now = ms(2);
+  wheel.poll();
+  ASSERT_TRUE(called);
+}
+
+TEST(TimingWheel, WhenDelaysSpanWheels_ThenTimersExpireInOrderAtTheirTicks)
+{
+  virtual_clock clock;
+  timing_wheel wheel(ms(1), clock.reader());
+  const std::int64_t delays[] = { 70000, 1, 255, 256, 257, 65535, 65536, 300, 16777217, 4294967297LL };
+  std::vector<std::int64_t> expired;
+  for (auto delay : delays)
+  {
+    wheel.schedule(ms(delay), [&, delay](){ expired.push_back(delay); ASSERT_EQ(delay, clock.now.count()); });
+  }
+
+  // Step through every tick near each expiry, and jump in between.
+  std::vector<std::int64_t> sorted(std::begin(delays), std::end(delays));
+  std::sort(sorted.begin(), sorted.end());
+  for (auto delay : sorted)
+  {
+    clock.now = ms(delay - 1);
+    wheel.poll();
+    clock.now = ms(delay);
+    wheel.poll();
+  }
+
+  ASSERT_EQ(sorted, expired);
+  ASSERT_EQ(0, wheel.size());
+}
+
+TEST(TimingWheel, WhenDelayIsNotAWholeTick_ThenItIsRoundedUp)
+{
+  virtual_clock clock;
+  timing_wheel wheel(ms(10), clock.reader());
+  bool called = false;
+  wheel.schedule(ms(11), [&](){ called = true; });
+
+  clock.now = ms(19);
+  wheel.poll();
+  ASSERT_FALSE(called);
+  clock.now = ms(20);
+  wheel.poll();
+  ASSERT_TRUE(called);
+}
+
+TEST(TimingWheel, WhenCallbackSchedulesTimer_ThenItExpiresOnALaterPoll)
+{
+  virtual_clock clock;
+  timing_wheel wheel(ms(1), clock.reader());
+  int calls = 0;
+  std::function<void()> callback = [&]()
+    {
+      if (++calls < 3)
+      {
+        wheel.schedule(ms(0), callback);
+      }
+    };
+  wheel.schedule(ms(1), callback);
+
+  clock.now = ms(1);
+  ASSERT_EQ(1, wheel.poll());
+  clock.now = ms(3);
+  ASSERT_EQ(2, wheel.poll());
+  ASSERT_EQ(3, calls);
+}
+
+TEST(TimingWheel, WhenManyTimersAreScheduledAndCancelled_ThenOnlyTheRestExpire)
+{
+  virtual_clock clock;
+  timing_wheel wheel(ms(1), clock.reader());
+  std::vector<timing_wheel::TTimerId> ids;
+  int calls = 0;
+  for (int i = 0; i < 10000; ++i)
+  {
+    ids.push_back(wheel.schedule(ms(i % 1000), [&](){ ++calls; }));
+  }
+  for (std::size_t i = 0; i < ids.size(); i += 2)
+  {
+    ASSERT_TRUE(wheel.cancel(ids[i]));
+  }
+
+  clock.now = ms(1000);
+  ASSERT_EQ(5000, wheel.poll());
+  ASSERT_EQ(5000, calls);
+}
+
+}
@@ -0,0 +1,234 @@
+/**
+ * Copyright 2013 Matt Mason
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#ifndef _WIN32
+
+#include <stateless++/instance_store.hpp>
+#include <stateless++/state_machine.hpp>
+#include <stateless++/trace_events.hpp>
+
+#include <state.hpp>
+#include <temporary_file.hpp>
+#include <trigger.hpp>
+
+#include <gtest/gtest.h>
+
+#include <cstdint>
+#include <fstream>
+#include <regex>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+using namespace stateless;
+using namespace testing;
+
+namespace
+{
+
+using TStateMachine = state_machine<state, trigger>;
+using TTracer = state_tracer<state, trigger>;
+
+struct span
+{
+  std::string name;
+  std::string category;
+  double start;
+  double end;
+  int process;
+  std::uint64_t track;
+};
+
+std::string read_all(const std::string& path)
+{
+  std::ifstream in(path);
+  std::ostringstream os;
+  os << in.rdbuf();
+  return os.str();
+}
+
+std::vector<span> read_spans(const std::string& text)
+{
+  const std::regex event(
+    "\\{\"name\":\"([^\"]*)\",\"cat\":\"([a-z]+)\",\"ph\":\"X\",\"ts\":([0-9.]+),"
+    "\"dur\":([0-9.]+),\"pid\":([0-9]+),\"tid\":([0-9]+)\\}");
+  std::vector<span> result;
+  for (std::sregex_iterator it(text.begin(), text.end(), event), end; it != end; ++it)
+  {
+    const auto& m = *it;
+    span s;
+    s.name = m[1];
+    s.category = m[2];
+    s.start = std::stod(m[3]);
+    s.end = s.start + std::stod(m[4]);
+    s.process = std::stoi(m[5]);
+    s.track = std::stoull(m[6]);
+    result.push_back(s);
+  }
+  return result;
+}
+
+const span* find(const std::vector<span>& spans, const std::string& name, int process)
+{
+  for (auto& s : spans)
+  {
+    if (s.name == name && s.process == process)
+    {
+      return &s;
+    }
+  }
+  return nullptr;
+}
+
+bool contains(const span& outer, const span& inner)
+{
+  return outer.track == inner.track && outer.start <= inner.start && inner.end <= outer.end;
+}
+
+TEST(TraceEvents, WhenFileIsClosed_ThenItIsAJsonArrayOfEvents)
+{
+  temporary_file temp;
+  {
+    trace_event_file file(temp.path());
+    file.add_span(trace_event_file::escape("a \"quoted\"\nname"), "state", 1, 7, 1.0, 2.5);
+  }
+
+  const auto text = read_all(temp.path());
+  ASSERT_EQ("[\n", text.substr(0, 2));
+  ASSERT_EQ("\n]\n", text.substr(text.size() - 3));
+  ASSERT_EQ(std::string::npos, text.find(",\n]"));
+  ASSERT_NE(std::string::npos, text.find("a \\\"quoted\\\"\\u000aname"));
+  ASSERT_NE(std::string::npos, text.find("\"name\":\"process_name\""));
+}
+
+TEST(TraceEvents, WhenMachineTransitions_ThenStatesAndActionsAreSpans)
+{
+  temporary_file temp;
+  {
+    trace_event_file file(temp.path());
+    TStateMachine sm(state::A);
+    sm.configure(state::A).permit_if(trigger::X, state::B, [](){ return true; });
+    sm.configure(state::B).permit(trigger::Y, state::A).on_entry([&](const TStateMachine::TTransition&)
+      {
+        sm.fire(trigger::Z);
+      });
+    sm.on_unhandled_trigger([](const state&, const trigger&){});
+    TTracer tracer(file, 3);
+    sm.set_observer(&tracer);
+
+    sm.fire(trigger::X);
+    sm.fire(trigger::Y);
+    sm.set_observer(nullptr);
+  }
+
+  const auto spans = read_spans(read_all(temp.path()));
+  const span* occupied_a = find(spans, "0", trace_event_file::states_process);
+  const span* occupied_b = find(spans, "1", trace_event_file::states_process);
+  const span* fire_x = find(spans, "0", trace_event_file::triggers_process);
+  const span* guard = find(spans, "guard met: 0", trace_event_file::triggers_process);
+  const span* entry_b = find(spans, "entry 1", trace_event_file::triggers_process);
+  const span* nested_z = find(spans, "2 (unhandled)", trace_event_file::triggers_process);
+  const span* fire_y = find(spans, "1", trace_event_file::triggers_process);
+  ASSERT_TRUE(occupied_a && occupied_b && fire_x && guard && entry_b && nested_z && fire_y);
+
+  ASSERT_EQ(3U, occupied_b->track);
+  ASSERT_LE(occupied_a->end, occupied_b->start);
+  ASSERT_TRUE(contains(*fire_x, *guard));
+  ASSERT_TRUE(contains(*fire_x, *entry_b));
+  // Triggers fired by actions are queued until the current one completes.
+  ASSERT_LE(fire_x->end, nested_z->start);
+  ASSERT_LE(nested_z->end, fire_y->start);
+  ASSERT_EQ("trigger", fire_x->category);
+  ASSERT_EQ("guard", guard->category);
+  ASSERT_EQ("action", entry_b->category);
+
+  // A is occupied again until the tracer is destroyed.
+  unsigned occupancies_of_a = 0;
+  for (auto& s : spans)
+  {
+    occupancies_of_a += s.process == trace_event_file::states_process && s.name == "0";
+  }
+  ASSERT_EQ(2U, occupancies_of_a);
+}
+
+TEST(TraceEvents, WhenStoreInstancesTransition_ThenEachHasATrack)
+{
+  temporary_file temp;
+  {
+    trace_event_file file(temp.path());
+    TStateMachine sm(state::A);
+    sm.configure(state::A).permit(trigger::X, state::B);
+    instance_store<state, trigger> store(sm.freeze(), 4, state::A);
+    TTracer tracer(file, [&](){ return static_cast<std::uint64_t>(store.current()); });
+    store.set_observer(&tracer);
+
+    store.fire(1, trigger::X);
+    store.fire(3, trigger::X);
+  }
+
+  const auto spans = read_spans(read_all(temp.path()));
+  unsigned tracks = 0;
+  for (auto& s : spans)
+  {
+    if (s.process == trace_event_file::states_process && s.name == "0")
+    {
+      ASSERT_TRUE(s.track == 1 || s.track == 3);
+      ++tracks;
+    }
+  }
+  ASSERT_EQ(2U, tracks);
+}
+
+TEST(TraceEvents, WhenTrackIsFiredOnAnotherThread_ThenItsOccupancyIsContinuous)
+{
+  temporary_file temp;
+  {
+    trace_event_file file(temp.path());
+    TStateMachine sm(state::A);
+    sm.configure(state::A).permit(trigger::X, state::B);
+    sm.configure(state::B).permit(trigger::Y, state::C);
+    TTracer tracer(file, 5);
+    sm.set_observer(&tracer);
+
+    sm.fire(trigger::X);
+    std::thread([&](){ sm.fire(trigger::Y); }).join();
+    sm.set_observer(nullptr);
+  }
+
+  const auto spans = read_spans(read_all(temp.path()));
+  std::vector<span> occupied;
+  for (auto& s : spans)
+  {
+    if (s.process == trace_event_file::states_process)
+    {
+      occupied.push_back(s);
+    }
+  }
+  ASSERT_EQ(3U, occupied.size());
+  const span* b = find(spans, "1", trace_event_file::states_process);
+  const span* fire_x = find(spans, "0", trace_event_file::triggers_process);
+  const span* fire_y = find(spans, "1", trace_event_file::triggers_process);
+  ASSERT_TRUE(b && fire_x && fire_y);
+  // B is shown from its entry on the first thread to its exit on the second.
+  ASSERT_LE(b->start, fire_x->end);
+  ASSERT_GE(b->end, fire_y->start);
+}
+
+}
+
+#endif
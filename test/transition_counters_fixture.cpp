@@ -0,0 +1,183 @@
+/**
+ * Copyright 2013 Matt Mason
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#include <stateless++/instance_store.hpp>
+#include <stateless++/state_machine.hpp>
+#include <stateless++/transition_counters.hpp>
+
+#include <state.hpp>
+#include <trigger.hpp>
+
+#include <gtest/gtest.h>
+
+#include <memory>
+#include <thread>
+#include <vector>
+
+using namespace stateless;
+using namespace testing;
+
+namespace
+{
+
+#ifdef _WIN32
+typedef state_machine<state, trigger> TStateMachine;
+typedef transition_counters<state, trigger> TCounters;
+#else
+using TStateMachine = state_machine<state, trigger>;
+using TCounters = transition_counters<state, trigger>;
+#endif
+
+TEST(TransitionCounters, WhenTriggersAreFired_ThenOutcomesAreCounted)
+{
+  bool allow = false;
+  TStateMachine sm(state::A);
+  sm.configure(state::A)
+    .permit_if(trigger::X, state::B, [&](){ return allow; })
+    .ignore(trigger::Y);
+  sm.configure(state::B).permit(trigger::X, state::A);
+  sm.on_unhandled_trigger([](const state&, const trigger&){});
+  TCounters counters;
+  sm.set_observer(&counters);
+
+  sm.fire(trigger::Y);
+  sm.fire(trigger::X);
+  allow = true;
+  sm.fire(trigger::X);
+  sm.fire(trigger::X);
+  sm.fire(trigger::Z);
+
+  auto a_x = counters.counts(state::A, trigger::X);
+  ASSERT_EQ(2, a_x.fires);
+  ASSERT_EQ(1, a_x.guard_rejections);
+  ASSERT_EQ(2, a_x.guard_evaluations);
+  ASSERT_EQ(1, a_x.guard_rejections);
+  ASSERT_EQ(1, a_x.unhandled);
+  ASSERT_EQ(1, counters.counts(state::A, trigger::Y).ignored);
+  ASSERT_EQ(1, counters.counts(state::A, trigger::Z).unhandled);
+  ASSERT_EQ(1, counters.transitions(state::A, trigger::X, state::B));
+  ASSERT_EQ(1, counters.transitions(state::B, trigger::X, state::A));
+  ASSERT_EQ(0, counters.transitions(state::B, trigger::X, state::C));
+  ASSERT_EQ(0, counters.counts(state::C, trigger::X).fires);
+}
+
+TEST(TransitionCounters, WhenVisited_ThenEveryTriggerAndTransitionIsReported)
+{
+  TStateMachine sm(state::A);
+  sm.configure(state::A).permit(trigger::X, state::B);
+  sm.configure(state::B).permit(trigger::X, state::A).ignore(trigger::Y);
+  TCounters counters;
+  sm.set_observer(&counters);
+  for (int i = 0; i < 3; ++i)
+  {
+    sm.fire(trigger::X);
+    sm.fire(trigger::Y);
+    sm.fire(trigger::X);
+  }
+
+  std::vector<std::uint64_t> fires;
+  counters.for_each([&](const state&, const trigger&, const TCounters::trigger_counts& c)
+    {
+      fires.push_back(c.fires);
+    });
+  ASSERT_EQ(3, fires.size());
+  ASSERT_EQ(3, fires[0]);
+  std::uint64_t transitions = 0;
+  counters.for_each_transition([&](const state&, const trigger& t, const state&, std::uint64_t n)
+    {
+      ASSERT_EQ(trigger::X, t);
+      transitions += n;
+    });
+  ASSERT_EQ(6, transitions);
+}
+
+TEST(TransitionCounters, WhenManyThreadsFire_ThenCountsAreMerged)
+{
+  TCounters counters;
+  const int threads = 4, fires = 10000;
+  std::vector<std::thread> workers;
+  for (int t = 0; t < threads; ++t)
+  {
+    workers.emplace_back([&]()
+      {
+        TStateMachine sm(state::A);
+        sm.configure(state::A).permit(trigger::X, state::B);
+        sm.configure(state::B).permit(trigger::X, state::A);
+        sm.set_observer(&counters);
+        for (int i = 0; i < fires; ++i)
+        {
+          sm.fire(trigger::X);
+        }
+      });
+  }
+  for (auto& worker : workers)
+  {
+    worker.join();
+  }
+
+  ASSERT_EQ(threads * fires / 2, counters.transitions(state::A, trigger::X, state::B));
+  ASSERT_EQ(threads * fires / 2, counters.counts(state::B, trigger::X).fires);
+}
+
+TEST(TransitionCounters, WhenStoreInstancesAreFired_ThenTheyAreCounted)
+{
+  TStateMachine sm(state::A);
+  sm.configure(state::A).permit(trigger::X, state::B);
+  instance_store<state, trigger> store(sm.freeze(), 10, state::A);
+  TCounters counters;
+  store.set_observer(&counters);
+
+  store.fire(3, trigger::X);
+  ASSERT_THROW(store.fire(3, trigger::X), stateless::error);
+
+  ASSERT_EQ(1, counters.transitions(state::A, trigger::X, state::B));
+  ASSERT_EQ(1, counters.counts(state::B, trigger::X).unhandled);
+}
+
+
+TEST(PerThread, WhenThreadCyclesThroughManyObjects_ThenEachKeepsOneValuePerThread)
+{
+  std::vector<std::unique_ptr<detail::per_thread<int>>> objects;
+  for (int i = 0; i < 12; ++i)
+  {
+    objects.emplace_back(new detail::per_thread<int>());
+  }
+  auto cycle = [&]()
+    {
+      for (int round = 0; round < 3; ++round)
+      {
+        for (auto& object : objects)
+        {
+          ++object->local();
+        }
+      }
+    };
+  cycle();
+  std::thread other(cycle);
+  other.join();
+
+  for (auto& object : objects)
+  {
+    std::vector<int> values;
+    object->for_each([&](const int& value){ values.push_back(value); });
+    ASSERT_EQ(2, values.size());
+    ASSERT_EQ(3, values[0]);
+    ASSERT_EQ(3, values[1]);
+  }
+}
+
+}
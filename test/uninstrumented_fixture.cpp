@@ -0,0 +1,101 @@
+/**
+ * Copyright 2013 Matt Mason
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+// Built into its own test executable, without STATELESS_ENABLE_INSTRUMENTATION.
+#ifdef STATELESS_ENABLE_INSTRUMENTATION
+#error "This fixture must be built without instrumentation."
+#endif
+
+#include <stateless++/instance_store.hpp>
+#include <stateless++/state_machine.hpp>
+
+#include <state.hpp>
+#include <trigger.hpp>
+
+#include <gtest/gtest.h>
+
+#include <type_traits>
+#include <utility>
+
+using namespace stateless;
+using namespace testing;
+
+namespace
+{
+
+#ifdef _WIN32
+typedef state_machine<state, trigger> TStateMachine;
+typedef instance_store<state, trigger> TStore;
+typedef fire_observer<state, trigger> TObserver;
+#else
+using TStateMachine = state_machine<state, trigger>;
+using TStore = instance_store<state, trigger>;
+using TObserver = fire_observer<state, trigger>;
+#endif
+
+/// Whether T has a set_observer() member taking an observer pointer.
+template<typename T>
+class has_set_observer
+{
+  template<typename U>
+  static std::true_type test(decltype(std::declval<U&>().set_observer(static_cast<TObserver*>(nullptr)))*);
+
+  template<typename U>
+  static std::false_type test(...);
+
+public:
+  static const bool value = decltype(test<T>(nullptr))::value;
+};
+
+TEST(Uninstrumented, WhenInstrumentationIsDisabled_ThenThereIsNoSetObserver)
+{
+  ASSERT_FALSE(has_set_observer<TStateMachine>::value);
+  ASSERT_FALSE(has_set_observer<TStore>::value);
+}
+
+TEST(Uninstrumented, WhenInstrumentationIsDisabled_ThenObserveEvaluatesNothing)
+{
+  int evaluated = 0;
+  auto observer = [&]() -> TObserver*
+    {
+      ++evaluated;
+      return nullptr;
+    };
+
+  STATELESS_OBSERVE(observer(), on_fire(state::A, trigger::X));
+  ASSERT_EQ(0, evaluated);
+
+  // Evaluating it directly is counted.
+  ASSERT_TRUE(observer() == nullptr);
+  ASSERT_EQ(1, evaluated);
+}
+
+TEST(Uninstrumented, WhenInstrumentationIsDisabled_ThenMachinesAndStoresStillFire)
+{
+  TStateMachine sm(state::A);
+  sm.configure(state::A).permit_if(trigger::X, state::B, [](){ return true; });
+  sm.configure(state::B).permit(trigger::X, state::C);
+  sm.fire(trigger::X);
+  ASSERT_EQ(state::B, sm.state());
+
+  TStore store(sm.freeze(), 3, state::A);
+  store.fire(1, trigger::X);
+  store.broadcast(trigger::X);
+  ASSERT_EQ(state::B, store.state(0));
+  ASSERT_EQ(state::C, store.state(1));
+}
+
+}